@@ -0,0 +1,41 @@
+// Smart Light System service worker
+// Keeps the dashboard shell available offline; live data always goes to the device.
+const CACHE_NAME = 'smartlights-shell-v1';
+const SHELL = ['/', '/manifest.json'];
+
+self.addEventListener('install', (event) => {
+    event.waitUntil(caches.open(CACHE_NAME).then((cache) => cache.addAll(SHELL)));
+    self.skipWaiting();
+});
+
+self.addEventListener('activate', (event) => {
+    event.waitUntil(
+        caches.keys().then((keys) => Promise.all(
+            keys.filter((key) => key !== CACHE_NAME).map((key) => caches.delete(key))
+        ))
+    );
+    self.clients.claim();
+});
+
+self.addEventListener('fetch', (event) => {
+    const url = new URL(event.request.url);
+    if (event.request.method !== 'GET' || url.pathname.startsWith('/api/')) {
+        return; // Status and analytics are never served from cache
+    }
+
+    // Stale-while-revalidate: answer from cache, refresh it in the background.
+    // The device replies 304 when the ETag still matches, so this is cheap.
+    event.respondWith(
+        caches.open(CACHE_NAME).then((cache) =>
+            cache.match(event.request).then((cached) => {
+                const network = fetch(event.request).then((response) => {
+                    if (response.ok) {
+                        cache.put(event.request, response.clone());
+                    }
+                    return response;
+                }).catch(() => cached);
+                return cached || network;
+            })
+        )
+    );
+});
@@ -21,6 +21,10 @@ const float TOTAL_LIGHT_POWER = LIGHT_POWER_WATTS * NUMBER_OF_LIGHTS;
 // Electricity cost per kilowatt-hour (kWh) in your local currency
 const float ENERGY_COST_PER_KWH = 0.12;  // Update with your local rate
 
+// The firmware takes its tariff, CO2 factor and per-light power from
+// src/main.cpp (TARIFF, CO2_GRAMS_PER_KWH) and /lights.txt; see
+// include/energy_ledger.h. The values here are the defaults it uses.
+
 // Peak/off-peak pricing (if applicable)
 const float PEAK_RATE = 0.15;      // Peak hours rate
 const float OFF_PEAK_RATE = 0.08;  // Off-peak hours rate
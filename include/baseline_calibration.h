@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "status_snapshot.h"
+
+// Per-sensor trigger thresholds learned from the empty doorway.
+//
+// Each sensor keeps an exponentially weighted mean and variance of what it
+// reads while nobody is there, in fixed point (Q8 cm and cm^2). The first
+// readings are averaged with a growing window, so the estimate settles after
+// minSamples readings; after that each reading moves it by 1/2^alphaShift and
+// readings far outside the learned spread (a person, a cart) are ignored. If
+// the doorway itself changes, a long run of such readings while the room is
+// empty starts the learning over.
+//
+// The threshold is the lower of thresholdPercent of the mean and mean minus
+// sigmaMultiple standard deviations, clamped to [minThresholdCm,
+// maxThresholdCm]. A sensor that never sees an echo learns the no-echo
+// distance and ends up at maxThresholdCm.
+
+#define CALIBRATION_MAX_SENSORS (MAX_DOORWAYS * 2)
+
+// Calibration file: "LSB1", sensor count, then per sensor meanQ8(4)
+// varianceQ8(4) samples(4), then a CRC-16 of everything before it
+#define CALIBRATION_MAGIC "LSB1"
+#define CALIBRATION_RECORD_SIZE 12
+#define CALIBRATION_FILE_MAX (5 + CALIBRATION_MAX_SENSORS * CALIBRATION_RECORD_SIZE + 2)
+
+struct BaselineConfig {
+    bool enabled;               // False keeps the fixed DoorwayConfig threshold
+    uint8_t alphaShift;         // Steady-state weight of a reading, 1/2^alphaShift
+    uint8_t sigmaMultiple;
+    uint8_t thresholdPercent;
+    uint16_t minSamples;        // Readings before the learned threshold is used
+    int minThresholdCm;
+    int maxThresholdCm;
+};
+
+// What one sensor has learned; also the persisted form
+struct BaselineState {
+    int32_t meanQ8;             // cm * 256
+    uint32_t varianceQ8;        // cm^2 * 256
+    uint32_t samples;
+};
+
+class BaselineEstimator {
+public:
+    BaselineEstimator();
+
+    void reset();
+    void restore(const BaselineState& state) { state_ = state; }
+    const BaselineState& state() const { return state_; }
+
+    // Feed a reading of the empty doorway. Returns false if it was ignored as
+    // an outlier.
+    bool add(int cm, const BaselineConfig& config);
+
+    bool calibrated(const BaselineConfig& config) const { return state_.samples >= config.minSamples; }
+    int meanCm() const;
+    int sigmaCm() const;
+    // Learned threshold, or fallbackCm until calibrated
+    int threshold(const BaselineConfig& config, int fallbackCm) const;
+
+private:
+    BaselineState state_;
+    uint32_t outliers_;         // Ignored readings in a row
+};
+
+// Every sensor's state, indexed by doorway * 2 + side
+struct CalibrationSet {
+    uint8_t count;
+    BaselineState sensors[CALIBRATION_MAX_SENSORS];
+};
+
+// Flash form of a CalibrationSet. encode returns the length written (0 if it
+// does not fit); decode rejects a bad magic, length or CRC.
+size_t encodeCalibration(const CalibrationSet& set, uint8_t* out, size_t size);
+bool decodeCalibration(const uint8_t* in, size_t length, CalibrationSet& out);
+
+// Read or replace the calibration file. The file is rewritten in place, so a
+// reset during the write leaves a CRC mismatch and the sensors relearn.
+bool loadCalibration(Storage& storage, const char* path, CalibrationSet& out);
+bool saveCalibration(Storage& storage, const char* path, const CalibrationSet& set);
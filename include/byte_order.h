@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Little-endian field access for the on-flash and download formats, which
+// must not depend on the host's byte order or struct padding, and the CRC
+// that guards their records.
+
+inline void putU16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+inline void putU32(uint8_t* out, uint32_t value) {
+    putU16(out, value & 0xFFFF);
+    putU16(out + 2, value >> 16);
+}
+
+inline uint16_t getU16(const uint8_t* in) {
+    return in[0] | (in[1] << 8);
+}
+
+inline uint32_t getU32(const uint8_t* in) {
+    return getU16(in) | (static_cast<uint32_t>(getU16(in + 2)) << 16);
+}
+
+// CRC-16/CCITT-FALSE
+inline uint16_t crc16(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= static_cast<uint16_t>(data[i]) << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
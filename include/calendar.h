@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+// Gregorian calendar arithmetic on day numbers (days since 1970-01-01), so
+// rollups can find day, week, month and year boundaries without mktime()
+// and the host build gets the same answers as the board.
+
+#define MINUTES_PER_DAY 1440UL
+
+struct CivilDate {
+    int year;
+    uint8_t month;  // 1..12
+    uint8_t day;    // 1..31
+};
+
+int32_t daysFromCivil(int year, unsigned month, unsigned day);
+CivilDate civilFromDays(int32_t days);
+
+// 0 = Monday ... 6 = Sunday
+unsigned weekdayFromDays(int32_t days);
+
+// The Monday on or before days
+int32_t weekStartDay(int32_t days);
+
+// Local day number of a Unix minute, utcOffsetMinutes east of UTC
+int32_t localDayFromMinute(uint32_t epochMinute, int32_t utcOffsetMinutes);
+
+// Months since January 1970, and the first day of such a month
+uint32_t monthIndexFromDays(int32_t days);
+int32_t daysFromMonthIndex(uint32_t monthIndex);
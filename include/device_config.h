@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "http_server.h"
+#include "occupancy.h"
+#include "signal_filter.h"
+#include "status_snapshot.h"
+
+// Settings that used to need a reflash: Wi-Fi, webhooks, sensor pins and the
+// detection tuning. They are read once at boot into a DeviceConfig, a plain
+// struct the tasks use directly, and changed through /api/config.
+//
+// Every field is described once in CONFIG_FIELDS (tag, name, type, range),
+// which drives the flash encoding, the checks, the form arguments and the
+// JSON view alike. The binary form is
+//   "LSC1", u8 schema major, u8 minor, u32 generation,
+//   records of u8 tag, u8 length, value (numbers little-endian),
+//   u16 CRC-16 of everything before it
+// and only carries the fields it sets, so the same format is both the saved
+// config (every field) and a patch pushed to a fleet (a few). Unknown tags
+// are skipped, so an older firmware reads a newer minor version; a record
+// with a bad length or an out-of-range value rejects the whole blob. A
+// different major version is refused. Tags are never reused.
+//
+// Fields marked CONFIG_FLAG_REBOOT (Wi-Fi, webhooks, pins) are saved but only
+// used from the next boot; the tuning fields take effect at once.
+
+#define CONFIG_MAGIC "LSC1"
+#define CONFIG_SCHEMA_MAJOR 1
+#define CONFIG_SCHEMA_MINOR 0
+#define CONFIG_HEADER_SIZE 10
+#define CONFIG_BLOB_MAX 1536        // Every field at its longest
+// Longest patch one request carries, leaving HTTP_REQUEST_MAX room for
+// the request line and headers; a bigger change goes as several patches
+#define CONFIG_PATCH_MAX (HTTP_REQUEST_MAX - 384)
+#define CONFIG_URL_MAX 128
+#define CONFIG_MAX_CHANNELS (MAX_DOORWAYS * 2)
+#define CONFIG_NO_PIN 0xFF
+
+static_assert(CONFIG_PATCH_MAX >= CONFIG_HEADER_SIZE + 2 + CONFIG_URL_MAX + 2, "A patch must fit any one field");
+
+struct DeviceConfig {
+    uint32_t generation;            // Bumped by every accepted change
+    char wifiSsid[33];
+    char wifiPassword[65];
+    char apiToken[33];              // Bearer token for /api/config; empty refuses every request
+    char webhooks[MAX_ROOMS][2][CONFIG_URL_MAX];   // Occupied, empty
+    uint8_t sensorPins[CONFIG_MAX_CHANNELS][2];    // Trigger, echo; CONFIG_NO_PIN if unused
+    int16_t thresholdCm;            // Until a sensor's baseline is learned
+    uint32_t sequenceTimeoutMs;
+    uint32_t lightMilliwatts;       // Per room without light profiles
+    bool filterEnabled;
+    uint8_t filterMedianTaps;
+    uint8_t filterHysteresisCm;
+    uint8_t filterDebounceSamples;
+};
+
+enum ConfigFieldType : uint8_t {
+    CONFIG_TEXT,        // NUL-terminated, at most size - 1 characters
+    CONFIG_UINT,        // size 1, 2 or 4
+    CONFIG_INT,
+    CONFIG_BOOL,
+};
+
+#define CONFIG_FLAG_SECRET 1        // Never shown, only whether it is set
+#define CONFIG_FLAG_REBOOT 2        // Used from the next boot
+#define CONFIG_FLAG_OUTPUT_PIN 4    // A GPIO in CONFIG_OUTPUT_PINS or CONFIG_NO_PIN
+#define CONFIG_FLAG_INPUT_PIN 8     // A GPIO in CONFIG_INPUT_PINS or CONFIG_NO_PIN
+
+// ESP32 GPIOs a sensor can be wired to. Triggers need an output: 0-5, 12-19,
+// 21-23, 25-27, 32-33. Echoes may also use the input-only 34-39. GPIO 6-11
+// carry the flash and the numbers in between do not exist.
+#define CONFIG_OUTPUT_PINS 0x30EEFF03FULL
+#define CONFIG_INPUT_PINS (CONFIG_OUTPUT_PINS | 0xFC00000000ULL)
+
+struct ConfigField {
+    uint8_t tag;
+    const char* name;
+    ConfigFieldType type;
+    uint16_t offset;
+    uint8_t size;
+    int32_t min;                    // Numbers only
+    int32_t max;
+    uint8_t flags;
+};
+
+extern const ConfigField CONFIG_FIELDS[];
+extern const uint8_t CONFIG_FIELD_COUNT;
+
+const ConfigField* findConfigField(const char* name);
+
+// Set a field from its text form (a form argument); false if it does not
+// parse or is out of range, leaving the field as it was
+bool parseConfigValue(DeviceConfig& config, const ConfigField& field, const char* text);
+
+// "name":value for the JSON view, with a leading comma unless first
+#define CONFIG_FIELD_JSON_MAX (CONFIG_URL_MAX * 6 + 32)     // A URL of control characters
+size_t formatConfigField(const DeviceConfig& config, const ConfigField& field, bool first, char* out, size_t size);
+
+enum ConfigResult : uint8_t {
+    CONFIG_OK,
+    CONFIG_BAD_FORMAT,      // Magic, length or CRC
+    CONFIG_BAD_VERSION,
+    CONFIG_BAD_FIELD,
+    CONFIG_STALE,           // Patch made against another generation
+};
+
+// Applying, loading and saving work in static buffers, to keep a config's
+// worth off the task stacks; applying and load are for one task (the web
+// task after setup()), save for one other.
+
+// Every field; returns the length, 0 if it does not fit
+size_t encodeDeviceConfig(const DeviceConfig& config, uint8_t* out, size_t size);
+// Applies the blob's records to config, all or (on any error) none.
+// generation is the one in the blob; config.generation is left alone.
+ConfigResult decodeDeviceConfig(const uint8_t* in, size_t length, DeviceConfig& config, uint32_t& generation);
+
+// A pushed blob: applied like decodeDeviceConfig() and config.generation
+// bumped. A blob generation other than 0 must be config's current one, so
+// two writers cannot overwrite each other unseen.
+ConfigResult applyConfigPatch(DeviceConfig& config, const uint8_t* in, size_t length);
+
+// The same from form arguments named like the fields; CONFIG_BAD_FIELD if
+// one does not parse or none is given
+ConfigResult applyConfigForm(DeviceConfig& config, const HttpRequest& request);
+
+// Whether anything changed that is only used from the next boot
+bool configNeedsReboot(const DeviceConfig& before, const DeviceConfig& after);
+
+// authorization is the Authorization header ("Bearer <token>"), NULL if
+// absent. Compares in constant time.
+bool configAuthorized(const DeviceConfig& config, const char* authorization);
+
+// The tuning fields in the form the sensing engine takes
+DoorwayConfig configDoorway(const DeviceConfig& config);
+SignalFilterConfig configFilter(const DeviceConfig& config);
+float configLightWatts(const DeviceConfig& config);
+
+// Read over config, which holds the defaults; false (config untouched) if
+// no valid copy is found. Saves alternate between path and path.2, always
+// overwriting the older one, so a reset during a save leaves the previous
+// config to load.
+bool loadDeviceConfig(Storage& storage, const char* path, DeviceConfig& config);
+bool saveDeviceConfig(Storage& storage, const char* path, const DeviceConfig& config);
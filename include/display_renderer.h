@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "status_display.h"
+
+// Keeps a copy of what is on the LCD and sends only the characters that
+// changed. Every character or cursor move is a byte to the controller, and on
+// an I2C backpack each byte is several bus transfers at ~100 kHz, so
+// rewriting both rows on every refresh costs ~34 bytes even when nothing
+// changed; a static screen now costs none and a new distance a few.
+
+// Unchanged characters between two changes that are resent rather than
+// moving the cursor past them (a cursor move costs one byte, like a character)
+#define DISPLAY_SPAN_GAP 1
+
+struct DisplayStats {
+    uint32_t frames;    // present() calls
+    uint32_t spans;     // Cursor moves
+    uint32_t bytes;     // Characters plus cursor moves sent
+};
+
+class DisplayRenderer {
+public:
+    explicit DisplayRenderer(Display& display);
+
+    // Forget the shadow copy so the next frame is written in full, e.g.
+    // after the display was cleared or re-initialized behind our back
+    void invalidate();
+
+    // Send the differences between rows and the shadow copy; returns the
+    // bytes sent, 0 when the screen already shows rows
+    uint32_t present(const char rows[DISPLAY_ROWS][DISPLAY_COLS + 1]);
+
+    const DisplayStats& stats() const { return stats_; }
+
+private:
+    Display& display_;
+    char shown_[DISPLAY_ROWS][DISPLAY_COLS];
+    bool valid_;
+    DisplayStats stats_;
+};
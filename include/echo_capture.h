@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// Interrupt-driven HC-SR04 echo capture.
+//
+// Each channel owns one trigger/echo pin pair. echoCaptureTrigger() fires a
+// 10us trigger pulse and returns immediately; a CHANGE interrupt on the echo
+// pin timestamps the rising and falling edges and pushes the completed pulse
+// width into a lock-free ring. The main loop drains finished samples with
+// echoCaptureNext() and never waits on a sensor.
+
+#define ECHO_MAX_CHANNELS 8   // Two per doorway (MAX_DOORWAYS in status_snapshot.h)
+
+// Longest echo we wait for before declaring the ping lost, until
+// echoCaptureSetMaxWidth() lowers it. An HC-SR04 with nothing in range holds
+// ECHO high for ~38ms, so 30ms also bounds the no-target case (~5m of range).
+#define ECHO_TIMEOUT_US 30000UL
+
+// Register a sensor. Returns false if the channel index is out of range.
+bool echoCaptureAttach(uint8_t channel, uint8_t trigPin, uint8_t echoPin);
+
+// Fire a ping. Returns false if the channel still has a ping in flight, or
+// the sensor is still holding ECHO high from one that already expired (it
+// would ignore the trigger).
+bool echoCaptureTrigger(uint8_t channel);
+
+// Cap the echo wait: pings expire ECHO_START_US + widthUs after the trigger
+// and longer pulses are reported as timed out.
+void echoCaptureSetMaxWidth(uint32_t widthUs);
+
+// True while a ping on this channel is waiting for its echo.
+bool echoCaptureBusy(uint8_t channel);
+
+// Pop the next completed (or expired) measurement. Only call from one task.
+bool echoCaptureNext(EchoSample& out);
+
+// Samples lost because the ring was full when the ISR completed them.
+uint32_t echoCaptureDropped();
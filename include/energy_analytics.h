@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Running kWh totals for the dashboard. An occupied session of t hours with
+// the lights drawing P watts accounts for P * t / 1000 kWh (method 1 in
+// examples/energy_config.h).
+struct EnergyAnalytics {
+    float energySavedToday;
+    float energySavedWeek;
+    float energySavedMonth;
+    float energySavedYear;
+};
+
+float sessionEnergyKwh(uint32_t sessionMs, float lightPowerWatts);
+
+void updateEnergySavings(EnergyAnalytics& energy, uint32_t sessionMs, float lightPowerWatts);
+
+// Start a new day; the longer periods keep accumulating.
+void resetDailyEnergy(EnergyAnalytics& energy);
+
+// Move from local day fromDay to toDay (calendar.h day numbers): today
+// restarts, and the week (Monday-based), month and year restart when toDay
+// falls in a different one.
+void rollEnergyPeriods(EnergyAnalytics& energy, int32_t fromDay, int32_t toDay);
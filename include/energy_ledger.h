@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "session_log.h"
+#include "status_snapshot.h"
+
+// Energy, cost and CO2 of the lights per room, under a time-of-use tariff.
+//
+// Each finished occupancy session is split at the tariff's boundaries and
+// its energy added to the band (off-peak, peak, ...) each piece fell in.
+// Energy is kept as integer microwatt-seconds (light power in mW times time
+// in ms, with no rounding), so a year of small sessions adds up exactly;
+// kWh, cost and CO2 are only derived from it when a report is asked for.
+//
+// The tariff repeats every week, so the boundaries are flattened once into
+// a table of at most TARIFF_MAX_SEGMENTS week segments. A session adds its
+// whole weeks in one step from the table's per-band totals and walks the
+// remaining part segment by segment, so one session costs at most one lap
+// of the table however long it was.
+//
+// Sessions count towards the day, week, month and year they ended in, as
+// the dashboard totals do.
+
+#define TARIFF_MAX_BANDS 4
+#define TARIFF_MAX_WINDOWS 6
+#define TARIFF_MAX_SEGMENTS (1 + 7 * 2 * TARIFF_MAX_WINDOWS)
+#define ENERGY_MAX_LIGHTS 16
+#define ENERGY_ALL_ROOMS 0xFF
+
+enum EnergyPeriod : uint8_t {
+    ENERGY_TODAY,
+    ENERGY_WEEK,
+    ENERGY_MONTH,
+    ENERGY_YEAR,
+    ENERGY_LIFETIME,
+    ENERGY_PERIODS
+};
+
+// Band applied on the days in weekdays (bit 0 Monday ... bit 6 Sunday) from
+// startMinute to endMinute, local minutes of the day. A window with
+// endMinute <= startMinute covers the start and the end of the same day,
+// e.g. 23:00-07:00 night rates. Earlier windows win; time in none is band 0.
+struct TariffWindow {
+    uint16_t startMinute;
+    uint16_t endMinute;
+    uint8_t weekdays;
+    uint8_t band;
+};
+
+struct TariffConfig {
+    uint8_t bandCount;                                  // 1..TARIFF_MAX_BANDS
+    uint32_t priceMicrosPerKwh[TARIFF_MAX_BANDS];       // Millionths of the currency unit
+    uint8_t windowCount;
+    TariffWindow windows[TARIFF_MAX_WINDOWS];
+    uint32_t co2GramsPerKwh;
+    int32_t utcOffsetMinutes;
+};
+
+// One light and the room it is switched with
+struct LightProfile {
+    uint8_t room;
+    uint32_t milliwatts;
+};
+
+// What the ledger keeps, and what goes to flash
+struct LedgerTotals {
+    int32_t day;        // Local day the periods belong to, INT32_MIN before the first
+    uint64_t microWattSeconds[MAX_ROOMS][ENERGY_PERIODS][TARIFF_MAX_BANDS];
+};
+
+// Figures for one room (or all) and period. Every value is in millionths:
+// mWh of a kWh, micro-units of the currency, mg of a kg of CO2.
+struct EnergyReport {
+    uint64_t bandMilliwattHours[TARIFF_MAX_BANDS];
+    uint64_t milliwattHours;
+    uint64_t costMicros;
+    uint64_t co2Milligrams;
+};
+
+class EnergyLedger {
+public:
+    // Rooms without a light profile draw defaultRoomMilliwatts
+    EnergyLedger(const TariffConfig& tariff, uint32_t defaultRoomMilliwatts);
+
+    // False (keeping the current tariff) for a band or window out of range
+    bool setTariff(const TariffConfig& tariff);
+    const TariffConfig& tariff() const { return tariff_; }
+
+    // Replaces every room's power with the sum of its lights
+    void setLights(const LightProfile* lights, size_t count);
+    // For the rooms setLights() found no lights for
+    void setDefaultRoomMilliwatts(uint32_t milliwatts);
+    uint32_t roomMilliwatts(uint8_t room) const { return roomMilliwatts_[room]; }
+
+    void add(const SessionRecord& session);
+
+    // Restart the periods that ended before local day day
+    void rollTo(int32_t day);
+
+    // room < MAX_ROOMS or ENERGY_ALL_ROOMS
+    EnergyReport report(uint8_t room, uint8_t period) const;
+
+    const LedgerTotals& totals() const { return totals_; }
+    void restore(const LedgerTotals& totals) { totals_ = totals; }
+
+private:
+    struct Segment {
+        uint32_t startMs;   // Into the week, Monday 00:00 local
+        uint8_t band;
+    };
+
+    void buildSegments();
+    void addEnergy(uint8_t room, uint8_t band, uint64_t microWattSeconds);
+
+    TariffConfig tariff_;
+    uint32_t defaultRoomMilliwatts_;
+    uint32_t roomMilliwatts_[MAX_ROOMS];
+    bool lit_[MAX_ROOMS];                   // Has light profiles
+    Segment segments_[TARIFF_MAX_SEGMENTS];
+    uint8_t segmentCount_;
+    uint32_t weekMs_[TARIFF_MAX_BANDS];     // Time in each band per week
+    LedgerTotals totals_;
+};
+
+// Light profiles as text, one light per line: room, watts, then anything
+// (a name). Blank lines and lines starting with # are skipped. Returns the
+// number of lights read, at most max.
+size_t parseLightProfiles(const char* text, size_t length, LightProfile* out, size_t max);
+size_t loadLightProfiles(Storage& storage, const char* path, LightProfile* out, size_t max);
+
+// Flash form of the totals, with a magic and a CRC like the calibration
+#define LEDGER_MAGIC "LSE1"
+#define LEDGER_FILE_MAX (4 + 4 + MAX_ROOMS * ENERGY_PERIODS * TARIFF_MAX_BANDS * 8 + 2)
+bool loadLedger(Storage& storage, const char* path, LedgerTotals& out);
+bool saveLedger(Storage& storage, const char* path, const LedgerTotals& totals);
+
+// /api/energy?room=N: the tariff and one room's (or all rooms') periods
+#define ENERGY_JSON_MAX 1536
+size_t formatEnergyJson(const EnergyLedger& ledger, uint8_t room, uint8_t roomCount, char* out, size_t size);
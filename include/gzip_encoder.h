@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming gzip (RFC 1952) in fixed, small RAM for compressed downloads.
+//
+// A full deflate implementation wants a 32 KB window and dynamic Huffman
+// tables; this one keeps a GZIP_WINDOW-byte window with a single-entry hash
+// per 3-byte prefix and codes everything with deflate's fixed Huffman table.
+// That is enough for the columnar, varint-packed formats it is used on,
+// which are dominated by runs and short repeats. Output is one continuous
+// deflate stream, so every gunzip and Content-Encoding: gzip client reads it.
+
+#define GZIP_WINDOW 2048            // Bytes of history a match can reach back
+#define GZIP_HASH_BITS 10
+#define GZIP_INPUT_MAX GZIP_WINDOW  // Largest write()
+// Room write() or finish() may need for length bytes of input (literals
+// above 143 take 9 bits) plus the gzip header and trailer
+#define GZIP_OUTPUT_MAX(length) ((length) + (length) / 8 + 32)
+
+class GzipEncoder {
+public:
+    GzipEncoder();
+
+    // Start a new member; the header goes out with the first write()
+    void begin();
+
+    // Compress length bytes (at most GZIP_INPUT_MAX) into out and return
+    // how many bytes were written. Some bits may be held back until the
+    // next call.
+    size_t write(const uint8_t* data, size_t length, uint8_t* out);
+
+    // End the stream: remaining bits, the final block and the trailer
+    size_t finish(uint8_t* out);
+
+private:
+    void putBits(uint32_t value, uint8_t count);
+    void putHuffman(uint16_t code, uint8_t length);
+    void putLiteral(uint8_t value);
+    void putMatch(uint16_t length, uint16_t distance);
+    size_t start(uint8_t* out);
+
+    uint8_t window_[GZIP_WINDOW + GZIP_INPUT_MAX];  // History, then the input being compressed
+    uint16_t head_[1 << GZIP_HASH_BITS];            // Window position + 1 of the last prefix seen, 0 = none
+    size_t history_;
+    bool started_;
+    uint32_t crc_;
+    uint32_t inputSize_;
+    uint32_t bits_;
+    uint8_t bitCount_;
+    uint8_t* out_;
+    size_t outLength_;
+};
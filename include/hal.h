@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin hardware abstraction between the portable firmware logic in src/core/
+// and the board. The ESP32 build implements it in src/hal_esp32.cpp, the
+// host build in src/native/sim_hal.cpp with a simulated clock and scripted
+// sensor input. Outgoing HTTP goes through WebhookTransport
+// (webhook_dispatcher.h), incoming through TcpListener and HttpServer.
+
+class Clock {
+public:
+    virtual ~Clock() {}
+    virtual uint32_t millis() = 0;
+    virtual uint32_t micros() = 0;
+    // Unix time in seconds, or 0 until the wall clock is known (NTP)
+    virtual uint32_t epochSeconds() { return 0; }
+};
+
+// Small files in flash: SPIFFS on the board, a directory on the host.
+// Paths are flat ("/name.bin").
+class Storage {
+public:
+    virtual ~Storage() {}
+    // File size in bytes, 0 if it does not exist
+    virtual size_t size(const char* path) = 0;
+    virtual bool read(const char* path, uint32_t offset, void* out, size_t length) = 0;
+    // Creates the file if needed
+    virtual bool append(const char* path, const void* data, size_t length) = 0;
+    // Overwrite bytes inside an existing file
+    virtual bool write(const char* path, uint32_t offset, const void* data, size_t length) = 0;
+    virtual bool remove(const char* path) = 0;
+};
+
+// One finished ultrasonic measurement
+struct EchoSample {
+    uint8_t channel;
+    bool timedOut;
+    uint32_t widthUs;      // Echo pulse width, 0 when timed out
+    uint32_t timestampUs;  // Clock micros() at the falling edge (or at expiry)
+};
+
+// An HC-SR04 raises ECHO about this long after its trigger pulse
+#define ECHO_START_US 500
+
+// Trigger/echo pairs addressed by channel number
+class EchoSource {
+public:
+    virtual ~EchoSource() {}
+    // Fire a ping; false if the channel still has one in flight.
+    virtual bool trigger(uint8_t channel) = 0;
+    virtual bool busy(uint8_t channel) = 0;
+    // Next completed or expired measurement, never blocks.
+    virtual bool next(EchoSample& out) = 0;
+    // Longest echo worth waiting for: a ping expires ECHO_START_US +
+    // widthUs after its trigger and a longer echo counts as no echo.
+    virtual void setMaxEchoWidth(uint32_t widthUs) = 0;
+};
+
+// Air temperature for the speed of sound (range_conversion.h)
+class TemperatureSource {
+public:
+    virtual ~TemperatureSource() {}
+    // Tenths of a degree Celsius; false if the sensor did not answer
+    virtual bool read(int16_t& deciCelsius) = 0;
+};
+
+// A configured temperature, for boards without a sensor
+class FixedTemperature : public TemperatureSource {
+public:
+    explicit FixedTemperature(int16_t deciCelsius) : deciCelsius_(deciCelsius) {}
+    bool read(int16_t& deciCelsius) override {
+        deciCelsius = deciCelsius_;
+        return true;
+    }
+
+private:
+    int16_t deciCelsius_;
+};
+
+// Character display; DisplayRenderer (display_renderer.h) decides what to send
+class Display {
+public:
+    virtual ~Display() {}
+    // Move the cursor to row, col and write length characters
+    virtual void write(uint8_t row, uint8_t col, const char* text, uint8_t length) = 0;
+};
+
+// Non-blocking TCP server sockets for HttpServer (http_server.h): lwIP
+// sockets on the board, POSIX on the host. A connection is its socket
+// number; none of the calls ever blocks except wait().
+class TcpListener {
+public:
+    virtual ~TcpListener() {}
+    virtual bool begin(uint16_t port) = 0;
+    // A connection that is waiting to be accepted, or -1
+    virtual int accept() = 0;
+    // Bytes read; 0 if nothing has arrived, -1 once the peer closed or the
+    // connection failed
+    virtual int read(int connection, uint8_t* out, size_t size) = 0;
+    // Bytes the send buffer took; 0 while it is full, -1 on failure
+    virtual int write(int connection, const uint8_t* data, size_t length) = 0;
+    virtual void close(int connection) = 0;
+    // Sleep until one of readable has data (or closed), one of writable has
+    // room, a client connects while accepting, or timeoutMs passes
+    virtual void wait(const int* readable, size_t readableCount, const int* writable, size_t writableCount,
+                      bool accepting, uint32_t timeoutMs) = 0;
+};
+
+// printf-style diagnostics (Serial on the board, stdout on the host)
+void logMessage(const char* format, ...);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <LiquidCrystal_I2C.h>
+#include <Wire.h>
+#include <esp_pm.h>
+
+#include "hal.h"
+
+// Board implementations of the HAL interfaces
+
+class ArduinoClock : public Clock {
+public:
+    uint32_t millis() override;
+    uint32_t micros() override;
+    uint32_t epochSeconds() override;
+};
+
+// Interrupt-driven HC-SR04 capture (echo_capture.h)
+class InterruptEchoSource : public EchoSource {
+public:
+    bool trigger(uint8_t channel) override;
+    bool busy(uint8_t channel) override;
+    bool next(EchoSample& out) override;
+    void setMaxEchoWidth(uint32_t widthUs) override;
+};
+
+// Files on the SPIFFS partition (mounted in setup())
+class SpiffsStorage : public Storage {
+public:
+    size_t size(const char* path) override;
+    bool read(const char* path, uint32_t offset, void* out, size_t length) override;
+    bool append(const char* path, const void* data, size_t length) override;
+    bool write(const char* path, uint32_t offset, const void* data, size_t length) override;
+    bool remove(const char* path) override;
+};
+
+class LcdDisplay : public Display {
+public:
+    explicit LcdDisplay(LiquidCrystal_I2C& lcd) : lcd_(lcd) {}
+    void write(uint8_t row, uint8_t col, const char* text, uint8_t length) override;
+
+private:
+    LiquidCrystal_I2C& lcd_;
+};
+
+// LM75 / TMP102-style I2C thermometer (temperature register 0, left-justified
+// two's complement, 1/256 degree per bit). Shares the LCD's bus, so only call
+// read() from the task that drives the LCD.
+class I2cTemperature : public TemperatureSource {
+public:
+    I2cTemperature(TwoWire& wire, uint8_t address) : wire_(wire), address_(address) {}
+    bool read(int16_t& deciCelsius) override;
+
+private:
+    TwoWire& wire_;
+    uint8_t address_;
+};
+
+// Non-blocking lwIP sockets for HttpServer; wait() is a select() on them
+class LwipTcpListener : public TcpListener {
+public:
+    bool begin(uint16_t port) override;
+    int accept() override;
+    int read(int connection, uint8_t* out, size_t size) override;
+    int write(int connection, const uint8_t* data, size_t length) override;
+    void close(int connection) override;
+    void wait(const int* readable, size_t readableCount, const int* writable, size_t writableCount,
+              bool accepting, uint32_t timeoutMs) override;
+
+private:
+    int socket_ = -1;
+};
+
+// What Esp32Power::begin() managed to set up, best first
+enum Esp32PowerMode : uint8_t {
+    POWER_MODE_LIGHT_SLEEP,     // Frequency scaling and automatic light sleep
+    POWER_MODE_SCALING,         // Frequency scaling only
+    POWER_MODE_FIXED_CLOCK,     // No esp_pm: the CPU runs at minMhz all the time
+    POWER_MODE_FULL_SPEED,      // Nothing took effect
+};
+
+// "lightSleep", "frequencyScaling", "fixedClock" or "fullSpeed"
+const char* esp32PowerModeName(Esp32PowerMode mode);
+
+// Power management through esp_pm: the CPU clock drops to minMhz while no
+// task needs full speed, and with automatic light sleep the chip sleeps
+// whenever every task is blocked. Light sleep needs an ESP-IDF built with
+// tickless idle, esp_pm one built with CONFIG_PM_ENABLE (stock
+// arduino-esp32 has neither); begin() falls back to frequency scaling and
+// then to a fixed minMhz clock.
+class Esp32Power {
+public:
+    Esp32PowerMode begin(bool lightSleep, uint8_t minMhz);
+
+    // Hold the chip out of light sleep, e.g. while an echo is due: the echo
+    // interrupt would otherwise timestamp the edge only after waking up
+    void stayAwake(bool awake);
+
+    // A presence sensor's output (PIR, radar) wakes the chip and notifies
+    // task when it goes high. takeWake() is true from then until the pin
+    // has dropped again, and re-arms it.
+    void wakeOnPin(int pin, TaskHandle_t task);
+    bool takeWake();
+
+private:
+    esp_pm_lock_handle_t lock_ = NULL;
+    bool held_ = false;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+#include "timeseries_store.h"
+
+// Pre-aggregated history for /api/history.
+//
+// Every finished minute is added to one bucket per level (minute, hour, local
+// day, calendar month), so the cost of a minute is constant and a query never
+// sums raw records: it reads one bucket per point, or a handful when points
+// span several buckets (weeks, years, "step=900"). Each level is a ring
+// indexed by bucket number; a slot whose stamp does not match the requested
+// bucket is simply empty.
+//
+// Bucket boundaries are local time (utcOffsetMinutes east of UTC), like the
+// store's rollups, so days start at local midnight, weeks on Monday and
+// months on the 1st. Timestamps in and out are Unix seconds.
+
+enum HistoryLevel : uint8_t {
+    HISTORY_MINUTE,
+    HISTORY_HOUR,
+    HISTORY_DAY,
+    HISTORY_MONTH,
+    HISTORY_LEVELS,
+};
+
+// Buckets kept per level
+#define HISTORY_MINUTE_BUCKETS 180   // 3 hours
+#define HISTORY_HOUR_BUCKETS 192     // 8 days
+#define HISTORY_DAY_BUCKETS 93       // 3 months
+#define HISTORY_MONTH_BUCKETS 36     // 3 years
+
+// Most points one query returns; longer ranges keep the newest points
+#define HISTORY_MAX_POINTS 400
+
+// Largest formatted point and header/footer
+#define HISTORY_POINT_MAX 64
+#define HISTORY_HEADER_MAX 96
+
+enum HistoryGroup : uint8_t {
+    HISTORY_GROUP_NONE,     // multiple consecutive buckets per point
+    HISTORY_GROUP_WEEK,     // day buckets, Monday to Sunday
+    HISTORY_GROUP_YEAR,     // month buckets, January to December
+};
+
+struct HistoryQuery {
+    uint32_t fromSeconds;
+    uint32_t toSeconds;     // Exclusive
+    HistoryLevel level;
+    HistoryGroup group;
+    uint32_t multiple;      // Buckets per point (7 for weeks, 12 for years)
+    char step[12];          // As requested, echoed in the response
+};
+
+struct HistoryPoint {
+    uint32_t startSeconds;
+    uint32_t energyMwh;
+    uint32_t occupiedSeconds;
+    uint32_t entries;
+    uint32_t exits;
+    uint8_t peakOccupants;
+};
+
+// Position in a query's result, filled by HistoryBuckets::open()
+struct HistoryCursor {
+    HistoryQuery query;
+    uint32_t next;          // First bucket of the next point
+    uint32_t end;           // Bucket after the last point
+    uint32_t fromSeconds;   // Range actually covered, after clamping to retention
+    uint32_t toSeconds;
+    bool truncated;         // Range was longer than retention or HISTORY_MAX_POINTS
+};
+
+// from/to are Unix seconds (NULL or empty for the defaults), step is minute,
+// hour, day, week, month, year or a number of seconds that is a multiple of
+// a minute, hour or day. Without from the range covers a default span for the
+// step ending at to (default nowSeconds). False for malformed input.
+bool parseHistoryQuery(const char* from, const char* to, const char* step, uint32_t nowSeconds,
+                       HistoryQuery& out);
+
+class HistoryBuckets {
+public:
+    explicit HistoryBuckets(int32_t utcOffsetMinutes);
+
+    // Rebuild the buckets from the persistent history. Call before the first
+    // add(); minute and hour buckets come from raw minutes, day and month
+    // buckets from the store's rollups.
+    void prime(TimeSeriesStore& store);
+
+    void add(const MinuteRecord& record);
+
+    // Start reading a query. Returns false if nothing has been recorded yet.
+    bool open(const HistoryQuery& query, HistoryCursor& cursor);
+
+    // Next points of the query, oldest first. Returns how many were written
+    // (at most max); 0 when the cursor is exhausted.
+    size_t read(HistoryCursor& cursor, HistoryPoint* out, size_t max);
+
+private:
+    struct Bucket {
+        uint32_t index;
+        uint32_t energyMwh;
+        uint32_t occupiedSeconds;
+        uint32_t entries;
+        uint32_t exits;
+        uint8_t peakOccupants;
+        bool used;
+    };
+
+    Bucket& slot(HistoryLevel level, uint32_t index);
+    Bucket* bucket(HistoryLevel level, uint32_t index);
+    uint32_t bucketIndex(HistoryLevel level, uint32_t epochMinute) const;
+    uint32_t bucketStartSeconds(HistoryLevel level, uint32_t index) const;
+    uint32_t pointStart(const HistoryQuery& query, uint32_t index) const;
+    uint32_t pointEnd(const HistoryQuery& query, uint32_t start) const;
+    void addTo(HistoryLevel level, uint32_t index, const MinuteRecord& record);
+    void setSummary(HistoryLevel level, uint32_t index, const PeriodSummary& summary);
+
+    int32_t utcOffsetMinutes_;
+    std::mutex lock_;
+
+    Bucket minutes_[HISTORY_MINUTE_BUCKETS];
+    Bucket hours_[HISTORY_HOUR_BUCKETS];
+    Bucket days_[HISTORY_DAY_BUCKETS];
+    Bucket months_[HISTORY_MONTH_BUCKETS];
+    bool hasNewest_;
+    uint32_t newest_[HISTORY_LEVELS];
+};
+
+// JSON pieces of a /api/history response: the header opens the points array,
+// each point is [start, energyWh, occupiedSeconds, entries, exits, peak]
+// (comma-prefixed unless first), the footer closes it. All return the length
+// written, or 0 if it did not fit.
+size_t formatHistoryHeader(const HistoryCursor& cursor, char* out, size_t size);
+size_t formatHistoryPoint(const HistoryPoint& point, bool first, char* out, size_t size);
+size_t formatHistoryFooter(const HistoryCursor& cursor, char* out, size_t size);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gzip_encoder.h"
+#include "timeseries_store.h"
+
+// Bulk export of the stored per-minute history for fleet collection
+// (/api/export?since=<cursor>).
+//
+// The export covers every stored minute from the cursor up to the newest
+// one at the time of the request, read from the store one block at a time,
+// so RAM use does not depend on the range. The response carries the cursor
+// for the next request (X-Export-Cursor), which starts right after the last
+// minute included; a collector that stores it and asks again gets each
+// minute exactly once.
+//
+// Format, all integers little-endian or unsigned LEB128 varints:
+//   "LSX1", u32 since, u32 cursor        (Unix minutes)
+//   blocks of up to EXPORT_BLOCK_RECORDS minutes:
+//     varint count, then one column after another, count values each:
+//       minute   varint, gap from the previous minute (the very first
+//                one from since)
+//       energyMwh, occupiedSeconds, entries, exits, peakOccupants  varints
+//   varint 0 ends the export
+// Columns keep alike values together (gaps of 1, runs of zeros), which is
+// what makes the optional gzip encoding effective. If the transfer breaks
+// off, everything up to the last complete block is valid and the collector
+// can resume from the minute after it.
+
+#define EXPORT_MAGIC "LSX1"
+#define EXPORT_HEADER_SIZE 12
+#define EXPORT_BLOCK_RECORDS 60     // An hour of minutes
+#define EXPORT_BLOCK_MAX (5 + EXPORT_BLOCK_RECORDS * 5 * 6)
+// Gzipped exports share one compressor; a stream that has not asked for
+// more for this long (longer than the HTTP server's I/O timeout) has been
+// dropped and gives it up
+#define EXPORT_GZIP_STALE_MS 10000
+
+// Position in one export; plain data so it can ride in a response stream
+struct ExportCursor {
+    uint32_t since;
+    uint32_t next;          // First minute not read yet
+    uint32_t end;           // Exclusive; the cursor for the next export
+    uint32_t lastMinute;    // Last minute written, for the next gap
+    uint32_t owner;         // Compressor lease, 0 for an uncompressed export
+    uint8_t part;           // Header, blocks or done
+};
+
+class HistoryExport {
+public:
+    explicit HistoryExport(TimeSeriesStore& store);
+
+    // Start an export at sinceMinute. False when gzip is asked for and the
+    // compressor is in use by another live export.
+    bool open(uint32_t sinceMinute, bool gzip, uint32_t nowMs, ExportCursor& cursor);
+
+    // Next piece of the export into out, which holds EXPORT_PIECE_MAX
+    // bytes; 0 once it is complete (or its compressor was taken over).
+    // Exports are read from one task.
+    size_t read(ExportCursor& cursor, uint8_t* out, uint32_t nowMs);
+
+private:
+    size_t nextBlock(ExportCursor& cursor, uint8_t* out);
+
+    TimeSeriesStore& store_;
+    GzipEncoder gzip_;
+    MinuteRecord records_[EXPORT_BLOCK_RECORDS];
+    uint8_t block_[EXPORT_BLOCK_MAX];   // Raw block on its way into the compressor
+    uint32_t owner_;                    // Lease of the export using gzip_, 0 = free
+    uint32_t leases_;
+    uint32_t lastUseMs_;
+};
+
+// Room read() needs, raw or compressed
+#define EXPORT_PIECE_MAX GZIP_OUTPUT_MAX(EXPORT_BLOCK_MAX)
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+#include "hal.h"
+#include "web_assets.h"
+
+// Event-driven HTTP/1.1 server for the dashboard and the JSON API.
+//
+// One task calls wait() and poll() in a loop. Every socket is non-blocking
+// and serviced in turn, so a slow client or a large response only holds its
+// own connection. Up to HTTP_MAX_CONNECTIONS clients stay connected with
+// keep-alive (pipelined requests are answered in order). A request that is
+// being read or answered borrows one of HTTP_BUFFER_COUNT request/response
+// buffer pairs; when the pool or the connection table is full the server
+// stops reading or accepting and lets TCP flow control hold the clients back,
+// so load never turns into RAM. A full table still makes room for a new
+// client by closing the connection that has been idle longest, so browsers
+// parking keep-alive connections cannot lock everyone else out.
+//
+// Handlers run to completion on the polling task and answer in one of four
+// ways: a body copied into the response buffer (send), bytes that outlive the
+// request such as flash assets (sendStatic), a body produced piece by piece
+// as the socket drains (stream), or a push channel that keeps the connection
+// after its header and gets frames from HttpServer::push() (/api/events).
+
+#ifndef HTTP_MAX_CONNECTIONS
+#define HTTP_MAX_CONNECTIONS 10     // lwIP has 16 sockets; webhooks and NTP need some
+#endif
+#ifndef HTTP_BUFFER_COUNT
+#define HTTP_BUFFER_COUNT 4         // Requests read or answered at the same time
+#endif
+#define HTTP_REQUEST_MAX 1024       // Request line, headers and body
+#define HTTP_RESPONSE_MAX 2560      // Header plus a body passed to send(); ROOMS_ENCODED_MAX fits
+#define HTTP_MAX_ROUTES 24
+#define HTTP_MAX_HEADERS 16
+#define HTTP_MAX_ARGS 8
+#define HTTP_STREAM_STATE_MAX 96    // Handler state carried by a streamed body
+#define HTTP_IDLE_TIMEOUT_MS 15000  // Kept-alive connection without a request
+#define HTTP_RECLAIM_IDLE_MS 1000   // Idle this long, a kept-alive connection gives way to a new client
+#define HTTP_IO_TIMEOUT_MS 5000     // Request incomplete or response not moving
+
+// Route methods are a mask of these
+enum HttpMethod : uint8_t {
+    HTTP_METHOD_GET = 1,
+    HTTP_METHOD_POST = 2,
+    HTTP_METHOD_OTHER = 4,          // Anything else; no route accepts it
+};
+#define HTTP_METHOD_ANY (HTTP_METHOD_GET | HTTP_METHOD_POST)
+
+// Returned by a stream's fill function once the body is complete
+#define HTTP_STREAM_END ((size_t)-1)
+
+// Identifies a push connection across polls; 0 is never a valid id
+typedef uint32_t HttpPushId;
+
+// A parsed request. Everything points into the connection's request buffer
+// and is only valid while the handler runs.
+class HttpRequest {
+public:
+    HttpMethod method() const { return method_; }
+    const char* path() const { return path_; }
+    // Query string or urlencoded form argument, decoded; NULL if absent
+    const char* arg(const char* name) const;
+    bool hasArg(const char* name) const { return arg(name) != NULL; }
+    // Case-insensitive; NULL if absent
+    const char* header(const char* name) const;
+    // The body as received; form bodies are decoded into arguments instead
+    const uint8_t* body() const { return body_; }
+    size_t bodyLength() const { return bodyLength_; }
+
+private:
+    friend class HttpServer;
+
+    enum ParseResult { PARSE_INCOMPLETE, PARSE_DONE, PARSE_BAD, PARSE_TOO_LARGE };
+
+    // Parses in place once the whole request is in data; size is the
+    // buffer's capacity. Sets consumed to the request's length (head and
+    // body), which may be less than length when requests are pipelined.
+    ParseResult parse(char* data, size_t length, size_t size, size_t& consumed);
+    void parseArgs(char* text);
+
+    HttpMethod method_;
+    bool http11_;
+    bool keepAlive_;
+    char* path_;
+    const uint8_t* body_;
+    size_t bodyLength_;
+    uint8_t headerCount_;
+    uint8_t argCount_;
+    const char* headerNames_[HTTP_MAX_HEADERS];
+    const char* headerValues_[HTTP_MAX_HEADERS];
+    const char* argNames_[HTTP_MAX_ARGS];
+    const char* argValues_[HTTP_MAX_ARGS];
+};
+
+class HttpStream;
+
+// Writes the next piece of a streamed body into out and returns its length;
+// 0 when nothing is ready yet (it is called again on the next poll),
+// HTTP_STREAM_END when the body is complete. Called whenever the previous
+// piece has gone to the socket, with size >= HTTP_RESPONSE_MAX - 16.
+typedef size_t (*HttpStreamFill)(HttpStream& stream, uint8_t* out, size_t size);
+
+class HttpStream {
+public:
+    // The state handed to HttpResponse::stream()
+    template <typename T>
+    T& state() {
+        static_assert(sizeof(T) <= HTTP_STREAM_STATE_MAX, "Stream state too large");
+        static_assert(std::is_trivially_copyable<T>::value, "Stream state must be plain data");
+        return *reinterpret_cast<T*>(state_);
+    }
+
+private:
+    friend class HttpResponse;
+    friend class HttpServer;
+
+    HttpStreamFill fill_;
+    alignas(8) uint8_t state_[HTTP_STREAM_STATE_MAX];
+};
+
+class HttpServer;
+
+// The answer to one request. A handler that does not answer, or whose
+// answer does not fit, makes the server send a 500.
+class HttpResponse {
+public:
+    // Header and a copy of body, which must fit HTTP_RESPONSE_MAX together
+    bool send(int status, const char* contentType, const void* body, size_t length,
+              const char* cacheControl = "no-store", const char* extraHeaders = NULL);
+    bool send(int status, const char* contentType, const char* text);
+    // Body sent straight from memory that stays valid (flash)
+    bool sendStatic(int status, const char* contentType, const uint8_t* body, size_t length,
+                    const char* cacheControl, const char* extraHeaders = NULL);
+    // Body produced by fill, chunked on a kept-alive connection; state is
+    // copied and available to fill as stream.state<T>()
+    template <typename T>
+    bool stream(int status, const char* contentType, HttpStreamFill fill, const T& state,
+                const char* extraHeaders = NULL) {
+        HttpStream* stream = beginStream(status, contentType, fill, extraHeaders);
+        if (stream) {
+            stream->state<T>() = state;
+        }
+        return stream != NULL;
+    }
+    // Send data (a complete raw header, perhaps a first frame) and keep the
+    // connection for HttpServer::push(). Returns 0 if it did not fit.
+    HttpPushId startPush(const void* data, size_t length);
+
+private:
+    friend class HttpServer;
+
+    HttpResponse(HttpServer& server, uint8_t connection) : server_(server), connection_(connection), sent_(false) {}
+    HttpStream* beginStream(int status, const char* contentType, HttpStreamFill fill, const char* extraHeaders);
+
+    HttpServer& server_;
+    uint8_t connection_;
+    bool sent_;
+};
+
+typedef void (*HttpHandler)(const HttpRequest& request, HttpResponse& response);
+
+struct HttpServerStats {
+    uint32_t accepted;          // Connections
+    uint32_t requests;
+    uint32_t reused;            // Requests on a kept-alive connection
+    uint32_t rejected;          // Malformed, too large or not routable
+    uint32_t timedOut;          // Closed while stalled mid-request or mid-response
+    uint32_t pushDropped;       // Push connections too slow to take a frame
+    uint8_t connections;        // Open now
+    uint8_t peakConnections;
+    uint8_t peakBuffers;        // HTTP_BUFFER_COUNT means requests waited for a buffer
+};
+
+class HttpServer {
+public:
+    explicit HttpServer(TcpListener& listener);
+
+    bool begin(uint16_t port);
+    // Dashboard files, matched by path before the routes (GET only)
+    void setAssets(const WebAsset* assets, size_t count);
+    // Exact path match (the query string is not part of it); methods is a
+    // mask of HttpMethod. False when the route table is full.
+    bool on(const char* path, uint8_t methods, HttpHandler handler);
+
+    // Sleep until a socket needs attention or timeoutMs passes
+    void wait(uint32_t timeoutMs);
+    // Accept, read, answer and send on every connection without blocking
+    void poll(uint32_t nowMs);
+
+    // Send a whole frame on a push connection. False, with the connection
+    // closed, if the client is gone or cannot take the frame at once.
+    bool push(HttpPushId id, const void* data, size_t length);
+    bool pushOpen(HttpPushId id) const;
+
+    const HttpServerStats& stats() const { return stats_; }
+
+private:
+    friend class HttpResponse;
+
+    enum ConnectionState : uint8_t {
+        CONNECTION_FREE,
+        CONNECTION_IDLE,        // Kept alive between requests, no buffer
+        CONNECTION_READING,     // Request arriving
+        CONNECTION_SENDING,     // Response going out
+        CONNECTION_PUSH,        // Push channel, no buffer
+    };
+
+    struct Connection {
+        int socket;
+        ConnectionState state;
+        int8_t buffer;          // Pool index while reading or sending, -1 otherwise
+        uint16_t generation;    // Tells push ids of successive clients apart
+        bool http11;            // Of the request being answered
+        bool keepAlive;         // After the response in progress
+        bool chunked;           // Stream framing for the response in progress
+        bool streaming;         // fill still has to be called
+        bool pushing;           // Becomes a push channel once the header is out
+        bool reused;
+        uint32_t lastProgressMs;
+        size_t received;        // Bytes in the request buffer
+        size_t requestLength;   // Request being answered; 0 while incomplete
+        size_t outStart;        // Unsent part of the response buffer
+        size_t outEnd;
+        const uint8_t* staticData;  // Unsent part of a sendStatic() body
+        size_t staticLength;
+    };
+
+    struct Buffers {
+        bool used;
+        char request[HTTP_REQUEST_MAX];
+        uint8_t response[HTTP_RESPONSE_MAX];
+        HttpStream stream;
+    };
+
+    struct Route {
+        const char* path;
+        uint8_t methods;
+        HttpHandler handler;
+    };
+
+    void acceptClients(uint32_t nowMs);
+    int reclaimable(uint32_t nowMs) const;
+    void service(uint8_t index, uint32_t nowMs);
+    bool readRequest(uint8_t index, uint32_t nowMs);
+    void answer(uint8_t index, const HttpRequest& request);
+    bool sendAsset(Connection& connection, const HttpRequest& request);
+    bool sendError(Connection& connection, int status);
+    bool flush(Connection& connection, uint32_t nowMs);
+    bool refill(Connection& connection);
+    void finishResponse(Connection& connection);
+    bool acquireBuffer(Connection& connection);
+    void releaseBuffer(Connection& connection);
+    void close(Connection& connection);
+    int findPush(HttpPushId id) const;
+
+    // Header formatted into the connection's response buffer
+    bool beginResponse(Connection& connection, int status, const char* contentType, size_t contentLength,
+                       const char* cacheControl, const char* extraHeaders);
+
+    TcpListener& listener_;
+    const WebAsset* assets_;
+    size_t assetCount_;
+    Route routes_[HTTP_MAX_ROUTES];
+    uint8_t routeCount_;
+    Connection connections_[HTTP_MAX_CONNECTIONS];
+    Buffers buffers_[HTTP_BUFFER_COUNT];
+    uint8_t buffersInUse_;
+    uint8_t firstServiced_;     // Rotates so no connection always comes first
+    uint32_t lastPollMs_;
+    HttpServerStats stats_;
+};
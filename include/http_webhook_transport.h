@@ -0,0 +1,27 @@
+#pragma once
+
+#include <HTTPClient.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+#include "webhook_dispatcher.h"
+
+#define WEBHOOK_CONNECT_TIMEOUT_MS 3000
+#define WEBHOOK_RESPONSE_TIMEOUT_MS 5000
+
+// HTTPClient-backed transport. Keeps one connection open between requests
+// so consecutive webhooks to the same host skip the TCP/TLS handshake.
+// Plain http:// URLs are supported so the dispatcher can be pointed at a
+// local stand-in server.
+class HttpWebhookTransport : public WebhookTransport {
+public:
+    HttpWebhookTransport();
+    int get(const char* url) override;
+
+private:
+    WiFiClient plainClient_;
+    WiFiClientSecure secureClient_;
+    HTTPClient http_;
+    String host_;
+    bool secure_;
+};
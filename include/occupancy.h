@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+
+// Entry/exit detection for one doorway watched by two sensors, and the
+// occupancy of the room behind it. Pure logic: callers pass in each sensor's
+// presence and the current time, nothing here touches hardware.
+
+enum CrossingEvent : uint8_t {
+    CROSSING_NONE = 0,
+    CROSSING_ENTRY,  // Sensor 1 (entrance) then sensor 2 (inside)
+    CROSSING_EXIT,   // Sensor 2 then sensor 1
+};
+
+struct DoorwayConfig {
+    int thresholdCm;             // Closer than this counts as "someone there"
+    uint32_t sequenceTimeoutMs;  // Passages slower than this are counted with less confidence
+};
+
+struct RoomState {
+    bool occupied;
+    int occupantCount;
+    uint8_t confidence;          // Percent probability that occupantCount is right
+    uint32_t occupiedSinceMs;
+    uint32_t totalOccupiedTime;  // ms, since boot
+    uint32_t dailyOccupiedTime;  // ms, since the last daily reset
+    uint32_t entries;            // People in, since boot
+    uint32_t exits;
+};
+
+// Occupancy from doorway passages, with a confidence figure.
+//
+// PassageDecoder turns each sensor's presence into a timed pair of edges
+// (arrived, left) and reads the order of the four edges like a quadrature
+// encoder: the doorway steps through clear -> entrance -> both -> inside ->
+// clear for someone walking in, and the same states backwards for someone
+// walking out. Each step forward is +1 and each step back -1, so a passage
+// is over when the doorway is clear again and the total, in quarters, is the
+// number of people who went through. Someone who turns back halfway undoes
+// their own steps and counts as nothing, as do two people passing each other
+// in opposite directions. Two people close together show up as more arrivals
+// at one sensor than the total says, a passage slower than the doorway's
+// sequence timeout may hide someone slipping past, and two sensors that both
+// changed between readings leave the direction to a guess; all three are
+// reported with the passage so the room can weigh it.
+//
+// OccupancyTracker keeps, per room, the probability of each occupant count
+// from 0 to TRACKER_MAX_OCCUPANTS. A passage shifts that distribution by its
+// total, spread over the likely alternatives for its quality; the reported
+// count is the most likely one and the confidence its probability. After
+// every quietMs with no doorway activity a share of each count's probability
+// moves one person down, so occupants left over from a missed exit fade out
+// overnight instead of keeping the lights on. Both classes are fixed size and
+// do a bounded amount of work per reading.
+
+#define TRACKER_MAX_OCCUPANTS 15
+
+// Probabilities are Q15
+#define TRACKER_PROBABILITY_ONE (1UL << 15)
+
+enum PassageQuality : uint8_t {
+    PASSAGE_CLEAN = 0,
+    PASSAGE_TANDEM,             // More arrivals at one sensor than people counted
+    PASSAGE_SLOW,               // Took longer than the sequence timeout
+    PASSAGE_GUESSED,            // Both sensors changed at once; direction guessed
+};
+
+struct Passage {
+    int8_t net;                 // People in (positive) or out (negative), never 0
+    PassageQuality quality;
+    uint32_t startMs;           // First arrival
+    uint32_t endMs;             // Doorway clear again
+};
+
+struct TrackerConfig {
+    uint32_t quietMs;           // No doorway activity this long moves the count down (0 = never)
+    uint8_t quietPercent;       // Share of each count's probability moved per quiet period
+};
+
+struct PassageStats {
+    uint32_t passages;          // With a non-zero total
+    uint32_t turnedBack;        // Finished with a zero total
+    uint32_t tandem;
+    uint32_t slow;
+    uint32_t guessed;
+};
+
+// Most likely number of people who went through: the total, or one more
+// for a tandem
+uint8_t passagePeople(const Passage& passage);
+
+class PassageDecoder {
+public:
+    PassageDecoder();
+
+    void reset();
+
+    // Take the sensors' presence as it is, without counting anything, while
+    // the doorway is not being counted (sensors still calibrating). A walk
+    // that started before then can only count once it completes a full cycle.
+    void sync(bool near1, bool near2);
+
+    // Feed the latest presence of both sensors. Returns true, with out filled
+    // in, when the doorway just cleared after people went through.
+    bool update(bool near1, bool near2, uint32_t nowMs, uint32_t sequenceTimeoutMs, Passage& out);
+
+    // Someone is in the doorway
+    bool busy() const { return state_ != 0; }
+    const PassageStats& stats() const { return stats_; }
+
+private:
+    uint8_t state_;             // bit 0 entrance, bit 1 inside
+    int8_t lastStep_;
+    bool guessed_;
+    int16_t position_;          // Quarter passages since the doorway was last clear
+    uint8_t arrivals_[2];
+    uint32_t startMs_;
+    PassageStats stats_;
+};
+
+class OccupancyTracker {
+public:
+    OccupancyTracker();
+
+    // Certain of count
+    void reset(uint8_t count = 0);
+
+    void applyPassage(const Passage& passage);
+
+    // Someone is in one of the room's doorways
+    void activity(uint32_t nowMs) { quietSinceMs_ = nowMs; }
+
+    // Apply the quiet-period decay if one is due. Returns true if the most
+    // likely count changed.
+    bool reconcile(uint32_t nowMs, const TrackerConfig& config);
+
+    uint8_t count() const { return mode_; }
+    // Probability of count(), in percent
+    uint8_t confidence() const;
+    bool occupied() const { return mode_ > 0; }
+
+private:
+    void updateMode();
+
+    uint16_t probability_[TRACKER_MAX_OCCUPANTS + 1];   // Sums to TRACKER_PROBABILITY_ONE
+    uint8_t mode_;
+    uint32_t quietSinceMs_;
+};
+
+// Copy the tracker's estimate into the room and account the occupied time.
+// Returns the length of the occupied session that just ended, or 0.
+uint32_t roomApplyEstimate(RoomState& room, const OccupancyTracker& tracker, uint32_t nowMs);
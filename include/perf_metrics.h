@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Runtime telemetry for /api/metrics in the Prometheus text format.
+//
+// Hot paths are timed with the CPU cycle counter (METRIC_SCOPE) into
+// fixed-bucket latency histograms; events and errors go into counters, and
+// gauges hold values sampled when the metrics are scraped. Every metric
+// object links itself into one list when it is constructed, so defining it
+// as a global is all it takes to export it. Metrics are never unlinked:
+// only define them as globals or function statics.
+//
+// A histogram has one writer (the task that owns the timed path) and is read
+// by the web task; a sequence number around each update lets the reader
+// take a consistent copy without a lock.
+//
+// Build with -DPERF_METRICS=0 to compile the METRIC_* macros to nothing;
+// main.cpp then leaves out the metric objects and /api/metrics.
+
+#ifndef PERF_METRICS
+#define PERF_METRICS 1
+#endif
+
+// Histogram bucket upper bounds in microseconds, from a sensor frame's work
+// up to a slow HTTPS request; one more bucket (+Inf) catches the rest
+#define METRIC_BUCKET_COUNT 14
+extern const uint32_t METRIC_BUCKET_US[METRIC_BUCKET_COUNT];
+
+// One metric family as text, HELP and TYPE lines included
+#define METRIC_TEXT_MAX 1536
+
+// Free-running CPU cycle counter and its rate, from the platform
+// (hal_esp32.cpp, sim_hal.cpp and the bench entry points). The ESP32's
+// 32-bit counter wraps after ~18s at 240MHz, so longer spans are not timed.
+uint32_t perfCycles();
+uint32_t perfCyclesPerUs();
+
+enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+class Metric {
+public:
+    // name and help must be string literals (or otherwise outlive the metric)
+    Metric(const char* name, const char* help, MetricType type);
+    virtual ~Metric() {}
+
+    static const Metric* first();
+    const Metric* next() const { return next_; }
+    const char* name() const { return name_; }
+
+    // HELP, TYPE and the sample lines; returns the length, 0 if it did not fit
+    size_t format(char* out, size_t size) const;
+
+protected:
+    virtual size_t formatSamples(char* out, size_t size) const = 0;
+
+private:
+    const char* name_;
+    const char* help_;
+    MetricType type_;
+    const Metric* next_;
+};
+
+class MetricCounter : public Metric {
+public:
+    MetricCounter(const char* name, const char* help) : Metric(name, help, METRIC_COUNTER) {}
+
+    void add(uint32_t count = 1) { value_.fetch_add(count, std::memory_order_relaxed); }
+    // Mirror a total that is counted elsewhere (e.g. WebhookStats)
+    void set(uint32_t value) { value_.store(value, std::memory_order_relaxed); }
+    uint32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+protected:
+    size_t formatSamples(char* out, size_t size) const override;
+
+private:
+    std::atomic<uint32_t> value_{0};
+};
+
+class MetricGauge : public Metric {
+public:
+    MetricGauge(const char* name, const char* help) : Metric(name, help, METRIC_GAUGE) {}
+
+    void set(int32_t value) { value_.store(value, std::memory_order_relaxed); }
+    int32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+protected:
+    size_t formatSamples(char* out, size_t size) const override;
+
+private:
+    std::atomic<int32_t> value_{0};
+};
+
+struct HistogramCounts {
+    uint32_t buckets[METRIC_BUCKET_COUNT + 1];  // Not cumulative; the last is +Inf
+    uint32_t count;
+    uint64_t sumNs;     // Nanoseconds, so sub-microsecond paths still add up
+};
+
+// Latency, exported in seconds as Prometheus expects
+class LatencyHistogram : public Metric {
+public:
+    LatencyHistogram(const char* name, const char* help);
+
+    // Only from the task that owns the timed path
+    void observeCycles(uint32_t cycles);
+    void observeUs(uint32_t us) { record(us, 0); }
+
+    // Consistent copy, from any task
+    HistogramCounts counts() const;
+
+protected:
+    size_t formatSamples(char* out, size_t size) const override;
+
+private:
+    void record(uint32_t us, uint32_t extraNs);
+
+    HistogramCounts counts_;
+    std::atomic<uint32_t> sequence_{0};
+};
+
+// Times the enclosing scope into a histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(LatencyHistogram& histogram) : histogram_(histogram), start_(perfCycles()) {}
+    ~ScopedTimer() { histogram_.observeCycles(perfCycles() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    LatencyHistogram& histogram_;
+    uint32_t start_;
+};
+
+#define METRIC_CONCAT_(a, b) a##b
+#define METRIC_CONCAT(a, b) METRIC_CONCAT_(a, b)
+
+#if PERF_METRICS
+#define METRIC_SCOPE(histogram) ScopedTimer METRIC_CONCAT(metricTimer, __LINE__)(histogram)
+#define METRIC_OBSERVE_US(histogram, us) (histogram).observeUs(us)
+#define METRIC_ADD(counter, count) (counter).add(count)
+#define METRIC_SET(metric, value) (metric).set(value)
+#else
+// The value is still evaluated, for calls like METRIC_ADD(c, present(rows))
+#define METRIC_SCOPE(histogram) do {} while (0)
+#define METRIC_OBSERVE_US(histogram, us) ((void)(us))
+#define METRIC_ADD(counter, count) ((void)(count))
+#define METRIC_SET(metric, value) ((void)(value))
+#endif
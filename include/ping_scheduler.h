@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed time grid for HC-SR04 pings.
+//
+// A slot is the echo window for the longest useful distance (maxRangeCm)
+// plus a guard window in which nothing is triggered, so late or multipath
+// echoes from one sensor die out before the next one listens. Slots start on
+// the grid (previous start + slot length), not "whenever the last echo came
+// back", so the ping rate does not depend on what the sensors see:
+//
+//   samples per second = sensors pinged per slot * 1000000 / slot length
+//
+// The grid runs at the active slot length while someone is near a doorway
+// and at idleSlotUs once nobody has been near for activeHoldMs. A near
+// reading during an idle slot pulls the next slot in to the fast grid.
+
+struct PingScheduleConfig {
+    int maxRangeCm;             // Echoes from further away are not waited for
+    uint32_t guardUs;           // Quiet time after each echo window
+    uint32_t idleSlotUs;        // Slot length while idle (0 or shorter than active: never slow down)
+    int wakeDistanceCm;         // A reading closer than this switches to the fast grid
+    uint32_t activeHoldMs;      // Stay fast this long after the last near reading
+};
+
+struct PingScheduleStats {
+    uint32_t slots;             // Slots started since begin()
+    uint32_t skippedPings;      // Triggers a sensor refused (still busy)
+    uint32_t lateSlots;         // Slots that started more than a slot behind the grid
+    uint32_t wakeups;           // Idle -> active switches
+    uint32_t slotUs;            // Current slot length
+    bool active;
+};
+
+class PingScheduler {
+public:
+    explicit PingScheduler(const PingScheduleConfig& config);
+
+    // Start on the fast grid, with the first slot due immediately
+    void begin(uint32_t nowUs);
+
+    // True when a slot starts now; advances the grid. Call every frame once
+    // the previous slot's echoes are all in.
+    bool due(uint32_t nowUs);
+
+    // Speed of sound from range_conversion.h; the echo window follows it so
+    // maxRangeCm stays covered whatever the air temperature
+    void setRangeFactor(uint32_t factorQ18);
+
+    // Someone is near (a close reading or a half-finished crossing)
+    void wake(uint32_t nowUs);
+
+    // Time until the next slot starts, 0 if it is due
+    uint32_t untilDueUs(uint32_t nowUs) const;
+
+    void pingSkipped() { skippedPings_++; }
+
+    // Longest echo pulse worth waiting for
+    uint32_t maxEchoWidthUs() const { return maxEchoWidthUs_; }
+    uint32_t activeSlotUs() const { return activeSlotUs_; }
+    uint32_t idleSlotUs() const { return idleSlotUs_; }
+    uint32_t slotUs() const { return active_ ? activeSlotUs_ : idleSlotUs_; }
+    bool active() const { return active_; }
+
+    // Readings per second at the current rate with pingsPerSlot sensors
+    // triggered in each slot
+    uint32_t samplesPerSecond(uint8_t pingsPerSlot) const;
+
+    PingScheduleStats stats() const;
+
+private:
+    int maxRangeCm_;
+    uint32_t guardUs_;
+    uint32_t configuredIdleUs_;
+    uint32_t maxEchoWidthUs_;
+    uint32_t activeSlotUs_;
+    uint32_t idleSlotUs_;
+    uint32_t holdUs_;
+    bool active_;
+    uint32_t nextSlotUs_;
+    uint32_t slotStartUs_;      // Start of the current slot
+    uint32_t lastNearUs_;
+    uint32_t slots_;
+    uint32_t skippedPings_;
+    uint32_t lateSlots_;
+    uint32_t wakeups_;
+};
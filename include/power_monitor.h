@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Frame pacing for low-power mode and an estimate of what the board draws.
+//
+// With low power on, the sensor task no longer wakes every frame while the
+// doorways are quiet: it sleeps until the ping grid's next slot (capped at
+// maxSleepUs), so between idle pings nothing runs and the platform can light
+// sleep. Someone near a sensor, a half-finished passage or an echo still on
+// its way puts it back on the short frame at once.
+//
+// There is no current sensor, so the draw is modelled: every task reports
+// how long it ran (addWake) and how long it kept the radio busy, and each
+// POWER_WINDOW_US the monitor turns that into a CPU duty cycle and an
+// average current from the per-state figures in PowerConfig.
+
+#define POWER_WINDOW_US 10000000UL
+
+struct PowerConfig {
+    bool lowPower;              // Sleep between idle frames
+    uint32_t activeFrameUs;     // Sensor frame while anything is happening
+    uint32_t maxSleepUs;        // Longest idle frame; bounds the reaction to a wake request
+    uint32_t wakeUs;            // CPU time a wake-up costs on top of the work (sleep exit, scheduler)
+    uint16_t awakeMa;           // CPU running, radio asleep
+    uint16_t idleMa;            // CPU idle but clocked (no light sleep)
+    uint16_t sleepMa;           // Light sleep
+    uint16_t radioMa;           // Added while the radio receives or transmits
+    uint32_t beaconListenUs;    // Radio on per beacon listened to
+    uint32_t listenIntervalUs;  // Between beacons listened to; 0 = radio never sleeps
+};
+
+// One finished window
+struct PowerStats {
+    uint32_t frameUs;           // Sensor frame length at the end of the window
+    uint16_t cpuDutyPermille;   // CPU awake
+    uint16_t radioDutyPermille; // Radio receiving or transmitting
+    uint16_t wakeupsPerSecond;
+    uint16_t estimatedDeciMa;   // Average supply current, tenths of a mA
+    bool lightSleep;            // The platform sleeps while no task runs
+};
+
+class PowerMonitor {
+public:
+    explicit PowerMonitor(const PowerConfig& config);
+
+    // Whether the platform accepted automatic light sleep (otherwise the
+    // idle CPU is costed at idleMa)
+    void setLightSleep(bool enabled) { lightSleep_ = enabled; }
+    bool lightSleep() const { return lightSleep_; }
+    const PowerConfig& config() const { return config_; }
+
+    // Sensor task: length of the next frame when the engine has nothing to
+    // do for idleUs (0 = busy)
+    uint32_t nextFrameUs(uint32_t idleUs);
+
+    // Any task, after each pass: how long it ran and kept the radio busy
+    void addWake(uint32_t busyUs) {
+        busyUs_.fetch_add(busyUs, std::memory_order_relaxed);
+        wakes_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void addRadioUs(uint32_t us) { radioUs_.fetch_add(us, std::memory_order_relaxed); }
+
+    // Sensor task, once per frame; true when a window finished and stats()
+    // changed
+    bool update(uint32_t nowUs);
+    const PowerStats& stats() const { return stats_; }
+
+private:
+    PowerConfig config_;
+    bool lightSleep_;
+    bool started_;
+    uint32_t windowStartUs_;
+    uint32_t frameUs_;
+    std::atomic<uint32_t> busyUs_{0};
+    std::atomic<uint32_t> radioUs_{0};
+    std::atomic<uint32_t> wakes_{0};
+    PowerStats stats_;
+};
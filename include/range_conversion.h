@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// Echo pulse width <-> distance in integer arithmetic, compensated for air
+// temperature.
+//
+// Sound travels at 331.3 * sqrt(1 + T / 273.15) m/s, about 0.6 m/s more per
+// degree, so a fixed 340 m/s misreads a 2 m doorway by a few centimetres
+// between winter and summer. A table built at compile time holds the
+// round-trip millimetres per microsecond of echo, in Q18, for every whole
+// degree from RANGE_MIN_CELSIUS to RANGE_MAX_CELSIUS; rangeFactorQ18()
+// interpolates it to a tenth of a degree when the temperature changes, and a
+// reading is then one multiply and one shift.
+
+#define RANGE_MIN_CELSIUS -20
+#define RANGE_MAX_CELSIUS 60
+
+// Assumed until a temperature source reports (tenths of a degree Celsius)
+#define RANGE_DEFAULT_DECI_CELSIUS 200
+
+// Longest pulse converted; an HC-SR04 with no target holds ECHO ~38ms, and
+// the cap keeps widthUs * factor inside 32 bits
+#define RANGE_MAX_WIDTH_US 65535UL
+
+// Round-trip millimetres per microsecond of echo at deciCelsius, in Q18
+// (Q16 would be up to 0.2 mm off over a 4 m echo).
+// Temperatures outside the table use its nearest end.
+uint32_t rangeFactorQ18(int16_t deciCelsius);
+
+inline uint32_t echoWidthToMm(uint32_t widthUs, uint32_t factorQ18) {
+    if (widthUs > RANGE_MAX_WIDTH_US) {
+        widthUs = RANGE_MAX_WIDTH_US;
+    }
+    return (widthUs * factorQ18 + 0x20000) >> 18;
+}
+
+// Nearest whole centimetre
+inline int echoWidthToCm(uint32_t widthUs, uint32_t factorQ18) {
+    return static_cast<int>((echoWidthToMm(widthUs, factorQ18) + 5) / 10);
+}
+
+// Echo pulse width for a target distanceCm away, the inverse of
+// echoWidthToCm(). Not for the per-sample path (it divides).
+uint32_t echoWidthForCm(int distanceCm, uint32_t factorQ18);
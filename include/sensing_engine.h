@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "baseline_calibration.h"
+#include "energy_analytics.h"
+#include "hal.h"
+#include "occupancy.h"
+#include "ping_scheduler.h"
+#include "range_conversion.h"
+#include "sensor_trace.h"
+#include "session_log.h"
+#include "signal_filter.h"
+#include "spsc_ring.h"
+#include "status_snapshot.h"
+
+#define DAY_MS 86400000UL
+
+// Analytics day before the wall clock has been seen
+#define SENSING_NO_DAY INT32_MIN
+
+// Echo channels the engine can address (two sensors per doorway)
+#define SENSING_MAX_CHANNELS (MAX_DOORWAYS * 2)
+
+// Finished sessions waiting for nextSession(); more are dropped and counted
+#define SENSING_SESSION_QUEUE 16
+
+// One row of the doorway table the firmware passes in at startup
+struct DoorwaySetup {
+    uint8_t entranceChannel;    // Outside sensor
+    uint8_t insideChannel;
+    uint8_t room;               // Room the doorway opens into (< roomCount)
+    uint8_t phase;              // 0 or 1; give neighbouring doorways different phases
+};
+
+struct SensingConfig {
+    const DoorwaySetup* doorways;   // Must outlive the engine
+    uint8_t doorwayCount;       // 1..MAX_DOORWAYS
+    uint8_t roomCount;          // 1..MAX_ROOMS
+    PingScheduleConfig ping;    // Ping grid; each sensor pings every second slot
+    int noEchoDistanceCm;       // Distance reported for a ping with no echo
+    DoorwayConfig doorway;      // Detection tuning shared by all doorways
+    SignalFilterConfig filter;  // Conditioning of every sensor's readings
+    BaselineConfig baseline;    // Learned per-sensor thresholds (doorway.thresholdCm until calibrated)
+    TrackerConfig tracker;      // Quiet-period decay of the occupant counts
+    float lightPowerWatts;      // Per room
+    int32_t utcOffsetMinutes;   // Local time zone for the day/week/month/year rollover
+};
+
+// The sensing pipeline for up to MAX_DOORWAYS doorways into up to MAX_ROOMS
+// rooms: schedules pings, drains finished echoes, decodes each doorway's
+// passages and keeps per-room occupancy and energy totals.
+// Per-doorway and per-room state live in fixed arrays indexed by position in
+// the table, so a frame walks a few cache lines regardless of the count.
+//
+// Pings go out in two alternating slots on the PingScheduler grid. In each
+// slot every doorway fires one of its sensors, the entrance sensor when
+// (slot ^ phase) is 0, and the next slot only starts once all of them have
+// their echo or hit the range cap. Each sensor therefore pings every second
+// slot however many doorways there are, two doorways in different phases
+// never have their hallway sensors listening at the same time, and the guard
+// window keeps one slot's stray echoes out of the next. Readings closer than
+// ping.wakeDistanceCm, or someone in a doorway, keep the grid fast.
+//
+// Echo widths become distances with the integer, temperature-compensated
+// conversion in range_conversion.h, at RANGE_DEFAULT_DECI_CELSIUS until the
+// firmware reports the air temperature.
+//
+// Each reading goes through its sensor's SignalFilter before the passage
+// decoder sees it (occupancy.h), and every room's occupant count is an
+// OccupancyTracker estimate with a confidence; the trace keeps the raw readings so a replay can try other
+// filter settings. With config.baseline enabled every sensor learns its own
+// threshold from the empty doorway (baseline_calibration.h); a doorway whose
+// sensors are still learning does not count crossings.
+//
+// The firmware calls step() once per sensor frame; the host build drives the
+// same code from a simulated clock.
+class SensingEngine {
+public:
+    SensingEngine(Clock& clock, EchoSource& echoes, const SensingConfig& config);
+
+    void begin();
+
+    // Record every reading and crossing of one doorway into trace (NULL to
+    // stop). The trace format covers a single sensor pair.
+    void setTrace(TraceRecorder* trace, uint8_t doorway = 0) {
+        trace_ = trace;
+        traceDoorway_ = doorway;
+    }
+
+    // Run one frame. Returns the direction of the passage completed in this
+    // frame, if any (the last one when several doorways completed one).
+    CrossingEvent step();
+
+    // How long step() has nothing to do: 0 while the grid is fast or an
+    // echo is outstanding, otherwise the time until the next idle slot.
+    // Low-power mode sleeps this long between frames.
+    uint32_t idleUs();
+
+    // Switch to the fast grid now, e.g. on a presence sensor's wake pin
+    void wake() { scheduler_.wake(clock_.micros()); }
+
+    void fillSnapshot(StatusSnapshot& out) const;
+
+    // Carry the aggregate totals over from persistent storage after a
+    // reboot; the per-room counters start again from zero. day is the local
+    // day they were recorded on (SENSING_NO_DAY if unknown), so a reboot
+    // across midnight still rolls them over.
+    void restoreTotals(const EnergyAnalytics& energy, uint32_t totalOccupiedMs, uint32_t dailyOccupiedMs,
+                       int32_t day);
+
+    uint8_t roomCount() const { return roomCount_; }
+    uint8_t doorwayCount() const { return doorwayCount_; }
+    const RoomState& room(uint8_t index) const { return rooms_[index]; }
+    const PassageStats& passages(uint8_t doorway) const { return doorways_[doorway].passage.stats(); }
+    const EnergyAnalytics& energy(uint8_t room) const { return energy_[room]; }
+    // Smoothed reading; side 0 is the entrance sensor, 1 the inside one
+    int distance(uint8_t doorway, uint8_t side) const { return doorways_[doorway].distanceCm[side]; }
+    uint32_t detectionLatencyUs() const { return detectionLatencyUs_; }
+    // Pings that came back without an echo (nothing in range)
+    uint32_t echoTimeouts() const { return echoTimeouts_; }
+
+    // Fallback threshold and passage timeout; sensors still learning switch
+    // to the new threshold at once, learned ones keep theirs
+    void setDoorwayConfig(const DoorwayConfig& doorway);
+    const DoorwayConfig& doorwayConfig() const { return config_.doorway; }
+    // Applies to the sessions that end from now on
+    void setLightPowerWatts(float watts) { config_.lightPowerWatts = watts; }
+
+    // Takes effect from the next reading; the filters keep their history
+    void setFilter(const SignalFilterConfig& filter) { config_.filter = sanitizeSignalFilter(filter); }
+    const SignalFilterConfig& filter() const { return config_.filter; }
+
+    // Air temperature for the echo-width conversion, in tenths of a degree.
+    // Also moves the ping scheduler's echo window.
+    void setTemperature(int16_t deciCelsius);
+    int16_t temperature() const { return temperatureDeciC_; }
+
+    // Learned baselines, indexed by doorway * 2 + side. Restore before
+    // begin(); a reset makes every sensor learn again from scratch.
+    void exportCalibration(CalibrationSet& out) const;
+    void restoreCalibration(const CalibrationSet& set);
+    void resetCalibration();
+    // Bumped when a sensor finishes learning or starts over
+    uint32_t calibrationChanges() const { return calibrationChanges_; }
+    int threshold(uint8_t doorway, uint8_t side) const { return doorways_[doorway].thresholdCm[side]; }
+    const PingScheduler& pings() const { return scheduler_; }
+
+    // Next finished occupancy session, oldest first. Called from one task,
+    // which may be another than the one running step().
+    bool nextSession(SessionRecord& out) { return sessions_.pop(out); }
+    uint32_t droppedSessions() const { return droppedSessions_; }
+
+private:
+    struct Doorway {
+        PassageDecoder passage;
+        SignalFilter filter[2];
+        BaselineEstimator baseline[2];
+        int16_t distanceCm[2];      // Entrance, inside; smoothed, for display
+        int16_t thresholdCm[2];     // Learned, or the configured one
+        uint8_t channel[2];
+        uint8_t room;
+        uint8_t phase;
+        bool updated;               // A reading changed this frame
+    };
+
+    void schedulePing();
+    void applyEchoSample(const EchoSample& sample, uint32_t nowMs);
+    void learnBaseline(Doorway& doorway, uint8_t index, int distance);
+    void applyPassage(uint8_t index, const Passage& passage, uint32_t nowMs);
+    void applyEstimate(uint8_t room, uint32_t nowMs);
+    bool calibrating(const Doorway& doorway) const;
+    void checkPeriodRollover(uint32_t nowMs);
+    void resetDailyOccupied();
+
+    Clock& clock_;
+    EchoSource& echoes_;
+    SensingConfig config_;
+    TraceRecorder* trace_;
+    uint8_t traceDoorway_;
+
+    uint8_t doorwayCount_;
+    uint8_t roomCount_;
+    uint8_t slot_;
+    PingScheduler scheduler_;
+    uint32_t lastEchoUs_;
+    uint32_t rangeFactorQ18_;
+    int16_t temperatureDeciC_;
+    uint32_t detectionLatencyUs_;
+    uint32_t echoTimeouts_;
+    uint32_t calibrationChanges_;
+    uint32_t lastDayResetMs_;
+    int32_t analyticsDay_;      // Local day the totals belong to
+
+    // Echo channel -> doorway * 2 + side, or -1
+    int8_t channelMap_[SENSING_MAX_CHANNELS];
+    Doorway doorways_[MAX_DOORWAYS];
+    RoomState rooms_[MAX_ROOMS];
+    OccupancyTracker trackers_[MAX_ROOMS];
+    EnergyAnalytics energy_[MAX_ROOMS];
+    // Running session of each occupied room
+    uint8_t sessionPeak_[MAX_ROOMS];
+    uint8_t sessionConfidence_[MAX_ROOMS];
+    SpscRing<SessionRecord, SENSING_SESSION_QUEUE> sessions_;
+    uint32_t droppedSessions_;
+
+    // Totals restored from storage, which are not split by room
+    EnergyAnalytics carriedEnergy_;
+    uint32_t carriedTotalMs_;
+    uint32_t carriedDailyMs_;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+#include "occupancy.h"
+#include "signal_filter.h"
+
+// Compact binary trace of what the doorway sensors saw.
+//
+// Every raw distance reading is recorded with its frame time, before the
+// signal filter, plus the crossings the device decided on, so a miscount can
+// be replayed offline (src/native, --replay) with exactly the same input and
+// any filter settings.
+//
+// Trace file: "LST1" followed by blocks. Each block is self-contained so the
+// RAM ring can drop its oldest block and a reader can start anywhere:
+//
+//   uint32 sequence   (little-endian; a jump means blocks were lost)
+//   uint32 startMs    time of the first record
+//   int16  distance1  readings before the first record
+//   int16  distance2
+//   uint16 length     record bytes that follow
+//
+// Each record is two varints: (deltaMs << 2 | kind), then a zigzag value.
+// kind 0/1 is a reading from sensor 1/2 and the value is the change in cm
+// since that sensor's previous reading; kind 2 is a crossing the device
+// detected (value = CrossingEvent). A steady 20ms ping with an unchanged
+// distance costs two bytes.
+
+#define TRACE_MAGIC "LST1"
+#define TRACE_MAGIC_SIZE 4
+#define TRACE_BLOCK_HEADER_SIZE 14
+#define TRACE_BLOCK_DATA 512
+#define TRACE_BLOCK_MAX (TRACE_BLOCK_HEADER_SIZE + TRACE_BLOCK_DATA)
+
+// RAM ring size; 32 blocks hold a few minutes of pings
+#ifndef TRACE_BLOCK_COUNT
+#define TRACE_BLOCK_COUNT 32
+#endif
+
+enum TraceRecordKind : uint8_t {
+    TRACE_SENSOR1 = 0,
+    TRACE_SENSOR2 = 1,
+    TRACE_CROSSING = 2,
+};
+
+// Records from the sensor task, read from the web task; all methods lock.
+class TraceRecorder {
+public:
+    TraceRecorder();
+
+    // sensor is 0 (entrance) or 1 (inside)
+    void recordReading(uint8_t sensor, int distanceCm, uint32_t nowMs);
+    void recordCrossing(CrossingEvent event, uint32_t nowMs);
+
+    // Blocks are numbered from 0. [oldestSequence(), nextSequence()) are held
+    // in RAM; the last of those is still being written.
+    uint32_t oldestSequence();
+    uint32_t nextSequence();
+
+    // Serialise one block (header + records) into out (TRACE_BLOCK_MAX
+    // bytes). Returns its size, or 0 if the block was already overwritten.
+    size_t copyBlock(uint32_t sequence, uint8_t* out);
+
+private:
+    struct Block {
+        uint32_t sequence;
+        uint32_t startMs;
+        int16_t distance[2];
+        uint16_t length;
+        uint8_t data[TRACE_BLOCK_DATA];
+    };
+
+    void append(uint8_t kind, int32_t value, uint32_t nowMs);
+    bool encode(Block& block, uint8_t kind, int32_t value, uint32_t nowMs);
+    void openBlock(uint32_t nowMs);
+
+    std::mutex lock_;
+    Block blocks_[TRACE_BLOCK_COUNT];
+    uint32_t nextSequence_;
+    uint32_t lastMs_;
+    int16_t lastDistance_[2];
+};
+
+// One decoded record
+struct TraceRecord {
+    uint8_t kind;      // TraceRecordKind
+    uint32_t atMs;
+    int value;         // Distance in cm for readings, CrossingEvent for crossings
+};
+
+// Walks a serialised trace (a download or a flash file) record by record.
+class TraceReader {
+public:
+    TraceReader(const uint8_t* data, size_t length);
+
+    // False once the trace ends or turns out to be malformed
+    bool next(TraceRecord& out);
+
+    bool valid() const { return valid_; }       // Header present and records well-formed
+    uint32_t gaps() const { return gaps_; }     // Sequence jumps (lost blocks)
+    // True if the block just entered does not follow the previous one
+    bool gapBefore() const { return gapBefore_; }
+    // Both sensors' readings as of the last record returned
+    int distance(uint8_t sensor) const { return distance_[sensor & 1]; }
+
+private:
+    bool readBlockHeader();
+    bool readVarint(uint32_t& value);
+
+    const uint8_t* data_;
+    size_t length_;
+    size_t pos_;
+    size_t blockEnd_;
+    bool valid_;
+    bool started_;
+    bool gapBefore_;
+    uint32_t sequence_;
+    uint32_t gaps_;
+    uint32_t nowMs_;
+    int distance_[2];
+};
+
+// Counts from running a trace through PassageDecoder/OccupancyTracker
+struct ReplayResult {
+    uint32_t readings;
+    uint32_t entries;        // People the replayed decoder saw go in
+    uint32_t exits;
+    int finalCount;          // Most likely occupant count at the end
+    uint8_t finalConfidence; // ...and its probability, percent
+    uint32_t turnedBack;     // Passages that cancelled out
+    uint32_t tandem;
+    uint32_t slow;
+    uint32_t guessed;
+    uint32_t deviceEntries;  // Crossings recorded by the device
+    uint32_t deviceExits;
+    uint32_t gaps;
+    bool valid;
+};
+
+// Called for every person the replay sees cross, with the room's most
+// likely occupant count after the passage
+typedef void (*ReplayCallback)(CrossingEvent event, uint32_t atMs, int occupants, void* context);
+
+// Feed a trace through the signal filters, passage decoder and occupancy
+// tracker with the given settings (no quiet-period decay). Readings that share a frame time are applied together, as
+// the sensing engine does, and everything is reset across lost blocks.
+ReplayResult replayTrace(const uint8_t* data, size_t length, const DoorwayConfig& config,
+                         const SignalFilterConfig& filter, ReplayCallback callback, void* context);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Occupancy sessions (a room going from empty to occupied and back) and
+// what they add up to, for /api/sessions.
+//
+// The sensing engine hands each finished session over as a SessionRecord;
+// SessionLog keeps the last SESSION_LOG_CAPACITY of them in a ring of
+// 16-byte records and folds every one into running statistics as it
+// arrives:
+//  - a dwell-time histogram with fixed, human-sized bounds
+//  - a log-linear sketch of session lengths (8 buckets per doubling, so a
+//    quantile is within about 6% of the exact one) for p50/p90
+//  - occupied seconds and session starts per local hour of day, for the
+//    busiest hours
+// Adding a session is O(1) (plus at most a day's worth of hour slots) and
+// every query walks at most the sketch's buckets, so nothing grows with
+// uptime. Sessions older than the ring still count in the statistics.
+
+#define SESSION_LOG_CAPACITY 256    // 4 KB of records
+#define SESSION_DWELL_BUCKETS 9     // The last one has no upper bound
+#define SESSION_SKETCH_SUB_BITS 3
+#define SESSION_SKETCH_BUCKETS 128  // Exact below 8 s, then up to 2^18 s (3 days); longer clamps
+#define SESSION_BUSIEST_HOURS 3
+
+// Largest formatted summary and record
+#define SESSION_SUMMARY_MAX 1024
+#define SESSION_RECORD_MAX 80
+
+struct SessionRecord {
+    uint32_t enteredSeconds;    // Unix seconds; 0 when the clock was not set at the exit
+    uint32_t leftSeconds;
+    uint32_t durationMs;
+    uint8_t room;
+    uint8_t peakOccupants;
+    uint8_t confidence;         // Lowest occupant-count confidence during the session, percent
+    uint8_t reserved;
+};
+
+class SessionLog {
+public:
+    // Hours of day are local, utcOffsetMinutes east of UTC
+    explicit SessionLog(int32_t utcOffsetMinutes);
+
+    void add(const SessionRecord& session);
+
+    // Sessions ever added, and how many of the newest the ring still holds
+    uint32_t total() const { return total_; }
+    size_t held() const { return total_ < SESSION_LOG_CAPACITY ? total_ : SESSION_LOG_CAPACITY; }
+    // 0 is the newest; index < held()
+    const SessionRecord& recent(size_t index) const;
+
+    // Upper bound of a dwell bucket in seconds (exclusive), 0 for the last
+    static uint32_t dwellBoundSeconds(uint8_t bucket);
+    uint32_t dwellCount(uint8_t bucket) const { return dwell_[bucket]; }
+
+    // Session length at the given percentile (1..100), 0 without sessions
+    uint32_t quantileSeconds(uint8_t percent) const;
+
+    uint32_t hourOccupiedSeconds(uint8_t hour) const { return hourSeconds_[hour]; }
+    uint32_t hourSessions(uint8_t hour) const { return hourStarts_[hour]; }
+    // Local hours with the most occupied time, busiest first; returns how
+    // many had any (at most max)
+    size_t busiestHours(uint8_t* out, size_t max) const;
+
+private:
+    void addHours(const SessionRecord& session);
+
+    int32_t utcOffsetSeconds_;
+    uint32_t total_;
+    SessionRecord ring_[SESSION_LOG_CAPACITY];
+    uint32_t dwell_[SESSION_DWELL_BUCKETS];
+    uint32_t sketch_[SESSION_SKETCH_BUCKETS];
+    uint32_t hourSeconds_[24];
+    uint32_t hourStarts_[24];
+};
+
+// JSON pieces of a /api/sessions response: the summary opens the "recent"
+// array, records are [room, entered, left, seconds, peak, confidence],
+// newest first, and the footer closes it. Each returns the length written,
+// 0 if it did not fit.
+size_t formatSessionSummary(const SessionLog& log, char* out, size_t size);
+size_t formatSessionRecord(const SessionRecord& session, bool first, char* out, size_t size);
+size_t formatSessionFooter(char* out, size_t size);
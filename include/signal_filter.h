@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+// Per-sensor conditioning between echo capture and the entry/exit state
+// machine, in three optional stages:
+//
+//   median      median of the last medianTaps readings, so a single
+//               multipath or cross-talk reading never reaches the FSM
+//   hysteresis  "someone there" starts below the threshold but only ends
+//               at threshold + hysteresisCm, so a reading hovering around
+//               the threshold does not flicker
+//   debounce    the presence decision changes only after debounceSamples
+//               readings in a row agree
+//
+// Integer only, in a fixed ring of the last SIGNAL_FILTER_MAX_TAPS readings,
+// so one update is a bounded handful of compares whatever the settings. The
+// median of 3 with debounce 1 (the defaults) delays a clean edge by one
+// reading and nothing else.
+
+#define SIGNAL_FILTER_MAX_TAPS 7
+
+struct SignalFilterConfig {
+    bool enabled;               // False passes readings straight through
+    uint8_t medianTaps;         // 1 (off), 3, 5 or 7
+    uint8_t hysteresisCm;       // 0 for a plain threshold
+    uint8_t debounceSamples;    // Readings in a row needed to change state (1 = off)
+};
+
+// Clamp settings to what the filter supports (odd taps, 1..MAX_TAPS, ...)
+SignalFilterConfig sanitizeSignalFilter(const SignalFilterConfig& config);
+
+class SignalFilter {
+public:
+    SignalFilter();
+
+    void reset();
+
+    // Feed one raw reading. Returns the distance the state machine should
+    // see: the smoothed reading, pulled to just below or at thresholdCm
+    // when hysteresis or debounce hold the presence decision.
+    int update(int rawCm, int thresholdCm, const SignalFilterConfig& config);
+
+    // Median of the recent readings, for display
+    int smoothed() const { return smoothed_; }
+    bool present() const { return present_; }
+
+private:
+    int16_t ring_[SIGNAL_FILTER_MAX_TAPS];
+    uint8_t head_;
+    uint8_t count_;
+    uint8_t pending_;           // Readings in a row that disagree with present_
+    bool present_;
+    int16_t smoothed_;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "status_snapshot.h"
+
+#define DISPLAY_COLS 16
+#define DISPLAY_ROWS 2
+
+// Render the two LCD rows ("D1:42 D2:180", "Occupied (2)"), each padded with
+// spaces to the full width so stale characters are overwritten.
+void formatStatusRows(const StatusSnapshot& status, char rows[DISPLAY_ROWS][DISPLAY_COLS + 1]);
+
+// Two lines of fixed text, cut or padded the same way (setup messages)
+void formatTextRows(const char* top, const char* bottom, char rows[DISPLAY_ROWS][DISPLAY_COLS + 1]);
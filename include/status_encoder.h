@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "status_snapshot.h"
+
+// Fixed-layout /api/status encoder.
+//
+// Writes JSON or CBOR straight into a caller-supplied buffer without touching
+// the heap (no ArduinoJson document, no String, no printf float formatting,
+// which allocates in newlib). A field mask selects which keys are emitted so
+// clients can ask for just the values they render.
+
+enum StatusField : uint32_t {
+    STATUS_OCCUPIED             = 1UL << 0,
+    STATUS_OCCUPANT_COUNT       = 1UL << 1,
+    STATUS_ENERGY_TODAY         = 1UL << 2,
+    STATUS_ENERGY_WEEK          = 1UL << 3,
+    STATUS_ENERGY_MONTH         = 1UL << 4,
+    STATUS_ENERGY_YEAR          = 1UL << 5,
+    STATUS_DAILY_OCCUPIED_TIME  = 1UL << 6,
+    STATUS_TOTAL_OCCUPIED_TIME  = 1UL << 7,
+    STATUS_UPTIME               = 1UL << 8,
+    STATUS_DISTANCE1            = 1UL << 9,
+    STATUS_DISTANCE2            = 1UL << 10,
+    STATUS_DETECTION_LATENCY    = 1UL << 11,
+    STATUS_SENSOR_OVERRUNS      = 1UL << 12,
+    STATUS_HEAP_FREE            = 1UL << 13,
+    STATUS_HEAP_MIN_FREE        = 1UL << 14,
+    STATUS_HEAP_DELTA           = 1UL << 15,
+    STATUS_SAMPLE_RATE          = 1UL << 16,
+    STATUS_SKIPPED_PINGS        = 1UL << 17,
+    STATUS_CONFIDENCE           = 1UL << 18,
+};
+
+#define STATUS_FIELD_COUNT 19
+#define STATUS_ALL_FIELDS ((1UL << STATUS_FIELD_COUNT) - 1)
+#define STATUS_ENERGY_FIELDS (STATUS_ENERGY_TODAY | STATUS_ENERGY_WEEK | STATUS_ENERGY_MONTH | STATUS_ENERGY_YEAR)
+#define STATUS_DISTANCE_FIELDS (STATUS_DISTANCE1 | STATUS_DISTANCE2)
+
+// Worst case for all fields in JSON; CBOR is always smaller.
+#define STATUS_ENCODED_MAX 576
+
+// Snapshot plus the values that belong to the request rather than the
+// sensing task.
+struct StatusReport {
+    StatusSnapshot status;
+    uint32_t uptimeMs;
+    uint32_t heapFree;
+    uint32_t heapMinFree;   // Low watermark since boot
+    int32_t heapDelta;      // Free-heap change across the previous status request
+};
+
+// Parse a comma-separated ?fields= list ("occupied,distance1"). Unknown names
+// are ignored. Returns STATUS_ALL_FIELDS for a NULL or empty list.
+uint32_t parseStatusFields(const char* list);
+
+// Both return the number of bytes written, or 0 if the buffer is too small.
+size_t encodeStatusJson(const StatusReport& report, uint32_t fields, char* out, size_t size);
+size_t encodeStatusCbor(const StatusReport& report, uint32_t fields, uint8_t* out, size_t size);
+
+// Worst case for one room and its doorways in JSON, and for all of them
+#define ROOM_ENCODED_MAX 512
+#define ROOMS_ENCODED_MAX (ROOM_ENCODED_MAX * MAX_ROOMS)
+
+// Per-room view for /api/rooms: {"rooms":[...]} with every room, or just the
+// room object when room >= 0. Returns 0 if room does not exist or the buffer
+// is too small.
+size_t encodeRoomsJson(const StatusSnapshot& status, int room, char* out, size_t size);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "http_server.h"
+#include "status_encoder.h"
+#include "status_snapshot.h"
+
+#define SSE_MAX_CLIENTS 4
+#define SSE_HEARTBEAT_MS 15000UL
+#define SSE_DISTANCE_INTERVAL_MS 100UL  // Distance-only frames are rate limited
+#define SSE_DISTANCE_DEADBAND_CM 2       // Ignore distance jitter below this
+// What the dashboard renders; heap and latency diagnostics stay on /api/status
+#define SSE_FULL_FIELDS (STATUS_OCCUPIED | STATUS_OCCUPANT_COUNT | STATUS_ENERGY_FIELDS | \
+                         STATUS_DAILY_OCCUPIED_TIME | STATUS_TOTAL_OCCUPIED_TIME | \
+                         STATUS_UPTIME | STATUS_DISTANCE_FIELDS | STATUS_CONFIDENCE)
+#define SSE_FRAME_SIZE 512
+
+// Server-Sent Events push channel for /api/events.
+//
+// Subscribers get one full status frame when they connect and afterwards only
+// delta frames carrying the fields that changed. Occupancy changes go out on
+// the next update() call; distance changes are rate limited. An idle stream
+// carries one small heartbeat frame every SSE_HEARTBEAT_MS. Boards with two
+// or more rooms also send a "rooms" event whenever a room's occupancy or
+// confidence changes, and one on connect.
+class StatusEventStream {
+public:
+    explicit StatusEventStream(HttpServer& server);
+
+    // Answer a request with the stream; the connection becomes a push
+    // channel. Returns false if all subscriber slots are in use.
+    bool subscribe(HttpResponse& response, const StatusSnapshot& status, uint32_t nowMs);
+
+    // Compare against the last published snapshot and push whatever changed.
+    void update(const StatusSnapshot& status, uint32_t nowMs);
+
+    int subscriberCount() const;
+
+private:
+    void broadcast(const char* frame, size_t length);
+    size_t formatFrame(const StatusSnapshot& status, uint32_t nowMs, uint32_t fields);
+    size_t formatRoomsFrame(const StatusSnapshot& status);
+
+    HttpServer& server_;
+    HttpPushId clients_[SSE_MAX_CLIENTS];
+    StatusSnapshot last_;
+    uint32_t lastFrameMs_;
+    uint32_t lastDistanceFrameMs_;
+    char frame_[SSE_FRAME_SIZE];
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Single-writer sequence lock. The writer bumps the sequence to an odd value,
+// copies the payload and bumps it back to even; readers retry until they see
+// the same even sequence on both sides of their copy. Readers never block the
+// writer, which is what the sensing task needs.
+template <typename T>
+class SeqLock {
+public:
+    void publish(const T& value) {
+        uint32_t seq = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value_ = value;
+        std::atomic_thread_fence(std::memory_order_release);
+        sequence_.store(seq + 2, std::memory_order_relaxed);
+    }
+
+    T read() const {
+        T copy;
+        uint32_t before, after;
+        do {
+            before = sequence_.load(std::memory_order_acquire);
+            copy = value_;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence_.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return copy;
+    }
+
+private:
+    T value_{};
+    std::atomic<uint32_t> sequence_{0};
+};
+
+// Doorways and rooms one controller can watch
+#define MAX_DOORWAYS 4
+#define MAX_ROOMS 4
+
+struct RoomSnapshot {
+    bool occupied;
+    int occupantCount;
+    uint8_t confidence;           // Percent probability that occupantCount is right
+    float energySavedToday;
+    float energySavedWeek;
+    float energySavedMonth;
+    float energySavedYear;
+    unsigned long dailyOccupiedTime;
+    unsigned long totalOccupiedTime;
+    uint32_t entries;
+    uint32_t exits;
+};
+
+struct DoorwaySnapshot {
+    uint8_t room;
+    int16_t entranceCm;
+    int16_t insideCm;
+};
+
+// Everything the web, LCD and webhook tasks need from the sensing task,
+// published once per sensor frame. The top-level fields are the aggregate
+// over all rooms (distance1/2 are doorway 0); rooms[] and doorways[] hold
+// the per-instance values.
+struct StatusSnapshot {
+    bool occupied;
+    int occupantCount;
+    int distance1;
+    int distance2;
+    float energySavedToday;
+    float energySavedWeek;
+    float energySavedMonth;
+    float energySavedYear;
+    unsigned long dailyOccupiedTime;
+    unsigned long totalOccupiedTime;
+    uint32_t totalEntries;        // Crossings since boot
+    uint32_t totalExits;
+    uint32_t detectionLatencyUs;  // Echo edge to published decision, last crossing
+    uint32_t sensorOverruns;      // Frames that missed their deadline
+    uint32_t samplesPerSecond;    // Sensor readings per second at the current ping rate
+    uint32_t skippedPings;        // Pings a still-busy sensor refused
+    uint32_t lateSlots;           // Ping slots that started more than a slot late
+    uint32_t echoTimeouts;        // Pings that got no echo
+    uint8_t occupancyConfidence;  // Lowest room confidence, percent
+    uint8_t occupiedRooms;
+    uint8_t roomCount;
+    uint8_t doorwayCount;
+    RoomSnapshot rooms[MAX_ROOMS];
+    DoorwaySnapshot doorways[MAX_DOORWAYS];
+};
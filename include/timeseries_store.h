@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+#include "hal.h"
+#include "status_snapshot.h"
+
+// Persistent per-minute occupancy and energy history.
+//
+// Raw minutes go into an append-only log of TS_SEGMENT_COUNT segment files,
+// each holding up to TS_SEGMENT_RECORDS fixed-size records. When the active
+// segment is full the oldest one is erased and reused, so segments are
+// rewritten round-robin and wear evenly; records are never modified.
+//
+// A record is written in two steps: the payload, then a one-byte commit
+// marker. A record without the marker, or whose CRC does not match, was torn
+// by a reset and is skipped.
+//
+// Day, month and lifetime summaries live in fixed slots of a rollup file,
+// written once when a period closes, so month/year totals read a few dozen
+// summaries instead of every minute. Recovery at boot reads the segment
+// headers, the first and last record of each segment and today's minutes.
+
+#define TS_SEGMENT_COUNT 8
+#define TS_SEGMENT_RECORDS 1440      // One day of minutes per segment
+#define TS_RECORD_SIZE 16
+#define TS_SEGMENT_HEADER_SIZE 16
+#define TS_SUMMARY_SIZE 24
+#define TS_DAY_SLOTS 400             // Day summaries kept (a bit over a year)
+#define TS_MONTH_SLOTS 120           // Month summaries kept (ten years)
+#define TS_COMMIT_MARKER 0xA5
+
+// One minute of activity, stamped with Unix minutes (epoch seconds / 60)
+struct MinuteRecord {
+    uint32_t minute;
+    uint32_t energyMwh;          // Light energy while occupied, milliwatt-hours
+    uint16_t occupiedSeconds;    // 0..60
+    uint8_t entries;
+    uint8_t exits;
+    uint8_t peakOccupants;
+};
+
+// Sum over a day, week, month, year or the device's lifetime
+struct PeriodSummary {
+    uint32_t startMinute;        // First minute of the period (UTC)
+    uint32_t energyMwh;
+    uint32_t occupiedSeconds;
+    uint32_t entries;
+    uint32_t exits;
+    uint8_t peakOccupants;
+};
+
+struct StoreTotals {
+    PeriodSummary today;
+    PeriodSummary week;          // Since Monday
+    PeriodSummary month;
+    PeriodSummary year;
+    PeriodSummary lifetime;
+};
+
+struct StoreStats {
+    uint32_t records;            // Raw minutes currently held
+    uint32_t activeSegment;
+    uint32_t generation;         // Segments opened since the store was created
+    uint32_t minEraseCount;      // Across segments; round-robin keeps these within one
+    uint32_t maxEraseCount;
+    uint32_t lastMinute;
+    uint32_t tornRecords;        // Skipped while reading: no commit marker or bad CRC
+    uint32_t writeErrors;
+};
+
+class TimeSeriesStore {
+public:
+    // Days, weeks and months start at local midnight, utcOffsetMinutes east
+    // of UTC.
+    TimeSeriesStore(Storage& storage, int32_t utcOffsetMinutes);
+
+    // Recover the log and the running totals. Call once before anything else.
+    bool begin();
+
+    // Add the next minute. Minutes must increase; an older or repeated
+    // minute (clock stepped back) is rejected.
+    bool append(const MinuteRecord& record);
+
+    // Raw minutes in [fromMinute, toMinute), oldest first. Returns how many
+    // were copied into out (at most max).
+    size_t readMinutes(uint32_t fromMinute, uint32_t toMinute, MinuteRecord* out, size_t max);
+
+    // Summary of a local day (see localDay()) or month (calendar.h month
+    // index). False if nothing was recorded for it or it has aged out.
+    bool readDay(int32_t day, PeriodSummary& out);
+    bool readMonth(uint32_t monthIndex, PeriodSummary& out);
+
+    StoreTotals totals();
+    StoreStats stats();
+
+    int32_t localDay(uint32_t minute) const;
+    uint32_t dayStartMinute(int32_t day) const;
+
+private:
+    struct Segment {
+        bool present;
+        bool hasData;            // At least one committed record
+        uint32_t generation;
+        uint32_t eraseCount;
+        uint32_t records;
+        uint32_t firstMinute;
+        uint32_t lastMinute;
+    };
+
+    // Return false to stop the walk
+    typedef bool (*MinuteVisitor)(const MinuteRecord& record, void* context);
+
+    void segmentPath(uint8_t index, char* out) const;
+    bool loadSegment(uint8_t index);
+    bool openSegment();
+    bool readRecord(uint8_t segment, uint32_t index, MinuteRecord& out);
+    bool findRecord(uint8_t segment, uint32_t from, uint32_t to, int step, uint32_t& index,
+                    MinuteRecord& out);
+    uint32_t lowerBound(uint8_t segment, uint32_t minute);
+    size_t visitMinutes(uint32_t fromMinute, uint32_t toMinute, MinuteVisitor visitor, void* context);
+
+    bool readSummary(uint32_t slot, PeriodSummary& out);
+    bool writeSummary(uint32_t slot, const PeriodSummary& summary);
+    bool loadDay(int32_t day, PeriodSummary& out);
+    bool loadMonth(uint32_t monthIndex, PeriodSummary& out);
+    void rollTo(int32_t day);
+    void rebuildTotals();
+
+    Storage& storage_;
+    int32_t utcOffsetMinutes_;
+    std::mutex lock_;
+
+    Segment segments_[TS_SEGMENT_COUNT];
+    int active_;                 // -1 before the first segment exists
+    uint32_t nextGeneration_;
+    bool hasLast_;
+    uint32_t lastMinute_;
+    uint32_t tornRecords_;
+    uint32_t writeErrors_;
+
+    // Running sums. week_, month_ and year_ hold only closed days/months;
+    // today_ is added on top when totals are read.
+    int32_t currentDay_;
+    PeriodSummary today_;
+    PeriodSummary week_;
+    PeriodSummary month_;
+    PeriodSummary year_;
+    PeriodSummary lifetime_;     // Closed days up to lifetimeDay_
+    int32_t lifetimeDay_;
+};
+
+// Folds ~1 Hz status samples into MinuteRecords. occupiedSeconds counts
+// time with any room occupied; energy is charged per occupied room.
+class MinuteAccumulator {
+public:
+    explicit MinuteAccumulator(float lightPowerWatts);
+
+    // Returns true and fills out when the sample starts a new minute. Samples
+    // are ignored while epochSeconds is 0 (wall clock not set yet).
+    bool sample(const StatusSnapshot& status, uint32_t epochSeconds, MinuteRecord& out);
+
+    // From the next finished minute on
+    void setLightPowerWatts(float watts) { lightPowerWatts_ = watts; }
+
+private:
+    void finish(MinuteRecord& out) const;
+
+    float lightPowerWatts_;
+    bool started_;
+    bool wasOccupied_;
+    uint8_t occupiedRooms_;
+    uint32_t minute_;
+    uint32_t lastSeconds_;
+    uint32_t occupiedSeconds_;
+    uint32_t roomSeconds_;       // Occupied seconds summed over rooms
+    uint32_t entries_;
+    uint32_t exits_;
+    uint32_t lastEntries_;
+    uint32_t lastExits_;
+    int peakOccupants_;
+};
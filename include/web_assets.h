@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+// Static dashboard files, gzipped at build time by scripts/embed_web_assets.py
+// and linked into flash. Served as-is with Content-Encoding: gzip; a client
+// that does not accept gzip gets 406, as there is no plain copy.
+struct WebAsset {
+    const char* path;
+    const char* contentType;
+    const char* cacheControl;
+    const char* etag;  // Strong validator, quoted, derived from the gzipped bytes
+    const uint8_t* data;
+    size_t length;
+};
+
+extern const WebAsset webAssets[];
+extern const size_t webAssetCount;
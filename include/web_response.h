@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "web_assets.h"
+
+// Response headers formatted into caller-owned buffers, so a response can go
+// out of static buffers without building Strings (HttpServer, http_server.h).
+
+#define RESPONSE_HEADER_MAX 256
+
+// Pass as contentLength for a body whose length is not known up front: it
+// is sent chunked on a kept-alive connection, otherwise it ends when the
+// connection closes
+#define RESPONSE_LENGTH_UNKNOWN ((size_t)-1)
+
+// "HTTP/1.1 <status> ..." with Content-Type/Length (or Transfer-Encoding),
+// Cache-Control and Connection. extraHeaders (may be NULL) must be complete
+// "Name: value\r\n" lines. Returns the header length, or 0 if it did not fit.
+size_t formatResponseHeader(char* out, size_t size, int status, const char* contentType,
+                            size_t contentLength, const char* cacheControl, const char* extraHeaders,
+                            bool keepAlive);
+
+// Headers for a pre-gzipped asset, with Vary: Accept-Encoding so caches keep
+// it from clients that cannot decode it. Sets notModified when ifNoneMatch
+// carries the asset's ETag; the caller then sends the header alone (a 304).
+size_t formatAssetHeader(char* out, size_t size, const WebAsset& asset, const char* ifNoneMatch,
+                         bool keepAlive, bool& notModified);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+
+// Asynchronous webhook delivery.
+//
+// Producers (the sensor task) call enqueue() and return immediately. A
+// background worker calls poll() which performs at most one HTTP request and
+// reports how long it may sleep before the next retry is due.
+//
+// Events share a coalescing key (one per room). Only one undelivered event
+// per key is kept: a newer state overwrites the pending one, so a burst of
+// occupied -> empty -> occupied while a request is in flight delivers just
+// the final state.
+
+#define WEBHOOK_QUEUE_LENGTH 8
+#define WEBHOOK_MAX_KEYS 8
+#define WEBHOOK_MAX_ATTEMPTS 5
+#define WEBHOOK_BACKOFF_BASE_MS 500UL
+#define WEBHOOK_BACKOFF_MAX_MS 30000UL
+#define WEBHOOK_IDLE_WAIT_MS 0xFFFFFFFFUL
+
+// Sends one request. Returns the HTTP status code, or a value <= 0 for a
+// transport error (connect failure, timeout, ...).
+class WebhookTransport {
+public:
+    virtual ~WebhookTransport() {}
+    virtual int get(const char* url) = 0;
+};
+
+struct WebhookStats {
+    uint32_t queued;     // Events accepted by enqueue()
+    uint32_t coalesced;  // Events superseded by a newer state for the same key
+    uint32_t sent;       // Requests answered with a 2xx/3xx status
+    uint32_t retried;    // Failed attempts that were rescheduled
+    uint32_t dropped;    // Events discarded: queue overflow or retries exhausted
+    uint32_t pending;    // Events currently waiting for delivery
+    int lastStatus;      // Status of the most recent attempt
+};
+
+class WebhookDispatcher {
+public:
+    explicit WebhookDispatcher(WebhookTransport& transport);
+
+    // Queue a request for key (< WEBHOOK_MAX_KEYS). The url must outlive the
+    // event; the firmware only passes string constants. Never blocks on the
+    // network.
+    void enqueue(uint8_t key, const char* url, uint32_t nowMs);
+
+    // Deliver the next due event, if any. Returns the number of milliseconds
+    // until another event is due, 0 if more work is ready right away, or
+    // WEBHOOK_IDLE_WAIT_MS when the queue is empty.
+    uint32_t poll(uint32_t nowMs);
+
+    WebhookStats stats();
+
+private:
+    struct Event {
+        bool used;
+        bool inFlight;
+        uint8_t key;
+        uint8_t attempts;
+        const char* url;
+        uint32_t order;  // Arrival sequence, for FIFO delivery
+        uint32_t dueAtMs;
+    };
+
+    int findPending(uint8_t key) const;
+    int findDue(uint32_t nowMs, uint32_t& waitMs) const;
+    int allocateSlot();
+    static uint32_t backoffMs(uint8_t attempts);
+
+    WebhookTransport& transport_;
+    std::mutex lock_;
+    Event events_[WEBHOOK_QUEUE_LENGTH];
+    uint32_t nextOrder_;
+    const char* lastDelivered_[WEBHOOK_MAX_KEYS];
+    WebhookStats stats_;
+};
@@ -0,0 +1,61 @@
+"""Compare two benchmark runs (JSON lines from the bench / esp32bench envs).
+
+    python scripts/bench_compare.py baseline.jsonl current.jsonl [--threshold 10]
+
+Prints the change in ns/op per benchmark and exits with status 1 when any
+benchmark slowed down by more than the threshold (percent) or started
+allocating.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith("{"):
+                continue  # Serial monitor noise
+            record = json.loads(line)
+            if "bench" in record:
+                results[record["bench"]] = record
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed ns/op increase in percent")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    failed = False
+
+    for name, now in current.items():
+        before = baseline.get(name)
+        if before is None:
+            print("%-24s %10.1f ns/op  (new)" % (name, now["ns_per_op"]))
+            continue
+
+        change = (now["ns_per_op"] - before["ns_per_op"]) / before["ns_per_op"] * 100
+        status = ""
+        if change > args.threshold:
+            status = "  SLOWER"
+            failed = True
+        if now["allocs_per_op"] > before["allocs_per_op"]:
+            status += "  ALLOCATES"
+            failed = True
+        print("%-24s %10.1f -> %10.1f ns/op  %+6.1f%%%s"
+              % (name, before["ns_per_op"], now["ns_per_op"], change, status))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,161 @@
+"""Push configuration changes to one board or a fleet (/api/config).
+
+    python scripts/config_push.py --token s3cret --set thresholdCm=80 --set lightMilliwatts=42000 \
+        http://192.168.1.50 http://192.168.1.51
+    python scripts/config_push.py --set room0Occupied=http://hub.local/on --out patch.bin
+
+Builds a binary patch holding only the given fields (the format is
+described in include/device_config.h) and POSTs it to every board with the
+Bearer token. The board takes at most PATCH_MAX bytes per request (its 1 KB
+request buffer less room for the headers), so a change that does not fit,
+such as all eight webhook URLs, is split into several patches sent in turn.
+Each patch is applied all or nothing, but a board that refuses a later one
+keeps the earlier ones. With --check-generation the current generation is
+read from each board first and every patch names the one before it, so a
+board changed by someone else in the meantime answers 409 instead of being
+overwritten. --out writes the patches to files instead (patch.bin,
+patch.bin.1, ...). Prints each board's new generation and whether it needs a
+reboot; exits non-zero if any board refused.
+"""
+
+import argparse
+import json
+import struct
+import sys
+import urllib.error
+import urllib.request
+
+MAGIC = b"LSC1"
+SCHEMA_MAJOR = 1
+SCHEMA_MINOR = 0
+HEADER_SIZE = 10
+PATCH_MAX = 1024 - 384  # CONFIG_PATCH_MAX
+
+# name: (tag, struct format or size of a text field); mirrors CONFIG_FIELDS
+FIELDS = {
+    "wifiSsid": (1, 33),
+    "wifiPassword": (2, 65),
+    "apiToken": (3, 33),
+    "thresholdCm": (4, "<h"),
+    "sequenceTimeoutMs": (5, "<I"),
+    "lightMilliwatts": (6, "<I"),
+    "filterEnabled": (7, "<?"),
+    "filterMedian": (8, "<B"),
+    "filterHysteresisCm": (9, "<B"),
+    "filterDebounce": (10, "<B"),
+}
+for room in range(4):
+    FIELDS["room%dOccupied" % room] = (16 + room * 2, 128)
+    FIELDS["room%dEmpty" % room] = (17 + room * 2, 128)
+for channel in range(8):
+    FIELDS["trig%d" % channel] = (32 + channel * 2, "<B")
+    FIELDS["echo%d" % channel] = (33 + channel * 2, "<B")
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def encode_record(name, text):
+    if name not in FIELDS:
+        raise ValueError("unknown field %s" % name)
+    tag, kind = FIELDS[name]
+    if isinstance(kind, int):
+        value = text.encode("utf-8")
+        if len(value) >= kind:
+            raise ValueError("%s is longer than %d bytes" % (name, kind - 1))
+    elif kind == "<?":
+        value = struct.pack(kind, text.lower() in ("1", "true"))
+    else:
+        value = struct.pack(kind, int(text))
+    return bytes([tag, len(value)]) + value
+
+
+def seal(records, generation):
+    data = MAGIC + struct.pack("<BBI", SCHEMA_MAJOR, SCHEMA_MINOR, generation) + records
+    return data + struct.pack("<H", crc16(data))
+
+
+def split_records(values):
+    """values: {name: text}; the board checks the ranges. Groups of records
+    that each fit in one patch."""
+    groups = [b""]
+    for name, text in values.items():
+        record = encode_record(name, text)
+        if HEADER_SIZE + len(groups[-1]) + len(record) + 2 > PATCH_MAX:
+            groups.append(b"")
+        groups[-1] += record
+    return groups
+
+
+def encode_patch(values, generation=0):
+    """A single patch; ValueError if the values need more than one."""
+    groups = split_records(values)
+    if len(groups) > 1:
+        raise ValueError("more than %d bytes, send as several patches" % PATCH_MAX)
+    return seal(groups[0], generation)
+
+
+def request(url, token, data=None):
+    headers = {"Authorization": "Bearer %s" % token}
+    if data is not None:
+        headers["Content-Type"] = "application/octet-stream"
+    call = urllib.request.Request(url.rstrip("/") + "/api/config", data=data, headers=headers)
+    with urllib.request.urlopen(call, timeout=10) as response:
+        return json.loads(response.read())
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("boards", nargs="*", help="board URLs")
+    parser.add_argument("--token", default="", help="the boards' API token")
+    parser.add_argument("--set", action="append", default=[], metavar="NAME=VALUE", help="field to change")
+    parser.add_argument("--check-generation", action="store_true",
+                        help="refuse boards changed since their generation was read")
+    parser.add_argument("--out", help="write the patches to this file (and .1, .2, ...) instead of sending them")
+    args = parser.parse_args()
+
+    values = {}
+    for item in args.set:
+        name, sep, text = item.partition("=")
+        if not sep:
+            parser.error("--set takes NAME=VALUE, got %s" % item)
+        values[name] = text
+    if not values:
+        parser.error("nothing to --set")
+
+    groups = split_records(values)
+    if args.out:
+        for i, records in enumerate(groups):
+            with open(args.out + (".%d" % i if i else ""), "wb") as f:
+                f.write(seal(records, 0))
+        return 0
+
+    failed = 0
+    for board in args.boards:
+        try:
+            generation = request(board, args.token)["generation"] if args.check_generation else 0
+            for records in groups:
+                answer = request(board, args.token, seal(records, generation))
+                if args.check_generation:
+                    generation = answer["generation"]
+            print("%s: generation %d%s" % (board, answer["generation"],
+                                          ", reboot to apply" if answer["rebootRequired"] else ""))
+        except urllib.error.HTTPError as error:
+            print("%s: %d %s" % (board, error.code, error.read().decode("utf-8", "replace").strip()),
+                  file=sys.stderr)
+            failed += 1
+        except (OSError, ValueError) as error:
+            print("%s: %s" % (board, error), file=sys.stderr)
+            failed += 1
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
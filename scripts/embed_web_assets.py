@@ -0,0 +1,80 @@
+"""Embed the dashboard files from data/ into the firmware as gzipped arrays.
+
+Runs as a PlatformIO pre-build script (see extra_scripts in platformio.ini)
+and can also be run by hand: python scripts/embed_web_assets.py
+
+Writes src/web_assets.cpp, which defines the webAssets[] table declared in
+include/web_assets.h. The file is only rewritten when its content changes so
+unchanged assets do not trigger a rebuild.
+"""
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    PROJECT_DIR = env["PROJECT_DIR"]  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# (URL path, file in data/, content type, Cache-Control)
+ASSETS = [
+    ("/", "index.html", "text/html", "no-cache"),
+    ("/manifest.json", "manifest.json", "application/manifest+json", "public, max-age=86400"),
+    ("/sw.js", "sw.js", "application/javascript", "no-cache"),
+]
+
+OUTPUT = os.path.join(PROJECT_DIR, "src", "web_assets.cpp")
+
+
+def symbol_for(name):
+    return "ASSET_" + "".join(c.upper() if c.isalnum() else "_" for c in name)
+
+
+def render():
+    lines = [
+        "// Generated by scripts/embed_web_assets.py from data/ - do not edit.",
+        '#include "web_assets.h"',
+        "",
+    ]
+    entries = []
+    for path, name, content_type, cache_control in ASSETS:
+        with open(os.path.join(PROJECT_DIR, "data", name), "rb") as source:
+            raw = source.read()
+        # mtime=0 keeps the output (and therefore the ETag) reproducible
+        packed = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = '"%s"' % hashlib.sha256(packed).hexdigest()[:16]
+        symbol = symbol_for(name)
+
+        lines.append("// %s: %d bytes, %d gzipped" % (name, len(raw), len(packed)))
+        lines.append("static const uint8_t %s[] PROGMEM = {" % symbol)
+        for i in range(0, len(packed), 16):
+            chunk = packed[i:i + 16]
+            lines.append("    " + ", ".join("0x%02x" % b for b in chunk) + ",")
+        lines.append("};")
+        lines.append("")
+        entries.append('    {"%s", "%s", "%s", "%s", %s, sizeof(%s)},' % (
+            path, content_type, cache_control, etag.replace('"', '\\"'), symbol, symbol))
+
+    lines.append("const WebAsset webAssets[] = {")
+    lines.extend(entries)
+    lines.append("};")
+    lines.append("")
+    lines.append("const size_t webAssetCount = sizeof(webAssets) / sizeof(webAssets[0]);")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def main():
+    content = render()
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT) as existing:
+            if existing.read() == content:
+                return
+    with open(OUTPUT, "w") as output:
+        output.write(content)
+    print("Embedded web assets -> %s" % os.path.relpath(OUTPUT, PROJECT_DIR))
+
+
+main()
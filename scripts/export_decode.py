@@ -0,0 +1,113 @@
+"""Collect and decode the per-minute history export (/api/export).
+
+    python scripts/export_decode.py http://192.168.1.50 --cursor-file board1.cursor >> board1.csv
+    python scripts/export_decode.py export.bin
+
+Prints one CSV row per minute: Unix minute, energy (mWh), occupied seconds,
+entries, exits and peak occupants. Given a URL it asks for a gzipped export
+starting at the cursor in --cursor-file (or --since) and, once everything
+arrived, stores the next cursor there, so running it periodically collects
+each minute exactly once. The format is described in include/history_export.h.
+"""
+
+import argparse
+import gzip
+import struct
+import sys
+import urllib.request
+
+MAGIC = b"LSX1"
+COLUMNS = ("minute", "energy_mwh", "occupied_seconds", "entries", "exits", "peak_occupants")
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        if pos >= len(data):
+            raise EOFError
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode(data):
+    """(since, cursor, rows, complete); rows stop at the last whole block."""
+    if data[:4] != MAGIC:
+        raise ValueError("not a history export")
+    since, cursor = struct.unpack_from("<II", data, 4)
+    rows = []
+    previous = since
+    pos = 12
+    try:
+        while True:
+            count, pos = read_varint(data, pos)
+            if count == 0:
+                return since, cursor, rows, True
+            columns = []
+            for _ in COLUMNS:
+                values = []
+                for _ in range(count):
+                    value, pos = read_varint(data, pos)
+                    values.append(value)
+                columns.append(values)
+            for i in range(count):
+                previous += columns[0][i]
+                rows.append([previous] + [column[i] for column in columns[1:]])
+    except EOFError:
+        return since, cursor, rows, False
+
+
+def fetch(url, since):
+    request = urllib.request.Request("%s/api/export?since=%d" % (url.rstrip("/"), since),
+                                     headers={"Accept-Encoding": "gzip"})
+    with urllib.request.urlopen(request, timeout=60) as response:
+        data = response.read()
+        if response.headers.get("Content-Encoding") == "gzip":
+            data = gzip.decompress(data)
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("source", help="board URL or a saved export file")
+    parser.add_argument("--since", type=int, default=0, help="first Unix minute (without --cursor-file)")
+    parser.add_argument("--cursor-file", help="read the start from and save the next cursor to this file")
+    args = parser.parse_args()
+
+    since = args.since
+    if args.cursor_file:
+        try:
+            with open(args.cursor_file) as f:
+                since = int(f.read().strip() or 0)
+        except FileNotFoundError:
+            pass
+
+    if args.source.startswith("http://") or args.source.startswith("https://"):
+        data = fetch(args.source, since)
+    else:
+        with open(args.source, "rb") as f:
+            data = f.read()
+        if data[:2] == b"\x1f\x8b":
+            data = gzip.decompress(data)
+
+    since, cursor, rows, complete = decode(data)
+    out = sys.stdout
+    for row in rows:
+        out.write(",".join(str(value) for value in row) + "\n")
+
+    if not complete:
+        # Resume after the last whole block next time
+        cursor = rows[-1][0] + 1 if rows else since
+        print("export cut short after %d minutes" % len(rows), file=sys.stderr)
+    if args.cursor_file:
+        with open(args.cursor_file, "w") as f:
+            f.write("%d\n" % cursor)
+    print("%d minutes, next cursor %d" % (len(rows), cursor), file=sys.stderr)
+    return 0 if complete else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
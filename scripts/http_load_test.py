@@ -0,0 +1,155 @@
+"""Load test for the HTTP server: concurrent keep-alive clients hammering
+the dashboard and the JSON API.
+
+    .pio/build/native/program sim/busy_doorway.txt --serve 8080 &
+    python scripts/http_load_test.py --port 8080 --clients 8 --seconds 10
+
+Each client holds one connection and sends its next request as soon as the
+previous answer is complete, cycling through --paths. Prints requests per
+second and latency percentiles overall and per path, then one JSON line with
+the same numbers for saving or comparing. --close opens a new connection for
+every request instead. Works against the board too (--host, port 80).
+The server keeps at most HTTP_MAX_CONNECTIONS (10) connections; busy
+keep-alive clients beyond that wait in the listen backlog, which shows in
+the max latency rather than as errors.
+"""
+
+import argparse
+import asyncio
+import json
+import time
+
+DEFAULT_PATHS = ["/api/status", "/", "/manifest.json", "/api/rooms", "/api/status?fields=occupied,distance1",
+                 "/api/metrics"]
+
+
+async def read_response(reader):
+    """Status code and body length of one response (Content-Length or chunked)."""
+    line = await reader.readline()
+    if not line:
+        raise ConnectionError("closed by server")
+    status = int(line.split()[1])
+    length = None
+    chunked = False
+    closes = False
+    while True:
+        line = await reader.readline()
+        if line in (b"\r\n", b""):
+            break
+        name, _, value = line.decode("latin-1").partition(":")
+        name = name.strip().lower()
+        value = value.strip().lower()
+        if name == "content-length":
+            length = int(value)
+        elif name == "transfer-encoding" and "chunked" in value:
+            chunked = True
+        elif name == "connection" and "close" in value:
+            closes = True
+
+    size = 0
+    if chunked:
+        while True:
+            chunk = int((await reader.readline()).split(b";")[0], 16)
+            if chunk == 0:
+                await reader.readline()
+                break
+            await reader.readexactly(chunk + 2)
+            size += chunk
+    elif length is not None:
+        await reader.readexactly(length)
+        size = length
+    else:
+        size = len(await reader.read())
+        closes = True
+    return status, size, closes
+
+
+async def client(host, port, paths, offset, deadline, close_each, results):
+    reader = writer = None
+    i = offset
+    while time.monotonic() < deadline:
+        path = paths[i % len(paths)]
+        i += 1
+        try:
+            if writer is None:
+                reader, writer = await asyncio.open_connection(host, port)
+            request = "GET %s HTTP/1.1\r\nHost: %s\r\nAccept-Encoding: gzip\r\n%s\r\n" % (
+                path, host, "Connection: close\r\n" if close_each else "")
+            start = time.monotonic()
+            writer.write(request.encode())
+            status, size, closes = await read_response(reader)
+            results.append((path, time.monotonic() - start, status, size))
+            if closes:
+                writer.close()
+                writer = None
+        except (ConnectionError, asyncio.IncompleteReadError, OSError, ValueError):
+            results.append((path, None, 0, 0))
+            if writer is not None:
+                writer.close()
+            writer = None
+            await asyncio.sleep(0.01)
+    if writer is not None:
+        writer.close()
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[index]
+
+
+def summarize(results, seconds):
+    latencies = sorted(r[1] for r in results if r[1] is not None and r[2] == 200)
+    return {
+        "requests": len(results),
+        "ok": len(latencies),
+        "errors": sum(1 for r in results if r[1] is None),
+        "non_200": sum(1 for r in results if r[1] is not None and r[2] != 200),
+        "rps": len(latencies) / seconds,
+        "p50_ms": percentile(latencies, 50) * 1000,
+        "p99_ms": percentile(latencies, 99) * 1000,
+        "max_ms": (latencies[-1] if latencies else 0.0) * 1000,
+        "bytes": sum(r[3] for r in results),
+    }
+
+
+async def run(args):
+    paths = args.paths
+    results = []
+    start = time.monotonic()
+    deadline = start + args.seconds
+    await asyncio.gather(*(client(args.host, args.port, paths, n, deadline, args.close, results)
+                           for n in range(args.clients)))
+    elapsed = time.monotonic() - start
+
+    total = summarize(results, elapsed)
+    print("%d clients, %.1f s, %s" % (args.clients, elapsed, "new connection per request" if args.close
+                                       else "keep-alive"))
+    print("%-40s %9s %9s %9s %9s %7s" % ("path", "req/s", "p50 ms", "p99 ms", "max ms", "errors"))
+    for path in paths:
+        s = summarize([r for r in results if r[0] == path], elapsed)
+        print("%-40s %9.1f %9.2f %9.2f %9.2f %7d" % (path, s["rps"], s["p50_ms"], s["p99_ms"], s["max_ms"],
+                                                     s["errors"] + s["non_200"]))
+    print("%-40s %9.1f %9.2f %9.2f %9.2f %7d" % ("all", total["rps"], total["p50_ms"], total["p99_ms"],
+                                                 total["max_ms"], total["errors"] + total["non_200"]))
+    total.update({"load_test": "http", "clients": args.clients, "keep_alive": not args.close})
+    print(json.dumps(total))
+    return 0 if total["errors"] == 0 and total["non_200"] == 0 else 1
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--clients", type=int, default=8)
+    parser.add_argument("--seconds", type=float, default=10.0)
+    parser.add_argument("--paths", nargs="+", default=DEFAULT_PATHS,
+                        help="request paths, cycled by every client")
+    parser.add_argument("--close", action="store_true", help="new connection for every request")
+    args = parser.parse_args()
+    raise SystemExit(asyncio.run(run(args)))
+
+
+if __name__ == "__main__":
+    main()
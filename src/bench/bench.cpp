@@ -0,0 +1,106 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocationCount{0};
+
+double percentile(uint32_t* samples, uint32_t count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t index = static_cast<uint32_t>(fraction * (count - 1));
+    std::nth_element(samples, samples + index, samples + count);
+    return static_cast<double>(samples[index]) / BENCH_BATCH;
+}
+
+}  // namespace
+
+// Every allocation is counted once, in malloc/calloc/realloc: the build links
+// with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, so calls to them from
+// any statically linked code (ours, header-only libraries, on the board also
+// newlib and the Arduino core) land here. new goes through malloc too.
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_realloc(p, size);
+}
+
+}  // extern "C"
+
+// Replaced so new reaches the wrapped malloc even where the C++ runtime is a
+// shared library
+void* operator new(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        abort();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+uint64_t benchAllocations() {
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+BenchRunner::BenchRunner(const char* name, uint64_t ops)
+    : name_(name), ops_(ops < BENCH_BATCH ? BENCH_BATCH : ops), bytesPerOp_(0), sampleCount_(0) {}
+
+BenchResult BenchRunner::finish(uint64_t ops, uint64_t elapsedNs, uint64_t allocs) {
+    BenchResult result;
+    result.name = name_;
+    result.ops = ops;
+    result.nsPerOp = static_cast<double>(elapsedNs) / ops;
+    result.p50Ns = percentile(samples_, sampleCount_, 0.50);
+    result.p99Ns = percentile(samples_, sampleCount_, 0.99);
+    result.allocsPerOp = static_cast<double>(allocs) / ops;
+    result.bytesPerOp = bytesPerOp_;
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "{\"bench\":\"%s\",\"platform\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.1f,"
+             "\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"allocs_per_op\":%.4f,\"bytes_per_op\":%.1f}",
+             result.name, benchPlatform(), static_cast<unsigned long long>(result.ops),
+             result.nsPerOp, result.p50Ns, result.p99Ns, result.allocsPerOp, result.bytesPerOp);
+    benchPrint(line);
+    return result;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Microbenchmark harness shared by the host ([env:bench]) and on-target
+// ([env:esp32bench]) builds. Each benchmark runs an operation many times in
+// batches of BENCH_BATCH, samples the batch times for p50/p99, counts heap
+// allocations (new, malloc, calloc, realloc; see bench.cpp) and prints one
+// JSON object per line.
+
+#define BENCH_BATCH 64
+#define BENCH_MAX_SAMPLES 4096
+
+struct BenchResult {
+    const char* name;
+    uint64_t ops;
+    double nsPerOp;
+    double p50Ns;         // Per-op time, from batch averages
+    double p99Ns;
+    double allocsPerOp;
+    double bytesPerOp;    // Output size for encoders, 0 otherwise
+};
+
+// Platform hooks, implemented in bench_native.cpp / bench_esp32.cpp
+uint64_t benchNowNs();
+void benchPrint(const char* line);
+const char* benchPlatform();
+
+// Heap allocations since boot. On the host, allocations made inside the
+// shared C library itself (glibc's own buffers) are not seen.
+uint64_t benchAllocations();
+
+// Run every benchmark with about baseOps operations each
+void runBenchmarks(uint64_t baseOps);
+
+class BenchRunner {
+public:
+    BenchRunner(const char* name, uint64_t ops);
+
+    // Time op(i) for i in [0, ops). Returns the result and prints it.
+    template <typename Op>
+    BenchResult run(Op&& op) {
+        uint64_t batches = ops_ / BENCH_BATCH;
+        uint64_t stride = batches / BENCH_MAX_SAMPLES + 1;
+        uint64_t allocsBefore = benchAllocations();
+        uint64_t start = benchNowNs();
+        uint64_t i = 0;
+
+        for (uint64_t batch = 0; batch < batches; batch++) {
+            uint64_t batchStart = benchNowNs();
+            for (int k = 0; k < BENCH_BATCH; k++, i++) {
+                op(i);
+            }
+            if (batch % stride == 0 && sampleCount_ < BENCH_MAX_SAMPLES) {
+                samples_[sampleCount_++] = static_cast<uint32_t>(benchNowNs() - batchStart);
+            }
+        }
+
+        uint64_t elapsed = benchNowNs() - start;
+        return finish(i, elapsed, benchAllocations() - allocsBefore);
+    }
+
+    // Report output bytes per op (set before run())
+    void setBytesPerOp(double bytes) { bytesPerOp_ = bytes; }
+
+private:
+    BenchResult finish(uint64_t ops, uint64_t elapsedNs, uint64_t allocs);
+
+    const char* name_;
+    uint64_t ops_;
+    double bytesPerOp_;
+    uint32_t sampleCount_;
+    uint32_t samples_[BENCH_MAX_SAMPLES];
+};
+
+// Keep the optimiser from deleting work whose result is otherwise unused
+template <typename T>
+inline void benchKeep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
@@ -0,0 +1,48 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "bench.h"
+#include "hal.h"
+#include "perf_metrics.h"
+
+// Host entry point: pio run -e bench && .pio/build/bench/program [ops]
+// Prints one JSON line per benchmark; compare two runs with
+// scripts/bench_compare.py.
+
+#define BENCH_DEFAULT_OPS 2000000ULL
+
+uint64_t benchNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void benchPrint(const char* line) {
+    printf("%s\n", line);
+    fflush(stdout);
+}
+
+const char* benchPlatform() {
+    return "native";
+}
+
+uint32_t perfCycles() {
+    return static_cast<uint32_t>(benchNowNs());
+}
+
+uint32_t perfCyclesPerUs() {
+    return 1000;
+}
+
+// Crossing logs would dominate the sensing numbers
+void logMessage(const char*, ...) {}
+
+int main(int argc, char** argv) {
+    uint64_t ops = BENCH_DEFAULT_OPS;
+    if (argc > 1) {
+        ops = strtoull(argv[1], NULL, 10);
+    }
+    runBenchmarks(ops);
+    return 0;
+}
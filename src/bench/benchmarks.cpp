@@ -0,0 +1,438 @@
+#include <string.h>
+
+#include "bench.h"
+#include "byte_order.h"
+#include "device_config.h"
+#include "display_renderer.h"
+#include "energy_ledger.h"
+#include "energy_analytics.h"
+#include "gzip_encoder.h"
+#include "hal.h"
+#include "occupancy.h"
+#include "perf_metrics.h"
+#include "range_conversion.h"
+#include "sensing_engine.h"
+#include "sensor_trace.h"
+#include "session_log.h"
+#include "signal_filter.h"
+#include "status_display.h"
+#include "status_encoder.h"
+#include "web_assets.h"
+#include "web_response.h"
+
+// The hot paths of one sensor frame and one dashboard request, each fed with
+// synthetic input so the numbers do not depend on sensors or a network.
+
+namespace {
+
+// Four doorways into three rooms; the single-doorway config uses the first
+const DoorwaySetup BENCH_DOORWAYS[MAX_DOORWAYS] = {
+    {0, 1, 0, 0}, {2, 3, 0, 1}, {4, 5, 1, 0}, {6, 7, 2, 1},
+};
+// No idle slots, so every op starts a slot
+const PingScheduleConfig BENCH_PINGS = {400, 2500, 0, 100, 5000};
+const SignalFilterConfig BENCH_FILTER = {true, 3, 10, 1};
+const BaselineConfig BENCH_BASELINE = {true, 6, 4, 70, 16, 20, 150};
+const TrackerConfig BENCH_TRACKER = {7200000, 25};
+const SensingConfig BENCH_SENSING = {BENCH_DOORWAYS, 1, 1, BENCH_PINGS, 400, {75, 3000}, BENCH_FILTER,
+                                     BENCH_BASELINE, BENCH_TRACKER, 60.0f, 0};
+const SensingConfig BENCH_SENSING_4 = {BENCH_DOORWAYS, 4, 3, BENCH_PINGS, 400, {75, 3000}, BENCH_FILTER,
+                                       BENCH_BASELINE, BENCH_TRACKER, 60.0f, 0};
+
+const uint32_t BENCH_RANGE_FACTOR = rangeFactorQ18(RANGE_DEFAULT_DECI_CELSIUS);
+
+// A person walks in, later walks out, repeated every BENCH_WALK_FRAMES frames
+#define BENCH_WALK_FRAMES 200
+
+int walkDistance(uint8_t channel, uint64_t frame) {
+    uint32_t phase = frame % BENCH_WALK_FRAMES;
+    bool entering = phase < BENCH_WALK_FRAMES / 2;
+    uint32_t t = phase % (BENCH_WALK_FRAMES / 2);
+    uint8_t first = entering ? 0 : 1;
+    if (t >= 10 && t < 20) {
+        return channel == first ? 40 : 400;
+    }
+    if (t >= 20 && t < 30) {
+        return channel == first ? 400 : 40;
+    }
+    return 400;
+}
+
+class BenchClock : public Clock {
+public:
+    BenchClock() : nowUs_(0) {}
+    uint32_t millis() override { return static_cast<uint32_t>(nowUs_ / 1000); }
+    uint32_t micros() override { return static_cast<uint32_t>(nowUs_); }
+    void advanceUs(uint32_t us) { nowUs_ += us; }
+
+private:
+    uint64_t nowUs_;
+};
+
+// Every ping echoes straight away, so each frame runs the full pipeline.
+// Doorway n walks the same pattern as doorway 0, shifted by n * 37 frames.
+class InstantEchoSource : public EchoSource {
+public:
+    explicit InstantEchoSource(BenchClock& clock) : clock_(clock), frame_(0), pending_(0) {}
+
+    void setFrame(uint64_t frame) { frame_ = frame; }
+
+    bool trigger(uint8_t channel) override {
+        pending_ |= 1U << channel;
+        return true;
+    }
+
+    bool busy(uint8_t) override { return false; }
+    void setMaxEchoWidth(uint32_t) override {}
+
+    bool next(EchoSample& out) override {
+        if (pending_ == 0) {
+            return false;
+        }
+        uint8_t channel = static_cast<uint8_t>(__builtin_ctz(pending_));
+        pending_ &= pending_ - 1;
+        int cm = walkDistance(channel & 1, frame_ + (channel >> 1) * 37);
+        out.channel = channel;
+        out.timedOut = cm >= BENCH_SENSING.noEchoDistanceCm;
+        out.widthUs = out.timedOut ? 0 : echoWidthForCm(cm, BENCH_RANGE_FACTOR);
+        out.timestampUs = clock_.micros();
+        return true;
+    }
+
+private:
+    BenchClock& clock_;
+    uint64_t frame_;
+    uint32_t pending_;
+};
+
+StatusReport sampleReport() {
+    StatusReport report;
+    memset(&report, 0, sizeof(report));
+    report.status.occupied = true;
+    report.status.occupantCount = 2;
+    report.status.distance1 = 123;
+    report.status.distance2 = 87;
+    report.status.energySavedToday = 0.125f;
+    report.status.energySavedWeek = 1.5f;
+    report.status.energySavedMonth = 6.25f;
+    report.status.energySavedYear = 71.75f;
+    report.status.dailyOccupiedTime = 5400000;
+    report.status.totalOccupiedTime = 86400000;
+    report.status.detectionLatencyUs = 412;
+    report.status.samplesPerSecond = 37;
+    report.uptimeMs = 123456789;
+    report.heapFree = 201344;
+    report.heapMinFree = 187920;
+    report.heapDelta = -64;
+    return report;
+}
+
+void benchSensingStep(const char* name, const SensingConfig& config, uint64_t ops) {
+    BenchClock clock;
+    InstantEchoSource echoes(clock);
+    SensingEngine engine(clock, echoes, config);
+    engine.begin();
+
+    BenchRunner(name, ops).run([&](uint64_t i) {
+        clock.advanceUs(engine.pings().slotUs());
+        echoes.setFrame(i);
+        CrossingEvent event = engine.step();
+        benchKeep(event);
+    });
+}
+
+// Per-reading cost of the trace the firmware records alongside sensing
+void benchTraceRecord(uint64_t ops) {
+    static TraceRecorder trace;
+    uint32_t nowMs = 0;
+
+    BenchRunner("trace_record", ops).run([&](uint64_t i) {
+        nowMs += 20;
+        trace.recordReading(i & 1, walkDistance(i & 1, i / 2), nowMs);
+    });
+}
+
+// One reading through a sensor's filter, with a cross-talk spike every 13th
+// reading; 7 taps is the worst case the firmware accepts
+void benchSignalFilter(const char* name, uint8_t medianTaps, uint64_t ops) {
+    SignalFilter filter;
+    SignalFilterConfig config = BENCH_FILTER;
+    config.medianTaps = medianTaps;
+
+    BenchRunner(name, ops).run([&](uint64_t i) {
+        int cm = i % 13 == 0 ? 20 : walkDistance(0, i);
+        int out = filter.update(cm, 75, config);
+        benchKeep(out);
+    });
+}
+
+// Echo width to centimetres across the HC-SR04's 2..400cm, with the
+// integer table and with the double-precision formula it replaced (software
+// floating point on the ESP32)
+void benchRangeConversion(uint64_t ops) {
+    BenchRunner("range_conversion", ops).run([&](uint64_t i) {
+        uint32_t widthUs = 117 + static_cast<uint32_t>(i * 7919 % 23200);
+        int cm = echoWidthToCm(widthUs, BENCH_RANGE_FACTOR);
+        benchKeep(cm);
+    });
+    BenchRunner("range_conversion_double", ops).run([&](uint64_t i) {
+        uint32_t widthUs = 117 + static_cast<uint32_t>(i * 7919 % 23200);
+        int cm = widthUs * 0.034 / 2;
+        benchKeep(cm);
+    });
+}
+
+void benchStatusJson(uint64_t ops) {
+    StatusReport report = sampleReport();
+    char out[STATUS_ENCODED_MAX];
+    BenchRunner runner("status_json", ops);
+    runner.setBytesPerOp(encodeStatusJson(report, STATUS_ALL_FIELDS, out, sizeof(out)));
+    runner.run([&](uint64_t i) {
+        report.uptimeMs = static_cast<uint32_t>(i);
+        size_t length = encodeStatusJson(report, STATUS_ALL_FIELDS, out, sizeof(out));
+        benchKeep(length);
+    });
+}
+
+void benchStatusCbor(uint64_t ops) {
+    StatusReport report = sampleReport();
+    uint8_t out[STATUS_ENCODED_MAX];
+    BenchRunner runner("status_cbor", ops);
+    runner.setBytesPerOp(encodeStatusCbor(report, STATUS_ALL_FIELDS, out, sizeof(out)));
+    runner.run([&](uint64_t i) {
+        report.uptimeMs = static_cast<uint32_t>(i);
+        size_t length = encodeStatusCbor(report, STATUS_ALL_FIELDS, out, sizeof(out));
+        benchKeep(length);
+    });
+}
+
+// Header formatting plus copying the gzipped page out in TCP-segment sized
+// writes, which is what the HTTP server hands to the socket for an asset.
+#define BENCH_SEGMENT 1460
+
+void benchDashboard(const char* name, uint64_t ops, bool revalidate) {
+    const WebAsset* page = NULL;
+    for (size_t i = 0; i < webAssetCount; i++) {
+        if (strcmp(webAssets[i].path, "/") == 0) {
+            page = &webAssets[i];
+        }
+    }
+    if (!page) {
+        return;
+    }
+
+    const char* ifNoneMatch = revalidate ? page->etag : NULL;
+    char header[RESPONSE_HEADER_MAX];
+    uint8_t segment[BENCH_SEGMENT];
+    bool notModified = false;
+
+    BenchRunner runner(name, ops);
+    size_t headerLength = formatAssetHeader(header, sizeof(header), *page, ifNoneMatch, true, notModified);
+    runner.setBytesPerOp(headerLength + (notModified ? 0 : page->length));
+    runner.run([&](uint64_t) {
+        size_t length = formatAssetHeader(header, sizeof(header), *page, ifNoneMatch, true, notModified);
+        if (!notModified) {
+            for (size_t offset = 0; offset < page->length; offset += BENCH_SEGMENT) {
+                size_t chunk = page->length - offset;
+                memcpy(segment, page->data + offset, chunk < BENCH_SEGMENT ? chunk : BENCH_SEGMENT);
+                benchKeep(segment);
+            }
+        }
+        benchKeep(length);
+    });
+}
+
+LatencyHistogram benchHistogram("bench_scope_seconds", "Scoped timer overhead");
+MetricCounter benchCounter("bench_events_total", "Counter overhead");
+
+// What instrumenting a hot path costs: a scoped timer around it (two cycle
+// counter reads and a histogram update) plus a counter increment
+void benchMetricsScope(uint64_t ops) {
+    BenchRunner("metrics_scope", ops).run([&](uint64_t i) {
+        METRIC_SCOPE(benchHistogram);
+        METRIC_ADD(benchCounter, 1);
+        benchKeep(i);
+    });
+}
+
+// The /api/metrics body for one histogram family
+void benchMetricsFormat(uint64_t ops) {
+    char text[METRIC_TEXT_MAX];
+    BenchRunner runner("metrics_format", ops);
+    runner.setBytesPerOp(benchHistogram.format(text, sizeof(text)));
+    runner.run([&](uint64_t) {
+        size_t length = benchHistogram.format(text, sizeof(text));
+        benchKeep(length);
+    });
+}
+
+// Discards what it is sent; the renderer counts the bytes
+class NullDisplay : public Display {
+public:
+    void write(uint8_t, uint8_t, const char* text, uint8_t) override { benchKeep(text); }
+};
+
+// One LCD refresh: format both rows and send what changed. The distance
+// changes every eighth refresh, the rest are static, like a quiet room.
+// Bytes per op are the bytes sent to the display.
+#define BENCH_LCD_SAMPLE 64
+
+void benchLcdRefresh(uint64_t ops) {
+    NullDisplay display;
+    StatusReport report = sampleReport();
+    char rows[DISPLAY_ROWS][DISPLAY_COLS + 1];
+    auto refresh = [&](DisplayRenderer& renderer, uint64_t i) {
+        report.status.distance1 = 180 + static_cast<int>((i >> 3) & 7);
+        formatStatusRows(report.status, rows);
+        return renderer.present(rows);
+    };
+
+    DisplayRenderer sample(display);
+    for (uint64_t i = 0; i < BENCH_LCD_SAMPLE; i++) {
+        refresh(sample, i);
+    }
+    DisplayRenderer renderer(display);
+    BenchRunner runner("lcd_refresh", ops);
+    runner.setBytesPerOp(static_cast<double>(sample.stats().bytes) / BENCH_LCD_SAMPLE);
+    runner.run([&](uint64_t i) { benchKeep(refresh(renderer, i)); });
+}
+
+// Passages folded into the room's occupant distribution and the energy
+// totals; every fourth one is a tandem, so the distribution stays spread
+void benchOccupancyAggregation(uint64_t ops) {
+    RoomState room;
+    EnergyAnalytics energy;
+    OccupancyTracker tracker;
+    memset(&room, 0, sizeof(room));
+    memset(&energy, 0, sizeof(energy));
+
+    BenchRunner("occupancy_aggregation", ops).run([&](uint64_t i) {
+        uint32_t nowMs = static_cast<uint32_t>(i * 1000);
+        Passage passage = {static_cast<int8_t>((i & 1) ? -1 : 1), (i & 3) == 2 ? PASSAGE_TANDEM : PASSAGE_CLEAN,
+                           nowMs - 800, nowMs};
+        tracker.applyPassage(passage);
+        uint32_t sessionMs = roomApplyEstimate(room, tracker, nowMs);
+        if (sessionMs > 0) {
+            updateEnergySavings(energy, sessionMs, BENCH_SENSING.lightPowerWatts);
+        }
+        benchKeep(energy);
+    });
+}
+
+// Compressing one hour-long /api/export block: gaps of one minute, then
+// columns that alternate between an occupied and an empty half hour.
+// Bytes per op are the raw block.
+void benchExportGzip(uint64_t ops) {
+    uint8_t block[6 * 60 + 1];
+    size_t length = 0;
+    block[length++] = 60;
+    for (int column = 0; column < 6; column++) {
+        for (int minute = 0; minute < 60; minute++) {
+            bool occupied = minute < 30;
+            const uint8_t values[6] = {1, static_cast<uint8_t>(occupied ? 100 : 0),
+                                       static_cast<uint8_t>(occupied ? 60 : 0),
+                                       static_cast<uint8_t>(minute == 0), static_cast<uint8_t>(minute == 30),
+                                       static_cast<uint8_t>(occupied)};
+            block[length++] = values[column];
+        }
+    }
+    static GzipEncoder encoder;
+    static uint8_t out[GZIP_OUTPUT_MAX(sizeof(block))];
+    encoder.begin();
+    BenchRunner runner("export_gzip", ops);
+    runner.setBytesPerOp(length);
+    runner.run([&](uint64_t) { benchKeep(encoder.write(block, length, out)); });
+}
+
+// Adding a session and reading p50/p90 back, as the web task does when it
+// drains a finished session and then serves /api/sessions. Lengths cover
+// the sketch from seconds to hours; sessions start every ten minutes.
+void benchSessionLog(uint64_t ops) {
+    static SessionLog log(0);
+    BenchRunner runner("session_log", ops);
+    runner.run([&](uint64_t i) {
+        uint32_t seconds = static_cast<uint32_t>((i * 2654435761UL) % 14400);
+        SessionRecord session = {static_cast<uint32_t>(1704096000 + i * 600), 0, seconds * 1000, 0, 1, 90, 0};
+        session.leftSeconds = session.enteredSeconds + seconds;
+        log.add(session);
+        benchKeep(log.quantileSeconds(50) + log.quantileSeconds(90));
+    });
+}
+
+// Costing sessions of up to three days under a tariff with weekday peaks,
+// weekend rates and a night window, the worst case being a full lap of the
+// week table per session
+void benchEnergyLedger(uint64_t ops) {
+    const TariffConfig tariff = {3, {80000, 150000, 50000}, 3,
+                                 {{17 * 60, 21 * 60, 0x1F, 1}, {8 * 60, 20 * 60, 0x60, 1}, {23 * 60, 7 * 60, 0x7F, 2}},
+                                 500, 60};
+    static EnergyLedger ledger(tariff, 60000);
+    BenchRunner runner("energy_ledger", ops);
+    runner.run([&](uint64_t i) {
+        uint32_t durationMs = static_cast<uint32_t>((i * 2654435761UL) % (3 * 86400000UL));
+        uint32_t left = static_cast<uint32_t>(1704096000 + i * 600);
+        SessionRecord session = {left - durationMs / 1000, left, durationMs, static_cast<uint8_t>(i & 3), 1, 90, 0};
+        ledger.add(session);
+        benchKeep(ledger.totals().microWattSeconds[0][ENERGY_TODAY][0]);
+    });
+}
+
+// Applying a three-field fleet patch to the live config: CRC, record walk
+// and the all-or-nothing copy
+void benchConfigPatch(uint64_t ops) {
+    static DeviceConfig config = {};
+    config.filterMedianTaps = 3;
+    config.filterDebounceSamples = 1;
+    config.thresholdCm = 75;
+    config.sequenceTimeoutMs = 3000;
+    uint8_t patch[CONFIG_HEADER_SIZE + 3 * 6 + 2];
+    memcpy(patch, CONFIG_MAGIC, 4);
+    patch[4] = CONFIG_SCHEMA_MAJOR;
+    patch[5] = CONFIG_SCHEMA_MINOR;
+    putU32(patch + 6, 0);
+    uint8_t* record = patch + CONFIG_HEADER_SIZE;
+    *record++ = 4;
+    *record++ = 2;
+    putU16(record, 80);
+    record += 2;
+    *record++ = 5;
+    *record++ = 4;
+    putU32(record, 2500);
+    record += 4;
+    *record++ = 6;
+    *record++ = 4;
+    putU32(record, 42000);
+    record += 4;
+    size_t length = record - patch;
+    putU16(record, crc16(patch, length));
+    length += 2;
+    BenchRunner runner("config_patch", ops);
+    runner.setBytesPerOp(static_cast<double>(length));
+    runner.run([&](uint64_t) {
+        benchKeep(applyConfigPatch(config, patch, length));
+        benchKeep(config.generation);
+    });
+}
+
+}  // namespace
+
+void runBenchmarks(uint64_t baseOps) {
+    benchSensingStep("sensing_step", BENCH_SENSING, baseOps);
+    benchSensingStep("sensing_step_4door", BENCH_SENSING_4, baseOps);
+    benchTraceRecord(baseOps);
+    benchSignalFilter("signal_filter", 3, baseOps);
+    benchSignalFilter("signal_filter_7", 7, baseOps);
+    benchRangeConversion(baseOps);
+    benchStatusJson(baseOps);
+    benchStatusCbor(baseOps);
+    benchDashboard("dashboard_200", baseOps / 10, false);
+    benchDashboard("dashboard_304", baseOps, true);
+    benchOccupancyAggregation(baseOps);
+    benchLcdRefresh(baseOps);
+    benchMetricsScope(baseOps);
+    benchMetricsFormat(baseOps / 10);
+    benchExportGzip(baseOps / 10);
+    benchSessionLog(baseOps);
+    benchEnergyLedger(baseOps);
+    benchConfigPatch(baseOps);
+}
@@ -0,0 +1,169 @@
+#include "baseline_calibration.h"
+
+#include <string.h>
+
+#include "byte_order.h"
+
+namespace {
+
+// Readings closer than this to the mean are never outliers, however steady
+// the sensor has been
+const int GATE_MIN_CM = 5;
+
+// Ignored readings in a row, in units of minSamples, that mean the empty
+// doorway now looks different
+const uint32_t RELEARN_FACTOR = 8;
+
+// Floor for the standard deviation: the HC-SR04 resolves about a centimetre
+const uint32_t MIN_VARIANCE_Q8 = 256;
+
+uint32_t isqrt(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+}  // namespace
+
+BaselineEstimator::BaselineEstimator() {
+    reset();
+}
+
+void BaselineEstimator::reset() {
+    memset(&state_, 0, sizeof(state_));
+    outliers_ = 0;
+}
+
+bool BaselineEstimator::add(int cm, const BaselineConfig& config) {
+    int32_t sample = static_cast<int32_t>(cm) << 8;
+    if (state_.samples == 0) {
+        state_.meanQ8 = sample;
+        state_.varianceQ8 = 0;
+        state_.samples = 1;
+        return true;
+    }
+
+    int32_t diff = sample - state_.meanQ8;
+    if (calibrated(config)) {
+        // |diff| > sigmaMultiple * sigma, compared squared to skip the root
+        int64_t squared = (static_cast<int64_t>(diff) * diff) >> 8;
+        int64_t gate = static_cast<int64_t>(config.sigmaMultiple) * config.sigmaMultiple *
+                       (state_.varianceQ8 > MIN_VARIANCE_Q8 ? state_.varianceQ8 : MIN_VARIANCE_Q8);
+        if (squared > gate && squared > GATE_MIN_CM * GATE_MIN_CM * 256) {
+            if (++outliers_ >= RELEARN_FACTOR * config.minSamples) {
+                reset();
+            }
+            return false;
+        }
+    }
+    outliers_ = 0;
+
+    if (state_.samples < UINT32_MAX) {
+        state_.samples++;
+    }
+    // Average over the readings so far until the window reaches 2^alphaShift.
+    // Shifts round towards minus infinity, which is well inside the Q8 noise.
+    uint8_t shift = config.alphaShift;
+    if (state_.samples < (1UL << shift)) {
+        shift = 0;
+        while ((2UL << shift) <= state_.samples) {
+            shift++;
+        }
+    }
+    state_.meanQ8 += diff >> shift;
+    int32_t squared = static_cast<int32_t>((static_cast<int64_t>(diff) * diff) >> 8);
+    state_.varianceQ8 += (squared - static_cast<int32_t>(state_.varianceQ8)) >> shift;
+    return true;
+}
+
+int BaselineEstimator::meanCm() const {
+    return (state_.meanQ8 + 128) >> 8;
+}
+
+int BaselineEstimator::sigmaCm() const {
+    uint32_t variance = state_.varianceQ8 > MIN_VARIANCE_Q8 ? state_.varianceQ8 : MIN_VARIANCE_Q8;
+    return (isqrt(variance) + 8) >> 4;  // sqrt of Q8 is Q4
+}
+
+int BaselineEstimator::threshold(const BaselineConfig& config, int fallbackCm) const {
+    if (!config.enabled || !calibrated(config)) {
+        return fallbackCm;
+    }
+    int mean = meanCm();
+    int byShare = mean * config.thresholdPercent / 100;
+    int bySpread = mean - sigmaCm() * config.sigmaMultiple;
+    int threshold = byShare < bySpread ? byShare : bySpread;
+    if (threshold < config.minThresholdCm) {
+        return config.minThresholdCm;
+    }
+    return threshold > config.maxThresholdCm ? config.maxThresholdCm : threshold;
+}
+
+size_t encodeCalibration(const CalibrationSet& set, uint8_t* out, size_t size) {
+    uint8_t count = set.count < CALIBRATION_MAX_SENSORS ? set.count : CALIBRATION_MAX_SENSORS;
+    size_t length = 5 + count * CALIBRATION_RECORD_SIZE + 2;
+    if (size < length) {
+        return 0;
+    }
+    memcpy(out, CALIBRATION_MAGIC, 4);
+    out[4] = count;
+    uint8_t* record = out + 5;
+    for (uint8_t i = 0; i < count; i++, record += CALIBRATION_RECORD_SIZE) {
+        putU32(record, static_cast<uint32_t>(set.sensors[i].meanQ8));
+        putU32(record + 4, set.sensors[i].varianceQ8);
+        putU32(record + 8, set.sensors[i].samples);
+    }
+    putU16(record, crc16(out, length - 2));
+    return length;
+}
+
+bool decodeCalibration(const uint8_t* in, size_t length, CalibrationSet& out) {
+    if (length < 7 || memcmp(in, CALIBRATION_MAGIC, 4) != 0 || in[4] > CALIBRATION_MAX_SENSORS ||
+        length != 5 + in[4] * CALIBRATION_RECORD_SIZE + 2u ||
+        getU16(in + length - 2) != crc16(in, length - 2)) {
+        return false;
+    }
+    memset(&out, 0, sizeof(out));
+    out.count = in[4];
+    const uint8_t* record = in + 5;
+    for (uint8_t i = 0; i < out.count; i++, record += CALIBRATION_RECORD_SIZE) {
+        out.sensors[i].meanQ8 = static_cast<int32_t>(getU32(record));
+        out.sensors[i].varianceQ8 = getU32(record + 4);
+        out.sensors[i].samples = getU32(record + 8);
+    }
+    return true;
+}
+
+bool loadCalibration(Storage& storage, const char* path, CalibrationSet& out) {
+    uint8_t data[CALIBRATION_FILE_MAX];
+    size_t length = storage.size(path);
+    if (length == 0 || length > sizeof(data) || !storage.read(path, 0, data, length)) {
+        return false;
+    }
+    return decodeCalibration(data, length, out);
+}
+
+bool saveCalibration(Storage& storage, const char* path, const CalibrationSet& set) {
+    uint8_t data[CALIBRATION_FILE_MAX];
+    size_t length = encodeCalibration(set, data, sizeof(data));
+    if (length == 0) {
+        return false;
+    }
+    if (storage.size(path) == length) {
+        return storage.write(path, 0, data, length);
+    }
+    storage.remove(path);
+    return storage.append(path, data, length);
+}
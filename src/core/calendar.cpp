@@ -0,0 +1,55 @@
+#include "calendar.h"
+
+// Howard Hinnant's days_from_civil / civil_from_days: eras of 400 years
+// starting on March 1st, which puts the leap day at the end of the year.
+
+int32_t daysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int32_t>(dayOfEra) - 719468;
+}
+
+CivilDate civilFromDays(int32_t days) {
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned mp = (5 * dayOfYear + 2) / 153;
+
+    CivilDate date;
+    date.day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    date.month = mp < 10 ? mp + 3 : mp - 9;
+    date.year = static_cast<int>(yearOfEra) + era * 400 + (date.month <= 2);
+    return date;
+}
+
+unsigned weekdayFromDays(int32_t days) {
+    // 1970-01-01 was a Thursday
+    return static_cast<unsigned>(((days % 7) + 7 + 3) % 7);
+}
+
+int32_t weekStartDay(int32_t days) {
+    return days - static_cast<int32_t>(weekdayFromDays(days));
+}
+
+int32_t localDayFromMinute(uint32_t epochMinute, int32_t utcOffsetMinutes) {
+    int64_t local = static_cast<int64_t>(epochMinute) + utcOffsetMinutes;
+    int64_t day = local / static_cast<int64_t>(MINUTES_PER_DAY);
+    if (local < 0 && local % static_cast<int64_t>(MINUTES_PER_DAY) != 0) {
+        day--;
+    }
+    return static_cast<int32_t>(day);
+}
+
+uint32_t monthIndexFromDays(int32_t days) {
+    CivilDate date = civilFromDays(days);
+    return static_cast<uint32_t>((date.year - 1970) * 12 + date.month - 1);
+}
+
+int32_t daysFromMonthIndex(uint32_t monthIndex) {
+    return daysFromCivil(1970 + monthIndex / 12, monthIndex % 12 + 1, 1);
+}
@@ -0,0 +1,430 @@
+#include "device_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byte_order.h"
+
+#define TEXT_FIELD(tag, name, member, size, flags) \
+    {tag, name, CONFIG_TEXT, offsetof(DeviceConfig, member), size, 0, 0, flags}
+#define NUMBER_FIELD(tag, name, type, member, min, max, flags) \
+    {tag, name, type, offsetof(DeviceConfig, member), sizeof(DeviceConfig::member), min, max, flags}
+#define WEBHOOK_FIELDS(room, tag)                                                                         \
+    TEXT_FIELD(tag, "room" #room "Occupied", webhooks[room][0], CONFIG_URL_MAX, CONFIG_FLAG_REBOOT),      \
+    TEXT_FIELD(tag + 1, "room" #room "Empty", webhooks[room][1], CONFIG_URL_MAX, CONFIG_FLAG_REBOOT)
+#define PIN_FIELDS(channel, tag)                                                                          \
+    {tag, "trig" #channel, CONFIG_UINT, offsetof(DeviceConfig, sensorPins[channel][0]), 1, 0, 255,       \
+     CONFIG_FLAG_REBOOT | CONFIG_FLAG_OUTPUT_PIN},                                                        \
+    {tag + 1, "echo" #channel, CONFIG_UINT, offsetof(DeviceConfig, sensorPins[channel][1]), 1, 0, 255,   \
+     CONFIG_FLAG_REBOOT | CONFIG_FLAG_INPUT_PIN}
+
+static_assert(MAX_ROOMS == 4 && CONFIG_MAX_CHANNELS == 8, "CONFIG_FIELDS lists the webhooks and pins one by one");
+
+const ConfigField CONFIG_FIELDS[] = {
+    TEXT_FIELD(1, "wifiSsid", wifiSsid, sizeof(DeviceConfig::wifiSsid), CONFIG_FLAG_REBOOT),
+    TEXT_FIELD(2, "wifiPassword", wifiPassword, sizeof(DeviceConfig::wifiPassword),
+               CONFIG_FLAG_SECRET | CONFIG_FLAG_REBOOT),
+    TEXT_FIELD(3, "apiToken", apiToken, sizeof(DeviceConfig::apiToken), CONFIG_FLAG_SECRET),
+    NUMBER_FIELD(4, "thresholdCm", CONFIG_INT, thresholdCm, 10, 400, 0),
+    NUMBER_FIELD(5, "sequenceTimeoutMs", CONFIG_UINT, sequenceTimeoutMs, 200, 60000, 0),
+    NUMBER_FIELD(6, "lightMilliwatts", CONFIG_UINT, lightMilliwatts, 0, 10000000, 0),
+    NUMBER_FIELD(7, "filterEnabled", CONFIG_BOOL, filterEnabled, 0, 1, 0),
+    NUMBER_FIELD(8, "filterMedian", CONFIG_UINT, filterMedianTaps, 1, SIGNAL_FILTER_MAX_TAPS, 0),
+    NUMBER_FIELD(9, "filterHysteresisCm", CONFIG_UINT, filterHysteresisCm, 0, 255, 0),
+    NUMBER_FIELD(10, "filterDebounce", CONFIG_UINT, filterDebounceSamples, 1, 255, 0),
+    WEBHOOK_FIELDS(0, 16),
+    WEBHOOK_FIELDS(1, 18),
+    WEBHOOK_FIELDS(2, 20),
+    WEBHOOK_FIELDS(3, 22),
+    PIN_FIELDS(0, 32),
+    PIN_FIELDS(1, 34),
+    PIN_FIELDS(2, 36),
+    PIN_FIELDS(3, 38),
+    PIN_FIELDS(4, 40),
+    PIN_FIELDS(5, 42),
+    PIN_FIELDS(6, 44),
+    PIN_FIELDS(7, 46),
+};
+const uint8_t CONFIG_FIELD_COUNT = sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]);
+
+namespace {
+
+DeviceConfig scratch;   // Changes are made here first, then copied over
+
+const ConfigField* fieldByTag(uint8_t tag) {
+    for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        if (CONFIG_FIELDS[i].tag == tag) {
+            return &CONFIG_FIELDS[i];
+        }
+    }
+    return NULL;
+}
+
+int32_t readNumber(const DeviceConfig& config, const ConfigField& field) {
+    const uint8_t* at = reinterpret_cast<const uint8_t*>(&config) + field.offset;
+    if (field.size == 1) {
+        return field.type == CONFIG_INT ? static_cast<int8_t>(*at) : *at;
+    }
+    if (field.size == 2) {
+        uint16_t value;
+        memcpy(&value, at, 2);
+        return field.type == CONFIG_INT ? static_cast<int16_t>(value) : value;
+    }
+    uint32_t value;
+    memcpy(&value, at, 4);
+    return static_cast<int32_t>(value);
+}
+
+void writeNumber(DeviceConfig& config, const ConfigField& field, int32_t value) {
+    uint8_t* at = reinterpret_cast<uint8_t*>(&config) + field.offset;
+    if (field.type == CONFIG_BOOL) {
+        bool flag = value != 0;
+        memcpy(at, &flag, 1);
+    } else if (field.size == 1) {
+        *at = static_cast<uint8_t>(value);
+    } else if (field.size == 2) {
+        uint16_t narrow = static_cast<uint16_t>(value);
+        memcpy(at, &narrow, 2);
+    } else {
+        uint32_t wide = static_cast<uint32_t>(value);
+        memcpy(at, &wide, 4);
+    }
+}
+
+bool inRange(const ConfigField& field, int64_t value) {
+    if (value < field.min || value > field.max) {
+        return false;
+    }
+    if (!(field.flags & (CONFIG_FLAG_OUTPUT_PIN | CONFIG_FLAG_INPUT_PIN)) || value == CONFIG_NO_PIN) {
+        return true;
+    }
+    uint64_t pins = field.flags & CONFIG_FLAG_OUTPUT_PIN ? CONFIG_OUTPUT_PINS : CONFIG_INPUT_PINS;
+    return value < 64 && ((pins >> value) & 1);
+}
+
+size_t finished(int length, size_t size) {
+    return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+}  // namespace
+
+const ConfigField* findConfigField(const char* name) {
+    for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        if (strcmp(CONFIG_FIELDS[i].name, name) == 0) {
+            return &CONFIG_FIELDS[i];
+        }
+    }
+    return NULL;
+}
+
+bool parseConfigValue(DeviceConfig& config, const ConfigField& field, const char* text) {
+    if (field.type == CONFIG_TEXT) {
+        size_t length = strlen(text);
+        if (length >= field.size) {
+            return false;
+        }
+        char* at = reinterpret_cast<char*>(&config) + field.offset;
+        memset(at, 0, field.size);
+        memcpy(at, text, length);
+        return true;
+    }
+    int64_t value;
+    if (field.type == CONFIG_BOOL && (strcmp(text, "true") == 0 || strcmp(text, "false") == 0)) {
+        value = text[0] == 't';
+    } else {
+        char* end;
+        value = strtoll(text, &end, 10);
+        if (end == text || *end != '\0') {
+            return false;
+        }
+    }
+    if (!inRange(field, value)) {
+        return false;
+    }
+    writeNumber(config, field, static_cast<int32_t>(value));
+    return true;
+}
+
+size_t formatConfigField(const DeviceConfig& config, const ConfigField& field, bool first, char* out, size_t size) {
+    size_t length = finished(snprintf(out, size, "%s\"%s\":", first ? "" : ",", field.name), size);
+    if (length == 0) {
+        return 0;
+    }
+    if (field.type == CONFIG_BOOL) {
+        return length + finished(snprintf(out + length, size - length, "%s",
+                                          readNumber(config, field) ? "true" : "false"),
+                                 size - length);
+    }
+    if (field.type != CONFIG_TEXT) {
+        return length + finished(snprintf(out + length, size - length, "%ld",
+                                          static_cast<long>(readNumber(config, field))),
+                                 size - length);
+    }
+
+    const char* text = reinterpret_cast<const char*>(&config) + field.offset;
+    if (field.flags & CONFIG_FLAG_SECRET) {
+        text = text[0] ? "***" : "";
+    }
+    if (length + 2 >= size) {
+        return 0;
+    }
+    out[length++] = '"';
+    for (; *text; text++) {
+        unsigned char c = static_cast<unsigned char>(*text);
+        size_t piece = c == '"' || c == '\\' ? 2 : (c < 0x20 ? 6 : 1);
+        if (length + piece + 1 >= size) {
+            return 0;
+        }
+        if (piece == 2) {
+            out[length++] = '\\';
+            out[length++] = c;
+        } else if (piece == 6) {
+            length += snprintf(out + length, size - length, "\\u%04x", c);
+        } else {
+            out[length++] = c;
+        }
+    }
+    out[length++] = '"';
+    out[length] = '\0';
+    return length;
+}
+
+size_t encodeDeviceConfig(const DeviceConfig& config, uint8_t* out, size_t size) {
+    if (size < CONFIG_HEADER_SIZE + 2) {
+        return 0;
+    }
+    memcpy(out, CONFIG_MAGIC, 4);
+    out[4] = CONFIG_SCHEMA_MAJOR;
+    out[5] = CONFIG_SCHEMA_MINOR;
+    putU32(out + 6, config.generation);
+    size_t length = CONFIG_HEADER_SIZE;
+    for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        const ConfigField& field = CONFIG_FIELDS[i];
+        const uint8_t* value = reinterpret_cast<const uint8_t*>(&config) + field.offset;
+        size_t valueLength = field.type == CONFIG_TEXT ? strnlen(reinterpret_cast<const char*>(value), field.size - 1)
+                                                       : field.size;
+        if (length + 2 + valueLength + 2 > size) {
+            return 0;
+        }
+        out[length++] = field.tag;
+        out[length++] = static_cast<uint8_t>(valueLength);
+        if (field.type == CONFIG_TEXT) {
+            memcpy(out + length, value, valueLength);
+        } else if (field.size == 4) {
+            putU32(out + length, static_cast<uint32_t>(readNumber(config, field)));
+        } else if (field.size == 2) {
+            putU16(out + length, static_cast<uint16_t>(readNumber(config, field)));
+        } else {
+            out[length] = static_cast<uint8_t>(readNumber(config, field));
+        }
+        length += valueLength;
+    }
+    putU16(out + length, crc16(out, length));
+    return length + 2;
+}
+
+ConfigResult decodeDeviceConfig(const uint8_t* in, size_t length, DeviceConfig& config, uint32_t& generation) {
+    if (length < CONFIG_HEADER_SIZE + 2 || memcmp(in, CONFIG_MAGIC, 4) != 0 ||
+        getU16(in + length - 2) != crc16(in, length - 2)) {
+        return CONFIG_BAD_FORMAT;
+    }
+    if (in[4] != CONFIG_SCHEMA_MAJOR) {
+        return CONFIG_BAD_VERSION;
+    }
+
+    // Into a copy, so a bad record leaves config as it was
+    DeviceConfig& updated = scratch;
+    updated = config;
+    size_t end = length - 2;
+    size_t pos = CONFIG_HEADER_SIZE;
+    while (pos < end) {
+        if (end - pos < 2 || end - pos - 2 < in[pos + 1]) {
+            return CONFIG_BAD_FORMAT;
+        }
+        uint8_t tag = in[pos];
+        uint8_t valueLength = in[pos + 1];
+        const uint8_t* value = in + pos + 2;
+        pos += 2 + valueLength;
+
+        const ConfigField* field = fieldByTag(tag);
+        if (!field) {
+            continue;   // From a newer minor version
+        }
+        if (field->type == CONFIG_TEXT) {
+            if (valueLength >= field->size || memchr(value, '\0', valueLength)) {
+                return CONFIG_BAD_FIELD;
+            }
+            char* at = reinterpret_cast<char*>(&updated) + field->offset;
+            memset(at, 0, field->size);
+            memcpy(at, value, valueLength);
+            continue;
+        }
+        if (valueLength != field->size) {
+            return CONFIG_BAD_FIELD;
+        }
+        int64_t number;
+        if (field->size == 4) {
+            number = field->type == CONFIG_INT ? static_cast<int32_t>(getU32(value)) : getU32(value);
+        } else if (field->size == 2) {
+            number = field->type == CONFIG_INT ? static_cast<int16_t>(getU16(value)) : getU16(value);
+        } else {
+            number = field->type == CONFIG_INT ? static_cast<int8_t>(value[0]) : value[0];
+        }
+        if (!inRange(*field, number)) {
+            return CONFIG_BAD_FIELD;
+        }
+        writeNumber(updated, *field, static_cast<int32_t>(number));
+    }
+    generation = getU32(in + 6);
+    config = updated;
+    return CONFIG_OK;
+}
+
+ConfigResult applyConfigPatch(DeviceConfig& config, const uint8_t* in, size_t length) {
+    // Checked up front, so a stale patch changes nothing
+    if (length >= CONFIG_HEADER_SIZE + 2 && memcmp(in, CONFIG_MAGIC, 4) == 0 &&
+        getU16(in + length - 2) == crc16(in, length - 2)) {
+        uint32_t base = getU32(in + 6);
+        if (base != 0 && base != config.generation) {
+            return CONFIG_STALE;
+        }
+    }
+    uint32_t generation;
+    ConfigResult result = decodeDeviceConfig(in, length, config, generation);
+    if (result == CONFIG_OK) {
+        config.generation++;
+    }
+    return result;
+}
+
+ConfigResult applyConfigForm(DeviceConfig& config, const HttpRequest& request) {
+    DeviceConfig& updated = scratch;
+    updated = config;
+    uint8_t given = 0;
+    for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        const char* value = request.arg(CONFIG_FIELDS[i].name);
+        if (!value) {
+            continue;
+        }
+        if (!parseConfigValue(updated, CONFIG_FIELDS[i], value)) {
+            return CONFIG_BAD_FIELD;
+        }
+        given++;
+    }
+    if (given == 0) {
+        return CONFIG_BAD_FIELD;
+    }
+    config = updated;
+    config.generation++;
+    return CONFIG_OK;
+}
+
+bool configNeedsReboot(const DeviceConfig& before, const DeviceConfig& after) {
+    for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        const ConfigField& field = CONFIG_FIELDS[i];
+        if ((field.flags & CONFIG_FLAG_REBOOT) &&
+            memcmp(reinterpret_cast<const uint8_t*>(&before) + field.offset,
+                   reinterpret_cast<const uint8_t*>(&after) + field.offset, field.size) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool configAuthorized(const DeviceConfig& config, const char* authorization) {
+    size_t tokenLength = strnlen(config.apiToken, sizeof(config.apiToken));
+    if (tokenLength == 0 || !authorization || strncmp(authorization, "Bearer ", 7) != 0) {
+        return false;
+    }
+    const char* given = authorization + 7;
+    size_t givenLength = strlen(given);
+    uint8_t difference = givenLength != tokenLength;
+    for (size_t i = 0; i < tokenLength; i++) {
+        difference |= config.apiToken[i] ^ (i < givenLength ? given[i] : 0);
+    }
+    return difference == 0;
+}
+
+DoorwayConfig configDoorway(const DeviceConfig& config) {
+    return DoorwayConfig{config.thresholdCm, config.sequenceTimeoutMs};
+}
+
+SignalFilterConfig configFilter(const DeviceConfig& config) {
+    return sanitizeSignalFilter(SignalFilterConfig{config.filterEnabled, config.filterMedianTaps,
+                                                   config.filterHysteresisCm, config.filterDebounceSamples});
+}
+
+float configLightWatts(const DeviceConfig& config) {
+    return config.lightMilliwatts / 1000.0f;
+}
+
+namespace {
+
+// The two files a config alternates between: path and path.2
+void slotPath(const char* path, uint8_t slot, char* out, size_t size) {
+    snprintf(out, size, slot == 0 ? "%s" : "%s.2", path);
+}
+
+// Reads a slot into data; its length, 0 if missing or torn (bad CRC)
+size_t readSlot(Storage& storage, const char* path, uint8_t slot, uint8_t* data, uint32_t& generation) {
+    char name[48];
+    slotPath(path, slot, name, sizeof(name));
+    size_t length = storage.size(name);
+    if (length < CONFIG_HEADER_SIZE + 2 || length > CONFIG_BLOB_MAX || !storage.read(name, 0, data, length) ||
+        memcmp(data, CONFIG_MAGIC, 4) != 0 || getU16(data + length - 2) != crc16(data, length - 2)) {
+        return 0;
+    }
+    generation = getU32(data + 6);
+    return length;
+}
+
+// The slot holding the newest intact config, -1 if neither does
+int newestSlot(Storage& storage, const char* path, uint8_t* data) {
+    uint32_t generations[2];
+    bool intact[2];
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        intact[slot] = readSlot(storage, path, slot, data, generations[slot]) > 0;
+    }
+    if (!intact[0] || !intact[1]) {
+        return intact[0] ? 0 : (intact[1] ? 1 : -1);
+    }
+    return static_cast<int32_t>(generations[1] - generations[0]) > 0 ? 1 : 0;
+}
+
+}  // namespace
+
+bool loadDeviceConfig(Storage& storage, const char* path, DeviceConfig& config) {
+    static uint8_t data[CONFIG_BLOB_MAX];
+    int newest = newestSlot(storage, path, data);
+    if (newest < 0) {
+        return false;
+    }
+    // The other slot is the one saved before, should the newest not decode
+    for (uint8_t attempt = 0; attempt < 2; attempt++) {
+        uint8_t slot = attempt == 0 ? newest : 1 - newest;
+        uint32_t generation;
+        size_t length = readSlot(storage, path, slot, data, generation);
+        if (length > 0 && decodeDeviceConfig(data, length, config, generation) == CONFIG_OK) {
+            config.generation = generation;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool saveDeviceConfig(Storage& storage, const char* path, const DeviceConfig& config) {
+    static uint8_t data[CONFIG_BLOB_MAX];
+    uint8_t slot = newestSlot(storage, path, data) == 0 ? 1 : 0;
+    size_t length = encodeDeviceConfig(config, data, sizeof(data));
+    if (length == 0) {
+        return false;
+    }
+    char name[48];
+    slotPath(path, slot, name, sizeof(name));
+    if (storage.size(name) == length) {
+        return storage.write(name, 0, data, length);
+    }
+    storage.remove(name);
+    return storage.append(name, data, length);
+}
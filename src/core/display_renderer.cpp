@@ -0,0 +1,47 @@
+#include "display_renderer.h"
+
+#include <string.h>
+
+DisplayRenderer::DisplayRenderer(Display& display) : display_(display), valid_(false) {
+    memset(shown_, ' ', sizeof(shown_));
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void DisplayRenderer::invalidate() {
+    valid_ = false;
+}
+
+uint32_t DisplayRenderer::present(const char rows[DISPLAY_ROWS][DISPLAY_COLS + 1]) {
+    uint32_t sent = 0;
+    for (uint8_t row = 0; row < DISPLAY_ROWS; row++) {
+        const char* text = rows[row];
+        char* shown = shown_[row];
+        uint8_t col = 0;
+        while (col < DISPLAY_COLS) {
+            if (valid_ && text[col] == shown[col]) {
+                col++;
+                continue;
+            }
+            // Extend the span over later changes separated by at most
+            // DISPLAY_SPAN_GAP unchanged characters
+            uint8_t end = col + 1;
+            uint8_t scan = end;
+            while (scan < DISPLAY_COLS && scan - end <= DISPLAY_SPAN_GAP) {
+                if (!valid_ || text[scan] != shown[scan]) {
+                    end = scan + 1;
+                }
+                scan++;
+            }
+            uint8_t length = end - col;
+            display_.write(row, col, text + col, length);
+            memcpy(shown + col, text + col, length);
+            stats_.spans++;
+            sent += 1 + length;
+            col = end;
+        }
+    }
+    valid_ = true;
+    stats_.frames++;
+    stats_.bytes += sent;
+    return sent;
+}
@@ -0,0 +1,36 @@
+#include "energy_analytics.h"
+
+#include "calendar.h"
+
+float sessionEnergyKwh(uint32_t sessionMs, float lightPowerWatts) {
+    float hoursOccupied = sessionMs / 3600000.0f;
+    return lightPowerWatts * hoursOccupied / 1000.0f;
+}
+
+void updateEnergySavings(EnergyAnalytics& energy, uint32_t sessionMs, float lightPowerWatts) {
+    float kwh = sessionEnergyKwh(sessionMs, lightPowerWatts);
+    energy.energySavedToday += kwh;
+    energy.energySavedWeek += kwh;
+    energy.energySavedMonth += kwh;
+    energy.energySavedYear += kwh;
+}
+
+void resetDailyEnergy(EnergyAnalytics& energy) {
+    energy.energySavedToday = 0;
+}
+
+void rollEnergyPeriods(EnergyAnalytics& energy, int32_t fromDay, int32_t toDay) {
+    if (toDay <= fromDay) {
+        return;
+    }
+    resetDailyEnergy(energy);
+    if (weekStartDay(toDay) != weekStartDay(fromDay)) {
+        energy.energySavedWeek = 0;
+    }
+    if (monthIndexFromDays(toDay) != monthIndexFromDays(fromDay)) {
+        energy.energySavedMonth = 0;
+    }
+    if (civilFromDays(toDay).year != civilFromDays(fromDay).year) {
+        energy.energySavedYear = 0;
+    }
+}
@@ -0,0 +1,380 @@
+#include "energy_ledger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byte_order.h"
+#include "calendar.h"
+
+namespace {
+
+const uint32_t DAY_MS = 86400000UL;
+const uint32_t WEEK_MS = 7 * DAY_MS;
+const uint64_t MICRO_WATT_SECONDS_PER_MWH = 3600000ULL;
+const size_t LIGHTS_FILE_MAX = 1024;
+
+// Band in force at a local minute of the week (0 = Monday 00:00)
+uint8_t bandAt(const TariffConfig& tariff, uint32_t weekMinute) {
+    uint8_t day = weekMinute / MINUTES_PER_DAY;
+    uint16_t minute = weekMinute % MINUTES_PER_DAY;
+    for (uint8_t i = 0; i < tariff.windowCount; i++) {
+        const TariffWindow& window = tariff.windows[i];
+        if (!(window.weekdays & (1 << day))) {
+            continue;
+        }
+        bool inside = window.startMinute < window.endMinute
+                          ? minute >= window.startMinute && minute < window.endMinute
+                          : minute >= window.startMinute || minute < window.endMinute;
+        if (inside) {
+            return window.band;
+        }
+    }
+    return 0;
+}
+
+void putU64(uint8_t* out, uint64_t value) {
+    putU32(out, static_cast<uint32_t>(value));
+    putU32(out + 4, static_cast<uint32_t>(value >> 32));
+}
+
+uint64_t getU64(const uint8_t* in) {
+    return getU32(in) | (static_cast<uint64_t>(getU32(in + 4)) << 32);
+}
+
+size_t finished(int length, size_t size) {
+    return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+// A millionths value with all six decimals, so nothing is rounded away
+size_t formatMicros(uint64_t value, char* out, size_t size) {
+    return finished(snprintf(out, size, "%lu.%06lu", static_cast<unsigned long>(value / 1000000),
+                             static_cast<unsigned long>(value % 1000000)),
+                    size);
+}
+
+}  // namespace
+
+EnergyLedger::EnergyLedger(const TariffConfig& tariff, uint32_t defaultRoomMilliwatts)
+    : defaultRoomMilliwatts_(defaultRoomMilliwatts) {
+    memset(&tariff_, 0, sizeof(tariff_));
+    tariff_.bandCount = 1;
+    buildSegments();
+    setTariff(tariff);
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        roomMilliwatts_[room] = defaultRoomMilliwatts;
+        lit_[room] = false;
+    }
+    memset(&totals_, 0, sizeof(totals_));
+    totals_.day = INT32_MIN;
+}
+
+bool EnergyLedger::setTariff(const TariffConfig& tariff) {
+    if (tariff.bandCount == 0 || tariff.bandCount > TARIFF_MAX_BANDS || tariff.windowCount > TARIFF_MAX_WINDOWS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < tariff.windowCount; i++) {
+        const TariffWindow& window = tariff.windows[i];
+        if (window.band >= tariff.bandCount || window.startMinute >= MINUTES_PER_DAY ||
+            window.endMinute > MINUTES_PER_DAY) {
+            return false;
+        }
+    }
+    tariff_ = tariff;
+    buildSegments();
+    return true;
+}
+
+// Every window edge on every day is a possible boundary; the band between
+// two neighbouring edges is constant, and neighbours with the same band merge
+void EnergyLedger::buildSegments() {
+    uint32_t edges[TARIFF_MAX_SEGMENTS];
+    uint8_t edgeCount = 0;
+    edges[edgeCount++] = 0;
+    for (uint8_t day = 0; day < 7; day++) {
+        for (uint8_t i = 0; i < tariff_.windowCount; i++) {
+            edges[edgeCount++] = day * MINUTES_PER_DAY + tariff_.windows[i].startMinute;
+            edges[edgeCount++] = day * MINUTES_PER_DAY + tariff_.windows[i].endMinute % MINUTES_PER_DAY;
+        }
+    }
+    // Insertion sort; there are at most TARIFF_MAX_SEGMENTS
+    for (uint8_t i = 1; i < edgeCount; i++) {
+        uint32_t edge = edges[i];
+        uint8_t j = i;
+        for (; j > 0 && edges[j - 1] > edge; j--) {
+            edges[j] = edges[j - 1];
+        }
+        edges[j] = edge;
+    }
+
+    segmentCount_ = 0;
+    for (uint8_t i = 0; i < edgeCount; i++) {
+        if (i > 0 && edges[i] == edges[i - 1]) {
+            continue;
+        }
+        uint8_t band = bandAt(tariff_, edges[i]);
+        if (segmentCount_ > 0 && segments_[segmentCount_ - 1].band == band) {
+            continue;
+        }
+        segments_[segmentCount_].startMs = edges[i] * 60000UL;
+        segments_[segmentCount_].band = band;
+        segmentCount_++;
+    }
+
+    memset(weekMs_, 0, sizeof(weekMs_));
+    for (uint8_t i = 0; i < segmentCount_; i++) {
+        uint32_t endMs = i + 1 < segmentCount_ ? segments_[i + 1].startMs : WEEK_MS;
+        weekMs_[segments_[i].band] += endMs - segments_[i].startMs;
+    }
+}
+
+void EnergyLedger::setLights(const LightProfile* lights, size_t count) {
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        roomMilliwatts_[room] = 0;
+        lit_[room] = false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (lights[i].room < MAX_ROOMS) {
+            roomMilliwatts_[lights[i].room] += lights[i].milliwatts;
+            lit_[lights[i].room] = true;
+        }
+    }
+    setDefaultRoomMilliwatts(defaultRoomMilliwatts_);
+}
+
+void EnergyLedger::setDefaultRoomMilliwatts(uint32_t milliwatts) {
+    defaultRoomMilliwatts_ = milliwatts;
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        if (!lit_[room]) {
+            roomMilliwatts_[room] = milliwatts;
+        }
+    }
+}
+
+void EnergyLedger::addEnergy(uint8_t room, uint8_t band, uint64_t microWattSeconds) {
+    for (uint8_t period = 0; period < ENERGY_PERIODS; period++) {
+        totals_.microWattSeconds[room][period][band] += microWattSeconds;
+    }
+}
+
+void EnergyLedger::add(const SessionRecord& session) {
+    if (session.room >= MAX_ROOMS) {
+        return;
+    }
+    uint64_t milliwatts = roomMilliwatts_[session.room];
+    uint32_t remainingMs = session.durationMs;
+    if (session.leftSeconds == 0) {
+        // No wall clock, so no time of day: the base rate
+        addEnergy(session.room, 0, milliwatts * remainingMs);
+        return;
+    }
+    rollTo(localDayFromMinute(session.leftSeconds / 60, tariff_.utcOffsetMinutes));
+
+    uint32_t weeks = remainingMs / WEEK_MS;
+    if (weeks > 0) {
+        for (uint8_t band = 0; band < tariff_.bandCount; band++) {
+            addEnergy(session.room, band, milliwatts * weekMs_[band] * weeks);
+        }
+        remainingMs -= weeks * WEEK_MS;
+    }
+
+    // Whole weeks later the position in the week is the same as at the start
+    int64_t startMs = static_cast<int64_t>(session.leftSeconds) * 1000 - session.durationMs +
+                      static_cast<int64_t>(tariff_.utcOffsetMinutes) * 60000;
+    int64_t day = startMs / DAY_MS - (startMs < 0 && startMs % DAY_MS != 0 ? 1 : 0);
+    uint32_t weekMs = weekdayFromDays(static_cast<int32_t>(day)) * DAY_MS +
+                      static_cast<uint32_t>(startMs - day * static_cast<int64_t>(DAY_MS));
+    uint8_t segment = segmentCount_ - 1;
+    while (segment > 0 && segments_[segment].startMs > weekMs) {
+        segment--;
+    }
+    while (remainingMs > 0) {
+        uint32_t endMs = segment + 1 < segmentCount_ ? segments_[segment + 1].startMs : WEEK_MS;
+        uint32_t pieceMs = endMs - weekMs < remainingMs ? endMs - weekMs : remainingMs;
+        addEnergy(session.room, segments_[segment].band, milliwatts * pieceMs);
+        remainingMs -= pieceMs;
+        weekMs = endMs;
+        if (++segment == segmentCount_) {
+            segment = 0;
+            weekMs = 0;
+        }
+    }
+}
+
+void EnergyLedger::rollTo(int32_t day) {
+    int32_t fromDay = totals_.day;
+    if (day <= fromDay) {
+        return;
+    }
+    totals_.day = day;
+    if (fromDay == INT32_MIN) {
+        return;
+    }
+    bool restart[ENERGY_PERIODS] = {
+        true,
+        weekStartDay(day) != weekStartDay(fromDay),
+        monthIndexFromDays(day) != monthIndexFromDays(fromDay),
+        civilFromDays(day).year != civilFromDays(fromDay).year,
+        false,
+    };
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        for (uint8_t period = 0; period < ENERGY_PERIODS; period++) {
+            if (restart[period]) {
+                memset(totals_.microWattSeconds[room][period], 0, sizeof(totals_.microWattSeconds[room][period]));
+            }
+        }
+    }
+}
+
+EnergyReport EnergyLedger::report(uint8_t room, uint8_t period) const {
+    EnergyReport report;
+    memset(&report, 0, sizeof(report));
+    for (uint8_t band = 0; band < tariff_.bandCount; band++) {
+        uint64_t microWattSeconds = 0;
+        for (uint8_t i = 0; i < MAX_ROOMS; i++) {
+            if (room == ENERGY_ALL_ROOMS || room == i) {
+                microWattSeconds += totals_.microWattSeconds[i][period][band];
+            }
+        }
+        uint64_t milliwattHours = microWattSeconds / MICRO_WATT_SECONDS_PER_MWH;
+        report.bandMilliwattHours[band] = milliwattHours;
+        report.milliwattHours += milliwattHours;
+        // mWh are millionths of a kWh, so a price per kWh in millionths
+        // gives the cost in millionths after dividing by a million
+        report.costMicros += milliwattHours * tariff_.priceMicrosPerKwh[band] / 1000000;
+    }
+    report.co2Milligrams = report.milliwattHours * tariff_.co2GramsPerKwh / 1000;
+    return report;
+}
+
+size_t parseLightProfiles(const char* text, size_t length, LightProfile* out, size_t max) {
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos < length && count < max) {
+        char line[64];
+        size_t lineLength = 0;
+        while (pos < length && text[pos] != '\n') {
+            if (lineLength < sizeof(line) - 1) {
+                line[lineLength++] = text[pos];
+            }
+            pos++;
+        }
+        pos++;
+        line[lineLength] = '\0';
+
+        char* cursor = line;
+        while (*cursor == ' ' || *cursor == '\t') {
+            cursor++;
+        }
+        if (*cursor == '\0' || *cursor == '#' || *cursor == '\r') {
+            continue;
+        }
+        char* end;
+        long room = strtol(cursor, &end, 10);
+        if (end == cursor || room < 0 || room >= MAX_ROOMS) {
+            continue;
+        }
+        cursor = end;
+        double watts = strtod(cursor, &end);
+        if (end == cursor || watts <= 0 || watts > 100000) {
+            continue;
+        }
+        out[count].room = static_cast<uint8_t>(room);
+        out[count].milliwatts = static_cast<uint32_t>(watts * 1000 + 0.5);
+        count++;
+    }
+    return count;
+}
+
+size_t loadLightProfiles(Storage& storage, const char* path, LightProfile* out, size_t max) {
+    char text[LIGHTS_FILE_MAX];
+    size_t length = storage.size(path);
+    if (length == 0 || length > sizeof(text) || !storage.read(path, 0, text, length)) {
+        return 0;
+    }
+    return parseLightProfiles(text, length, out, max);
+}
+
+bool loadLedger(Storage& storage, const char* path, LedgerTotals& out) {
+    uint8_t data[LEDGER_FILE_MAX];
+    if (storage.size(path) != sizeof(data) || !storage.read(path, 0, data, sizeof(data)) ||
+        memcmp(data, LEDGER_MAGIC, 4) != 0 || getU16(data + sizeof(data) - 2) != crc16(data, sizeof(data) - 2)) {
+        return false;
+    }
+    out.day = static_cast<int32_t>(getU32(data + 4));
+    const uint8_t* value = data + 8;
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        for (uint8_t period = 0; period < ENERGY_PERIODS; period++) {
+            for (uint8_t band = 0; band < TARIFF_MAX_BANDS; band++, value += 8) {
+                out.microWattSeconds[room][period][band] = getU64(value);
+            }
+        }
+    }
+    return true;
+}
+
+// Rewritten in place like the calibration; a reset during the write leaves a
+// CRC mismatch and the totals start over
+bool saveLedger(Storage& storage, const char* path, const LedgerTotals& totals) {
+    uint8_t data[LEDGER_FILE_MAX];
+    memcpy(data, LEDGER_MAGIC, 4);
+    putU32(data + 4, static_cast<uint32_t>(totals.day));
+    uint8_t* value = data + 8;
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        for (uint8_t period = 0; period < ENERGY_PERIODS; period++) {
+            for (uint8_t band = 0; band < TARIFF_MAX_BANDS; band++, value += 8) {
+                putU64(value, totals.microWattSeconds[room][period][band]);
+            }
+        }
+    }
+    putU16(value, crc16(data, sizeof(data) - 2));
+    if (storage.size(path) == sizeof(data)) {
+        return storage.write(path, 0, data, sizeof(data));
+    }
+    storage.remove(path);
+    return storage.append(path, data, sizeof(data));
+}
+
+size_t formatEnergyJson(const EnergyLedger& ledger, uint8_t room, uint8_t roomCount, char* out, size_t size) {
+    static const char* const PERIOD_NAMES[ENERGY_PERIODS] = {"today", "week", "month", "year", "lifetime"};
+    const TariffConfig& tariff = ledger.tariff();
+    uint32_t milliwatts = 0;
+    for (uint8_t i = 0; i < roomCount && i < MAX_ROOMS; i++) {
+        milliwatts += room == ENERGY_ALL_ROOMS || room == i ? ledger.roomMilliwatts(i) : 0;
+    }
+
+    size_t length = 0;
+    if (room == ENERGY_ALL_ROOMS) {
+        length = finished(snprintf(out, size, "{\"room\":\"all\","), size);
+    } else {
+        length = finished(snprintf(out, size, "{\"room\":%u,", room), size);
+    }
+    length += finished(snprintf(out + length, size - length, "\"lightWatts\":"), size - length);
+    length += formatMicros(static_cast<uint64_t>(milliwatts) * 1000, out + length, size - length);
+    length += finished(snprintf(out + length, size - length, ",\"pricesPerKwh\":["), size - length);
+    for (uint8_t band = 0; band < tariff.bandCount; band++) {
+        length += finished(snprintf(out + length, size - length, "%s", band ? "," : ""), size - length);
+        length += formatMicros(tariff.priceMicrosPerKwh[band], out + length, size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "],\"co2KgPerKwh\":"), size - length);
+    length += formatMicros(static_cast<uint64_t>(tariff.co2GramsPerKwh) * 1000, out + length, size - length);
+
+    for (uint8_t period = 0; period < ENERGY_PERIODS; period++) {
+        EnergyReport report = ledger.report(room, period);
+        length += finished(snprintf(out + length, size - length, ",\"%s\":{\"kwh\":", PERIOD_NAMES[period]),
+                           size - length);
+        length += formatMicros(report.milliwattHours, out + length, size - length);
+        length += finished(snprintf(out + length, size - length, ",\"cost\":"), size - length);
+        length += formatMicros(report.costMicros, out + length, size - length);
+        length += finished(snprintf(out + length, size - length, ",\"co2Kg\":"), size - length);
+        length += formatMicros(report.co2Milligrams, out + length, size - length);
+        length += finished(snprintf(out + length, size - length, ",\"bandKwh\":["), size - length);
+        for (uint8_t band = 0; band < tariff.bandCount; band++) {
+            length += finished(snprintf(out + length, size - length, "%s", band ? "," : ""), size - length);
+            length += formatMicros(report.bandMilliwattHours[band], out + length, size - length);
+        }
+        length += finished(snprintf(out + length, size - length, "]}"), size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "}"), size - length);
+    return length < size - 1 ? length : 0;
+}
@@ -0,0 +1,199 @@
+#include "gzip_encoder.h"
+
+#include <string.h>
+
+#include "byte_order.h"
+
+namespace {
+
+const uint16_t MIN_MATCH = 3;
+const uint16_t MAX_MATCH = 258;
+const uint16_t END_OF_BLOCK = 256;
+
+// Match lengths 3..258 as codes 257..285 plus extra bits (RFC 1951 3.2.5)
+const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DISTANCE_BASE[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+uint32_t prefixHash(const uint8_t* p) {
+    uint32_t key = (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+    return static_cast<uint32_t>(key * 2654435761UL) >> (32 - GZIP_HASH_BITS);
+}
+
+}  // namespace
+
+GzipEncoder::GzipEncoder() {
+    begin();
+}
+
+void GzipEncoder::begin() {
+    memset(head_, 0, sizeof(head_));
+    history_ = 0;
+    started_ = false;
+    crc_ = 0;
+    inputSize_ = 0;
+    bits_ = 0;
+    bitCount_ = 0;
+    out_ = NULL;
+    outLength_ = 0;
+}
+
+// Deflate packs bits from the least significant end
+void GzipEncoder::putBits(uint32_t value, uint8_t count) {
+    bits_ |= value << bitCount_;
+    bitCount_ += count;
+    while (bitCount_ >= 8) {
+        out_[outLength_++] = static_cast<uint8_t>(bits_);
+        bits_ >>= 8;
+        bitCount_ -= 8;
+    }
+}
+
+// Huffman codes go most significant bit first
+void GzipEncoder::putHuffman(uint16_t code, uint8_t length) {
+    uint16_t reversed = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    putBits(reversed, length);
+}
+
+// Fixed literal/length table: 0..143 8 bits, 144..255 9 bits, 256..279 7
+// bits, 280..287 8 bits
+void GzipEncoder::putLiteral(uint8_t value) {
+    if (value < 144) {
+        putHuffman(0x30 + value, 8);
+    } else {
+        putHuffman(0x190 + (value - 144), 9);
+    }
+}
+
+void GzipEncoder::putMatch(uint16_t length, uint16_t distance) {
+    uint8_t code = 28;
+    while (LENGTH_BASE[code] > length) {
+        code--;
+    }
+    uint16_t symbol = 257 + code;
+    if (symbol < 280) {
+        putHuffman(symbol - 256, 7);
+    } else {
+        putHuffman(0xC0 + (symbol - 280), 8);
+    }
+    putBits(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (DISTANCE_BASE[code] > distance) {
+        code--;
+    }
+    putHuffman(code, 5);
+    putBits(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+// gzip member header (deflate, no name, unknown OS) and the opening of the
+// one fixed-Huffman block that carries all the data
+size_t GzipEncoder::start(uint8_t* out) {
+    static const uint8_t HEADER[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+    memcpy(out, HEADER, sizeof(HEADER));
+    out_ = out;
+    outLength_ = sizeof(HEADER);
+    putBits(0, 1);  // Not the final block
+    putBits(1, 2);  // Fixed Huffman codes
+    started_ = true;
+    return outLength_;
+}
+
+size_t GzipEncoder::write(const uint8_t* data, size_t length, uint8_t* out) {
+    out_ = out;
+    outLength_ = 0;
+    if (!started_) {
+        start(out);
+    }
+    if (length > GZIP_INPUT_MAX) {
+        length = GZIP_INPUT_MAX;
+    }
+    crc_ = crc32Update(crc_, data, length);
+    inputSize_ += length;
+    memcpy(window_ + history_, data, length);
+
+    size_t end = history_ + length;
+    size_t pos = history_;
+    while (pos < end) {
+        uint16_t bestLength = 0;
+        size_t bestDistance = 0;
+        if (pos + MIN_MATCH <= end) {
+            uint32_t hash = prefixHash(window_ + pos);
+            size_t candidate = head_[hash];
+            head_[hash] = static_cast<uint16_t>(pos + 1);
+            if (candidate > 0) {
+                candidate--;
+                size_t limit = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+                size_t matched = 0;
+                while (matched < limit && window_[candidate + matched] == window_[pos + matched]) {
+                    matched++;
+                }
+                if (matched >= MIN_MATCH) {
+                    bestLength = static_cast<uint16_t>(matched);
+                    bestDistance = pos - candidate;
+                }
+            }
+        }
+        if (bestLength == 0) {
+            putLiteral(window_[pos]);
+            pos++;
+            continue;
+        }
+        putMatch(bestLength, static_cast<uint16_t>(bestDistance));
+        // Later matches can start anywhere inside this one
+        for (size_t p = pos + 1; p < pos + bestLength && p + MIN_MATCH <= end; p++) {
+            head_[prefixHash(window_ + p)] = static_cast<uint16_t>(p + 1);
+        }
+        pos += bestLength;
+    }
+
+    // Keep the last GZIP_WINDOW bytes as history for the next write
+    if (end > GZIP_WINDOW) {
+        size_t shift = end - GZIP_WINDOW;
+        memmove(window_, window_ + shift, GZIP_WINDOW);
+        for (size_t i = 0; i < (1u << GZIP_HASH_BITS); i++) {
+            head_[i] = head_[i] > shift ? static_cast<uint16_t>(head_[i] - shift) : 0;
+        }
+        end = GZIP_WINDOW;
+    }
+    history_ = end;
+    return outLength_;
+}
+
+size_t GzipEncoder::finish(uint8_t* out) {
+    out_ = out;
+    outLength_ = 0;
+    if (!started_) {
+        start(out);
+    }
+    putHuffman(END_OF_BLOCK - 256, 7);
+    // An empty final block, since the open one was not marked final
+    putBits(1, 1);
+    putBits(1, 2);
+    putHuffman(END_OF_BLOCK - 256, 7);
+    if (bitCount_ > 0) {
+        putBits(0, 8 - bitCount_);
+    }
+    putU32(out_ + outLength_, crc_);
+    putU32(out_ + outLength_ + 4, inputSize_);
+    outLength_ += 8;
+    started_ = false;
+    return outLength_;
+}
@@ -0,0 +1,359 @@
+#include "history_buckets.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "calendar.h"
+
+namespace {
+
+const size_t PRIME_BATCH = 32;  // Raw minutes per store read while priming
+
+struct StepName {
+    const char* name;
+    HistoryLevel level;
+    HistoryGroup group;
+    uint32_t multiple;
+    uint32_t defaultSpanSeconds;
+};
+
+const StepName STEP_NAMES[] = {
+    {"minute", HISTORY_MINUTE, HISTORY_GROUP_NONE, 1, 2 * 3600UL},
+    {"hour", HISTORY_HOUR, HISTORY_GROUP_NONE, 1, 86400UL},
+    {"day", HISTORY_DAY, HISTORY_GROUP_NONE, 1, 30 * 86400UL},
+    {"week", HISTORY_DAY, HISTORY_GROUP_WEEK, 7, 12 * 7 * 86400UL},
+    {"month", HISTORY_MONTH, HISTORY_GROUP_NONE, 1, 365 * 86400UL},
+    {"year", HISTORY_MONTH, HISTORY_GROUP_YEAR, 12, 3 * 365 * 86400UL},
+};
+
+// Points a numeric step covers when no range is given
+const uint32_t NUMERIC_DEFAULT_POINTS = 96;
+
+const uint32_t CAPACITY[HISTORY_LEVELS] = {
+    HISTORY_MINUTE_BUCKETS, HISTORY_HOUR_BUCKETS, HISTORY_DAY_BUCKETS, HISTORY_MONTH_BUCKETS,
+};
+
+// Absent (NULL or empty) leaves value alone; anything but digits fails
+bool parseSeconds(const char* text, uint32_t& value) {
+    if (text == NULL || *text == '\0') {
+        return true;
+    }
+    uint64_t result = 0;
+    for (const char* p = text; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        result = result * 10 + static_cast<uint64_t>(*p - '0');
+        if (result > 0xFFFFFFFFULL) {
+            return false;
+        }
+    }
+    value = static_cast<uint32_t>(result);
+    return true;
+}
+
+}  // namespace
+
+bool parseHistoryQuery(const char* from, const char* to, const char* step, uint32_t nowSeconds,
+                       HistoryQuery& out) {
+    if (step == NULL || *step == '\0') {
+        step = "hour";
+    }
+    if (strlen(step) >= sizeof(out.step)) {
+        return false;
+    }
+
+    uint32_t spanSeconds = 0;
+    bool named = false;
+    for (size_t i = 0; i < sizeof(STEP_NAMES) / sizeof(STEP_NAMES[0]); i++) {
+        if (strcmp(step, STEP_NAMES[i].name) == 0) {
+            out.level = STEP_NAMES[i].level;
+            out.group = STEP_NAMES[i].group;
+            out.multiple = STEP_NAMES[i].multiple;
+            spanSeconds = STEP_NAMES[i].defaultSpanSeconds;
+            named = true;
+            break;
+        }
+    }
+    if (!named) {
+        uint32_t seconds = 0;
+        if (!parseSeconds(step, seconds) || seconds == 0) {
+            return false;
+        }
+        out.group = HISTORY_GROUP_NONE;
+        if (seconds % 86400UL == 0) {
+            out.level = HISTORY_DAY;
+            out.multiple = seconds / 86400UL;
+        } else if (seconds % 3600UL == 0) {
+            out.level = HISTORY_HOUR;
+            out.multiple = seconds / 3600UL;
+        } else if (seconds % 60UL == 0) {
+            out.level = HISTORY_MINUTE;
+            out.multiple = seconds / 60UL;
+        } else {
+            return false;
+        }
+        uint64_t span = static_cast<uint64_t>(seconds) * NUMERIC_DEFAULT_POINTS;
+        spanSeconds = span > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : static_cast<uint32_t>(span);
+    }
+    strcpy(out.step, step);
+
+    out.toSeconds = nowSeconds;
+    if (!parseSeconds(to, out.toSeconds)) {
+        return false;
+    }
+    out.fromSeconds = out.toSeconds > spanSeconds ? out.toSeconds - spanSeconds : 0;
+    if (!parseSeconds(from, out.fromSeconds)) {
+        return false;
+    }
+    return out.fromSeconds < out.toSeconds;
+}
+
+HistoryBuckets::HistoryBuckets(int32_t utcOffsetMinutes)
+    : utcOffsetMinutes_(utcOffsetMinutes), hasNewest_(false) {
+    memset(minutes_, 0, sizeof(minutes_));
+    memset(hours_, 0, sizeof(hours_));
+    memset(days_, 0, sizeof(days_));
+    memset(months_, 0, sizeof(months_));
+    memset(newest_, 0, sizeof(newest_));
+}
+
+void HistoryBuckets::prime(TimeSeriesStore& store) {
+    StoreStats stats = store.stats();
+    if (stats.records == 0 || stats.lastMinute == 0) {
+        return;
+    }
+    uint32_t last = stats.lastMinute;
+
+    // Raw minutes cover the hour ring (and with it the minute ring)
+    uint32_t span = HISTORY_HOUR_BUCKETS * 60UL;
+    uint32_t next = last >= span ? last + 1 - span : 0;
+    MinuteRecord batch[PRIME_BATCH];
+    for (;;) {
+        size_t count = store.readMinutes(next, last + 1, batch, PRIME_BATCH);
+        if (count == 0) {
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            add(batch[i]);
+        }
+        next = batch[count - 1].minute + 1;
+    }
+
+    // Day and month rollups replace what the raw minutes added, since they
+    // also include minutes from before the raw window
+    int32_t lastDay = store.localDay(last);
+    PeriodSummary summary;
+    for (int32_t day = lastDay - HISTORY_DAY_BUCKETS + 1; day <= lastDay; day++) {
+        if (store.readDay(day, summary)) {
+            std::lock_guard<std::mutex> guard(lock_);
+            setSummary(HISTORY_DAY, static_cast<uint32_t>(day), summary);
+        }
+    }
+    uint32_t lastMonth = monthIndexFromDays(lastDay);
+    uint32_t firstMonth = lastMonth >= HISTORY_MONTH_BUCKETS - 1 ? lastMonth - (HISTORY_MONTH_BUCKETS - 1) : 0;
+    for (uint32_t month = firstMonth; month <= lastMonth; month++) {
+        if (store.readMonth(month, summary)) {
+            std::lock_guard<std::mutex> guard(lock_);
+            setSummary(HISTORY_MONTH, month, summary);
+        }
+    }
+}
+
+void HistoryBuckets::add(const MinuteRecord& record) {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (int level = 0; level < HISTORY_LEVELS; level++) {
+        HistoryLevel l = static_cast<HistoryLevel>(level);
+        addTo(l, bucketIndex(l, record.minute), record);
+    }
+}
+
+bool HistoryBuckets::open(const HistoryQuery& query, HistoryCursor& cursor) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!hasNewest_) {
+        return false;
+    }
+    HistoryLevel level = query.level;
+    uint32_t width = query.multiple;
+    uint32_t first = pointStart(query, bucketIndex(level, query.fromSeconds / 60));
+    uint32_t end = pointEnd(query, pointStart(query, bucketIndex(level, (query.toSeconds - 1) / 60)));
+
+    cursor.query = query;
+    cursor.truncated = false;
+
+    // Only whole points inside the ring; older buckets have been reused
+    uint32_t newest = newest_[level];
+    uint32_t oldest = newest >= CAPACITY[level] - 1 ? newest - (CAPACITY[level] - 1) : 0;
+    if (first < oldest) {
+        first = pointStart(query, oldest);
+        if (first < oldest) {
+            first = pointEnd(query, first);
+        }
+        cursor.truncated = true;
+    }
+    // Nothing past the newest bucket exists yet, so a future `to` must not
+    // push real points out of the HISTORY_MAX_POINTS window
+    uint32_t newestEnd = pointEnd(query, pointStart(query, newest));
+    if (end > newestEnd) {
+        end = newestEnd;
+    }
+    if (first < end && (end - first) / width > HISTORY_MAX_POINTS) {
+        first = end - HISTORY_MAX_POINTS * width;
+        cursor.truncated = true;
+    }
+    if (first > end) {
+        first = end;
+    }
+
+    cursor.next = first;
+    cursor.end = end;
+    cursor.fromSeconds = bucketStartSeconds(level, first);
+    cursor.toSeconds = bucketStartSeconds(level, end);
+    return true;
+}
+
+size_t HistoryBuckets::read(HistoryCursor& cursor, HistoryPoint* out, size_t max) {
+    std::lock_guard<std::mutex> guard(lock_);
+    const HistoryQuery& query = cursor.query;
+    uint32_t width = query.multiple;
+    size_t count = 0;
+    while (count < max && cursor.next < cursor.end) {
+        HistoryPoint& point = out[count++];
+        memset(&point, 0, sizeof(point));
+        point.startSeconds = bucketStartSeconds(query.level, cursor.next);
+        for (uint32_t index = cursor.next; index < cursor.next + width; index++) {
+            const Bucket* b = bucket(query.level, index);
+            if (b == NULL) {
+                continue;
+            }
+            point.energyMwh += b->energyMwh;
+            point.occupiedSeconds += b->occupiedSeconds;
+            point.entries += b->entries;
+            point.exits += b->exits;
+            if (b->peakOccupants > point.peakOccupants) {
+                point.peakOccupants = b->peakOccupants;
+            }
+        }
+        cursor.next += width;
+    }
+    return count;
+}
+
+// Ring slot that index maps to, whatever bucket it currently holds
+HistoryBuckets::Bucket& HistoryBuckets::slot(HistoryLevel level, uint32_t index) {
+    Bucket* ring = level == HISTORY_MINUTE ? minutes_
+                 : level == HISTORY_HOUR   ? hours_
+                 : level == HISTORY_DAY    ? days_
+                                           : months_;
+    return ring[index % CAPACITY[level]];
+}
+
+// The slot holding index, or NULL if it holds another bucket or none
+HistoryBuckets::Bucket* HistoryBuckets::bucket(HistoryLevel level, uint32_t index) {
+    Bucket& slot = this->slot(level, index);
+    if (!slot.used || slot.index != index) {
+        return NULL;
+    }
+    return &slot;
+}
+
+// Bucket numbers count local minutes, hours, days and months since 1970
+uint32_t HistoryBuckets::bucketIndex(HistoryLevel level, uint32_t epochMinute) const {
+    int64_t localMinute = static_cast<int64_t>(epochMinute) + utcOffsetMinutes_;
+    if (localMinute < 0) {
+        localMinute = 0;
+    }
+    switch (level) {
+        case HISTORY_MINUTE: return static_cast<uint32_t>(localMinute);
+        case HISTORY_HOUR: return static_cast<uint32_t>(localMinute / 60);
+        case HISTORY_DAY: return static_cast<uint32_t>(localMinute / MINUTES_PER_DAY);
+        default: return monthIndexFromDays(static_cast<int32_t>(localMinute / MINUTES_PER_DAY));
+    }
+}
+
+uint32_t HistoryBuckets::bucketStartSeconds(HistoryLevel level, uint32_t index) const {
+    int64_t localMinute;
+    switch (level) {
+        case HISTORY_MINUTE: localMinute = index; break;
+        case HISTORY_HOUR: localMinute = static_cast<int64_t>(index) * 60; break;
+        case HISTORY_DAY: localMinute = static_cast<int64_t>(index) * MINUTES_PER_DAY; break;
+        default: localMinute = static_cast<int64_t>(daysFromMonthIndex(index)) * MINUTES_PER_DAY; break;
+    }
+    int64_t seconds = (localMinute - utcOffsetMinutes_) * 60;
+    return seconds < 0 ? 0 : static_cast<uint32_t>(seconds);
+}
+
+// First bucket of the point containing index
+uint32_t HistoryBuckets::pointStart(const HistoryQuery& query, uint32_t index) const {
+    switch (query.group) {
+        case HISTORY_GROUP_WEEK: return static_cast<uint32_t>(weekStartDay(static_cast<int32_t>(index)));
+        case HISTORY_GROUP_YEAR: return index - index % 12;
+        default: return index - index % query.multiple;
+    }
+}
+
+uint32_t HistoryBuckets::pointEnd(const HistoryQuery& query, uint32_t start) const {
+    return start + query.multiple;
+}
+
+void HistoryBuckets::addTo(HistoryLevel level, uint32_t index, const MinuteRecord& record) {
+    Bucket& slot = this->slot(level, index);
+    if (!slot.used || slot.index != index) {
+        if (slot.used && slot.index > index) {
+            return;  // Older than what the slot already holds
+        }
+        memset(&slot, 0, sizeof(slot));
+        slot.index = index;
+        slot.used = true;
+    }
+    slot.energyMwh += record.energyMwh;
+    slot.occupiedSeconds += record.occupiedSeconds;
+    slot.entries += record.entries;
+    slot.exits += record.exits;
+    if (record.peakOccupants > slot.peakOccupants) {
+        slot.peakOccupants = record.peakOccupants;
+    }
+    if (!hasNewest_ || index > newest_[level]) {
+        newest_[level] = index;
+    }
+    hasNewest_ = true;
+}
+
+void HistoryBuckets::setSummary(HistoryLevel level, uint32_t index, const PeriodSummary& summary) {
+    Bucket& slot = this->slot(level, index);
+    slot.index = index;
+    slot.used = true;
+    slot.energyMwh = summary.energyMwh;
+    slot.occupiedSeconds = summary.occupiedSeconds;
+    slot.entries = summary.entries;
+    slot.exits = summary.exits;
+    slot.peakOccupants = summary.peakOccupants;
+    if (!hasNewest_ || index > newest_[level]) {
+        newest_[level] = index;
+    }
+}
+
+size_t formatHistoryHeader(const HistoryCursor& cursor, char* out, size_t size) {
+    int length = snprintf(out, size, "{\"from\":%lu,\"to\":%lu,\"step\":\"%s\",\"points\":[",
+                          static_cast<unsigned long>(cursor.fromSeconds),
+                          static_cast<unsigned long>(cursor.toSeconds), cursor.query.step);
+    return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+// Energy in Wh with three decimals, from integer milliwatt-hours
+size_t formatHistoryPoint(const HistoryPoint& point, bool first, char* out, size_t size) {
+    int length = snprintf(out, size, "%s[%lu,%lu.%03lu,%lu,%lu,%lu,%u]", first ? "" : ",",
+                          static_cast<unsigned long>(point.startSeconds),
+                          static_cast<unsigned long>(point.energyMwh / 1000),
+                          static_cast<unsigned long>(point.energyMwh % 1000),
+                          static_cast<unsigned long>(point.occupiedSeconds),
+                          static_cast<unsigned long>(point.entries),
+                          static_cast<unsigned long>(point.exits),
+                          static_cast<unsigned>(point.peakOccupants));
+    return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+size_t formatHistoryFooter(const HistoryCursor& cursor, char* out, size_t size) {
+    int length = snprintf(out, size, "],\"truncated\":%s}", cursor.truncated ? "true" : "false");
+    return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
@@ -0,0 +1,124 @@
+#include "history_export.h"
+
+#include <string.h>
+
+#include "byte_order.h"
+
+namespace {
+
+enum ExportPart : uint8_t {
+    EXPORT_PART_HEADER,
+    EXPORT_PART_BLOCKS,
+    EXPORT_PART_DONE,
+};
+
+size_t putVarint(uint8_t* out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+}  // namespace
+
+HistoryExport::HistoryExport(TimeSeriesStore& store) : store_(store), owner_(0), leases_(0), lastUseMs_(0) {}
+
+bool HistoryExport::open(uint32_t sinceMinute, bool gzip, uint32_t nowMs, ExportCursor& cursor) {
+    if (gzip && owner_ != 0 && nowMs - lastUseMs_ < EXPORT_GZIP_STALE_MS) {
+        return false;
+    }
+    StoreStats stats = store_.stats();
+    cursor.since = sinceMinute;
+    cursor.next = sinceMinute;
+    cursor.end = stats.records > 0 && stats.lastMinute >= sinceMinute ? stats.lastMinute + 1 : sinceMinute;
+    cursor.lastMinute = sinceMinute;
+    cursor.owner = 0;
+    cursor.part = EXPORT_PART_HEADER;
+    if (gzip) {
+        if (++leases_ == 0) {
+            leases_ = 1;
+        }
+        owner_ = leases_;
+        cursor.owner = owner_;
+        lastUseMs_ = nowMs;
+        gzip_.begin();
+    }
+    return true;
+}
+
+size_t HistoryExport::read(ExportCursor& cursor, uint8_t* out, uint32_t nowMs) {
+    bool gzip = cursor.owner != 0;
+    if (gzip && cursor.owner != owner_) {
+        return 0;
+    }
+    while (cursor.part != EXPORT_PART_DONE) {
+        uint8_t* raw = gzip ? block_ : out;
+        size_t length;
+        if (cursor.part == EXPORT_PART_HEADER) {
+            memcpy(raw, EXPORT_MAGIC, 4);
+            putU32(raw + 4, cursor.since);
+            putU32(raw + 8, cursor.end);
+            length = EXPORT_HEADER_SIZE;
+            cursor.part = EXPORT_PART_BLOCKS;
+        } else {
+            length = nextBlock(cursor, raw);
+            if (length == 0) {
+                raw[0] = 0;
+                length = 1;
+                cursor.part = EXPORT_PART_DONE;
+            }
+        }
+        if (!gzip) {
+            return length;
+        }
+
+        size_t written = gzip_.write(raw, length, out);
+        if (cursor.part == EXPORT_PART_DONE) {
+            written += gzip_.finish(out + written);
+            owner_ = 0;
+        }
+        lastUseMs_ = nowMs;
+        if (written > 0) {
+            return written;
+        }
+    }
+    return 0;
+}
+
+// Up to EXPORT_BLOCK_RECORDS stored minutes as columns; 0 when none are left
+size_t HistoryExport::nextBlock(ExportCursor& cursor, uint8_t* out) {
+    if (cursor.next >= cursor.end) {
+        return 0;
+    }
+    size_t count = store_.readMinutes(cursor.next, cursor.end, records_, EXPORT_BLOCK_RECORDS);
+    if (count == 0) {
+        cursor.next = cursor.end;
+        return 0;
+    }
+    cursor.next = records_[count - 1].minute + 1;
+
+    size_t length = putVarint(out, static_cast<uint32_t>(count));
+    for (size_t i = 0; i < count; i++) {
+        length += putVarint(out + length, records_[i].minute - cursor.lastMinute);
+        cursor.lastMinute = records_[i].minute;
+    }
+    for (size_t i = 0; i < count; i++) {
+        length += putVarint(out + length, records_[i].energyMwh);
+    }
+    for (size_t i = 0; i < count; i++) {
+        length += putVarint(out + length, records_[i].occupiedSeconds);
+    }
+    for (size_t i = 0; i < count; i++) {
+        length += putVarint(out + length, records_[i].entries);
+    }
+    for (size_t i = 0; i < count; i++) {
+        length += putVarint(out + length, records_[i].exits);
+    }
+    for (size_t i = 0; i < count; i++) {
+        length += putVarint(out + length, records_[i].peakOccupants);
+    }
+    return length;
+}
@@ -0,0 +1,807 @@
+#include "http_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "web_response.h"
+
+namespace {
+
+// Room for a chunk's "<hex length>\r\n" in front of the data and its
+// "\r\n" behind; the response buffer needs at most three hex digits
+const size_t CHUNK_HEAD = 6;
+const size_t CHUNK_TAIL = 2;
+const char LAST_CHUNK[] = "0\r\n\r\n";
+
+// Requests answered back to back on one connection before the others get a
+// turn, when a client pipelines
+const uint8_t PIPELINE_PER_POLL = 4;
+
+char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+bool equalsIgnoreCase(const char* a, const char* b) {
+    while (*a && lower(*a) == lower(*b)) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+bool startsWithIgnoreCase(const char* text, const char* prefix) {
+    while (*prefix && lower(*text) == lower(*prefix)) {
+        text++;
+        prefix++;
+    }
+    return *prefix == '\0';
+}
+
+// "keep-alive" in "Keep-Alive, Upgrade"
+bool hasToken(const char* list, const char* token) {
+    for (; *list; list++) {
+        if (startsWithIgnoreCase(list, token)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = lower(c);
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// Percent-decoding in place; '+' is a space in query strings and forms
+void decodeArg(char* text) {
+    char* out = text;
+    for (const char* in = text; *in; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%' && hexValue(in[1]) >= 0 && hexValue(in[2]) >= 0) {
+            *out++ = static_cast<char>(hexValue(in[1]) << 4 | hexValue(in[2]));
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+// Length of the head including the blank line, 0 while it is incomplete
+size_t headLength(const char* data, size_t length) {
+    for (size_t i = 3; i < length; i++) {
+        if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Content-Length of an unparsed head, read without modifying it: 0 without
+// one, -1 if it is malformed or the body is chunked (not supported)
+long declaredBodyLength(const char* head, size_t length) {
+    const char* end = head + length;
+    for (const char* line = head; line < end;) {
+        const char* next = static_cast<const char*>(memchr(line, '\n', end - line));
+        next = next ? next + 1 : end;
+        if (startsWithIgnoreCase(line, "transfer-encoding:")) {
+            return -1;
+        }
+        if (startsWithIgnoreCase(line, "content-length:")) {
+            const char* value = line + strlen("content-length:");
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            if (*value < '0' || *value > '9') {
+                return -1;
+            }
+            long bodyLength = 0;
+            for (; *value >= '0' && *value <= '9'; value++) {
+                bodyLength = bodyLength * 10 + (*value - '0');
+                if (bodyLength > HTTP_REQUEST_MAX) {
+                    return HTTP_REQUEST_MAX + 1;
+                }
+            }
+            return bodyLength;
+        }
+        line = next;
+    }
+    return 0;
+}
+
+// NUL-terminates the line at its "\r\n" and returns the next one, NULL if
+// there is no line end
+char* terminateLine(char* line) {
+    char* end = strstr(line, "\r\n");
+    if (!end) {
+        return NULL;
+    }
+    *end = '\0';
+    return end + 2;
+}
+
+}  // namespace
+
+const char* HttpRequest::arg(const char* name) const {
+    for (uint8_t i = 0; i < argCount_; i++) {
+        if (strcmp(argNames_[i], name) == 0) {
+            return argValues_[i];
+        }
+    }
+    return NULL;
+}
+
+const char* HttpRequest::header(const char* name) const {
+    for (uint8_t i = 0; i < headerCount_; i++) {
+        if (equalsIgnoreCase(headerNames_[i], name)) {
+            return headerValues_[i];
+        }
+    }
+    return NULL;
+}
+
+HttpRequest::ParseResult HttpRequest::parse(char* data, size_t length, size_t size, size_t& consumed) {
+    size_t head = headLength(data, length);
+    if (head == 0) {
+        return length >= size ? PARSE_TOO_LARGE : PARSE_INCOMPLETE;
+    }
+    long contentLength = declaredBodyLength(data, head);
+    if (contentLength < 0) {
+        return PARSE_BAD;
+    }
+    if (head + contentLength > size) {
+        return PARSE_TOO_LARGE;
+    }
+    if (head + contentLength > length) {
+        return PARSE_INCOMPLETE;
+    }
+    consumed = head + contentLength;
+
+    // Request line: METHOD SP target SP version
+    char* line = data;
+    char* next = terminateLine(line);
+    char* target = next ? strchr(line, ' ') : NULL;
+    char* version = target ? strchr(target + 1, ' ') : NULL;
+    if (!version) {
+        return PARSE_BAD;
+    }
+    *target++ = '\0';
+    *version++ = '\0';
+    if (*target != '/') {
+        return PARSE_BAD;
+    }
+    if (strcmp(version, "HTTP/1.1") == 0) {
+        http11_ = true;
+    } else if (strcmp(version, "HTTP/1.0") == 0) {
+        http11_ = false;
+    } else {
+        return PARSE_BAD;
+    }
+    if (strcmp(line, "GET") == 0) {
+        method_ = HTTP_METHOD_GET;
+    } else if (strcmp(line, "POST") == 0) {
+        method_ = HTTP_METHOD_POST;
+    } else {
+        method_ = HTTP_METHOD_OTHER;
+    }
+
+    headerCount_ = 0;
+    argCount_ = 0;
+    body_ = NULL;
+    bodyLength_ = 0;
+    for (line = next; *line != '\r'; line = next) {
+        next = terminateLine(line);
+        char* colon = next ? strchr(line, ':') : NULL;
+        if (!colon) {
+            return PARSE_BAD;
+        }
+        *colon = '\0';
+        char* value = colon + 1;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+        char* end = value + strlen(value);
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+        if (headerCount_ < HTTP_MAX_HEADERS) {
+            headerNames_[headerCount_] = line;
+            headerValues_[headerCount_] = value;
+            headerCount_++;
+        }
+    }
+
+    const char* connection = header("Connection");
+    keepAlive_ = http11_ ? !(connection && hasToken(connection, "close"))
+                         : (connection && hasToken(connection, "keep-alive"));
+
+    char* query = strchr(target, '?');
+    if (query) {
+        *query++ = '\0';
+        parseArgs(query);
+    }
+    path_ = target;
+
+    char* body = data + head;
+    const char* contentType = header("Content-Type");
+    if (contentLength > 0 && contentType && startsWithIgnoreCase(contentType, "application/x-www-form-urlencoded")) {
+        // Move the form one byte back over the head's last '\n' to make room
+        // for its terminator without touching a pipelined request behind it
+        memmove(body - 1, body, contentLength);
+        body[contentLength - 1] = '\0';
+        parseArgs(body - 1);
+    } else if (contentLength > 0) {
+        body_ = reinterpret_cast<const uint8_t*>(body);
+        bodyLength_ = contentLength;
+    }
+    return PARSE_DONE;
+}
+
+// name=value pairs separated by '&'; a name without '=' gets an empty value
+void HttpRequest::parseArgs(char* text) {
+    while (text && *text) {
+        char* next = strchr(text, '&');
+        if (next) {
+            *next++ = '\0';
+        }
+        char* value = strchr(text, '=');
+        if (value) {
+            *value++ = '\0';
+        } else {
+            value = text + strlen(text);
+        }
+        if (*text && argCount_ < HTTP_MAX_ARGS) {
+            decodeArg(text);
+            decodeArg(value);
+            argNames_[argCount_] = text;
+            argValues_[argCount_] = value;
+            argCount_++;
+        }
+        text = next;
+    }
+}
+
+bool HttpResponse::send(int status, const char* contentType, const void* body, size_t length,
+                        const char* cacheControl, const char* extraHeaders) {
+    HttpServer::Connection& connection = server_.connections_[connection_];
+    if (!server_.beginResponse(connection, status, contentType, length, cacheControl, extraHeaders) ||
+        connection.outEnd + length > HTTP_RESPONSE_MAX) {
+        return false;
+    }
+    memcpy(server_.buffers_[connection.buffer].response + connection.outEnd, body, length);
+    connection.outEnd += length;
+    sent_ = true;
+    return true;
+}
+
+bool HttpResponse::send(int status, const char* contentType, const char* text) {
+    return send(status, contentType, text, strlen(text));
+}
+
+bool HttpResponse::sendStatic(int status, const char* contentType, const uint8_t* body, size_t length,
+                              const char* cacheControl, const char* extraHeaders) {
+    HttpServer::Connection& connection = server_.connections_[connection_];
+    if (!server_.beginResponse(connection, status, contentType, length, cacheControl, extraHeaders)) {
+        return false;
+    }
+    connection.staticData = body;
+    connection.staticLength = length;
+    sent_ = true;
+    return true;
+}
+
+// HTTP/1.0 has no chunked encoding, so the body ends with the connection
+HttpStream* HttpResponse::beginStream(int status, const char* contentType, HttpStreamFill fill,
+                                      const char* extraHeaders) {
+    HttpServer::Connection& connection = server_.connections_[connection_];
+    connection.keepAlive = connection.keepAlive && connection.http11;
+    if (!server_.beginResponse(connection, status, contentType, RESPONSE_LENGTH_UNKNOWN, "no-store", extraHeaders)) {
+        return NULL;
+    }
+    connection.chunked = connection.keepAlive;
+    connection.streaming = true;
+    HttpStream& stream = server_.buffers_[connection.buffer].stream;
+    stream.fill_ = fill;
+    sent_ = true;
+    return &stream;
+}
+
+HttpPushId HttpResponse::startPush(const void* data, size_t length) {
+    HttpServer::Connection& connection = server_.connections_[connection_];
+    if (length > HTTP_RESPONSE_MAX) {
+        return 0;
+    }
+    memcpy(server_.buffers_[connection.buffer].response, data, length);
+    connection.outStart = 0;
+    connection.outEnd = length;
+    connection.staticLength = 0;
+    connection.streaming = false;
+    connection.pushing = true;
+    connection.keepAlive = false;
+    sent_ = true;
+    return static_cast<HttpPushId>(connection.generation) << 8 | (connection_ + 1);
+}
+
+HttpServer::HttpServer(TcpListener& listener)
+    : listener_(listener), assets_(NULL), assetCount_(0), routeCount_(0), buffersInUse_(0), firstServiced_(0),
+      lastPollMs_(0) {
+    memset(connections_, 0, sizeof(connections_));
+    for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        connections_[i].socket = -1;
+        connections_[i].state = CONNECTION_FREE;
+        connections_[i].buffer = -1;
+    }
+    for (uint8_t i = 0; i < HTTP_BUFFER_COUNT; i++) {
+        buffers_[i].used = false;
+    }
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+bool HttpServer::begin(uint16_t port) {
+    return listener_.begin(port);
+}
+
+void HttpServer::setAssets(const WebAsset* assets, size_t count) {
+    assets_ = assets;
+    assetCount_ = count;
+}
+
+bool HttpServer::on(const char* path, uint8_t methods, HttpHandler handler) {
+    if (routeCount_ == HTTP_MAX_ROUTES) {
+        return false;
+    }
+    routes_[routeCount_++] = Route{path, methods, handler};
+    return true;
+}
+
+// Idle connections are only read while a buffer is free; otherwise their
+// requests wait in the socket (backpressure) rather than waking us for
+// nothing. A stream whose fill had nothing ready is retried after timeoutMs.
+void HttpServer::wait(uint32_t timeoutMs) {
+    int readable[HTTP_MAX_CONNECTIONS];
+    int writable[HTTP_MAX_CONNECTIONS];
+    size_t readableCount = 0;
+    size_t writableCount = 0;
+    bool bufferFree = buffersInUse_ < HTTP_BUFFER_COUNT;
+    for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        const Connection& connection = connections_[i];
+        switch (connection.state) {
+            case CONNECTION_IDLE:
+                if (bufferFree) {
+                    readable[readableCount++] = connection.socket;
+                }
+                break;
+            case CONNECTION_READING:
+            case CONNECTION_PUSH:
+                readable[readableCount++] = connection.socket;
+                break;
+            case CONNECTION_SENDING:
+                if (connection.outStart < connection.outEnd || connection.staticLength > 0) {
+                    writable[writableCount++] = connection.socket;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    listener_.wait(readable, readableCount, writable, writableCount,
+                   stats_.connections < HTTP_MAX_CONNECTIONS || reclaimable(lastPollMs_) >= 0, timeoutMs);
+}
+
+void HttpServer::poll(uint32_t nowMs) {
+    lastPollMs_ = nowMs;
+    acceptClients(nowMs);
+    for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        uint8_t index = (firstServiced_ + i) % HTTP_MAX_CONNECTIONS;
+        if (connections_[index].state != CONNECTION_FREE) {
+            service(index, nowMs);
+        }
+    }
+    firstServiced_ = (firstServiced_ + 1) % HTTP_MAX_CONNECTIONS;
+}
+
+bool HttpServer::push(HttpPushId id, const void* data, size_t length) {
+    int index = findPush(id);
+    if (index < 0) {
+        return false;
+    }
+    Connection& connection = connections_[index];
+    if (connection.state == CONNECTION_PUSH) {
+        if (listener_.write(connection.socket, static_cast<const uint8_t*>(data), length) ==
+            static_cast<int>(length)) {
+            return true;
+        }
+    } else {
+        // The header is still going out: queue the frame behind it
+        uint8_t* response = buffers_[connection.buffer].response;
+        if (connection.outEnd + length > HTTP_RESPONSE_MAX) {
+            memmove(response, response + connection.outStart, connection.outEnd - connection.outStart);
+            connection.outEnd -= connection.outStart;
+            connection.outStart = 0;
+        }
+        if (connection.outEnd + length <= HTTP_RESPONSE_MAX) {
+            memcpy(response + connection.outEnd, data, length);
+            connection.outEnd += length;
+            return true;
+        }
+    }
+    stats_.pushDropped++;
+    close(connection);
+    return false;
+}
+
+bool HttpServer::pushOpen(HttpPushId id) const {
+    return findPush(id) >= 0;
+}
+
+int HttpServer::findPush(HttpPushId id) const {
+    uint32_t index = (id & 0xFF) - 1;
+    if (index >= HTTP_MAX_CONNECTIONS) {
+        return -1;
+    }
+    const Connection& connection = connections_[index];
+    bool open = connection.state == CONNECTION_PUSH || (connection.state == CONNECTION_SENDING && connection.pushing);
+    return open && connection.generation == (id >> 8) ? static_cast<int>(index) : -1;
+}
+
+// The kept-alive connection idle longest, if it has been idle for at least
+// HTTP_RECLAIM_IDLE_MS with nothing received; -1 if none
+int HttpServer::reclaimable(uint32_t nowMs) const {
+    int oldest = -1;
+    for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        const Connection& connection = connections_[i];
+        if (connection.state != CONNECTION_IDLE || connection.received > 0 ||
+            nowMs - connection.lastProgressMs < HTTP_RECLAIM_IDLE_MS) {
+            continue;
+        }
+        if (oldest < 0 || static_cast<int32_t>(connection.lastProgressMs - connections_[oldest].lastProgressMs) < 0) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+void HttpServer::acceptClients(uint32_t nowMs) {
+    for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        int index = i;
+        if (stats_.connections >= HTTP_MAX_CONNECTIONS) {
+            index = reclaimable(nowMs);
+            if (index < 0) {
+                return;
+            }
+        } else if (connections_[i].state != CONNECTION_FREE) {
+            continue;
+        }
+        int socket = listener_.accept();
+        if (socket < 0) {
+            return;
+        }
+        Connection& connection = connections_[index];
+        if (connection.state != CONNECTION_FREE) {
+            close(connection);
+        }
+        connection.socket = socket;
+        connection.state = CONNECTION_IDLE;
+        connection.buffer = -1;
+        connection.generation++;
+        connection.reused = false;
+        connection.lastProgressMs = nowMs;
+        connection.received = 0;
+        connection.requestLength = 0;
+        stats_.accepted++;
+        stats_.connections++;
+        if (stats_.connections > stats_.peakConnections) {
+            stats_.peakConnections = stats_.connections;
+        }
+    }
+}
+
+void HttpServer::service(uint8_t index, uint32_t nowMs) {
+    Connection& connection = connections_[index];
+    for (uint8_t pass = 0; pass < PIPELINE_PER_POLL; pass++) {
+        if (connection.state == CONNECTION_PUSH) {
+            // Push clients never send anything that matters; reading tells
+            // when they leave
+            uint8_t discard[64];
+            if (listener_.read(connection.socket, discard, sizeof(discard)) < 0) {
+                close(connection);
+            }
+            return;
+        }
+        if (connection.state == CONNECTION_IDLE) {
+            if (nowMs - connection.lastProgressMs >= HTTP_IDLE_TIMEOUT_MS) {
+                close(connection);
+                return;
+            }
+            if (!acquireBuffer(connection)) {
+                return;
+            }
+            connection.state = CONNECTION_READING;
+        }
+        if (connection.state == CONNECTION_READING && !readRequest(index, nowMs)) {
+            return;
+        }
+        if (!flush(connection, nowMs)) {
+            return;
+        }
+        finishResponse(connection);
+        if (connection.state != CONNECTION_READING) {
+            return;
+        }
+    }
+}
+
+// True once a response is ready to send
+bool HttpServer::readRequest(uint8_t index, uint32_t nowMs) {
+    Connection& connection = connections_[index];
+    Buffers& buffers = buffers_[connection.buffer];
+    if (connection.received < HTTP_REQUEST_MAX) {
+        int length = listener_.read(connection.socket, reinterpret_cast<uint8_t*>(buffers.request) + connection.received,
+                                    HTTP_REQUEST_MAX - connection.received);
+        if (length < 0) {
+            close(connection);
+            return false;
+        }
+        if (length > 0) {
+            connection.received += length;
+            connection.lastProgressMs = nowMs;
+        }
+    }
+    if (connection.received == 0) {
+        releaseBuffer(connection);
+        connection.state = CONNECTION_IDLE;
+        return false;
+    }
+
+    HttpRequest request;
+    size_t consumed = 0;
+    HttpRequest::ParseResult result = request.parse(buffers.request, connection.received, HTTP_REQUEST_MAX, consumed);
+    if (result == HttpRequest::PARSE_INCOMPLETE) {
+        if (nowMs - connection.lastProgressMs >= HTTP_IO_TIMEOUT_MS) {
+            stats_.timedOut++;
+            close(connection);
+        }
+        return false;
+    }
+    if (result != HttpRequest::PARSE_DONE) {
+        stats_.rejected++;
+        connection.state = CONNECTION_SENDING;
+        connection.keepAlive = false;
+        return sendError(connection, result == HttpRequest::PARSE_TOO_LARGE ? 413 : 400);
+    }
+    connection.requestLength = consumed;
+    answer(index, request);
+    return true;
+}
+
+void HttpServer::answer(uint8_t index, const HttpRequest& request) {
+    Connection& connection = connections_[index];
+    stats_.requests++;
+    if (connection.reused) {
+        stats_.reused++;
+    }
+    connection.reused = true;
+    connection.http11 = request.http11_;
+    connection.keepAlive = request.keepAlive_;
+    connection.state = CONNECTION_SENDING;
+
+    if (sendAsset(connection, request)) {
+        return;
+    }
+    for (uint8_t i = 0; i < routeCount_; i++) {
+        const Route& route = routes_[i];
+        if (strcmp(route.path, request.path()) != 0) {
+            continue;
+        }
+        if (!(route.methods & request.method())) {
+            stats_.rejected++;
+            sendError(connection, 405);
+            return;
+        }
+        HttpResponse response(*this, index);
+        route.handler(request, response);
+        if (!response.sent_) {
+            sendError(connection, 500);
+        }
+        return;
+    }
+    stats_.rejected++;
+    sendError(connection, 404);
+}
+
+// Pre-gzipped dashboard file straight from flash, or an empty 304 when the
+// browser already holds this version. Only gzip is stored, so a client that
+// does not accept it gets 406.
+bool HttpServer::sendAsset(Connection& connection, const HttpRequest& request) {
+    for (size_t i = 0; i < assetCount_; i++) {
+        const WebAsset& asset = assets_[i];
+        if (strcmp(asset.path, request.path()) != 0) {
+            continue;
+        }
+        if (request.method() != HTTP_METHOD_GET) {
+            stats_.rejected++;
+            return sendError(connection, 405);
+        }
+        const char* encodings = request.header("Accept-Encoding");
+        if (!encodings || !strstr(encodings, "gzip")) {
+            stats_.rejected++;
+            return sendError(connection, 406);
+        }
+        bool notModified;
+        size_t length = formatAssetHeader(reinterpret_cast<char*>(buffers_[connection.buffer].response),
+                                          HTTP_RESPONSE_MAX, asset, request.header("If-None-Match"),
+                                          connection.keepAlive, notModified);
+        if (length == 0) {
+            return sendError(connection, 500);
+        }
+        connection.outStart = 0;
+        connection.outEnd = length;
+        connection.staticData = asset.data;
+        connection.staticLength = notModified ? 0 : asset.length;
+        connection.streaming = false;
+        connection.pushing = false;
+        return true;
+    }
+    return false;
+}
+
+bool HttpServer::sendError(Connection& connection, int status) {
+    beginResponse(connection, status, "text/plain", 0, "no-store", NULL);
+    return true;
+}
+
+bool HttpServer::beginResponse(Connection& connection, int status, const char* contentType, size_t contentLength,
+                               const char* cacheControl, const char* extraHeaders) {
+    size_t length = formatResponseHeader(reinterpret_cast<char*>(buffers_[connection.buffer].response),
+                                         HTTP_RESPONSE_MAX, status, contentType, contentLength, cacheControl,
+                                         extraHeaders, connection.keepAlive);
+    connection.outStart = 0;
+    connection.outEnd = length;
+    connection.staticLength = 0;
+    connection.chunked = false;
+    connection.streaming = false;
+    connection.pushing = false;
+    return length > 0;
+}
+
+// True once the whole response is out
+bool HttpServer::flush(Connection& connection, uint32_t nowMs) {
+    for (;;) {
+        const uint8_t* data;
+        size_t length;
+        if (connection.outStart < connection.outEnd) {
+            data = buffers_[connection.buffer].response + connection.outStart;
+            length = connection.outEnd - connection.outStart;
+        } else if (connection.staticLength > 0) {
+            data = connection.staticData;
+            length = connection.staticLength;
+        } else if (connection.streaming) {
+            if (!refill(connection)) {
+                break;
+            }
+            continue;
+        } else {
+            return true;
+        }
+
+        int written = listener_.write(connection.socket, data, length);
+        if (written < 0) {
+            close(connection);
+            return false;
+        }
+        if (written == 0) {
+            break;
+        }
+        connection.lastProgressMs = nowMs;
+        if (connection.outStart < connection.outEnd) {
+            connection.outStart += written;
+        } else {
+            connection.staticData += written;
+            connection.staticLength -= written;
+        }
+        if (static_cast<size_t>(written) < length) {
+            break;  // Send buffer full
+        }
+    }
+    if (nowMs - connection.lastProgressMs >= HTTP_IO_TIMEOUT_MS) {
+        stats_.timedOut++;
+        close(connection);
+    }
+    return false;
+}
+
+// Next piece of a streamed body into the (drained) response buffer. False
+// if fill had nothing ready.
+bool HttpServer::refill(Connection& connection) {
+    Buffers& buffers = buffers_[connection.buffer];
+    size_t offset = connection.chunked ? CHUNK_HEAD : 0;
+    size_t size = HTTP_RESPONSE_MAX - (connection.chunked ? CHUNK_HEAD + CHUNK_TAIL : 0);
+    size_t length = buffers.stream.fill_(buffers.stream, buffers.response + offset, size);
+    if (length == HTTP_STREAM_END) {
+        connection.streaming = false;
+        connection.outStart = 0;
+        connection.outEnd = 0;
+        if (connection.chunked) {
+            memcpy(buffers.response, LAST_CHUNK, sizeof(LAST_CHUNK) - 1);
+            connection.outEnd = sizeof(LAST_CHUNK) - 1;
+        }
+        return true;
+    }
+    if (length == 0) {
+        return false;
+    }
+    connection.outStart = offset;
+    connection.outEnd = offset + length;
+    if (connection.chunked) {
+        char prefix[CHUNK_HEAD + 1];
+        int prefixLength = snprintf(prefix, sizeof(prefix), "%x\r\n", static_cast<unsigned>(length));
+        connection.outStart = CHUNK_HEAD - prefixLength;
+        memcpy(buffers.response + connection.outStart, prefix, prefixLength);
+        memcpy(buffers.response + connection.outEnd, "\r\n", CHUNK_TAIL);
+        connection.outEnd += CHUNK_TAIL;
+    }
+    return true;
+}
+
+// A kept-alive connection goes back to idle, or straight on to the next
+// request if the client pipelined one
+void HttpServer::finishResponse(Connection& connection) {
+    if (connection.pushing) {
+        releaseBuffer(connection);
+        connection.state = CONNECTION_PUSH;
+        return;
+    }
+    if (!connection.keepAlive) {
+        close(connection);
+        return;
+    }
+    size_t rest = connection.received - connection.requestLength;
+    if (rest > 0) {
+        char* request = buffers_[connection.buffer].request;
+        memmove(request, request + connection.requestLength, rest);
+        connection.received = rest;
+        connection.requestLength = 0;
+        connection.state = CONNECTION_READING;
+        return;
+    }
+    connection.received = 0;
+    connection.requestLength = 0;
+    releaseBuffer(connection);
+    connection.state = CONNECTION_IDLE;
+}
+
+bool HttpServer::acquireBuffer(Connection& connection) {
+    for (uint8_t i = 0; i < HTTP_BUFFER_COUNT; i++) {
+        if (!buffers_[i].used) {
+            buffers_[i].used = true;
+            connection.buffer = i;
+            buffersInUse_++;
+            if (buffersInUse_ > stats_.peakBuffers) {
+                stats_.peakBuffers = buffersInUse_;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpServer::releaseBuffer(Connection& connection) {
+    if (connection.buffer >= 0) {
+        buffers_[connection.buffer].used = false;
+        connection.buffer = -1;
+        buffersInUse_--;
+    }
+}
+
+void HttpServer::close(Connection& connection) {
+    listener_.close(connection.socket);
+    releaseBuffer(connection);
+    connection.socket = -1;
+    connection.state = CONNECTION_FREE;
+    stats_.connections--;
+}
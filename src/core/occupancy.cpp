@@ -0,0 +1,203 @@
+#include "occupancy.h"
+
+#include <string.h>
+
+namespace {
+
+// Doorway state (bit 0 entrance, bit 1 inside) -> step along clear,
+// entrance, both, inside
+const uint8_t PHASE[4] = {0, 1, 3, 2};
+
+// Longest passage tracked, in people; more would not fit a Passage
+const int16_t MAX_POSITION = 127 * 4;
+
+// How a passage of each quality moves the occupant count: the decoded total
+// with the first probability, otherwise one person fewer (a spurious or
+// overcounted passage) or, for a tandem, one more
+struct PassageOdds {
+    uint8_t decodedPercent;
+    int8_t otherwise;           // Added to the total's magnitude
+};
+
+const PassageOdds ODDS[] = {
+    {95, -1},   // PASSAGE_CLEAN
+    {40, 1},    // PASSAGE_TANDEM: the arrivals are the better guess
+    {85, -1},   // PASSAGE_SLOW
+    {60, -1},   // PASSAGE_GUESSED
+};
+
+}  // namespace
+
+PassageDecoder::PassageDecoder() {
+    reset();
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void PassageDecoder::reset() {
+    state_ = 0;
+    lastStep_ = 0;
+    guessed_ = false;
+    position_ = 0;
+    arrivals_[0] = 0;
+    arrivals_[1] = 0;
+    startMs_ = 0;
+}
+
+void PassageDecoder::sync(bool near1, bool near2) {
+    reset();
+    state_ = (near1 ? 1 : 0) | (near2 ? 2 : 0);
+}
+
+bool PassageDecoder::update(bool near1, bool near2, uint32_t nowMs, uint32_t sequenceTimeoutMs, Passage& out) {
+    uint8_t state = (near1 ? 1 : 0) | (near2 ? 2 : 0);
+    if (state == state_) {
+        return false;
+    }
+    if (state_ == 0) {
+        reset();
+        startMs_ = nowMs;
+    }
+    uint8_t arrived = state & ~state_;
+    for (uint8_t side = 0; side < 2; side++) {
+        if ((arrived >> side) & 1 && arrivals_[side] < UINT8_MAX) {
+            arrivals_[side]++;
+        }
+    }
+
+    // Both sensors changed between readings: keep going the way the last
+    // step went (forward if there was none) and remember it was a guess
+    int8_t step;
+    switch ((PHASE[state] - PHASE[state_]) & 3) {
+        case 1: step = 1; break;
+        case 3: step = -1; break;
+        default:
+            step = lastStep_ < 0 ? -2 : 2;
+            guessed_ = true;
+            break;
+    }
+    if (step == 1 || step == -1) {
+        lastStep_ = step;
+    }
+    if ((step > 0 && position_ < MAX_POSITION) || (step < 0 && position_ > -MAX_POSITION)) {
+        position_ += step;
+    }
+    state_ = state;
+    if (state != 0) {
+        return false;
+    }
+
+    int8_t net = static_cast<int8_t>(position_ / 4);
+    if (net == 0) {
+        stats_.turnedBack++;
+        return false;
+    }
+    uint8_t people = net > 0 ? net : -net;
+    uint8_t arrivals = arrivals_[0] > arrivals_[1] ? arrivals_[0] : arrivals_[1];
+    out.net = net;
+    out.startMs = startMs_;
+    out.endMs = nowMs;
+    if (guessed_) {
+        out.quality = PASSAGE_GUESSED;
+        stats_.guessed++;
+    } else if (nowMs - startMs_ > sequenceTimeoutMs) {
+        out.quality = PASSAGE_SLOW;
+        stats_.slow++;
+    } else if (arrivals > people) {
+        out.quality = PASSAGE_TANDEM;
+        stats_.tandem++;
+    } else {
+        out.quality = PASSAGE_CLEAN;
+    }
+    stats_.passages++;
+    return true;
+}
+
+uint8_t passagePeople(const Passage& passage) {
+    uint8_t people = passage.net > 0 ? passage.net : -passage.net;
+    return ODDS[passage.quality].decodedPercent < 50 ? people + ODDS[passage.quality].otherwise : people;
+}
+
+OccupancyTracker::OccupancyTracker() {
+    reset();
+    quietSinceMs_ = 0;
+}
+
+void OccupancyTracker::reset(uint8_t count) {
+    memset(probability_, 0, sizeof(probability_));
+    mode_ = count < TRACKER_MAX_OCCUPANTS ? count : TRACKER_MAX_OCCUPANTS;
+    probability_[mode_] = TRACKER_PROBABILITY_ONE;
+}
+
+// Shift every count by the passage's total or its alternative; counts pile
+// up at 0 and TRACKER_MAX_OCCUPANTS rather than falling off
+void OccupancyTracker::applyPassage(const Passage& passage) {
+    const PassageOdds& odds = ODDS[passage.quality];
+    int sign = passage.net > 0 ? 1 : -1;
+    int moves[2] = {passage.net, passage.net + sign * odds.otherwise};
+    uint32_t weights[2] = {odds.decodedPercent, 100U - odds.decodedPercent};
+
+    uint32_t next[TRACKER_MAX_OCCUPANTS + 1] = {};
+    uint32_t total = 0;
+    for (int count = 0; count <= TRACKER_MAX_OCCUPANTS; count++) {
+        if (probability_[count] == 0) {
+            continue;
+        }
+        for (uint8_t i = 0; i < 2; i++) {
+            int to = count + moves[i];
+            to = to < 0 ? 0 : (to > TRACKER_MAX_OCCUPANTS ? TRACKER_MAX_OCCUPANTS : to);
+            next[to] += probability_[count] * weights[i];
+            total += probability_[count] * weights[i];
+        }
+    }
+    for (int count = 0; count <= TRACKER_MAX_OCCUPANTS; count++) {
+        probability_[count] = static_cast<uint16_t>(
+            static_cast<uint64_t>(next[count]) * TRACKER_PROBABILITY_ONE / total);
+    }
+    updateMode();
+}
+
+bool OccupancyTracker::reconcile(uint32_t nowMs, const TrackerConfig& config) {
+    if (config.quietMs == 0 || nowMs - quietSinceMs_ < config.quietMs) {
+        return false;
+    }
+    quietSinceMs_ = nowMs;
+    uint8_t before = mode_;
+    for (int count = 1; count <= TRACKER_MAX_OCCUPANTS; count++) {
+        uint16_t moved = static_cast<uint16_t>(static_cast<uint32_t>(probability_[count]) * config.quietPercent / 100);
+        probability_[count] -= moved;
+        probability_[count - 1] += moved;
+    }
+    updateMode();
+    return mode_ != before;
+}
+
+uint8_t OccupancyTracker::confidence() const {
+    return static_cast<uint8_t>((probability_[mode_] * 100UL + TRACKER_PROBABILITY_ONE / 2) / TRACKER_PROBABILITY_ONE);
+}
+
+// Ties go to the smaller count
+void OccupancyTracker::updateMode() {
+    mode_ = 0;
+    for (uint8_t count = 1; count <= TRACKER_MAX_OCCUPANTS; count++) {
+        if (probability_[count] > probability_[mode_]) {
+            mode_ = count;
+        }
+    }
+}
+
+uint32_t roomApplyEstimate(RoomState& room, const OccupancyTracker& tracker, uint32_t nowMs) {
+    room.occupantCount = tracker.count();
+    room.confidence = tracker.confidence();
+    if (tracker.occupied() == room.occupied) {
+        return 0;
+    }
+    room.occupied = tracker.occupied();
+    if (room.occupied) {
+        room.occupiedSinceMs = nowMs;
+        return 0;
+    }
+    uint32_t sessionTime = nowMs - room.occupiedSinceMs;
+    room.totalOccupiedTime += sessionTime;
+    room.dailyOccupiedTime += sessionTime;
+    return sessionTime;
+}
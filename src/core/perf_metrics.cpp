@@ -0,0 +1,128 @@
+#include "perf_metrics.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+const uint32_t METRIC_BUCKET_US[METRIC_BUCKET_COUNT] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 1000000, 5000000,
+};
+
+namespace {
+
+// Constant-initialized, so metrics defined as globals in any translation
+// unit can link themselves in during static initialization
+const Metric* metricList = nullptr;
+const Metric** metricTail = &metricList;
+
+const char* const TYPE_NAMES[] = {"counter", "gauge", "histogram"};
+
+// snprintf into out + length, tracking overflow: once anything did not fit
+// the whole family is dropped (returns false)
+bool append(char* out, size_t size, size_t& length, const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+bool append(char* out, size_t size, size_t& length, const char* format, ...) {
+    if (length >= size) {
+        return false;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(out + length, size - length, format, args);
+    va_end(args);
+    if (written < 0 || static_cast<size_t>(written) >= size - length) {
+        length = size;
+        return false;
+    }
+    length += written;
+    return true;
+}
+
+}  // namespace
+
+Metric::Metric(const char* name, const char* help, MetricType type)
+    : name_(name), help_(help), type_(type), next_(nullptr) {
+    *metricTail = this;
+    metricTail = &next_;
+}
+
+const Metric* Metric::first() {
+    return metricList;
+}
+
+size_t Metric::format(char* out, size_t size) const {
+    size_t length = 0;
+    if (!append(out, size, length, "# HELP %s %s\n# TYPE %s %s\n", name_, help_, name_, TYPE_NAMES[type_])) {
+        return 0;
+    }
+    size_t samples = formatSamples(out + length, size - length);
+    return samples == 0 ? 0 : length + samples;
+}
+
+size_t MetricCounter::formatSamples(char* out, size_t size) const {
+    size_t length = 0;
+    return append(out, size, length, "%s %" PRIu32 "\n", name(), value()) ? length : 0;
+}
+
+size_t MetricGauge::formatSamples(char* out, size_t size) const {
+    size_t length = 0;
+    return append(out, size, length, "%s %" PRId32 "\n", name(), value()) ? length : 0;
+}
+
+LatencyHistogram::LatencyHistogram(const char* name, const char* help) : Metric(name, help, METRIC_HISTOGRAM) {
+    memset(&counts_, 0, sizeof(counts_));
+}
+
+// 32-bit arithmetic only; a 64-bit division is a library call on the ESP32
+void LatencyHistogram::observeCycles(uint32_t cycles) {
+    uint32_t perUs = perfCyclesPerUs();
+    record(cycles / perUs, (cycles % perUs) * 1000 / perUs);
+}
+
+void LatencyHistogram::record(uint32_t us, uint32_t extraNs) {
+    uint8_t bucket = 0;
+    while (bucket < METRIC_BUCKET_COUNT && us > METRIC_BUCKET_US[bucket]) {
+        bucket++;
+    }
+    uint32_t seq = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    counts_.buckets[bucket]++;
+    counts_.count++;
+    counts_.sumNs += static_cast<uint64_t>(us) * 1000 + extraNs;
+    std::atomic_thread_fence(std::memory_order_release);
+    sequence_.store(seq + 2, std::memory_order_relaxed);
+}
+
+HistogramCounts LatencyHistogram::counts() const {
+    HistogramCounts copy;
+    uint32_t before, after;
+    do {
+        before = sequence_.load(std::memory_order_acquire);
+        copy = counts_;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return copy;
+}
+
+// Cumulative buckets with their bounds in seconds, then _sum and _count
+size_t LatencyHistogram::formatSamples(char* out, size_t size) const {
+    HistogramCounts snapshot = counts();
+    size_t length = 0;
+    uint32_t cumulative = 0;
+    for (uint8_t i = 0; i < METRIC_BUCKET_COUNT; i++) {
+        cumulative += snapshot.buckets[i];
+        uint32_t us = METRIC_BUCKET_US[i];
+        if (!append(out, size, length, "%s_bucket{le=\"%" PRIu32 ".%06" PRIu32 "\"} %" PRIu32 "\n", name(),
+                    us / 1000000, us % 1000000, cumulative)) {
+            return 0;
+        }
+    }
+    bool ok = append(out, size, length, "%s_bucket{le=\"+Inf\"} %" PRIu32 "\n", name(), snapshot.count) &&
+              append(out, size, length, "%s_sum %" PRIu64 ".%09" PRIu32 "\n%s_count %" PRIu32 "\n", name(),
+                     snapshot.sumNs / 1000000000, static_cast<uint32_t>(snapshot.sumNs % 1000000000), name(),
+                     snapshot.count);
+    return ok ? length : 0;
+}
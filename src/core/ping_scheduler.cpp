@@ -0,0 +1,94 @@
+#include "ping_scheduler.h"
+
+#include "hal.h"
+#include "range_conversion.h"
+
+PingScheduler::PingScheduler(const PingScheduleConfig& config) {
+    maxRangeCm_ = config.maxRangeCm;
+    guardUs_ = config.guardUs;
+    configuredIdleUs_ = config.idleSlotUs;
+    setRangeFactor(rangeFactorQ18(RANGE_DEFAULT_DECI_CELSIUS));
+    holdUs_ = config.activeHoldMs * 1000;
+    active_ = true;
+    nextSlotUs_ = 0;
+    slotStartUs_ = 0;
+    lastNearUs_ = 0;
+    slots_ = 0;
+    skippedPings_ = 0;
+    lateSlots_ = 0;
+    wakeups_ = 0;
+}
+
+void PingScheduler::begin(uint32_t nowUs) {
+    active_ = true;
+    nextSlotUs_ = nowUs;
+    slotStartUs_ = nowUs - activeSlotUs_;
+    lastNearUs_ = nowUs;
+}
+
+void PingScheduler::setRangeFactor(uint32_t factorQ18) {
+    maxEchoWidthUs_ = echoWidthForCm(maxRangeCm_, factorQ18);
+    activeSlotUs_ = ECHO_START_US + maxEchoWidthUs_ + guardUs_;
+    idleSlotUs_ = configuredIdleUs_ > activeSlotUs_ ? configuredIdleUs_ : activeSlotUs_;
+}
+
+bool PingScheduler::due(uint32_t nowUs) {
+    int32_t behind = static_cast<int32_t>(nowUs - nextSlotUs_);
+    if (behind < 0) {
+        return false;
+    }
+    if (active_ && nowUs - lastNearUs_ >= holdUs_) {
+        active_ = false;
+    }
+
+    // A frame that ran late shifts the slot a little; a whole missed slot
+    // restarts the grid rather than firing a burst to catch up.
+    uint32_t slot = slotUs();
+    if (static_cast<uint32_t>(behind) >= slot) {
+        lateSlots_++;
+        nextSlotUs_ = nowUs;
+    }
+    slotStartUs_ = nextSlotUs_;
+    nextSlotUs_ += slot;
+    slots_++;
+    return true;
+}
+
+void PingScheduler::wake(uint32_t nowUs) {
+    lastNearUs_ = nowUs;
+    if (active_) {
+        return;
+    }
+    active_ = true;
+    wakeups_++;
+
+    // Cut the idle slot short: the next one starts where the fast grid
+    // would have put it, or now if that has already passed
+    uint32_t next = slotStartUs_ + activeSlotUs_;
+    if (static_cast<int32_t>(nowUs - next) > 0) {
+        next = nowUs;
+    }
+    if (static_cast<int32_t>(nextSlotUs_ - next) > 0) {
+        nextSlotUs_ = next;
+    }
+}
+
+uint32_t PingScheduler::untilDueUs(uint32_t nowUs) const {
+    int32_t ahead = static_cast<int32_t>(nextSlotUs_ - nowUs);
+    return ahead > 0 ? static_cast<uint32_t>(ahead) : 0;
+}
+
+uint32_t PingScheduler::samplesPerSecond(uint8_t pingsPerSlot) const {
+    return static_cast<uint32_t>(pingsPerSlot * 1000000ULL / slotUs());
+}
+
+PingScheduleStats PingScheduler::stats() const {
+    PingScheduleStats out;
+    out.slots = slots_;
+    out.skippedPings = skippedPings_;
+    out.lateSlots = lateSlots_;
+    out.wakeups = wakeups_;
+    out.slotUs = slotUs();
+    out.active = active_;
+    return out;
+}
@@ -0,0 +1,56 @@
+#include "power_monitor.h"
+
+#include <string.h>
+
+PowerMonitor::PowerMonitor(const PowerConfig& config)
+    : config_(config), lightSleep_(false), started_(false), windowStartUs_(0), frameUs_(config.activeFrameUs) {
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.frameUs = frameUs_;
+}
+
+// Idle frames end a little before the next slot is due rather than after it,
+// so a millisecond-tick sleep never makes the grid late
+uint32_t PowerMonitor::nextFrameUs(uint32_t idleUs) {
+    if (!config_.lowPower || idleUs <= config_.activeFrameUs) {
+        frameUs_ = config_.activeFrameUs;
+    } else {
+        frameUs_ = idleUs < config_.maxSleepUs ? idleUs : config_.maxSleepUs;
+        frameUs_ -= frameUs_ % 1000;
+    }
+    return frameUs_;
+}
+
+bool PowerMonitor::update(uint32_t nowUs) {
+    if (!started_) {
+        started_ = true;
+        windowStartUs_ = nowUs;
+        return false;
+    }
+    uint32_t elapsed = nowUs - windowStartUs_;
+    if (elapsed < POWER_WINDOW_US) {
+        return false;
+    }
+    windowStartUs_ = nowUs;
+
+    uint32_t wakes = wakes_.exchange(0, std::memory_order_relaxed);
+    uint64_t busy = busyUs_.exchange(0, std::memory_order_relaxed) + static_cast<uint64_t>(wakes) * config_.wakeUs;
+    uint64_t radio = radioUs_.exchange(0, std::memory_order_relaxed);
+    if (config_.listenIntervalUs == 0) {
+        radio = elapsed;
+    } else {
+        radio += static_cast<uint64_t>(elapsed / config_.listenIntervalUs) * config_.beaconListenUs;
+    }
+    busy = busy < elapsed ? busy : elapsed;
+    radio = radio < elapsed ? radio : elapsed;
+
+    uint32_t restingMa = lightSleep_ ? config_.sleepMa : config_.idleMa;
+    uint64_t deciMaUs = (busy * config_.awakeMa + (elapsed - busy) * restingMa + radio * config_.radioMa) * 10;
+
+    stats_.frameUs = frameUs_;
+    stats_.cpuDutyPermille = static_cast<uint16_t>(busy * 1000 / elapsed);
+    stats_.radioDutyPermille = static_cast<uint16_t>(radio * 1000 / elapsed);
+    stats_.wakeupsPerSecond = static_cast<uint16_t>(static_cast<uint64_t>(wakes) * 1000000 / elapsed);
+    stats_.estimatedDeciMa = static_cast<uint16_t>(deciMaUs / elapsed);
+    stats_.lightSleep = lightSleep_;
+    return true;
+}
@@ -0,0 +1,68 @@
+#include "range_conversion.h"
+
+namespace {
+
+// C++11 constexpr, so the table is built by the compiler on every target
+
+constexpr double sqrtNewton(double x, double guess, int steps) {
+    return steps == 0 ? guess : sqrtNewton(x, (guess + x / guess) / 2, steps - 1);
+}
+
+// Speed of sound in m/s -> round-trip mm per us is c / 2000; times 2^18
+constexpr uint16_t factorAt(int celsius) {
+    return static_cast<uint16_t>(331.3 * sqrtNewton(1.0 + celsius / 273.15, 1.0, 8) * 262144 / 2000 + 0.5);
+}
+
+template <int... Celsius>
+struct FactorTable {
+    static const uint16_t values[sizeof...(Celsius)];
+};
+
+template <int... Celsius>
+const uint16_t FactorTable<Celsius...>::values[] = {factorAt(Celsius)...};
+
+// Expands to FactorTable<first, first + 1, ..., first + count - 1>
+template <int First, int Count, int... Celsius>
+struct MakeFactorTable : MakeFactorTable<First, Count - 1, First + Count - 1, Celsius...> {};
+
+template <int First, int... Celsius>
+struct MakeFactorTable<First, 0, Celsius...> {
+    typedef FactorTable<Celsius...> type;
+};
+
+const int TABLE_SIZE = RANGE_MAX_CELSIUS - RANGE_MIN_CELSIUS + 1;
+typedef MakeFactorTable<RANGE_MIN_CELSIUS, TABLE_SIZE>::type Factors;
+
+// Spot checks against 331.3 * sqrt(1 + T / 273.15) * 262144 / 2000
+static_assert(factorAt(-20) == 41804, "range table at -20C");
+static_assert(factorAt(0) == 43424, "range table at 0C");
+static_assert(factorAt(20) == 44986, "range table at 20C");
+static_assert(factorAt(60) == 47957, "range table at 60C");
+// RANGE_MAX_WIDTH_US * factor + rounding must not overflow
+static_assert(RANGE_MAX_WIDTH_US * factorAt(RANGE_MAX_CELSIUS) + 0x20000 <= UINT32_MAX,
+              "range conversion overflows");
+
+}  // namespace
+
+uint32_t rangeFactorQ18(int16_t deciCelsius) {
+    int offset = deciCelsius - RANGE_MIN_CELSIUS * 10;
+    if (offset <= 0) {
+        return Factors::values[0];
+    }
+    if (offset >= (TABLE_SIZE - 1) * 10) {
+        return Factors::values[TABLE_SIZE - 1];
+    }
+    int index = offset / 10;
+    int tenths = offset % 10;
+    int low = Factors::values[index];
+    int high = Factors::values[index + 1];
+    return static_cast<uint32_t>(low + ((high - low) * tenths + 5) / 10);
+}
+
+uint32_t echoWidthForCm(int distanceCm, uint32_t factorQ18) {
+    if (distanceCm <= 0 || factorQ18 == 0) {
+        return 0;
+    }
+    uint64_t scaled = static_cast<uint64_t>(distanceCm) * 10 << 18;
+    return static_cast<uint32_t>((scaled + factorQ18 / 2) / factorQ18);
+}
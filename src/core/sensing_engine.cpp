@@ -0,0 +1,446 @@
+#include "sensing_engine.h"
+
+#include <string.h>
+
+#include "calendar.h"
+
+SensingEngine::SensingEngine(Clock& clock, EchoSource& echoes, const SensingConfig& config)
+    : clock_(clock), echoes_(echoes), config_(config), trace_(NULL), traceDoorway_(0),
+      scheduler_(config.ping) {
+    doorwayCount_ = config.doorwayCount < MAX_DOORWAYS ? config.doorwayCount : MAX_DOORWAYS;
+    roomCount_ = config.roomCount < MAX_ROOMS ? config.roomCount : MAX_ROOMS;
+    if (roomCount_ == 0) {
+        roomCount_ = 1;
+    }
+    slot_ = 0;
+    lastEchoUs_ = 0;
+    temperatureDeciC_ = RANGE_DEFAULT_DECI_CELSIUS;
+    rangeFactorQ18_ = rangeFactorQ18(temperatureDeciC_);
+    detectionLatencyUs_ = 0;
+    echoTimeouts_ = 0;
+    calibrationChanges_ = 0;
+    lastDayResetMs_ = 0;
+    analyticsDay_ = SENSING_NO_DAY;
+    config_.filter = sanitizeSignalFilter(config.filter);
+    memset(channelMap_, -1, sizeof(channelMap_));
+    memset(rooms_, 0, sizeof(rooms_));
+    for (uint8_t i = 0; i < MAX_ROOMS; i++) {
+        rooms_[i].confidence = trackers_[i].confidence();
+    }
+    memset(energy_, 0, sizeof(energy_));
+    memset(sessionPeak_, 0, sizeof(sessionPeak_));
+    memset(sessionConfidence_, 0, sizeof(sessionConfidence_));
+    droppedSessions_ = 0;
+    memset(&carriedEnergy_, 0, sizeof(carriedEnergy_));
+    carriedTotalMs_ = 0;
+    carriedDailyMs_ = 0;
+
+    for (uint8_t i = 0; i < MAX_DOORWAYS; i++) {
+        Doorway& doorway = doorways_[i];
+        memset(doorway.channel, 0, sizeof(doorway.channel));
+        doorway.room = 0;
+        doorway.phase = 0;
+        doorway.updated = false;
+        for (uint8_t side = 0; side < 2; side++) {
+            doorway.distanceCm[side] = config.noEchoDistanceCm;
+            doorway.thresholdCm[side] = config.doorway.thresholdCm;
+        }
+    }
+
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        const DoorwaySetup& setup = config.doorways[i];
+        Doorway& doorway = doorways_[i];
+        doorway.channel[0] = setup.entranceChannel;
+        doorway.channel[1] = setup.insideChannel;
+        doorway.room = setup.room < roomCount_ ? setup.room : 0;
+        doorway.phase = setup.phase & 1;
+        for (uint8_t side = 0; side < 2; side++) {
+            if (doorway.channel[side] < SENSING_MAX_CHANNELS) {
+                channelMap_[doorway.channel[side]] = i * 2 + side;
+            }
+        }
+    }
+}
+
+void SensingEngine::begin() {
+    lastDayResetMs_ = clock_.millis();
+    echoes_.setMaxEchoWidth(scheduler_.maxEchoWidthUs());
+    scheduler_.begin(clock_.micros());
+}
+
+void SensingEngine::setTemperature(int16_t deciCelsius) {
+    temperatureDeciC_ = deciCelsius;
+    rangeFactorQ18_ = rangeFactorQ18(deciCelsius);
+    scheduler_.setRangeFactor(rangeFactorQ18_);
+    echoes_.setMaxEchoWidth(scheduler_.maxEchoWidthUs());
+}
+
+CrossingEvent SensingEngine::step() {
+    schedulePing();
+
+    // Drain every finished echo; a doorway's state machine only needs to run
+    // when one of its readings actually changed.
+    uint32_t nowMs = clock_.millis();
+    EchoSample sample;
+    bool updated = false;
+    while (echoes_.next(sample)) {
+        applyEchoSample(sample, nowMs);
+        updated = true;
+    }
+
+    checkPeriodRollover(nowMs);
+    for (uint8_t i = 0; i < roomCount_; i++) {
+        if (trackers_[i].reconcile(nowMs, config_.tracker)) {
+            applyEstimate(i, nowMs);
+            logMessage("Room %u quiet, count now %d (%u%%)\n", i, rooms_[i].occupantCount, rooms_[i].confidence);
+        }
+    }
+    if (!updated) {
+        return CROSSING_NONE;
+    }
+
+    CrossingEvent last = CROSSING_NONE;
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        Doorway& doorway = doorways_[i];
+        if (!doorway.updated) {
+            continue;
+        }
+        doorway.updated = false;
+        if (calibrating(doorway)) {
+            doorway.passage.sync(doorway.filter[0].present(), doorway.filter[1].present());
+            continue;
+        }
+
+        Passage passage;
+        bool done = doorway.passage.update(doorway.filter[0].present(), doorway.filter[1].present(), nowMs,
+                                           config_.doorway.sequenceTimeoutMs, passage);
+        if (doorway.passage.busy()) {
+            scheduler_.wake(clock_.micros());
+            trackers_[doorway.room].activity(nowMs);
+        }
+        if (!done) {
+            continue;
+        }
+        applyPassage(i, passage, nowMs);
+        last = passage.net > 0 ? CROSSING_ENTRY : CROSSING_EXIT;
+    }
+    return last;
+}
+
+void SensingEngine::applyPassage(uint8_t index, const Passage& passage, uint32_t nowMs) {
+    uint8_t roomIndex = doorways_[index].room;
+    RoomState& room = rooms_[roomIndex];
+    OccupancyTracker& tracker = trackers_[roomIndex];
+    tracker.applyPassage(passage);
+    tracker.activity(nowMs);
+    uint8_t people = passagePeople(passage);
+    CrossingEvent event = passage.net > 0 ? CROSSING_ENTRY : CROSSING_EXIT;
+    if (event == CROSSING_ENTRY) {
+        room.entries += people;
+    } else {
+        room.exits += people;
+    }
+    applyEstimate(roomIndex, nowMs);
+    detectionLatencyUs_ = clock_.micros() - lastEchoUs_;
+    if (trace_ && index == traceDoorway_) {
+        for (uint8_t i = 0; i < people; i++) {
+            trace_->recordCrossing(event, nowMs);
+        }
+    }
+
+    const char* verb = event == CROSSING_ENTRY ? "entered" : "exited";
+    if (people == 1) {
+        logMessage("Person %s room %u (doorway %u). Count: %d (%u%%)\n", verb, roomIndex, index,
+                   room.occupantCount, room.confidence);
+    } else {
+        logMessage("%u people %s room %u (doorway %u). Count: %d (%u%%)\n", people, verb, roomIndex, index,
+                   room.occupantCount, room.confidence);
+    }
+}
+
+void SensingEngine::applyEstimate(uint8_t room, uint32_t nowMs) {
+    bool wasOccupied = rooms_[room].occupied;
+    uint32_t sessionMs = roomApplyEstimate(rooms_[room], trackers_[room], nowMs);
+    const RoomState& state = rooms_[room];
+    uint8_t count = state.occupantCount < 0 ? 0 : (state.occupantCount > 255 ? 255 : state.occupantCount);
+    if (state.occupied) {
+        if (!wasOccupied) {
+            sessionPeak_[room] = 0;
+            sessionConfidence_[room] = 100;
+        }
+        if (count > sessionPeak_[room]) {
+            sessionPeak_[room] = count;
+        }
+        if (state.confidence < sessionConfidence_[room]) {
+            sessionConfidence_[room] = state.confidence;
+        }
+    }
+    if (sessionMs > 0) {
+        updateEnergySavings(energy_[room], sessionMs, config_.lightPowerWatts);
+
+        SessionRecord session;
+        session.leftSeconds = clock_.epochSeconds();
+        session.enteredSeconds = session.leftSeconds ? session.leftSeconds - sessionMs / 1000 : 0;
+        session.durationMs = sessionMs;
+        session.room = room;
+        session.peakOccupants = sessionPeak_[room];
+        // The count that ended the session is part of it too
+        session.confidence = state.confidence < sessionConfidence_[room] ? state.confidence : sessionConfidence_[room];
+        session.reserved = 0;
+        if (!sessions_.push(session)) {
+            droppedSessions_++;
+        }
+    }
+}
+
+void SensingEngine::fillSnapshot(StatusSnapshot& out) const {
+    EnergyAnalytics total = carriedEnergy_;
+    unsigned long dailyOccupied = carriedDailyMs_;
+    unsigned long totalOccupied = carriedTotalMs_;
+    out.occupied = false;
+    out.occupantCount = 0;
+    out.totalEntries = 0;
+    out.totalExits = 0;
+    out.occupiedRooms = 0;
+    out.occupancyConfidence = 100;
+    out.roomCount = roomCount_;
+    for (uint8_t i = 0; i < roomCount_; i++) {
+        const RoomState& room = rooms_[i];
+        const EnergyAnalytics& energy = energy_[i];
+        RoomSnapshot& r = out.rooms[i];
+        r.occupied = room.occupied;
+        r.occupantCount = room.occupantCount;
+        r.confidence = room.confidence;
+        r.energySavedToday = energy.energySavedToday;
+        r.energySavedWeek = energy.energySavedWeek;
+        r.energySavedMonth = energy.energySavedMonth;
+        r.energySavedYear = energy.energySavedYear;
+        r.dailyOccupiedTime = room.dailyOccupiedTime;
+        r.totalOccupiedTime = room.totalOccupiedTime;
+        r.entries = room.entries;
+        r.exits = room.exits;
+
+        out.occupied = out.occupied || room.occupied;
+        out.occupiedRooms += room.occupied ? 1 : 0;
+        if (room.confidence < out.occupancyConfidence) {
+            out.occupancyConfidence = room.confidence;
+        }
+        out.occupantCount += room.occupantCount;
+        out.totalEntries += room.entries;
+        out.totalExits += room.exits;
+        total.energySavedToday += energy.energySavedToday;
+        total.energySavedWeek += energy.energySavedWeek;
+        total.energySavedMonth += energy.energySavedMonth;
+        total.energySavedYear += energy.energySavedYear;
+        dailyOccupied += room.dailyOccupiedTime;
+        totalOccupied += room.totalOccupiedTime;
+    }
+
+    out.doorwayCount = doorwayCount_;
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        out.doorways[i].room = doorways_[i].room;
+        out.doorways[i].entranceCm = doorways_[i].distanceCm[0];
+        out.doorways[i].insideCm = doorways_[i].distanceCm[1];
+    }
+
+    out.distance1 = doorways_[0].distanceCm[0];
+    out.distance2 = doorways_[0].distanceCm[1];
+    out.energySavedToday = total.energySavedToday;
+    out.energySavedWeek = total.energySavedWeek;
+    out.energySavedMonth = total.energySavedMonth;
+    out.energySavedYear = total.energySavedYear;
+    out.dailyOccupiedTime = dailyOccupied;
+    out.totalOccupiedTime = totalOccupied;
+    out.detectionLatencyUs = detectionLatencyUs_;
+    out.samplesPerSecond = scheduler_.samplesPerSecond(doorwayCount_);
+    PingScheduleStats pings = scheduler_.stats();
+    out.skippedPings = pings.skippedPings;
+    out.lateSlots = pings.lateSlots;
+    out.echoTimeouts = echoTimeouts_;
+}
+
+void SensingEngine::restoreTotals(const EnergyAnalytics& energy, uint32_t totalOccupiedMs,
+                                  uint32_t dailyOccupiedMs, int32_t day) {
+    carriedEnergy_ = energy;
+    carriedTotalMs_ = totalOccupiedMs;
+    carriedDailyMs_ = dailyOccupiedMs;
+    analyticsDay_ = day;
+}
+
+uint32_t SensingEngine::idleUs() {
+    if (scheduler_.active()) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        if (echoes_.busy(doorways_[i].channel[0]) || echoes_.busy(doorways_[i].channel[1]) ||
+            doorways_[i].passage.busy()) {
+            return 0;
+        }
+    }
+    return scheduler_.untilDueUs(clock_.micros());
+}
+
+// Start the next slot when the grid says so and every echo of the current
+// one is in. A sensor that refuses the trigger is counted and skipped for
+// this slot rather than retried, so it cannot push the others off the grid.
+void SensingEngine::schedulePing() {
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        if (echoes_.busy(doorways_[i].channel[0]) || echoes_.busy(doorways_[i].channel[1])) {
+            return;
+        }
+    }
+    if (!scheduler_.due(clock_.micros())) {
+        return;
+    }
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        const Doorway& doorway = doorways_[i];
+        if (!echoes_.trigger(doorway.channel[slot_ ^ doorway.phase])) {
+            scheduler_.pingSkipped();
+        }
+    }
+    slot_ ^= 1;
+}
+
+// Apply one finished echo to the matching distance reading. The trace gets
+// the raw reading at the frame time, which is what the filter sees.
+void SensingEngine::applyEchoSample(const EchoSample& sample, uint32_t nowMs) {
+    if (sample.channel >= SENSING_MAX_CHANNELS || channelMap_[sample.channel] < 0) {
+        return;
+    }
+    uint8_t index = static_cast<uint8_t>(channelMap_[sample.channel]);
+    uint8_t side = index & 1;
+    Doorway& doorway = doorways_[index >> 1];
+
+    if (sample.timedOut) {
+        echoTimeouts_++;
+    }
+    int distance = sample.timedOut ? config_.noEchoDistanceCm : echoWidthToCm(sample.widthUs, rangeFactorQ18_);
+    if (distance < config_.ping.wakeDistanceCm) {
+        scheduler_.wake(sample.timestampUs);
+    }
+    SignalFilter& filter = doorway.filter[side];
+    filter.update(distance, doorway.thresholdCm[side], config_.filter);
+    doorway.distanceCm[side] = filter.smoothed();
+    learnBaseline(doorway, index, filter.smoothed());
+    doorway.updated = true;
+    if (trace_ && (index >> 1) == traceDoorway_) {
+        trace_->recordReading(side, distance, nowMs);
+    }
+    lastEchoUs_ = sample.timestampUs;
+}
+
+// Until a sensor is calibrated every reading counts, so a fresh doorway
+// learns within a second or two. After that only readings taken while the
+// room is empty and nobody is in this doorway do.
+void SensingEngine::learnBaseline(Doorway& doorway, uint8_t index, int distance) {
+    uint8_t side = index & 1;
+    BaselineEstimator& baseline = doorway.baseline[side];
+    if (!config_.baseline.enabled) {
+        return;
+    }
+    bool wasCalibrated = baseline.calibrated(config_.baseline);
+    if (wasCalibrated && (rooms_[doorway.room].occupied || doorway.filter[side].present() ||
+                          doorway.passage.busy())) {
+        return;
+    }
+    if (!baseline.add(distance, config_.baseline)) {
+        return;
+    }
+
+    // The threshold drifts slowly; recomputing it (a square root) every
+    // 16th reading is plenty
+    bool isCalibrated = baseline.calibrated(config_.baseline);
+    if (isCalibrated != wasCalibrated || (baseline.state().samples & 15) == 0) {
+        doorway.thresholdCm[side] = baseline.threshold(config_.baseline, config_.doorway.thresholdCm);
+    }
+    if (isCalibrated != wasCalibrated) {
+        calibrationChanges_++;
+        if (isCalibrated) {
+            logMessage("Doorway %u sensor %u calibrated: empty at %d cm, threshold %d cm\n", index >> 1, side,
+                       baseline.meanCm(), doorway.thresholdCm[side]);
+        } else {
+            logMessage("Doorway %u sensor %u changed, calibrating again\n", index >> 1, side);
+        }
+    }
+}
+
+bool SensingEngine::calibrating(const Doorway& doorway) const {
+    return config_.baseline.enabled && !(doorway.baseline[0].calibrated(config_.baseline) &&
+                                         doorway.baseline[1].calibrated(config_.baseline));
+}
+
+void SensingEngine::exportCalibration(CalibrationSet& out) const {
+    memset(&out, 0, sizeof(out));
+    out.count = doorwayCount_ * 2;
+    for (uint8_t i = 0; i < out.count; i++) {
+        out.sensors[i] = doorways_[i >> 1].baseline[i & 1].state();
+    }
+}
+
+void SensingEngine::restoreCalibration(const CalibrationSet& set) {
+    for (uint8_t i = 0; i < set.count && i < doorwayCount_ * 2; i++) {
+        Doorway& doorway = doorways_[i >> 1];
+        doorway.baseline[i & 1].restore(set.sensors[i]);
+        doorway.thresholdCm[i & 1] = doorway.baseline[i & 1].threshold(config_.baseline, config_.doorway.thresholdCm);
+    }
+    calibrationChanges_++;
+}
+
+void SensingEngine::setDoorwayConfig(const DoorwayConfig& doorway) {
+    config_.doorway = doorway;
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        for (uint8_t side = 0; side < 2; side++) {
+            doorways_[i].thresholdCm[side] =
+                doorways_[i].baseline[side].threshold(config_.baseline, config_.doorway.thresholdCm);
+        }
+    }
+}
+
+void SensingEngine::resetCalibration() {
+    for (uint8_t i = 0; i < doorwayCount_; i++) {
+        for (uint8_t side = 0; side < 2; side++) {
+            doorways_[i].baseline[side].reset();
+            doorways_[i].thresholdCm[side] = config_.doorway.thresholdCm;
+        }
+        doorways_[i].passage.reset();
+    }
+    calibrationChanges_++;
+    logMessage("Calibration reset, learning the empty doorways\n");
+}
+
+void SensingEngine::resetDailyOccupied() {
+    for (uint8_t i = 0; i < roomCount_; i++) {
+        rooms_[i].dailyOccupiedTime = 0;
+    }
+    carriedDailyMs_ = 0;
+}
+
+// Roll the totals over at local midnight once NTP has set the clock. Until
+// then the only reference is uptime, so the day restarts every 24 hours.
+void SensingEngine::checkPeriodRollover(uint32_t nowMs) {
+    uint32_t epochSeconds = clock_.epochSeconds();
+    if (epochSeconds != 0) {
+        int32_t day = localDayFromMinute(epochSeconds / 60, config_.utcOffsetMinutes);
+        if (analyticsDay_ != SENSING_NO_DAY && day > analyticsDay_) {
+            resetDailyOccupied();
+            rollEnergyPeriods(carriedEnergy_, analyticsDay_, day);
+            for (uint8_t i = 0; i < roomCount_; i++) {
+                rollEnergyPeriods(energy_[i], analyticsDay_, day);
+            }
+        }
+        if (analyticsDay_ == SENSING_NO_DAY || day > analyticsDay_) {
+            analyticsDay_ = day;
+        }
+        lastDayResetMs_ = nowMs;
+        return;
+    }
+
+    if (nowMs - lastDayResetMs_ > DAY_MS) {
+        resetDailyOccupied();
+        resetDailyEnergy(carriedEnergy_);
+        for (uint8_t i = 0; i < roomCount_; i++) {
+            resetDailyEnergy(energy_[i]);
+        }
+        lastDayResetMs_ = nowMs;
+    }
+}
@@ -0,0 +1,302 @@
+#include "sensor_trace.h"
+
+#include <string.h>
+
+#include "byte_order.h"
+
+namespace {
+
+// Longest gap one record can encode (delta << 2 must fit 32 bits)
+const uint32_t MAX_DELTA_MS = 1UL << 29;
+const size_t RECORD_MAX = 10;  // Two 5-byte varints
+
+size_t putVarint(uint8_t* out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+uint32_t zigzag(int32_t value) {
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unzigzag(uint32_t value) {
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+}  // namespace
+
+TraceRecorder::TraceRecorder() : nextSequence_(0), lastMs_(0) {
+    memset(blocks_, 0, sizeof(blocks_));
+    lastDistance_[0] = 0;
+    lastDistance_[1] = 0;
+}
+
+void TraceRecorder::recordReading(uint8_t sensor, int distanceCm, uint32_t nowMs) {
+    sensor &= 1;
+    std::lock_guard<std::mutex> guard(lock_);
+    append(sensor, distanceCm - lastDistance_[sensor], nowMs);
+    lastDistance_[sensor] = distanceCm;
+}
+
+void TraceRecorder::recordCrossing(CrossingEvent event, uint32_t nowMs) {
+    std::lock_guard<std::mutex> guard(lock_);
+    append(TRACE_CROSSING, event, nowMs);
+}
+
+uint32_t TraceRecorder::oldestSequence() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return nextSequence_ > TRACE_BLOCK_COUNT ? nextSequence_ - TRACE_BLOCK_COUNT : 0;
+}
+
+uint32_t TraceRecorder::nextSequence() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return nextSequence_;
+}
+
+size_t TraceRecorder::copyBlock(uint32_t sequence, uint8_t* out) {
+    std::lock_guard<std::mutex> guard(lock_);
+    const Block& block = blocks_[sequence % TRACE_BLOCK_COUNT];
+    if (sequence >= nextSequence_ || block.sequence != sequence) {
+        return 0;
+    }
+
+    putU32(out, block.sequence);
+    putU32(out + 4, block.startMs);
+    putU16(out + 8, static_cast<uint16_t>(block.distance[0]));
+    putU16(out + 10, static_cast<uint16_t>(block.distance[1]));
+    putU16(out + 12, block.length);
+    memcpy(out + TRACE_BLOCK_HEADER_SIZE, block.data, block.length);
+    return TRACE_BLOCK_HEADER_SIZE + block.length;
+}
+
+// Caller holds lock_
+void TraceRecorder::append(uint8_t kind, int32_t value, uint32_t nowMs) {
+    if (nextSequence_ == 0 || !encode(blocks_[(nextSequence_ - 1) % TRACE_BLOCK_COUNT], kind, value, nowMs)) {
+        openBlock(nowMs);
+        encode(blocks_[(nextSequence_ - 1) % TRACE_BLOCK_COUNT], kind, value, nowMs);
+    }
+    lastMs_ = nowMs;
+}
+
+bool TraceRecorder::encode(Block& block, uint8_t kind, int32_t value, uint32_t nowMs) {
+    uint32_t delta = nowMs - lastMs_;
+    if (delta >= MAX_DELTA_MS) {
+        return false;
+    }
+
+    uint8_t record[RECORD_MAX];
+    size_t n = putVarint(record, (delta << 2) | kind);
+    n += putVarint(record + n, zigzag(value));
+    if (block.length + n > TRACE_BLOCK_DATA) {
+        return false;
+    }
+    memcpy(block.data + block.length, record, n);
+    block.length += n;
+    return true;
+}
+
+// Start a new block, overwriting the oldest once the ring is full. The
+// block carries the current readings so it decodes on its own.
+void TraceRecorder::openBlock(uint32_t nowMs) {
+    Block& block = blocks_[nextSequence_ % TRACE_BLOCK_COUNT];
+    block.sequence = nextSequence_++;
+    block.startMs = nowMs;
+    block.distance[0] = lastDistance_[0];
+    block.distance[1] = lastDistance_[1];
+    block.length = 0;
+    lastMs_ = nowMs;
+}
+
+TraceReader::TraceReader(const uint8_t* data, size_t length)
+    : data_(data), length_(length), pos_(TRACE_MAGIC_SIZE), blockEnd_(TRACE_MAGIC_SIZE),
+      started_(false), gapBefore_(false), sequence_(0), gaps_(0), nowMs_(0) {
+    valid_ = length >= TRACE_MAGIC_SIZE && memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0;
+    distance_[0] = 0;
+    distance_[1] = 0;
+}
+
+bool TraceReader::next(TraceRecord& out) {
+    gapBefore_ = false;
+    while (valid_) {
+        if (pos_ >= blockEnd_) {
+            if (pos_ == length_) {
+                return false;
+            }
+            if (!readBlockHeader()) {
+                valid_ = false;
+                return false;
+            }
+            continue;
+        }
+
+        uint32_t head;
+        uint32_t value;
+        if (!readVarint(head) || !readVarint(value)) {
+            valid_ = false;
+            return false;
+        }
+
+        uint8_t kind = head & 3;
+        nowMs_ += head >> 2;
+        out.kind = kind;
+        out.atMs = nowMs_;
+        if (kind == TRACE_SENSOR1 || kind == TRACE_SENSOR2) {
+            distance_[kind] += unzigzag(value);
+            out.value = distance_[kind];
+            return true;
+        }
+        if (kind == TRACE_CROSSING) {
+            out.value = unzigzag(value);
+            return true;
+        }
+        // Unknown kinds are skipped so older readers survive new records
+    }
+    return false;
+}
+
+bool TraceReader::readBlockHeader() {
+    if (length_ - pos_ < TRACE_BLOCK_HEADER_SIZE) {
+        return false;
+    }
+    const uint8_t* header = data_ + pos_;
+    uint32_t sequence = getU32(header);
+    uint16_t length = getU16(header + 12);
+    if (length > TRACE_BLOCK_DATA || length_ - pos_ - TRACE_BLOCK_HEADER_SIZE < length) {
+        return false;
+    }
+
+    // Blocks from a later boot restart at 0, which also counts as a gap
+    if (started_ && sequence != sequence_ + 1) {
+        gaps_++;
+        gapBefore_ = true;
+    }
+    started_ = true;
+    sequence_ = sequence;
+    nowMs_ = getU32(header + 4);
+    distance_[0] = static_cast<int16_t>(getU16(header + 8));
+    distance_[1] = static_cast<int16_t>(getU16(header + 10));
+    pos_ += TRACE_BLOCK_HEADER_SIZE;
+    blockEnd_ = pos_ + length;
+    return true;
+}
+
+bool TraceReader::readVarint(uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && pos_ < blockEnd_; shift += 7) {
+        uint8_t byte = data_[pos_++];
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+// Readings with the same frame time go through the state machine together
+struct Replayer {
+    const DoorwayConfig& config;
+    const SignalFilterConfig& filterConfig;
+    ReplayCallback callback;
+    void* context;
+    ReplayResult& result;
+    PassageDecoder doorway;
+    OccupancyTracker room;
+    SignalFilter filter[2];
+    bool primed;        // Both sensors have a reading since the start or the last gap
+    bool pending;
+    uint32_t pendingMs;
+
+    void reading(uint8_t sensor, int cm) {
+        filter[sensor].update(cm, config.thresholdCm, filterConfig);
+    }
+
+    void flush() {
+        if (!pending) {
+            return;
+        }
+        pending = false;
+        Passage passage;
+        if (!doorway.update(filter[0].present(), filter[1].present(), pendingMs, config.sequenceTimeoutMs,
+                            passage)) {
+            return;
+        }
+        room.applyPassage(passage);
+        CrossingEvent event = passage.net > 0 ? CROSSING_ENTRY : CROSSING_EXIT;
+        uint8_t people = passagePeople(passage);
+        if (event == CROSSING_ENTRY) {
+            result.entries += people;
+        } else {
+            result.exits += people;
+        }
+        if (callback) {
+            for (uint8_t i = 0; i < people; i++) {
+                callback(event, pendingMs, room.count(), context);
+            }
+        }
+    }
+};
+
+}  // namespace
+
+ReplayResult replayTrace(const uint8_t* data, size_t length, const DoorwayConfig& config,
+                         const SignalFilterConfig& filter, ReplayCallback callback, void* context) {
+    ReplayResult result;
+    memset(&result, 0, sizeof(result));
+
+    SignalFilterConfig filterConfig = sanitizeSignalFilter(filter);
+    Replayer replayer = {config, filterConfig, callback, context, result, {}, {}, {}, false, false, 0};
+
+    TraceReader reader(data, length);
+    TraceRecord record;
+    while (reader.next(record)) {
+        if (reader.gapBefore()) {
+            // Lost blocks: whatever sequence was in progress is meaningless
+            replayer.flush();
+            replayer.doorway.reset();
+            replayer.filter[0].reset();
+            replayer.filter[1].reset();
+            replayer.primed = false;
+        }
+
+        if (record.kind == TRACE_CROSSING) {
+            if (record.value == CROSSING_ENTRY) {
+                result.deviceEntries++;
+            } else if (record.value == CROSSING_EXIT) {
+                result.deviceExits++;
+            }
+            continue;
+        }
+
+        if (replayer.pending && record.atMs != replayer.pendingMs) {
+            replayer.flush();
+        }
+        uint8_t sensor = record.kind;
+        if (!replayer.primed) {
+            // The other sensor's last reading comes from the block header
+            replayer.reading(sensor ^ 1, reader.distance(sensor ^ 1));
+            replayer.primed = true;
+        }
+        replayer.reading(sensor, record.value);
+        replayer.pending = true;
+        replayer.pendingMs = record.atMs;
+        result.readings++;
+    }
+    replayer.flush();
+
+    result.finalCount = replayer.room.count();
+    result.finalConfidence = replayer.room.confidence();
+    result.turnedBack = replayer.doorway.stats().turnedBack;
+    result.tandem = replayer.doorway.stats().tandem;
+    result.slow = replayer.doorway.stats().slow;
+    result.guessed = replayer.doorway.stats().guessed;
+    result.gaps = reader.gaps();
+    result.valid = reader.valid();
+    return result;
+}
@@ -0,0 +1,186 @@
+#include "session_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const uint32_t DWELL_BOUNDS[SESSION_DWELL_BUCKETS] = {60, 300, 900, 1800, 3600, 7200, 14400, 28800, 0};
+const uint32_t SUB_BUCKETS = 1u << SESSION_SKETCH_SUB_BITS;
+
+// Exact below SUB_BUCKETS seconds, then SUB_BUCKETS buckets per doubling
+uint8_t sketchIndex(uint32_t seconds) {
+    if (seconds < SUB_BUCKETS) {
+        return static_cast<uint8_t>(seconds);
+    }
+    uint8_t msb = 0;
+    while ((seconds >> msb) > 1) {
+        msb++;
+    }
+    uint32_t index = SUB_BUCKETS + (msb - SESSION_SKETCH_SUB_BITS) * SUB_BUCKETS +
+                     ((seconds >> (msb - SESSION_SKETCH_SUB_BITS)) & (SUB_BUCKETS - 1));
+    return static_cast<uint8_t>(index < SESSION_SKETCH_BUCKETS ? index : SESSION_SKETCH_BUCKETS - 1);
+}
+
+// Middle of a bucket's range
+uint32_t sketchValue(uint8_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    uint32_t octave = (index - SUB_BUCKETS) / SUB_BUCKETS;
+    uint32_t sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+    uint32_t width = 1UL << octave;
+    return ((SUB_BUCKETS + sub) << octave) + width / 2;
+}
+
+size_t finished(int length, size_t size) {
+    return length > 0 && static_cast<size_t>(length) < size ? static_cast<size_t>(length) : 0;
+}
+
+}  // namespace
+
+SessionLog::SessionLog(int32_t utcOffsetMinutes) : utcOffsetSeconds_(utcOffsetMinutes * 60), total_(0) {
+    memset(ring_, 0, sizeof(ring_));
+    memset(dwell_, 0, sizeof(dwell_));
+    memset(sketch_, 0, sizeof(sketch_));
+    memset(hourSeconds_, 0, sizeof(hourSeconds_));
+    memset(hourStarts_, 0, sizeof(hourStarts_));
+}
+
+void SessionLog::add(const SessionRecord& session) {
+    ring_[total_ % SESSION_LOG_CAPACITY] = session;
+    total_++;
+
+    uint32_t seconds = session.durationMs / 1000;
+    uint8_t bucket = 0;
+    while (bucket < SESSION_DWELL_BUCKETS - 1 && seconds >= DWELL_BOUNDS[bucket]) {
+        bucket++;
+    }
+    dwell_[bucket]++;
+    sketch_[sketchIndex(seconds)]++;
+    addHours(session);
+}
+
+// Spread the session's time over the local hours it covered. Whole days
+// go to every hour at once, so this is at most 25 steps.
+void SessionLog::addHours(const SessionRecord& session) {
+    if (session.enteredSeconds == 0) {
+        return;
+    }
+    int64_t start = static_cast<int64_t>(session.enteredSeconds) + utcOffsetSeconds_;
+    uint32_t duration = session.durationMs / 1000;
+    hourStarts_[(start / 3600) % 24]++;
+
+    uint32_t days = duration / 86400;
+    if (days > 0) {
+        for (uint8_t hour = 0; hour < 24; hour++) {
+            hourSeconds_[hour] += days * 3600;
+        }
+        start += static_cast<int64_t>(days) * 86400;
+        duration -= days * 86400;
+    }
+    int64_t end = start + duration;
+    while (start < end) {
+        int64_t boundary = (start / 3600 + 1) * 3600;
+        int64_t stop = boundary < end ? boundary : end;
+        hourSeconds_[(start / 3600) % 24] += static_cast<uint32_t>(stop - start);
+        start = stop;
+    }
+}
+
+const SessionRecord& SessionLog::recent(size_t index) const {
+    return ring_[(total_ - 1 - index) % SESSION_LOG_CAPACITY];
+}
+
+uint32_t SessionLog::dwellBoundSeconds(uint8_t bucket) {
+    return DWELL_BOUNDS[bucket];
+}
+
+uint32_t SessionLog::quantileSeconds(uint8_t percent) const {
+    if (total_ == 0) {
+        return 0;
+    }
+    uint64_t rank = (static_cast<uint64_t>(total_) * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < SESSION_SKETCH_BUCKETS; i++) {
+        seen += sketch_[i];
+        if (seen >= rank) {
+            return sketchValue(i);
+        }
+    }
+    return sketchValue(SESSION_SKETCH_BUCKETS - 1);
+}
+
+size_t SessionLog::busiestHours(uint8_t* out, size_t max) const {
+    size_t count = 0;
+    bool taken[24] = {};
+    while (count < max) {
+        int best = -1;
+        for (uint8_t hour = 0; hour < 24; hour++) {
+            if (!taken[hour] && hourSeconds_[hour] > 0 && (best < 0 || hourSeconds_[hour] > hourSeconds_[best])) {
+                best = hour;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        taken[best] = true;
+        out[count++] = static_cast<uint8_t>(best);
+    }
+    return count;
+}
+
+size_t formatSessionSummary(const SessionLog& log, char* out, size_t size) {
+    size_t length = finished(snprintf(out, size, "{\"sessions\":%lu,\"p50Seconds\":%lu,\"p90Seconds\":%lu,\"dwellBounds\":[",
+                                      static_cast<unsigned long>(log.total()),
+                                      static_cast<unsigned long>(log.quantileSeconds(50)),
+                                      static_cast<unsigned long>(log.quantileSeconds(90))),
+                             size);
+    for (uint8_t i = 0; length > 0 && i < SESSION_DWELL_BUCKETS - 1; i++) {
+        length += finished(snprintf(out + length, size - length, "%s%lu", i ? "," : "",
+                                    static_cast<unsigned long>(SessionLog::dwellBoundSeconds(i))),
+                           size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "],\"dwellCounts\":["), size - length);
+    for (uint8_t i = 0; i < SESSION_DWELL_BUCKETS; i++) {
+        length += finished(snprintf(out + length, size - length, "%s%lu", i ? "," : "",
+                                    static_cast<unsigned long>(log.dwellCount(i))),
+                           size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "],\"hourOccupiedSeconds\":["), size - length);
+    for (uint8_t hour = 0; hour < 24; hour++) {
+        length += finished(snprintf(out + length, size - length, "%s%lu", hour ? "," : "",
+                                    static_cast<unsigned long>(log.hourOccupiedSeconds(hour))),
+                           size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "],\"hourSessions\":["), size - length);
+    for (uint8_t hour = 0; hour < 24; hour++) {
+        length += finished(snprintf(out + length, size - length, "%s%lu", hour ? "," : "",
+                                    static_cast<unsigned long>(log.hourSessions(hour))),
+                           size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "],\"busiestHours\":["), size - length);
+    uint8_t hours[SESSION_BUSIEST_HOURS];
+    size_t count = log.busiestHours(hours, SESSION_BUSIEST_HOURS);
+    for (size_t i = 0; i < count; i++) {
+        length += finished(snprintf(out + length, size - length, "%s%u", i ? "," : "", hours[i]), size - length);
+    }
+    length += finished(snprintf(out + length, size - length, "],\"recent\":["), size - length);
+    return length < size ? length : 0;
+}
+
+size_t formatSessionRecord(const SessionRecord& session, bool first, char* out, size_t size) {
+    int length = snprintf(out, size, "%s[%u,%lu,%lu,%lu,%u,%u]", first ? "" : ",", session.room,
+                          static_cast<unsigned long>(session.enteredSeconds),
+                          static_cast<unsigned long>(session.leftSeconds),
+                          static_cast<unsigned long>(session.durationMs / 1000), session.peakOccupants,
+                          session.confidence);
+    return finished(length, size);
+}
+
+size_t formatSessionFooter(char* out, size_t size) {
+    return finished(snprintf(out, size, "]}"), size);
+}
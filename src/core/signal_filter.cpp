@@ -0,0 +1,86 @@
+#include "signal_filter.h"
+
+#include <string.h>
+
+// Longest debounce accepted; more would add seconds of latency at the idle rate
+#define SIGNAL_FILTER_MAX_DEBOUNCE 8
+
+SignalFilterConfig sanitizeSignalFilter(const SignalFilterConfig& config) {
+    SignalFilterConfig out = config;
+    if (out.medianTaps < 1) {
+        out.medianTaps = 1;
+    } else if (out.medianTaps > SIGNAL_FILTER_MAX_TAPS) {
+        out.medianTaps = SIGNAL_FILTER_MAX_TAPS;
+    }
+    out.medianTaps |= 1;  // Odd, so there is a middle reading
+    if (out.debounceSamples < 1) {
+        out.debounceSamples = 1;
+    } else if (out.debounceSamples > SIGNAL_FILTER_MAX_DEBOUNCE) {
+        out.debounceSamples = SIGNAL_FILTER_MAX_DEBOUNCE;
+    }
+    return out;
+}
+
+SignalFilter::SignalFilter() {
+    reset();
+}
+
+void SignalFilter::reset() {
+    memset(ring_, 0, sizeof(ring_));
+    head_ = 0;
+    count_ = 0;
+    pending_ = 0;
+    present_ = false;
+    smoothed_ = 0;
+}
+
+int SignalFilter::update(int rawCm, int thresholdCm, const SignalFilterConfig& config) {
+    if (rawCm > INT16_MAX) {
+        rawCm = INT16_MAX;
+    }
+    ring_[head_] = static_cast<int16_t>(rawCm);
+    head_ = head_ + 1 < SIGNAL_FILTER_MAX_TAPS ? head_ + 1 : 0;
+    if (count_ < SIGNAL_FILTER_MAX_TAPS) {
+        count_++;
+    }
+
+    if (!config.enabled) {
+        smoothed_ = ring_[head_ ? head_ - 1 : SIGNAL_FILTER_MAX_TAPS - 1];
+        present_ = smoothed_ < thresholdCm;
+        pending_ = 0;
+        return rawCm;
+    }
+
+    // Insertion sort of the newest taps readings; at most 7 elements, so
+    // this beats anything cleverer and its cost is fixed.
+    uint8_t taps = config.medianTaps < count_ ? config.medianTaps : count_;
+    int16_t window[SIGNAL_FILTER_MAX_TAPS];
+    uint8_t index = head_;
+    for (uint8_t i = 0; i < taps; i++) {
+        index = index ? index - 1 : SIGNAL_FILTER_MAX_TAPS - 1;
+        int16_t value = ring_[index];
+        uint8_t j = i;
+        while (j > 0 && window[j - 1] > value) {
+            window[j] = window[j - 1];
+            j--;
+        }
+        window[j] = value;
+    }
+    int median = window[(taps - 1) / 2];
+    smoothed_ = static_cast<int16_t>(median);
+
+    bool near = present_ ? median < thresholdCm + config.hysteresisCm : median < thresholdCm;
+    if (near == present_) {
+        pending_ = 0;
+    } else if (++pending_ >= config.debounceSamples) {
+        present_ = near;
+        pending_ = 0;
+    }
+
+    // The state machine compares against the plain threshold, so hand it a
+    // distance on the side of the threshold the filter decided on
+    if (present_) {
+        return median < thresholdCm ? median : thresholdCm - 1;
+    }
+    return median >= thresholdCm ? median : thresholdCm;
+}
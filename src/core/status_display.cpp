@@ -0,0 +1,33 @@
+#include "status_display.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+void padRow(char* row, int length) {
+    if (length < 0) {
+        length = 0;
+    }
+    for (int i = length; i < DISPLAY_COLS; i++) {
+        row[i] = ' ';
+    }
+    row[DISPLAY_COLS] = '\0';
+}
+
+}  // namespace
+
+void formatStatusRows(const StatusSnapshot& status, char rows[DISPLAY_ROWS][DISPLAY_COLS + 1]) {
+    padRow(rows[0], snprintf(rows[0], DISPLAY_COLS + 1, "D1:%d D2:%d", status.distance1, status.distance2));
+
+    if (status.occupied) {
+        padRow(rows[1], snprintf(rows[1], DISPLAY_COLS + 1, "Occupied (%d)", status.occupantCount));
+    } else {
+        padRow(rows[1], snprintf(rows[1], DISPLAY_COLS + 1, "Empty"));
+    }
+}
+
+void formatTextRows(const char* top, const char* bottom, char rows[DISPLAY_ROWS][DISPLAY_COLS + 1]) {
+    padRow(rows[0], snprintf(rows[0], DISPLAY_COLS + 1, "%s", top));
+    padRow(rows[1], snprintf(rows[1], DISPLAY_COLS + 1, "%s", bottom));
+}
@@ -0,0 +1,346 @@
+#include "status_encoder.h"
+
+#include <string.h>
+
+namespace {
+
+enum FieldType : uint8_t {
+    FIELD_BOOL,
+    FIELD_INT,
+    FIELD_UINT,
+    FIELD_KWH,  // Energy, rendered with three decimals in JSON
+};
+
+struct FieldSpec {
+    const char* name;
+    FieldType type;
+};
+
+// Order matches the StatusField bit positions
+const FieldSpec FIELDS[STATUS_FIELD_COUNT] = {
+    {"occupied", FIELD_BOOL},
+    {"occupantCount", FIELD_INT},
+    {"energySavedToday", FIELD_KWH},
+    {"energySavedWeek", FIELD_KWH},
+    {"energySavedMonth", FIELD_KWH},
+    {"energySavedYear", FIELD_KWH},
+    {"dailyOccupiedTime", FIELD_UINT},
+    {"totalOccupiedTime", FIELD_UINT},
+    {"uptime", FIELD_UINT},
+    {"distance1", FIELD_INT},
+    {"distance2", FIELD_INT},
+    {"detectionLatencyUs", FIELD_UINT},
+    {"sensorOverruns", FIELD_UINT},
+    {"heapFree", FIELD_UINT},
+    {"heapMinFree", FIELD_UINT},
+    {"statusHeapDelta", FIELD_INT},
+    {"samplesPerSecond", FIELD_UINT},
+    {"skippedPings", FIELD_UINT},
+    {"occupancyConfidence", FIELD_UINT},
+};
+
+// Field values widened to one type so the encoders stay table driven
+struct FieldValue {
+    int64_t integer;
+    float real;
+};
+
+FieldValue fieldValue(const StatusReport& report, int index) {
+    const StatusSnapshot& s = report.status;
+    FieldValue v = {0, 0.0f};
+    switch (index) {
+        case 0: v.integer = s.occupied; break;
+        case 1: v.integer = s.occupantCount; break;
+        case 2: v.real = s.energySavedToday; break;
+        case 3: v.real = s.energySavedWeek; break;
+        case 4: v.real = s.energySavedMonth; break;
+        case 5: v.real = s.energySavedYear; break;
+        case 6: v.integer = s.dailyOccupiedTime; break;
+        case 7: v.integer = s.totalOccupiedTime; break;
+        case 8: v.integer = report.uptimeMs; break;
+        case 9: v.integer = s.distance1; break;
+        case 10: v.integer = s.distance2; break;
+        case 11: v.integer = s.detectionLatencyUs; break;
+        case 12: v.integer = s.sensorOverruns; break;
+        case 13: v.integer = report.heapFree; break;
+        case 14: v.integer = report.heapMinFree; break;
+        case 15: v.integer = report.heapDelta; break;
+        case 16: v.integer = s.samplesPerSecond; break;
+        case 17: v.integer = s.skippedPings; break;
+        case 18: v.integer = s.occupancyConfidence; break;
+    }
+    return v;
+}
+
+// Bounded append-only writer; once it overflows every later write is a no-op
+// and the encoders report failure.
+class Writer {
+public:
+    Writer(uint8_t* out, size_t size) : out_(out), size_(size), length_(0), overflow_(false) {}
+
+    void byte(uint8_t b) {
+        if (length_ < size_) {
+            out_[length_++] = b;
+        } else {
+            overflow_ = true;
+        }
+    }
+
+    void bytes(const void* data, size_t n) {
+        if (n > size_ - length_) {
+            overflow_ = true;
+            return;
+        }
+        memcpy(out_ + length_, data, n);
+        length_ += n;
+    }
+
+    void text(const char* s) { bytes(s, strlen(s)); }
+
+    void decimal(uint64_t value) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        while (n) {
+            byte(digits[--n]);
+        }
+    }
+
+    void signedDecimal(int64_t value) {
+        if (value < 0) {
+            byte('-');
+            decimal(static_cast<uint64_t>(-value));
+        } else {
+            decimal(static_cast<uint64_t>(value));
+        }
+    }
+
+    // Fixed three-decimal rendering, matching the dashboard's toFixed(3)
+    void milli(float value) {
+        int64_t scaled = static_cast<int64_t>(value * 1000.0f + (value < 0 ? -0.5f : 0.5f));
+        if (scaled < 0) {
+            byte('-');
+            scaled = -scaled;
+        }
+        decimal(static_cast<uint64_t>(scaled / 1000));
+        byte('.');
+        uint32_t fraction = scaled % 1000;
+        byte('0' + fraction / 100);
+        byte('0' + fraction / 10 % 10);
+        byte('0' + fraction % 10);
+    }
+
+    // CBOR head: major type in the top three bits, argument in the shortest form
+    void cborHead(uint8_t major, uint64_t argument) {
+        major <<= 5;
+        if (argument < 24) {
+            byte(major | argument);
+        } else if (argument <= 0xFF) {
+            byte(major | 24);
+            byte(argument);
+        } else if (argument <= 0xFFFF) {
+            byte(major | 25);
+            byte(argument >> 8);
+            byte(argument);
+        } else if (argument <= 0xFFFFFFFFULL) {
+            byte(major | 26);
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                byte(argument >> shift);
+            }
+        } else {
+            byte(major | 27);
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                byte(argument >> shift);
+            }
+        }
+    }
+
+    size_t finish() const { return overflow_ ? 0 : length_; }
+
+private:
+    uint8_t* out_;
+    size_t size_;
+    size_t length_;
+    bool overflow_;
+};
+
+int popcount(uint32_t mask) {
+    int count = 0;
+    for (; mask; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+}
+
+}  // namespace
+
+uint32_t parseStatusFields(const char* list) {
+    if (list == NULL || *list == '\0') {
+        return STATUS_ALL_FIELDS;
+    }
+
+    uint32_t mask = 0;
+    const char* start = list;
+    while (*start) {
+        size_t length = strcspn(start, ",");
+        for (int i = 0; i < STATUS_FIELD_COUNT; i++) {
+            if (strlen(FIELDS[i].name) == length && strncmp(FIELDS[i].name, start, length) == 0) {
+                mask |= 1UL << i;
+                break;
+            }
+        }
+        start += length;
+        if (*start == ',') {
+            start++;
+        }
+    }
+    return mask;
+}
+
+size_t encodeStatusJson(const StatusReport& report, uint32_t fields, char* out, size_t size) {
+    Writer w(reinterpret_cast<uint8_t*>(out), size);
+    bool first = true;
+
+    w.byte('{');
+    for (int i = 0; i < STATUS_FIELD_COUNT; i++) {
+        if (!(fields & (1UL << i))) {
+            continue;
+        }
+        if (!first) {
+            w.byte(',');
+        }
+        first = false;
+
+        w.byte('"');
+        w.text(FIELDS[i].name);
+        w.text("\":");
+
+        FieldValue v = fieldValue(report, i);
+        switch (FIELDS[i].type) {
+            case FIELD_BOOL: w.text(v.integer ? "true" : "false"); break;
+            case FIELD_INT:
+            case FIELD_UINT: w.signedDecimal(v.integer); break;
+            case FIELD_KWH: w.milli(v.real); break;
+        }
+    }
+    w.byte('}');
+    return w.finish();
+}
+
+size_t encodeStatusCbor(const StatusReport& report, uint32_t fields, uint8_t* out, size_t size) {
+    Writer w(out, size);
+
+    w.cborHead(5, popcount(fields & STATUS_ALL_FIELDS));  // Map
+    for (int i = 0; i < STATUS_FIELD_COUNT; i++) {
+        if (!(fields & (1UL << i))) {
+            continue;
+        }
+        size_t nameLength = strlen(FIELDS[i].name);
+        w.cborHead(3, nameLength);  // Text string key
+        w.bytes(FIELDS[i].name, nameLength);
+
+        FieldValue v = fieldValue(report, i);
+        switch (FIELDS[i].type) {
+            case FIELD_BOOL:
+                w.byte(v.integer ? 0xF5 : 0xF4);
+                break;
+            case FIELD_INT:
+            case FIELD_UINT:
+                if (v.integer < 0) {
+                    w.cborHead(1, static_cast<uint64_t>(-1 - v.integer));
+                } else {
+                    w.cborHead(0, static_cast<uint64_t>(v.integer));
+                }
+                break;
+            case FIELD_KWH: {
+                uint32_t bits;
+                memcpy(&bits, &v.real, sizeof(bits));
+                w.byte(0xFA);  // Single-precision float
+                w.byte(bits >> 24);
+                w.byte(bits >> 16);
+                w.byte(bits >> 8);
+                w.byte(bits);
+                break;
+            }
+        }
+    }
+    return w.finish();
+}
+
+namespace {
+
+void encodeRoom(Writer& w, const StatusSnapshot& status, uint8_t index) {
+    const RoomSnapshot& room = status.rooms[index];
+    w.text("{\"room\":");
+    w.decimal(index);
+    w.text(",\"occupied\":");
+    w.text(room.occupied ? "true" : "false");
+    w.text(",\"occupantCount\":");
+    w.signedDecimal(room.occupantCount);
+    w.text(",\"confidence\":");
+    w.decimal(room.confidence);
+    w.text(",\"energySavedToday\":");
+    w.milli(room.energySavedToday);
+    w.text(",\"energySavedWeek\":");
+    w.milli(room.energySavedWeek);
+    w.text(",\"energySavedMonth\":");
+    w.milli(room.energySavedMonth);
+    w.text(",\"energySavedYear\":");
+    w.milli(room.energySavedYear);
+    w.text(",\"dailyOccupiedTime\":");
+    w.decimal(room.dailyOccupiedTime);
+    w.text(",\"totalOccupiedTime\":");
+    w.decimal(room.totalOccupiedTime);
+    w.text(",\"entries\":");
+    w.decimal(room.entries);
+    w.text(",\"exits\":");
+    w.decimal(room.exits);
+
+    w.text(",\"doorways\":[");
+    bool first = true;
+    for (uint8_t i = 0; i < status.doorwayCount && i < MAX_DOORWAYS; i++) {
+        const DoorwaySnapshot& doorway = status.doorways[i];
+        if (doorway.room != index) {
+            continue;
+        }
+        if (!first) {
+            w.byte(',');
+        }
+        first = false;
+        w.text("{\"doorway\":");
+        w.decimal(i);
+        w.text(",\"distance1\":");
+        w.signedDecimal(doorway.entranceCm);
+        w.text(",\"distance2\":");
+        w.signedDecimal(doorway.insideCm);
+        w.byte('}');
+    }
+    w.text("]}");
+}
+
+}  // namespace
+
+size_t encodeRoomsJson(const StatusSnapshot& status, int room, char* out, size_t size) {
+    Writer w(reinterpret_cast<uint8_t*>(out), size);
+    uint8_t count = status.roomCount < MAX_ROOMS ? status.roomCount : MAX_ROOMS;
+    if (room >= 0) {
+        if (room >= count) {
+            return 0;
+        }
+        encodeRoom(w, status, static_cast<uint8_t>(room));
+        return w.finish();
+    }
+
+    w.text("{\"rooms\":[");
+    for (uint8_t i = 0; i < count; i++) {
+        if (i > 0) {
+            w.byte(',');
+        }
+        encodeRoom(w, status, i);
+    }
+    w.text("]}");
+    return w.finish();
+}
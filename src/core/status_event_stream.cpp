@@ -0,0 +1,168 @@
+#include "status_event_stream.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+const char SSE_HEADERS[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n"
+    "retry: 3000\n\n";
+
+}  // namespace
+
+StatusEventStream::StatusEventStream(HttpServer& server)
+    : server_(server), clients_(), last_(), lastFrameMs_(0), lastDistanceFrameMs_(0) {}
+
+bool StatusEventStream::subscribe(HttpResponse& response, const StatusSnapshot& status, uint32_t nowMs) {
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        if (server_.pushOpen(clients_[i])) {
+            continue;
+        }
+
+        // New subscribers start from a complete picture, sent with the header
+        char start[sizeof(SSE_HEADERS) - 1 + SSE_FRAME_SIZE];
+        size_t length = formatFrame(status, nowMs, SSE_FULL_FIELDS);
+        memcpy(start, SSE_HEADERS, sizeof(SSE_HEADERS) - 1);
+        memcpy(start + sizeof(SSE_HEADERS) - 1, frame_, length);
+        clients_[i] = response.startPush(start, sizeof(SSE_HEADERS) - 1 + length);
+        if (clients_[i] != 0 && status.roomCount >= 2) {
+            length = formatRoomsFrame(status);
+            if (length > 0 && !server_.push(clients_[i], frame_, length)) {
+                clients_[i] = 0;
+            }
+        }
+        return clients_[i] != 0;
+    }
+    return false;
+}
+
+void StatusEventStream::update(const StatusSnapshot& status, uint32_t nowMs) {
+    bool stateChanged = status.occupied != last_.occupied ||
+                        status.occupantCount != last_.occupantCount ||
+                        status.occupancyConfidence != last_.occupancyConfidence ||
+                        status.totalOccupiedTime != last_.totalOccupiedTime;
+    bool roomsChanged = false;
+    for (uint8_t i = 0; i < status.roomCount && i < MAX_ROOMS; i++) {
+        const RoomSnapshot& room = status.rooms[i];
+        const RoomSnapshot& before = last_.rooms[i];
+        roomsChanged = roomsChanged || room.occupied != before.occupied ||
+                       room.occupantCount != before.occupantCount || room.confidence != before.confidence;
+    }
+    bool distanceChanged = abs(status.distance1 - last_.distance1) >= SSE_DISTANCE_DEADBAND_CM ||
+                           abs(status.distance2 - last_.distance2) >= SSE_DISTANCE_DEADBAND_CM;
+
+    size_t length = 0;
+    if (stateChanged) {
+        // Entries and exits also move the energy and occupancy totals, so
+        // send everything the dashboard shows. The confidence also changes
+        // on its own when a quiet room is reconciled.
+        length = formatFrame(status, nowMs, SSE_FULL_FIELDS);
+        last_ = status;
+        lastDistanceFrameMs_ = nowMs;
+    } else if (distanceChanged && nowMs - lastDistanceFrameMs_ >= SSE_DISTANCE_INTERVAL_MS) {
+        length = formatFrame(status, nowMs, STATUS_DISTANCE_FIELDS);
+        last_.distance1 = status.distance1;
+        last_.distance2 = status.distance2;
+        lastDistanceFrameMs_ = nowMs;
+    } else if (nowMs - lastFrameMs_ >= SSE_HEARTBEAT_MS) {
+        length = formatFrame(status, nowMs, STATUS_UPTIME);
+    }
+
+    if (length > 0) {
+        broadcast(frame_, length);
+        lastFrameMs_ = nowMs;
+    }
+
+    // A person moving between rooms leaves the totals alone, so rooms get
+    // their own event
+    if (roomsChanged) {
+        memcpy(last_.rooms, status.rooms, sizeof(last_.rooms));
+        length = status.roomCount >= 2 ? formatRoomsFrame(status) : 0;
+        if (length > 0) {
+            broadcast(frame_, length);
+            lastFrameMs_ = nowMs;
+        }
+    }
+}
+
+int StatusEventStream::subscriberCount() const {
+    int count = 0;
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        if (server_.pushOpen(clients_[i])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void StatusEventStream::broadcast(const char* frame, size_t length) {
+    // A subscriber that cannot take a whole frame is too slow to keep; the
+    // server closes it, and it reconnects on its own (retry: 3000) and gets
+    // a fresh full frame.
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        if (clients_[i] != 0 && !server_.push(clients_[i], frame, length)) {
+            clients_[i] = 0;
+        }
+    }
+}
+
+// "data: <json>\n\n" built in place in frame_
+size_t StatusEventStream::formatFrame(const StatusSnapshot& status, uint32_t nowMs, uint32_t fields) {
+    static const char PREFIX[] = "data: ";
+    const size_t prefixLength = sizeof(PREFIX) - 1;
+
+    StatusReport report = {};
+    report.status = status;
+    report.uptimeMs = nowMs;
+
+    memcpy(frame_, PREFIX, prefixLength);
+    size_t length = encodeStatusJson(report, fields, frame_ + prefixLength, sizeof(frame_) - prefixLength - 2);
+    if (length == 0) {
+        return 0;
+    }
+    length += prefixLength;
+    frame_[length++] = '\n';
+    frame_[length++] = '\n';
+    return length;
+}
+
+// "event: rooms\ndata: {"rooms":[...]}\n\n" with what the dashboard's room
+// list shows; the full per-room view stays on /api/rooms
+size_t StatusEventStream::formatRoomsFrame(const StatusSnapshot& status) {
+    size_t length = 0;
+    int written = snprintf(frame_, sizeof(frame_), "event: rooms\ndata: {\"rooms\":[");
+    for (uint8_t i = 0; written > 0 && i < status.roomCount && i < MAX_ROOMS; i++) {
+        length += static_cast<size_t>(written);
+        if (length >= sizeof(frame_)) {
+            return 0;
+        }
+        const RoomSnapshot& room = status.rooms[i];
+        unsigned long milliKwh = static_cast<unsigned long>(lroundf(room.energySavedToday * 1000.0f));
+        written = snprintf(frame_ + length, sizeof(frame_) - length,
+                           "%s{\"room\":%u,\"occupied\":%s,\"occupantCount\":%d,\"confidence\":%u,"
+                           "\"energySavedToday\":%lu.%03lu}",
+                           i > 0 ? "," : "", static_cast<unsigned>(i), room.occupied ? "true" : "false",
+                           room.occupantCount, static_cast<unsigned>(room.confidence), milliKwh / 1000,
+                           milliKwh % 1000);
+    }
+    if (written <= 0) {
+        return 0;
+    }
+    length += static_cast<size_t>(written);
+    if (length >= sizeof(frame_)) {
+        return 0;
+    }
+    written = snprintf(frame_ + length, sizeof(frame_) - length, "]}\n\n");
+    if (written <= 0 || length + static_cast<size_t>(written) >= sizeof(frame_)) {
+        return 0;
+    }
+    return length + static_cast<size_t>(written);
+}
@@ -0,0 +1,697 @@
+#include "timeseries_store.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "byte_order.h"
+#include "calendar.h"
+
+namespace {
+
+const char* ROLLUP_PATH = "/tsroll.bin";
+const char SEGMENT_MAGIC[4] = {'L', 'S', 'T', 'S'};
+const int32_t NO_DAY = INT32_MIN;
+
+// Rollup file: lifetime, then day slots, then month slots
+const uint32_t LIFETIME_SLOT = 0;
+const uint32_t ROLLUP_SLOTS = 1 + TS_DAY_SLOTS + TS_MONTH_SLOTS;
+const size_t READ_BATCH = 32;  // Records per read while walking a segment
+
+uint32_t daySlot(int32_t day) {
+    return 1 + static_cast<uint32_t>(day) % TS_DAY_SLOTS;
+}
+
+uint32_t monthSlot(uint32_t monthIndex) {
+    return 1 + TS_DAY_SLOTS + monthIndex % TS_MONTH_SLOTS;
+}
+
+// Record: minute(4) energyMwh(4) occupiedSeconds(2) entries exits peak
+// crc16(2) commit(1)
+void encodeRecord(const MinuteRecord& record, uint8_t* out) {
+    putU32(out, record.minute);
+    putU32(out + 4, record.energyMwh);
+    putU16(out + 8, record.occupiedSeconds);
+    out[10] = record.entries;
+    out[11] = record.exits;
+    out[12] = record.peakOccupants;
+    putU16(out + 13, crc16(out, 13));
+    out[15] = TS_COMMIT_MARKER;
+}
+
+bool decodeRecord(const uint8_t* in, MinuteRecord& out) {
+    if (in[15] != TS_COMMIT_MARKER || getU16(in + 13) != crc16(in, 13)) {
+        return false;
+    }
+    out.minute = getU32(in);
+    out.energyMwh = getU32(in + 4);
+    out.occupiedSeconds = getU16(in + 8);
+    out.entries = in[10];
+    out.exits = in[11];
+    out.peakOccupants = in[12];
+    return true;
+}
+
+// Summary: startMinute(4) energyMwh(4) occupiedSeconds(4) entries(4)
+// exits(4) peak(1) crc16(2) commit(1)
+void encodeSummary(const PeriodSummary& summary, uint8_t* out) {
+    putU32(out, summary.startMinute);
+    putU32(out + 4, summary.energyMwh);
+    putU32(out + 8, summary.occupiedSeconds);
+    putU32(out + 12, summary.entries);
+    putU32(out + 16, summary.exits);
+    out[20] = summary.peakOccupants;
+    putU16(out + 21, crc16(out, 21));
+    out[23] = TS_COMMIT_MARKER;
+}
+
+bool decodeSummary(const uint8_t* in, PeriodSummary& out) {
+    if (in[23] != TS_COMMIT_MARKER || getU16(in + 21) != crc16(in, 21)) {
+        return false;
+    }
+    out.startMinute = getU32(in);
+    out.energyMwh = getU32(in + 4);
+    out.occupiedSeconds = getU32(in + 8);
+    out.entries = getU32(in + 12);
+    out.exits = getU32(in + 16);
+    out.peakOccupants = in[20];
+    return true;
+}
+
+PeriodSummary emptySummary(uint32_t startMinute) {
+    PeriodSummary summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.startMinute = startMinute;
+    return summary;
+}
+
+void addMinute(PeriodSummary& sum, const MinuteRecord& record) {
+    sum.energyMwh += record.energyMwh;
+    sum.occupiedSeconds += record.occupiedSeconds;
+    sum.entries += record.entries;
+    sum.exits += record.exits;
+    if (record.peakOccupants > sum.peakOccupants) {
+        sum.peakOccupants = record.peakOccupants;
+    }
+}
+
+void addSummary(PeriodSummary& sum, const PeriodSummary& other) {
+    sum.energyMwh += other.energyMwh;
+    sum.occupiedSeconds += other.occupiedSeconds;
+    sum.entries += other.entries;
+    sum.exits += other.exits;
+    if (other.peakOccupants > sum.peakOccupants) {
+        sum.peakOccupants = other.peakOccupants;
+    }
+}
+
+bool sumMinute(const MinuteRecord& record, void* context) {
+    PeriodSummary* sum = static_cast<PeriodSummary*>(context);
+    addMinute(*sum, record);
+    return true;
+}
+
+struct CopyContext {
+    MinuteRecord* out;
+    size_t count;
+    size_t max;
+};
+
+bool copyMinute(const MinuteRecord& record, void* context) {
+    CopyContext* copy = static_cast<CopyContext*>(context);
+    if (copy->count >= copy->max) {
+        return false;
+    }
+    copy->out[copy->count++] = record;
+    return true;
+}
+
+}  // namespace
+
+TimeSeriesStore::TimeSeriesStore(Storage& storage, int32_t utcOffsetMinutes)
+    : storage_(storage), utcOffsetMinutes_(utcOffsetMinutes), active_(-1), nextGeneration_(0),
+      hasLast_(false), lastMinute_(0), tornRecords_(0), writeErrors_(0), currentDay_(NO_DAY),
+      lifetimeDay_(NO_DAY) {
+    memset(segments_, 0, sizeof(segments_));
+    today_ = week_ = month_ = year_ = lifetime_ = emptySummary(0);
+}
+
+bool TimeSeriesStore::begin() {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    // Make sure every rollup slot exists so summaries can be written in place
+    static const uint8_t zeros[TS_SUMMARY_SIZE] = {0};
+    size_t rollupSize = storage_.size(ROLLUP_PATH);
+    while (rollupSize < ROLLUP_SLOTS * TS_SUMMARY_SIZE) {
+        size_t chunk = TS_SUMMARY_SIZE - rollupSize % TS_SUMMARY_SIZE;
+        if (!storage_.append(ROLLUP_PATH, zeros, chunk)) {
+            writeErrors_++;
+            return false;
+        }
+        rollupSize += chunk;
+    }
+
+    // Newest segment is the active one; its last record is where we stopped
+    for (uint8_t i = 0; i < TS_SEGMENT_COUNT; i++) {
+        loadSegment(i);
+        const Segment& segment = segments_[i];
+        if (!segment.present) {
+            continue;
+        }
+        if (segment.generation >= nextGeneration_) {
+            nextGeneration_ = segment.generation + 1;
+        }
+        if (active_ < 0 || segment.generation > segments_[active_].generation) {
+            active_ = i;
+        }
+        if (segment.hasData && (!hasLast_ || segment.lastMinute > lastMinute_)) {
+            hasLast_ = true;
+            lastMinute_ = segment.lastMinute;
+        }
+    }
+
+    rebuildTotals();
+    return true;
+}
+
+bool TimeSeriesStore::append(const MinuteRecord& record) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (hasLast_ && record.minute <= lastMinute_) {
+        return false;
+    }
+
+    rollTo(localDay(record.minute));
+
+    if (active_ < 0 || segments_[active_].records >= TS_SEGMENT_RECORDS) {
+        if (!openSegment()) {
+            writeErrors_++;
+            return false;
+        }
+    }
+
+    // Payload first, commit marker once the payload is down
+    char path[16];
+    segmentPath(active_, path);
+    uint8_t bytes[TS_RECORD_SIZE];
+    encodeRecord(record, bytes);
+    if (!storage_.append(path, bytes, TS_RECORD_SIZE - 1) ||
+        !storage_.append(path, bytes + TS_RECORD_SIZE - 1, 1)) {
+        // Realign after whatever part made it to flash
+        writeErrors_++;
+        loadSegment(active_);
+        return false;
+    }
+
+    Segment& segment = segments_[active_];
+    segment.records++;
+    if (!segment.hasData) {
+        segment.hasData = true;
+        segment.firstMinute = record.minute;
+    }
+    segment.lastMinute = record.minute;
+    hasLast_ = true;
+    lastMinute_ = record.minute;
+    addMinute(today_, record);
+    return true;
+}
+
+size_t TimeSeriesStore::readMinutes(uint32_t fromMinute, uint32_t toMinute, MinuteRecord* out, size_t max) {
+    std::lock_guard<std::mutex> guard(lock_);
+    CopyContext copy = {out, 0, max};
+    visitMinutes(fromMinute, toMinute, copyMinute, &copy);
+    return copy.count;
+}
+
+bool TimeSeriesStore::readDay(int32_t day, PeriodSummary& out) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (day == currentDay_) {
+        out = today_;
+        return true;
+    }
+    return loadDay(day, out);
+}
+
+bool TimeSeriesStore::readMonth(uint32_t monthIndex, PeriodSummary& out) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (currentDay_ != NO_DAY && monthIndex == monthIndexFromDays(currentDay_)) {
+        out = month_;
+        out.startMinute = dayStartMinute(daysFromMonthIndex(monthIndex));
+        addSummary(out, today_);
+        return true;
+    }
+    return loadMonth(monthIndex, out);
+}
+
+StoreTotals TimeSeriesStore::totals() {
+    std::lock_guard<std::mutex> guard(lock_);
+    StoreTotals totals;
+    totals.today = today_;
+    totals.week = week_;
+    totals.month = month_;
+    totals.year = year_;
+    totals.lifetime = lifetime_;
+
+    addSummary(totals.week, today_);
+    addSummary(totals.month, today_);
+    addSummary(totals.year, month_);
+    addSummary(totals.year, today_);
+    if (currentDay_ > lifetimeDay_) {
+        addSummary(totals.lifetime, today_);
+    }
+
+    if (currentDay_ != NO_DAY) {
+        totals.week.startMinute = dayStartMinute(weekStartDay(currentDay_));
+        uint32_t monthIndex = monthIndexFromDays(currentDay_);
+        totals.month.startMinute = dayStartMinute(daysFromMonthIndex(monthIndex));
+        totals.year.startMinute = dayStartMinute(daysFromMonthIndex(monthIndex - monthIndex % 12));
+    }
+    return totals;
+}
+
+StoreStats TimeSeriesStore::stats() {
+    std::lock_guard<std::mutex> guard(lock_);
+    StoreStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.activeSegment = active_ < 0 ? 0 : active_;
+    stats.generation = nextGeneration_;
+    stats.lastMinute = lastMinute_;
+    stats.tornRecords = tornRecords_;
+    stats.writeErrors = writeErrors_;
+
+    bool first = true;
+    for (uint8_t i = 0; i < TS_SEGMENT_COUNT; i++) {
+        const Segment& segment = segments_[i];
+        uint32_t eraseCount = segment.present ? segment.eraseCount : 0;
+        stats.records += segment.present ? segment.records : 0;
+        if (first || eraseCount < stats.minEraseCount) {
+            stats.minEraseCount = eraseCount;
+        }
+        if (first || eraseCount > stats.maxEraseCount) {
+            stats.maxEraseCount = eraseCount;
+        }
+        first = false;
+    }
+    return stats;
+}
+
+int32_t TimeSeriesStore::localDay(uint32_t minute) const {
+    return localDayFromMinute(minute, utcOffsetMinutes_);
+}
+
+uint32_t TimeSeriesStore::dayStartMinute(int32_t day) const {
+    return static_cast<uint32_t>(static_cast<int64_t>(day) * MINUTES_PER_DAY - utcOffsetMinutes_);
+}
+
+void TimeSeriesStore::segmentPath(uint8_t index, char* out) const {
+    snprintf(out, 16, "/ts%u.bin", index);
+}
+
+// Read a segment's header and the records at either end. A file whose
+// length stopped mid-record (reset during append) is padded back onto the
+// record grid; the padding has no commit marker and reads as torn.
+bool TimeSeriesStore::loadSegment(uint8_t index) {
+    Segment& segment = segments_[index];
+    memset(&segment, 0, sizeof(segment));
+
+    char path[16];
+    segmentPath(index, path);
+    size_t size = storage_.size(path);
+    uint8_t header[TS_SEGMENT_HEADER_SIZE];
+    if (size < TS_SEGMENT_HEADER_SIZE || !storage_.read(path, 0, header, sizeof(header)) ||
+        memcmp(header, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 ||
+        getU16(header + 12) != crc16(header, 12)) {
+        return false;
+    }
+
+    size_t body = size - TS_SEGMENT_HEADER_SIZE;
+    size_t partial = body % TS_RECORD_SIZE;
+    if (partial != 0) {
+        static const uint8_t zeros[TS_RECORD_SIZE] = {0};
+        if (!storage_.append(path, zeros, TS_RECORD_SIZE - partial)) {
+            writeErrors_++;
+        }
+        body += TS_RECORD_SIZE - partial;
+    }
+
+    segment.present = true;
+    segment.generation = getU32(header + 4);
+    segment.eraseCount = getU32(header + 8);
+    segment.records = body / TS_RECORD_SIZE;
+
+    MinuteRecord record;
+    uint32_t found;
+    if (segment.records > 0 && findRecord(index, 0, segment.records, 1, found, record)) {
+        segment.hasData = true;
+        segment.firstMinute = record.minute;
+        findRecord(index, segment.records - 1, 0, -1, found, record);
+        segment.lastMinute = record.minute;
+    }
+    return true;
+}
+
+// Erase the oldest segment (or use a missing one) and start writing into it
+bool TimeSeriesStore::openSegment() {
+    int target = -1;
+    for (uint8_t i = 0; i < TS_SEGMENT_COUNT; i++) {
+        if (!segments_[i].present) {
+            target = i;
+            break;
+        }
+        if (target < 0 || segments_[i].generation < segments_[target].generation) {
+            target = i;
+        }
+    }
+
+    Segment& segment = segments_[target];
+    uint32_t eraseCount = segment.present ? segment.eraseCount + 1 : 0;
+
+    uint8_t header[TS_SEGMENT_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    putU32(header + 4, nextGeneration_);
+    putU32(header + 8, eraseCount);
+    putU16(header + 12, crc16(header, 12));
+
+    char path[16];
+    segmentPath(target, path);
+    storage_.remove(path);
+    memset(&segment, 0, sizeof(segment));
+    if (!storage_.append(path, header, sizeof(header))) {
+        return false;
+    }
+
+    segment.present = true;
+    segment.generation = nextGeneration_++;
+    segment.eraseCount = eraseCount;
+    active_ = target;
+    return true;
+}
+
+bool TimeSeriesStore::readRecord(uint8_t segment, uint32_t index, MinuteRecord& out) {
+    char path[16];
+    segmentPath(segment, path);
+    uint8_t bytes[TS_RECORD_SIZE];
+    if (!storage_.read(path, TS_SEGMENT_HEADER_SIZE + index * TS_RECORD_SIZE, bytes, sizeof(bytes))) {
+        return false;
+    }
+    if (!decodeRecord(bytes, out)) {
+        tornRecords_++;
+        return false;
+    }
+    return true;
+}
+
+// First committed record walking from `from` towards `to` (exclusive when
+// walking forward, inclusive when walking back)
+bool TimeSeriesStore::findRecord(uint8_t segment, uint32_t from, uint32_t to, int step, uint32_t& index,
+                                 MinuteRecord& out) {
+    for (int64_t i = from; step > 0 ? i < to : i >= static_cast<int64_t>(to); i += step) {
+        if (readRecord(segment, static_cast<uint32_t>(i), out)) {
+            index = static_cast<uint32_t>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Index of the first record at or after minute. Records in a segment are in
+// minute order; torn ones are skipped over.
+uint32_t TimeSeriesStore::lowerBound(uint8_t segment, uint32_t minute) {
+    uint32_t low = 0;
+    uint32_t high = segments_[segment].records;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        uint32_t found;
+        MinuteRecord record;
+        if (!findRecord(segment, mid, high, 1, found, record) || record.minute >= minute) {
+            high = mid;
+        } else {
+            low = found + 1;
+        }
+    }
+    return low;
+}
+
+size_t TimeSeriesStore::visitMinutes(uint32_t fromMinute, uint32_t toMinute, MinuteVisitor visitor,
+                                     void* context) {
+    // Segments oldest first
+    uint8_t order[TS_SEGMENT_COUNT];
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < TS_SEGMENT_COUNT; i++) {
+        if (!segments_[i].present || !segments_[i].hasData) {
+            continue;
+        }
+        uint8_t j = count++;
+        while (j > 0 && segments_[order[j - 1]].generation > segments_[i].generation) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    size_t visited = 0;
+    uint8_t batch[READ_BATCH * TS_RECORD_SIZE];
+    for (uint8_t k = 0; k < count; k++) {
+        uint8_t index = order[k];
+        const Segment& segment = segments_[index];
+        if (segment.lastMinute < fromMinute || segment.firstMinute >= toMinute) {
+            continue;
+        }
+
+        char path[16];
+        segmentPath(index, path);
+        for (uint32_t i = lowerBound(index, fromMinute); i < segment.records; i += READ_BATCH) {
+            uint32_t n = segment.records - i < READ_BATCH ? segment.records - i : READ_BATCH;
+            if (!storage_.read(path, TS_SEGMENT_HEADER_SIZE + i * TS_RECORD_SIZE, batch, n * TS_RECORD_SIZE)) {
+                break;
+            }
+            for (uint32_t r = 0; r < n; r++) {
+                MinuteRecord record;
+                if (!decodeRecord(batch + r * TS_RECORD_SIZE, record)) {
+                    tornRecords_++;
+                    continue;
+                }
+                if (record.minute >= toMinute) {
+                    return visited;
+                }
+                if (record.minute < fromMinute) {
+                    continue;
+                }
+                visited++;
+                if (!visitor(record, context)) {
+                    return visited;
+                }
+            }
+        }
+    }
+    return visited;
+}
+
+bool TimeSeriesStore::readSummary(uint32_t slot, PeriodSummary& out) {
+    uint8_t bytes[TS_SUMMARY_SIZE];
+    return storage_.read(ROLLUP_PATH, slot * TS_SUMMARY_SIZE, bytes, sizeof(bytes)) &&
+           decodeSummary(bytes, out);
+}
+
+bool TimeSeriesStore::writeSummary(uint32_t slot, const PeriodSummary& summary) {
+    uint8_t bytes[TS_SUMMARY_SIZE];
+    encodeSummary(summary, bytes);
+    if (!storage_.write(ROLLUP_PATH, slot * TS_SUMMARY_SIZE, bytes, sizeof(bytes))) {
+        writeErrors_++;
+        return false;
+    }
+    return true;
+}
+
+// A closed day's summary. If its slot is missing or torn but the raw
+// minutes are still in the log, rebuild it and write it back.
+bool TimeSeriesStore::loadDay(int32_t day, PeriodSummary& out) {
+    uint32_t start = dayStartMinute(day);
+    if (readSummary(daySlot(day), out) && out.startMinute == start) {
+        return true;
+    }
+
+    out = emptySummary(start);
+    if (visitMinutes(start, start + MINUTES_PER_DAY, sumMinute, &out) == 0) {
+        return false;
+    }
+    if (day < currentDay_) {
+        writeSummary(daySlot(day), out);
+    }
+    return true;
+}
+
+bool TimeSeriesStore::loadMonth(uint32_t monthIndex, PeriodSummary& out) {
+    return readSummary(monthSlot(monthIndex), out) &&
+           out.startMinute == dayStartMinute(daysFromMonthIndex(monthIndex));
+}
+
+// Close every period that ends before `day` begins
+void TimeSeriesStore::rollTo(int32_t day) {
+    if (currentDay_ == NO_DAY) {
+        currentDay_ = day;
+        today_ = emptySummary(dayStartMinute(day));
+        return;
+    }
+    if (day <= currentDay_) {
+        return;
+    }
+
+    writeSummary(daySlot(currentDay_), today_);
+    if (currentDay_ > lifetimeDay_) {
+        addSummary(lifetime_, today_);
+        lifetimeDay_ = currentDay_;
+        PeriodSummary lifetime = lifetime_;
+        lifetime.startMinute = dayStartMinute(lifetimeDay_);
+        writeSummary(LIFETIME_SLOT, lifetime);
+    }
+    addSummary(week_, today_);
+    addSummary(month_, today_);
+
+    uint32_t oldMonth = monthIndexFromDays(currentDay_);
+    uint32_t newMonth = monthIndexFromDays(day);
+    if (newMonth != oldMonth) {
+        month_.startMinute = dayStartMinute(daysFromMonthIndex(oldMonth));
+        writeSummary(monthSlot(oldMonth), month_);
+        if (newMonth / 12 == oldMonth / 12) {
+            addSummary(year_, month_);
+        } else {
+            year_ = emptySummary(0);
+        }
+        month_ = emptySummary(0);
+    }
+    if (weekStartDay(day) != weekStartDay(currentDay_)) {
+        week_ = emptySummary(0);
+    }
+
+    currentDay_ = day;
+    today_ = emptySummary(dayStartMinute(day));
+}
+
+// Running sums after a reboot: today from its raw minutes, the rest of the
+// week and month from day summaries, the year from month summaries.
+void TimeSeriesStore::rebuildTotals() {
+    PeriodSummary lifetime;
+    if (readSummary(LIFETIME_SLOT, lifetime)) {
+        lifetimeDay_ = localDay(lifetime.startMinute);
+        lifetime_ = lifetime;
+    }
+    if (!hasLast_) {
+        return;
+    }
+
+    currentDay_ = localDay(lastMinute_);
+    uint32_t start = dayStartMinute(currentDay_);
+    today_ = emptySummary(start);
+    visitMinutes(start, start + MINUTES_PER_DAY, sumMinute, &today_);
+
+    // Days that closed without reaching the lifetime total (reset between
+    // the two writes in rollTo())
+    int32_t firstMissing = currentDay_ - TS_DAY_SLOTS;
+    if (lifetimeDay_ != NO_DAY && lifetimeDay_ + 1 > firstMissing) {
+        firstMissing = lifetimeDay_ + 1;
+    }
+    bool repaired = false;
+    PeriodSummary day;
+    for (int32_t d = firstMissing; d < currentDay_; d++) {
+        if (loadDay(d, day)) {
+            addSummary(lifetime_, day);
+            lifetimeDay_ = d;
+            repaired = true;
+        }
+    }
+    if (repaired) {
+        lifetime = lifetime_;
+        lifetime.startMinute = dayStartMinute(lifetimeDay_);
+        writeSummary(LIFETIME_SLOT, lifetime);
+    }
+
+    for (int32_t d = weekStartDay(currentDay_); d < currentDay_; d++) {
+        if (loadDay(d, day)) {
+            addSummary(week_, day);
+        }
+    }
+    uint32_t monthIndex = monthIndexFromDays(currentDay_);
+    for (int32_t d = daysFromMonthIndex(monthIndex); d < currentDay_; d++) {
+        if (loadDay(d, day)) {
+            addSummary(month_, day);
+        }
+    }
+    PeriodSummary month;
+    for (uint32_t m = monthIndex - monthIndex % 12; m < monthIndex; m++) {
+        if (loadMonth(m, month)) {
+            addSummary(year_, month);
+        }
+    }
+}
+
+MinuteAccumulator::MinuteAccumulator(float lightPowerWatts)
+    : lightPowerWatts_(lightPowerWatts), started_(false), wasOccupied_(false), occupiedRooms_(0), minute_(0),
+      lastSeconds_(0), occupiedSeconds_(0), roomSeconds_(0), entries_(0), exits_(0), lastEntries_(0),
+      lastExits_(0), peakOccupants_(0) {}
+
+bool MinuteAccumulator::sample(const StatusSnapshot& status, uint32_t epochSeconds, MinuteRecord& out) {
+    if (epochSeconds == 0) {
+        return false;
+    }
+    uint32_t minute = epochSeconds / 60;
+    bool finished = false;
+
+    if (!started_) {
+        started_ = true;
+        minute_ = minute;
+        lastSeconds_ = epochSeconds;
+        lastEntries_ = status.totalEntries;
+        lastExits_ = status.totalExits;
+    } else if (epochSeconds < lastSeconds_) {
+        // Clock stepped back (NTP correction): restart the interval
+        lastSeconds_ = epochSeconds;
+    }
+
+    if (minute > minute_) {
+        // The part of the interval up to the boundary belongs to the old minute
+        uint32_t boundary = (minute_ + 1) * 60;
+        if (wasOccupied_ && boundary > lastSeconds_) {
+            occupiedSeconds_ += boundary - lastSeconds_;
+            roomSeconds_ += (boundary - lastSeconds_) * occupiedRooms_;
+        }
+        finish(out);
+        finished = true;
+
+        minute_ = minute;
+        occupiedSeconds_ = 0;
+        roomSeconds_ = 0;
+        entries_ = 0;
+        exits_ = 0;
+        peakOccupants_ = 0;
+        uint32_t minuteStart = minute * 60;
+        lastSeconds_ = lastSeconds_ > minuteStart ? lastSeconds_ : minuteStart;
+    }
+
+    if (wasOccupied_) {
+        occupiedSeconds_ += epochSeconds - lastSeconds_;
+        roomSeconds_ += (epochSeconds - lastSeconds_) * occupiedRooms_;
+    }
+    entries_ += status.totalEntries - lastEntries_;
+    exits_ += status.totalExits - lastExits_;
+    if (status.occupantCount > peakOccupants_) {
+        peakOccupants_ = status.occupantCount;
+    }
+
+    lastSeconds_ = epochSeconds;
+    lastEntries_ = status.totalEntries;
+    lastExits_ = status.totalExits;
+    wasOccupied_ = status.occupied;
+    occupiedRooms_ = status.occupiedRooms;
+    return finished;
+}
+
+void MinuteAccumulator::finish(MinuteRecord& out) const {
+    uint32_t occupied = occupiedSeconds_ > 60 ? 60 : occupiedSeconds_;
+    uint32_t roomSeconds = roomSeconds_ > 60UL * MAX_ROOMS ? 60UL * MAX_ROOMS : roomSeconds_;
+    out.minute = minute_;
+    out.occupiedSeconds = occupied;
+    out.energyMwh = static_cast<uint32_t>(roomSeconds * lightPowerWatts_ * 1000.0f / 3600.0f + 0.5f);
+    out.entries = entries_ > 255 ? 255 : entries_;
+    out.exits = exits_ > 255 ? 255 : exits_;
+    out.peakOccupants = peakOccupants_ > 255 ? 255 : peakOccupants_;
+}
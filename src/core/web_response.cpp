@@ -0,0 +1,74 @@
+#include "web_response.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const char* reasonPhrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 202: return "Accepted";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 406: return "Not Acceptable";
+        case 409: return "Conflict";
+        case 413: return "Content Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "";
+    }
+}
+
+// If-None-Match may list several tags ("a", "b") or be "*"
+bool etagMatches(const char* ifNoneMatch, const char* etag) {
+    if (ifNoneMatch == NULL || *ifNoneMatch == '\0') {
+        return false;
+    }
+    if (strcmp(ifNoneMatch, "*") == 0) {
+        return true;
+    }
+    return strstr(ifNoneMatch, etag) != NULL;
+}
+
+}  // namespace
+
+size_t formatResponseHeader(char* out, size_t size, int status, const char* contentType,
+                            size_t contentLength, const char* cacheControl, const char* extraHeaders,
+                            bool keepAlive) {
+    char lengthHeader[32] = "";
+    if (contentLength != RESPONSE_LENGTH_UNKNOWN) {
+        snprintf(lengthHeader, sizeof(lengthHeader), "Content-Length: %u\r\n",
+                 static_cast<unsigned>(contentLength));
+    } else if (keepAlive) {
+        strcpy(lengthHeader, "Transfer-Encoding: chunked\r\n");
+    }
+    int length = snprintf(out, size,
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s"
+        "Cache-Control: %s\r\n"
+        "%s"
+        "Connection: %s\r\n"
+        "\r\n",
+        status, reasonPhrase(status), contentType, lengthHeader,
+        cacheControl, extraHeaders ? extraHeaders : "", keepAlive ? "keep-alive" : "close");
+    return (length < 0 || static_cast<size_t>(length) >= size) ? 0 : length;
+}
+
+size_t formatAssetHeader(char* out, size_t size, const WebAsset& asset, const char* ifNoneMatch,
+                         bool keepAlive, bool& notModified) {
+    notModified = etagMatches(ifNoneMatch, asset.etag);
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), "ETag: %s\r\nVary: Accept-Encoding\r\n%s", asset.etag,
+             notModified ? "" : "Content-Encoding: gzip\r\n");
+    // A 304 may only carry the Content-Length the 200 would have (RFC 9110
+    // 8.6); its body stays empty either way
+    return formatResponseHeader(out, size, notModified ? 304 : 200, asset.contentType, asset.length,
+                                asset.cacheControl, extra, keepAlive);
+}
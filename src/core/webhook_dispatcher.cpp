@@ -0,0 +1,156 @@
+#include "webhook_dispatcher.h"
+
+#include <string.h>
+
+WebhookDispatcher::WebhookDispatcher(WebhookTransport& transport)
+    : transport_(transport), nextOrder_(0) {
+    memset(events_, 0, sizeof(events_));
+    memset(lastDelivered_, 0, sizeof(lastDelivered_));
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void WebhookDispatcher::enqueue(uint8_t key, const char* url, uint32_t nowMs) {
+    if (key >= WEBHOOK_MAX_KEYS) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    stats_.queued++;
+
+    int slot = findPending(key);
+    if (slot >= 0) {
+        // Newer state for the same room: replace it in place and start its
+        // retry budget over.
+        stats_.coalesced++;
+    } else {
+        slot = allocateSlot();
+        events_[slot].order = nextOrder_++;
+        stats_.pending++;
+    }
+
+    Event& event = events_[slot];
+    event.used = true;
+    event.inFlight = false;
+    event.key = key;
+    event.attempts = 0;
+    event.url = url;
+    event.dueAtMs = nowMs;
+}
+
+uint32_t WebhookDispatcher::poll(uint32_t nowMs) {
+    int slot;
+    const char* url;
+    uint8_t key;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        uint32_t waitMs;
+        slot = findDue(nowMs, waitMs);
+        if (slot < 0) {
+            return waitMs;
+        }
+
+        Event& event = events_[slot];
+        if (event.url == lastDelivered_[event.key]) {
+            // The room went back to the state we last delivered before this
+            // event could be sent; nothing to tell the far end.
+            event.used = false;
+            stats_.pending--;
+            stats_.coalesced++;
+            return 0;
+        }
+        event.inFlight = true;
+        url = event.url;
+        key = event.key;
+    }
+
+    // The network round trip happens without the lock so producers are
+    // never held up by a slow server.
+    int status = transport_.get(url);
+
+    std::lock_guard<std::mutex> guard(lock_);
+    Event& event = events_[slot];
+    bool superseded = findPending(key) >= 0;
+    event.inFlight = false;
+    stats_.lastStatus = status;
+
+    bool success = status >= 200 && status < 400;
+    bool retryable = status <= 0 || status == 429 || status >= 500;
+    if (success) {
+        lastDelivered_[key] = url;
+        stats_.sent++;
+    } else if (superseded) {
+        stats_.coalesced++;  // A newer state is already queued behind us
+    } else if (retryable && event.attempts + 1 < WEBHOOK_MAX_ATTEMPTS) {
+        event.attempts++;
+        event.dueAtMs = nowMs + backoffMs(event.attempts);
+        stats_.retried++;
+        return 0;
+    } else {
+        stats_.dropped++;
+    }
+
+    event.used = false;
+    stats_.pending--;
+    return 0;
+}
+
+WebhookStats WebhookDispatcher::stats() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return stats_;
+}
+
+int WebhookDispatcher::findPending(uint8_t key) const {
+    for (int i = 0; i < WEBHOOK_QUEUE_LENGTH; i++) {
+        const Event& event = events_[i];
+        if (event.used && !event.inFlight && event.key == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Oldest event whose retry time has arrived; otherwise report how long until
+// the earliest one will be.
+int WebhookDispatcher::findDue(uint32_t nowMs, uint32_t& waitMs) const {
+    int due = -1;
+    waitMs = WEBHOOK_IDLE_WAIT_MS;
+    for (int i = 0; i < WEBHOOK_QUEUE_LENGTH; i++) {
+        const Event& event = events_[i];
+        if (!event.used || event.inFlight) {
+            continue;
+        }
+        int32_t remaining = static_cast<int32_t>(event.dueAtMs - nowMs);
+        if (remaining <= 0) {
+            if (due < 0 || static_cast<int32_t>(event.order - events_[due].order) < 0) {
+                due = i;
+            }
+        } else if (static_cast<uint32_t>(remaining) < waitMs) {
+            waitMs = remaining;
+        }
+    }
+    return due;
+}
+
+int WebhookDispatcher::allocateSlot() {
+    int oldest = -1;
+    for (int i = 0; i < WEBHOOK_QUEUE_LENGTH; i++) {
+        const Event& event = events_[i];
+        if (!event.used) {
+            return i;
+        }
+        if (!event.inFlight &&
+            (oldest < 0 || static_cast<int32_t>(event.order - events_[oldest].order) < 0)) {
+            oldest = i;
+        }
+    }
+
+    // Full: the oldest waiting event makes room for the new one
+    stats_.dropped++;
+    stats_.pending--;
+    events_[oldest].used = false;
+    return oldest;
+}
+
+uint32_t WebhookDispatcher::backoffMs(uint8_t attempts) {
+    uint32_t delay = WEBHOOK_BACKOFF_BASE_MS << (attempts - 1);
+    return delay > WEBHOOK_BACKOFF_MAX_MS ? WEBHOOK_BACKOFF_MAX_MS : delay;
+}
@@ -0,0 +1,145 @@
+#include "echo_capture.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "spsc_ring.h"
+
+namespace {
+
+enum EchoState : uint8_t {
+    ECHO_IDLE = 0,
+    ECHO_ARMED,     // Trigger sent, waiting for the rising edge
+    ECHO_HIGH,      // Rising edge seen, waiting for the falling edge
+};
+
+struct EchoChannel {
+    uint8_t trigPin;
+    uint8_t echoPin;
+    bool attached;
+    std::atomic<uint8_t> state;
+    volatile uint32_t triggeredAtUs;
+    volatile uint32_t riseAtUs;
+};
+
+EchoChannel channels[ECHO_MAX_CHANNELS];
+SpscRing<EchoSample, 16> completed;
+std::atomic<uint32_t> droppedSamples{0};
+volatile uint32_t maxWidthUs = ECHO_TIMEOUT_US;
+volatile uint32_t expireAfterUs = ECHO_TIMEOUT_US;
+
+// The ISR and the timeout check in echoCaptureNext() race to finish a ping;
+// whichever wins the compare-exchange back to IDLE owns the result.
+bool finishPing(EchoChannel& ch, uint8_t expected) {
+    return ch.state.compare_exchange_strong(expected, ECHO_IDLE);
+}
+
+void IRAM_ATTR echoIsr(void* arg) {
+    EchoChannel& ch = *static_cast<EchoChannel*>(arg);
+    uint32_t now = micros();
+
+    if (digitalRead(ch.echoPin) == HIGH) {
+        uint8_t expected = ECHO_ARMED;
+        ch.riseAtUs = now;
+        ch.state.compare_exchange_strong(expected, ECHO_HIGH);
+        return;
+    }
+
+    if (!finishPing(ch, ECHO_HIGH)) {
+        return;  // Stray edge or the ping already expired
+    }
+
+    EchoSample sample;
+    sample.channel = static_cast<uint8_t>(&ch - channels);
+    sample.widthUs = now - ch.riseAtUs;
+    sample.timedOut = sample.widthUs > maxWidthUs;  // Beyond the useful range
+    if (sample.timedOut) {
+        sample.widthUs = 0;
+    }
+    sample.timestampUs = now;
+    if (!completed.push(sample)) {
+        droppedSamples.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace
+
+bool echoCaptureAttach(uint8_t channel, uint8_t trigPin, uint8_t echoPin) {
+    if (channel >= ECHO_MAX_CHANNELS) {
+        return false;
+    }
+    EchoChannel& ch = channels[channel];
+    ch.trigPin = trigPin;
+    ch.echoPin = echoPin;
+    ch.state.store(ECHO_IDLE);
+    ch.attached = true;
+
+    pinMode(trigPin, OUTPUT);
+    digitalWrite(trigPin, LOW);
+    pinMode(echoPin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(echoPin), echoIsr, &ch, CHANGE);
+    return true;
+}
+
+bool echoCaptureTrigger(uint8_t channel) {
+    if (channel >= ECHO_MAX_CHANNELS || !channels[channel].attached) {
+        return false;
+    }
+    EchoChannel& ch = channels[channel];
+    if (digitalRead(ch.echoPin) == HIGH) {
+        return false;
+    }
+    uint8_t expected = ECHO_IDLE;
+    if (!ch.state.compare_exchange_strong(expected, ECHO_ARMED)) {
+        return false;
+    }
+    ch.triggeredAtUs = micros();
+
+    digitalWrite(ch.trigPin, LOW);
+    delayMicroseconds(2);
+    digitalWrite(ch.trigPin, HIGH);
+    delayMicroseconds(10);
+    digitalWrite(ch.trigPin, LOW);
+    return true;
+}
+
+void echoCaptureSetMaxWidth(uint32_t widthUs) {
+    maxWidthUs = widthUs < ECHO_TIMEOUT_US ? widthUs : ECHO_TIMEOUT_US;
+    expireAfterUs = ECHO_START_US + maxWidthUs;
+}
+
+bool echoCaptureBusy(uint8_t channel) {
+    if (channel >= ECHO_MAX_CHANNELS) {
+        return false;
+    }
+    return channels[channel].state.load() != ECHO_IDLE;
+}
+
+bool echoCaptureNext(EchoSample& out) {
+    if (completed.pop(out)) {
+        return true;
+    }
+
+    // Nothing finished; retire any ping whose echo never came back so the
+    // channel can be re-armed.
+    uint32_t now = micros();
+    for (uint8_t i = 0; i < ECHO_MAX_CHANNELS; i++) {
+        EchoChannel& ch = channels[i];
+        uint8_t state = ch.state.load();
+        if (state == ECHO_IDLE || (now - ch.triggeredAtUs) < expireAfterUs) {
+            continue;
+        }
+        if (finishPing(ch, state)) {
+            out.channel = i;
+            out.timedOut = true;
+            out.widthUs = 0;
+            out.timestampUs = now;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t echoCaptureDropped() {
+    return droppedSamples.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,289 @@
+#include "hal_esp32.h"
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+#include <fcntl.h>
+#include <lwip/sockets.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "echo_capture.h"
+#include "perf_metrics.h"
+
+uint32_t ArduinoClock::millis() {
+    return ::millis();
+}
+
+uint32_t ArduinoClock::micros() {
+    return ::micros();
+}
+
+// Anything before 2020 means NTP has not answered yet
+uint32_t ArduinoClock::epochSeconds() {
+    time_t now = time(NULL);
+    return now > 1577836800 ? static_cast<uint32_t>(now) : 0;
+}
+
+bool InterruptEchoSource::trigger(uint8_t channel) {
+    return echoCaptureTrigger(channel);
+}
+
+bool InterruptEchoSource::busy(uint8_t channel) {
+    return echoCaptureBusy(channel);
+}
+
+bool InterruptEchoSource::next(EchoSample& out) {
+    return echoCaptureNext(out);
+}
+
+void InterruptEchoSource::setMaxEchoWidth(uint32_t widthUs) {
+    echoCaptureSetMaxWidth(widthUs);
+}
+
+size_t SpiffsStorage::size(const char* path) {
+    if (!SPIFFS.exists(path)) {
+        return 0;
+    }
+    File file = SPIFFS.open(path, FILE_READ);
+    size_t size = file ? file.size() : 0;
+    file.close();
+    return size;
+}
+
+bool SpiffsStorage::read(const char* path, uint32_t offset, void* out, size_t length) {
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    bool ok = file.seek(offset) && file.read(static_cast<uint8_t*>(out), length) == length;
+    file.close();
+    return ok;
+}
+
+bool SpiffsStorage::append(const char* path, const void* data, size_t length) {
+    File file = SPIFFS.open(path, FILE_APPEND);
+    if (!file) {
+        return false;
+    }
+    bool ok = file.write(static_cast<const uint8_t*>(data), length) == length;
+    file.close();
+    return ok;
+}
+
+bool SpiffsStorage::write(const char* path, uint32_t offset, const void* data, size_t length) {
+    File file = SPIFFS.open(path, "r+");
+    if (!file) {
+        return false;
+    }
+    bool ok = file.seek(offset) && file.write(static_cast<const uint8_t*>(data), length) == length;
+    file.close();
+    return ok;
+}
+
+bool SpiffsStorage::remove(const char* path) {
+    return !SPIFFS.exists(path) || SPIFFS.remove(path);
+}
+
+void LcdDisplay::write(uint8_t row, uint8_t col, const char* text, uint8_t length) {
+    lcd_.setCursor(col, row);
+    lcd_.write(reinterpret_cast<const uint8_t*>(text), length);
+}
+
+bool I2cTemperature::read(int16_t& deciCelsius) {
+    wire_.beginTransmission(address_);
+    wire_.write(0);
+    if (wire_.endTransmission(false) != 0 || wire_.requestFrom(address_, static_cast<uint8_t>(2)) != 2) {
+        return false;
+    }
+    uint8_t high = wire_.read();
+    uint8_t low = wire_.read();
+    int16_t raw = static_cast<int16_t>((high << 8) | low);
+    deciCelsius = static_cast<int16_t>((raw * 10 + (raw >= 0 ? 128 : -128)) / 256);
+    return true;
+}
+
+void logMessage(const char* format, ...) {
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    Serial.print(line);
+}
+
+// Connections the stack has accepted but we have not yet; more are refused
+const int HTTP_LISTEN_BACKLOG = 4;
+
+bool LwipTcpListener::begin(uint16_t port) {
+    socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (socket_ < 0) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(socket_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(socket_, HTTP_LISTEN_BACKLOG) < 0) {
+        ::close(socket_);
+        socket_ = -1;
+        return false;
+    }
+    fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+int LwipTcpListener::accept() {
+    int connection = ::accept(socket_, NULL, NULL);
+    if (connection < 0) {
+        return -1;
+    }
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL, 0) | O_NONBLOCK);
+    int noDelay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return connection;
+}
+
+int LwipTcpListener::read(int connection, uint8_t* out, size_t size) {
+    int length = recv(connection, out, size, 0);
+    if (length > 0) {
+        return length;
+    }
+    return (length < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) ? 0 : -1;
+}
+
+int LwipTcpListener::write(int connection, const uint8_t* data, size_t length) {
+    int written = send(connection, data, length, 0);
+    if (written >= 0) {
+        return written;
+    }
+    return (errno == EWOULDBLOCK || errno == EAGAIN) ? 0 : -1;
+}
+
+void LwipTcpListener::close(int connection) {
+    ::close(connection);
+}
+
+void LwipTcpListener::wait(const int* readable, size_t readableCount, const int* writable, size_t writableCount,
+                           bool accepting, uint32_t timeoutMs) {
+    fd_set readSet;
+    fd_set writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    int maxSocket = -1;
+    if (accepting && socket_ >= 0) {
+        FD_SET(socket_, &readSet);
+        maxSocket = socket_;
+    }
+    for (size_t i = 0; i < readableCount; i++) {
+        FD_SET(readable[i], &readSet);
+        maxSocket = readable[i] > maxSocket ? readable[i] : maxSocket;
+    }
+    for (size_t i = 0; i < writableCount; i++) {
+        FD_SET(writable[i], &writeSet);
+        maxSocket = writable[i] > maxSocket ? writable[i] : maxSocket;
+    }
+    if (maxSocket < 0) {
+        vTaskDelay(pdMS_TO_TICKS(timeoutMs));
+        return;
+    }
+    struct timeval timeout = {static_cast<time_t>(timeoutMs / 1000), static_cast<suseconds_t>(timeoutMs % 1000 * 1000)};
+    select(maxSocket + 1, &readSet, &writeSet, NULL, &timeout);
+}
+
+const char* esp32PowerModeName(Esp32PowerMode mode) {
+    switch (mode) {
+        case POWER_MODE_LIGHT_SLEEP: return "lightSleep";
+        case POWER_MODE_SCALING: return "frequencyScaling";
+        case POWER_MODE_FIXED_CLOCK: return "fixedClock";
+        default: return "fullSpeed";
+    }
+}
+
+Esp32PowerMode Esp32Power::begin(bool lightSleep, uint8_t minMhz) {
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "echo", &lock_) != ESP_OK) {
+        lock_ = NULL;
+    }
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz = getCpuFrequencyMhz();
+    config.min_freq_mhz = minMhz;
+    config.light_sleep_enable = lightSleep;
+    if (esp_pm_configure(&config) == ESP_OK) {
+        return lightSleep ? POWER_MODE_LIGHT_SLEEP : POWER_MODE_SCALING;
+    }
+    config.light_sleep_enable = false;
+    if (lightSleep && esp_pm_configure(&config) == ESP_OK) {
+        return POWER_MODE_SCALING;
+    }
+    // Without esp_pm (ESP_ERR_NOT_SUPPORTED) nothing scales the clock, so
+    // settle for the low one
+    return setCpuFrequencyMhz(minMhz) ? POWER_MODE_FIXED_CLOCK : POWER_MODE_FULL_SPEED;
+}
+
+void Esp32Power::stayAwake(bool awake) {
+    if (!lock_ || awake == held_) {
+        return;
+    }
+    if (awake) {
+        esp_pm_lock_acquire(lock_);
+    } else {
+        esp_pm_lock_release(lock_);
+    }
+    held_ = awake;
+}
+
+namespace {
+
+// The wake pin is level triggered, so it can also bring the chip out of
+// light sleep; the ISR masks it until takeWake() sees the level drop
+int wakePin = -1;
+TaskHandle_t wakeTask = NULL;
+volatile bool wakePending = false;
+
+void IRAM_ATTR wakePinIsr() {
+    gpio_intr_disable(static_cast<gpio_num_t>(wakePin));
+    wakePending = true;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(wakeTask, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+}  // namespace
+
+void Esp32Power::wakeOnPin(int pin, TaskHandle_t task) {
+    if (pin < 0) {
+        return;
+    }
+    wakePin = pin;
+    wakeTask = task;
+    pinMode(pin, INPUT);
+    attachInterrupt(digitalPinToInterrupt(pin), wakePinIsr, ONHIGH);
+    gpio_wakeup_enable(static_cast<gpio_num_t>(pin), GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+}
+
+bool Esp32Power::takeWake() {
+    if (wakePin < 0 || !wakePending) {
+        return false;
+    }
+    if (digitalRead(wakePin) == LOW) {
+        wakePending = false;
+        gpio_intr_enable(static_cast<gpio_num_t>(wakePin));
+    }
+    return true;
+}
+
+uint32_t perfCycles() {
+    return ESP.getCycleCount();
+}
+
+// Read every time; the CPU clock may be lowered at runtime
+uint32_t perfCyclesPerUs() {
+    return getCpuFrequencyMhz();
+}
@@ -0,0 +1,51 @@
+#include "http_webhook_transport.h"
+
+#include <WiFi.h>
+
+HttpWebhookTransport::HttpWebhookTransport() : secure_(false) {
+    // IFTTT certificates rotate; like the previous http.begin(url) call we
+    // do not pin a CA.
+    secureClient_.setInsecure();
+    http_.setReuse(true);
+    http_.setConnectTimeout(WEBHOOK_CONNECT_TIMEOUT_MS);
+    http_.setTimeout(WEBHOOK_RESPONSE_TIMEOUT_MS);
+}
+
+int HttpWebhookTransport::get(const char* url) {
+    if (WiFi.status() != WL_CONNECTED) {
+        Serial.println("WiFi Disconnected");
+        return HTTPC_ERROR_NOT_CONNECTED;
+    }
+
+    bool secure = strncmp(url, "https://", 8) == 0;
+    const char* hostStart = strstr(url, "://");
+    hostStart = hostStart ? hostStart + 3 : url;
+    size_t hostLength = strcspn(hostStart, "/:?");
+    String host(hostStart);
+    host.remove(hostLength);
+
+    // HTTPClient reuses whatever socket is open, so drop it when the next
+    // request goes somewhere else.
+    if (secure != secure_ || host != host_) {
+        plainClient_.stop();
+        secureClient_.stop();
+        secure_ = secure;
+        host_ = host;
+    }
+
+    WiFiClient& client = secure ? static_cast<WiFiClient&>(secureClient_) : plainClient_;
+    if (!http_.begin(client, url)) {
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    int httpResponseCode = http_.GET();
+
+    if (httpResponseCode > 0) {
+        Serial.print("HTTP Response code: ");
+        Serial.println(httpResponseCode);
+    } else {
+        Serial.print("Error code: ");
+        Serial.println(httpResponseCode);
+    }
+    http_.end();  // Keeps the socket open when the server allows keep-alive
+    return httpResponseCode;
+}
@@ -2,474 +2,1424 @@
 #include <LiquidCrystal_I2C.h>
 #include <WiFi.h>
 #include <HTTPClient.h>
-#include <WebServer.h>
-#include <ArduinoJson.h>
 #include <SPIFFS.h>
+#include <esp_attr.h>
+#include <esp_system.h>
 #include <time.h>
 
+#include "calendar.h"
+#include "device_config.h"
+#include "display_renderer.h"
+#include "echo_capture.h"
+#include "energy_ledger.h"
+#include "hal_esp32.h"
+#include "history_buckets.h"
+#include "history_export.h"
+#include "http_server.h"
+#include "http_webhook_transport.h"
+#include "perf_metrics.h"
+#include "power_monitor.h"
+#include "sensing_engine.h"
+#include "sensor_trace.h"
+#include "session_log.h"
+#include "status_display.h"
+#include "status_encoder.h"
+#include "status_event_stream.h"
+#include "status_snapshot.h"
+#include "timeseries_store.h"
+#include "web_assets.h"
+#include "web_response.h"
+
+// Wi-Fi, webhooks, pins, SENSOR_THRESHOLD, SEQUENCE_TIMEOUT, the filter and
+// LIGHT_POWER_WATTS below are only the defaults: the board runs on the
+// config saved in CONFIG_FILE once /api/config has changed any of them
+// (include/device_config.h). CONFIG_API_TOKEN is the Bearer token
+// /api/config asks for; left empty, the endpoint stays closed.
+const char* CONFIG_API_TOKEN = "";
+const char* CONFIG_FILE = "/config.bin";
+// A saved config the board keeps resetting with (bad pins, say) is skipped
+// after CONFIG_MAX_FAILED_BOOTS boots that did not last CONFIG_BOOT_OK_MS,
+// until /api/config saves a new one. Saved Wi-Fi credentials that do not
+// connect fall back to ssid/password below for that boot.
+const uint8_t CONFIG_MAX_FAILED_BOOTS = 3;
+const unsigned long CONFIG_BOOT_OK_MS = 120000;
+const int WIFI_CONNECT_ATTEMPTS = 20; // One per second
+
 const char* ssid = "wifi_SSID";              // Your Wi-Fi SSID
 const char* password = "wifi_password";            // Your Wi-Fi Password
 
+// Plain http:// URLs also work, e.g. a local stand-in server for testing
 const char* ifttt_webhook_occupied = "https://maker.ifttt.com/yourIFTTTURL";
 const char* ifttt_webhook_empty = "https://maker.ifttt.com/yourIFTTTURL";
 
+// Turn-on/turn-off webhooks per room, indexed like the rooms in DOORWAYS
+const char* const ROOM_WEBHOOKS[][2] = {
+    {ifttt_webhook_occupied, ifttt_webhook_empty},
+};
+const uint8_t ROOM_COUNT = sizeof(ROOM_WEBHOOKS) / sizeof(ROOM_WEBHOOKS[0]);
+
 // Dual Ultrasonic Sensor Pins
 #define TRIG_PIN_1 5   // Entrance sensor trigger
 #define ECHO_PIN_1 18  // Entrance sensor echo
 #define TRIG_PIN_2 4   // Exit sensor trigger  
 #define ECHO_PIN_2 19  // Exit sensor echo
 
-// Sensor variables
-long duration1, duration2;
-int distance1, distance2;
-bool sensor1_triggered = false;
-bool sensor2_triggered = false;
-unsigned long sensor1_time = 0;
-unsigned long sensor2_time = 0;
+// Trigger/echo pins per echo capture channel
+const uint8_t SENSOR_PINS[][2] = {
+    {TRIG_PIN_1, ECHO_PIN_1},   // Channel 0
+    {TRIG_PIN_2, ECHO_PIN_2},   // Channel 1
+    // {25, 26}, {27, 32},      // A second doorway on channels 2 and 3
+};
+const uint8_t SENSOR_COUNT = sizeof(SENSOR_PINS) / sizeof(SENSOR_PINS[0]);
+
+// Doorways (up to MAX_DOORWAYS): entrance channel, inside channel, room,
+// ping phase. Doorways next to each other get different phases so their
+// hallway sensors never ping at the same time.
+const DoorwaySetup DOORWAYS[] = {
+    {0, 1, 0, 0},
+    // {2, 3, 0, 1},            // Second door into the same room
+};
+const uint8_t DOORWAY_COUNT = sizeof(DOORWAYS) / sizeof(DOORWAYS[0]);
+
+// Detection parameters
 const int SENSOR_THRESHOLD = 75; // Distance threshold in cm
 const unsigned long SEQUENCE_TIMEOUT = 3000; // 3 seconds timeout for sensor sequence
+const int NO_ECHO_DISTANCE = 400; // Reported when a ping gets no echo (HC-SR04 max range)
+
+// Ping grid (src/core/ping_scheduler.cpp). A slot is the echo time for
+// MAX_SENSOR_DISTANCE plus the guard window, ~26.5ms at 400cm, so each sensor
+// reads ~19 times a second while someone is near and every 120ms when idle.
+// Lowering MAX_SENSOR_DISTANCE to just past the far door frame raises the
+// fast rate; a sensor that sees nothing in range still holds ECHO for ~38ms
+// and skips pings if two slots are shorter than that.
+const int MAX_SENSOR_DISTANCE = 400; // Echoes from further away are not waited for
+const unsigned long PING_GUARD_US = 2500; // Quiet time for stray echoes between slots
+const unsigned long PING_IDLE_SLOT_US = 60000; // Slot length when nobody is near
+const int PING_WAKE_DISTANCE = 100; // Closer than this switches to the fast grid
+const unsigned long PING_ACTIVE_HOLD_MS = 5000; // Stay fast this long after the last close reading
+
+// Air temperature for the echo-width to distance conversion
+// (src/core/range_conversion.cpp). With TEMPERATURE_SENSOR_ADDRESS set, an
+// LM75/TMP102-style thermometer on the LCD's I2C bus is read every
+// TEMPERATURE_READ_MS; otherwise, or while it does not answer, the fixed
+// AIR_TEMPERATURE applies. Sound is ~0.17% faster per degree.
+const uint8_t TEMPERATURE_SENSOR_ADDRESS = 0; // 0 = no sensor, e.g. 0x48 for an LM75
+const int16_t AIR_TEMPERATURE_DECI_C = 200; // Tenths of a degree Celsius
+const unsigned long TEMPERATURE_READ_MS = 30000;
+
+// Per-sensor conditioning before the entry/exit state machine
+// (src/core/signal_filter.cpp); /api/filter shows and changes it at runtime
+const uint8_t FILTER_MEDIAN_TAPS = 3; // Median of the last 3 readings drops single outliers
+const uint8_t FILTER_HYSTERESIS_CM = 10; // Presence ends at SENSOR_THRESHOLD + this
+const uint8_t FILTER_DEBOUNCE_SAMPLES = 1; // Readings in a row to change state (1 = off)
+
+// Each sensor learns the empty doorway and sets its own threshold
+// (src/core/baseline_calibration.cpp); SENSOR_THRESHOLD only applies until
+// then. /api/calibration shows what was learned and resets it.
+const uint8_t CALIBRATION_ALPHA_SHIFT = 6; // Steady state averages ~64 empty readings
+const uint8_t CALIBRATION_SIGMA_MULTIPLE = 4; // Threshold at least 4 standard deviations below empty
+const uint8_t CALIBRATION_THRESHOLD_PERCENT = 70; // ...and at most 70% of the empty distance
+const uint16_t CALIBRATION_SAMPLES = 16; // Readings to learn a new doorway (~1s)
+const int CALIBRATION_MIN_THRESHOLD = 20; // cm
+const int CALIBRATION_MAX_THRESHOLD = 150; // cm, for sensors that see no echo when empty
+const BaselineConfig SENSOR_CALIBRATION = {
+    true, CALIBRATION_ALPHA_SHIFT, CALIBRATION_SIGMA_MULTIPLE, CALIBRATION_THRESHOLD_PERCENT,
+    CALIBRATION_SAMPLES, CALIBRATION_MIN_THRESHOLD, CALIBRATION_MAX_THRESHOLD};
+const char* CALIBRATION_FILE = "/baseline.bin";
+const unsigned long CALIBRATION_SAVE_MS = 600000; // Persist the learned baselines every 10 minutes
 
-// Room state variables
-bool roomOccupied = false;
-bool previousState = false;
-int occupantCount = 0;
-unsigned long roomOccupiedSince = 0;
-unsigned long totalOccupiedTime = 0;
-unsigned long dailyOccupiedTime = 0;
-unsigned long lastDayReset = 0;
-
-// Analytics variables
-float energySavedToday = 0.0;
-float energySavedWeek = 0.0;
-float energySavedMonth = 0.0;
-float energySavedYear = 0.0;
+// Occupant counts are an estimate with a confidence
+// (src/core/occupancy.cpp). After every TRACKER_QUIET_MS without anyone in
+// a room's doorways, TRACKER_QUIET_PERCENT of each count's probability moves
+// one person down, so a missed exit stops keeping the lights on: one phantom
+// occupant is gone after ~6 quiet hours.
+const unsigned long TRACKER_QUIET_MS = 2 * 3600000UL;
+const uint8_t TRACKER_QUIET_PERCENT = 25;
+
+// Analytics parameters
 const float LIGHT_POWER_WATTS = 60.0; // Assumed light power consumption
-const float ENERGY_COST_PER_KWH = 0.12; // Cost per kWh in currency
+const long UTC_OFFSET_MINUTES = 0; // Local time zone; days, weeks and months start at local midnight
+
+// Cost and CO2 per room (include/energy_ledger.h). Prices are in millionths
+// of the currency unit per kWh; peak is 17:00-21:00 local on every day
+// (weekdays is a Monday-first bit mask). Rooms are costed with the lights
+// listed in LIGHTS_FILE ("room watts name" per line), LIGHT_POWER_WATTS
+// for a room with none.
+const uint32_t OFF_PEAK_PRICE_MICROS = 80000;   // 0.08 per kWh
+const uint32_t PEAK_PRICE_MICROS = 150000;      // 0.15 per kWh
+const uint32_t CO2_GRAMS_PER_KWH = 500;         // Grid average; see examples/energy_config.h
+const TariffConfig TARIFF = {
+    2, {OFF_PEAK_PRICE_MICROS, PEAK_PRICE_MICROS},
+    1, {{17 * 60, 21 * 60, 0x7F, 1}},
+    CO2_GRAMS_PER_KWH, UTC_OFFSET_MINUTES};
+const char* LIGHTS_FILE = "/lights.txt";
+const char* LEDGER_FILE = "/energy.bin";
+const unsigned long LEDGER_SAVE_MS = 600000; // Persist the cost totals every 10 minutes
+
+// The config the board booted with; read-only once setup() is done, so the
+// sensor task uses its webhook URLs without a copy. liveConfig is the web
+// task's, with every change accepted since; configState carries it to the
+// storage task to save.
+DeviceConfig bootConfig;
+DeviceConfig liveConfig;
+SeqLock<DeviceConfig> configState;
+std::atomic<bool> configSaveRequested{false};
+
+// Boots on the saved config that ended in a reset, counted in RTC memory,
+// which keeps its contents across resets but not power cycles
+const uint32_t FAILED_BOOTS_MAGIC = 0x4C534346;
+RTC_NOINIT_ATTR uint32_t failedBootsMagic;
+RTC_NOINIT_ATTR uint8_t failedBoots;
+bool savedConfigInUse = false;
+
+// Sensing pipeline (src/core/sensing_engine.cpp); only the sensor task
+// touches it after setup()
+ArduinoClock boardClock;
+InterruptEchoSource echoSource;
+SensingEngine sensing(boardClock, echoSource, SensingConfig{
+    DOORWAYS, DOORWAY_COUNT, ROOM_COUNT,
+    PingScheduleConfig{MAX_SENSOR_DISTANCE, PING_GUARD_US, PING_IDLE_SLOT_US, PING_WAKE_DISTANCE,
+                       PING_ACTIVE_HOLD_MS},
+    NO_ECHO_DISTANCE, DoorwayConfig{SENSOR_THRESHOLD, SEQUENCE_TIMEOUT},
+    SignalFilterConfig{true, FILTER_MEDIAN_TAPS, FILTER_HYSTERESIS_CM, FILTER_DEBOUNCE_SAMPLES},
+    SENSOR_CALIBRATION, TrackerConfig{TRACKER_QUIET_MS, TRACKER_QUIET_PERCENT}, LIGHT_POWER_WATTS,
+    UTC_OFFSET_MINUTES});
+
+// Read by the LCD task, which owns the I2C bus; the sensor task applies a
+// changed value at its next frame
+FixedTemperature fixedTemperature(AIR_TEMPERATURE_DECI_C);
+I2cTemperature i2cTemperature(Wire, TEMPERATURE_SENSOR_ADDRESS);
+TemperatureSource& temperatureSource = TEMPERATURE_SENSOR_ADDRESS
+    ? static_cast<TemperatureSource&>(i2cTemperature) : fixedTemperature;
+std::atomic<int16_t> airTemperature{AIR_TEMPERATURE_DECI_C};
+
+// Per-minute occupancy and energy history in SPIFFS, so the totals survive
+// a reboot. Minutes are stamped with NTP time and only recorded once it is set.
+SpiffsStorage flashStorage;
+TimeSeriesStore history(flashStorage, UTC_OFFSET_MINUTES);
+MinuteAccumulator minuteAccumulator(LIGHT_POWER_WATTS);
+const unsigned long HISTORY_SAMPLE_MS = 1000;
+
+// Minute/hour/day/month buckets behind /api/history, rebuilt from the store
+// when the storage task starts
+HistoryBuckets historyBuckets(UTC_OFFSET_MINUTES);
 
-// Web server
-WebServer server(80);
+// Raw minutes for fleet collection (/api/export), read straight from the
+// store by the web task. Holds the gzip window, about 9 KB.
+HistoryExport historyExport(history);
+
+// Finished occupancy sessions and their statistics behind /api/sessions;
+// the web task drains them from the sensing engine and is the only user
+SessionLog sessionLog(UTC_OFFSET_MINUTES);
+const uint16_t SESSIONS_DEFAULT_RECENT = 20;
+
+// Tariff accounting of the same sessions, also owned by the web task; its
+// totals are published for the storage task to save
+EnergyLedger energyLedger(TARIFF, static_cast<uint32_t>(LIGHT_POWER_WATTS * 1000));
+SeqLock<LedgerTotals> ledgerState;
+std::atomic<bool> ledgerChanged{false};
+
+// Every reading and crossing goes into a RAM ring; the storage task appends
+// finished blocks to SPIFFS so a miscount can be replayed offline
+// (pio run -e native, --replay). Two files of TRACE_FILE_MAX are kept.
+TraceRecorder sensorTrace;
+const char* TRACE_FILE = "/trace.bin";
+const char* TRACE_FILE_OLD = "/trace.old.bin";
+const size_t TRACE_FILE_MAX = 256 * 1024;
+const unsigned long TRACE_FLUSH_MS = 60000;
+TaskHandle_t storageTaskHandle;
+
+// Task layout
+#define SENSOR_CORE 1   // Application core, sensing only
+#define NETWORK_CORE 0  // Protocol core, shared with the WiFi stack
+const unsigned long SENSOR_FRAME_MS = 5; // Sensor task period
+const unsigned long LCD_REFRESH_MS = 250; // Changed LCD characters are sent at most 4 times per second
+const unsigned long WEB_POLL_MS = 2; // Longest wait between event-stream updates; requests wake the task at once
+
+// Low-power mode (src/core/power_monitor.cpp). While the doorways are quiet
+// the sensor task sleeps until the next idle ping instead of waking every
+// frame, the CPU light-sleeps whenever no task runs and WiFi only listens to
+// every WIFI_LISTEN_BEACONS-th beacon. Detection is unchanged: idle pings
+// keep their grid and a near reading still switches to the fast one. A
+// request to the board can wait for the next beacon it listens to, so the
+// dashboard and webhook replies get up to WEB_LATENCY_BOUND_MS slower.
+const bool LOW_POWER = true;
+const unsigned long POWER_MAX_SLEEP_MS = 100; // Longest idle sensor frame
+const uint8_t POWER_MIN_CPU_MHZ = 80; // Clock while nothing needs full speed (WiFi needs 80)
+const int PRESENCE_WAKE_PIN = -1; // PIR or radar output that wakes the fast grid, -1 = none
+const unsigned long WEB_POLL_LOW_POWER_MS = 20;
+const uint8_t WIFI_LISTEN_BEACONS = 3; // ESP-IDF's listen interval with WIFI_PS_MAX_MODEM
+const unsigned long BEACON_INTERVAL_US = 102400; // Usual access point setting
+const unsigned long WEB_LATENCY_BOUND_MS = (LOW_POWER ? WIFI_LISTEN_BEACONS : 1) * BEACON_INTERVAL_US / 1000;
+// Current model: typical ESP32-WROOM figures, the board's regulator and the
+// sensors not included
+const PowerConfig POWER_CONFIG = {
+    LOW_POWER, SENSOR_FRAME_MS * 1000, POWER_MAX_SLEEP_MS * 1000,
+    500,    // us awake per wake-up beyond the task's own work
+    30,     // mA, CPU running
+    20,     // mA, CPU idle without light sleep
+    1,      // mA, light sleep
+    100,    // mA, radio receiving or transmitting
+    3000,   // us the radio listens per beacon
+    (LOW_POWER ? WIFI_LISTEN_BEACONS : 1) * BEACON_INTERVAL_US};
+Esp32Power boardPower;
+Esp32PowerMode powerMode = POWER_MODE_FULL_SPEED;   // What boardPower.begin() achieved
+PowerMonitor powerMonitor(POWER_CONFIG);
+SeqLock<PowerStats> powerState;  // Published by the sensor task after each window
+TaskHandle_t sensorTaskHandle;
+
+// Telemetry behind /api/metrics (include/perf_metrics.h). Each histogram is
+// written only by the task that owns the timed path; the counters mirrored
+// from elsewhere and the gauges are sampled when the metrics are scraped.
+// Build with -DPERF_METRICS=0 to leave all of it out.
+#if PERF_METRICS
+LatencyHistogram sensorFrameSeconds("lightsys_sensor_frame_seconds", "Sensor task work per frame");
+LatencyHistogram sensorPeriodSeconds("lightsys_sensor_period_seconds", "Time between sensor task frames");
+LatencyHistogram httpPollSeconds("lightsys_http_poll_seconds", "HTTP server poll passes");
+LatencyHistogram webhookRequestSeconds("lightsys_webhook_request_seconds", "IFTTT webhook requests");
+LatencyHistogram lcdRefreshSeconds("lightsys_lcd_refresh_seconds", "LCD refreshes");
+LatencyHistogram storagePassSeconds("lightsys_storage_pass_seconds", "Storage task passes (history, trace, calibration)");
+MetricCounter sensorOverrunsTotal("lightsys_sensor_overruns_total", "Sensor frames that missed their deadline");
+MetricCounter echoTimeoutsTotal("lightsys_echo_timeouts_total", "Pings that got no echo");
+MetricCounter skippedPingsTotal("lightsys_skipped_pings_total", "Pings a still-busy sensor refused");
+MetricCounter lateSlotsTotal("lightsys_late_ping_slots_total", "Ping slots that started more than a slot late");
+MetricCounter entriesTotal("lightsys_entries_total", "People counted in");
+MetricCounter exitsTotal("lightsys_exits_total", "People counted out");
+MetricCounter webhookSentTotal("lightsys_webhook_sent_total", "Webhook requests delivered");
+MetricCounter webhookRetriedTotal("lightsys_webhook_retried_total", "Webhook attempts that failed and were retried");
+MetricCounter webhookDroppedTotal("lightsys_webhook_dropped_total", "Webhook events given up on");
+MetricCounter statusRequestsTotal("lightsys_status_requests_total", "/api/status requests served");
+MetricCounter httpRequestsTotal("lightsys_http_requests_total", "HTTP requests answered");
+MetricCounter httpRejectedTotal("lightsys_http_rejected_total", "HTTP requests malformed, too large or not routable");
+MetricCounter httpTimedOutTotal("lightsys_http_timed_out_total", "HTTP connections closed while stalled");
+MetricCounter lcdBytesTotal("lightsys_lcd_bytes_total", "Characters and cursor moves sent to the LCD");
+MetricCounter temperatureErrorsTotal("lightsys_temperature_read_errors_total", "Temperature sensor reads that failed");
+MetricGauge heapFreeBytes("lightsys_heap_free_bytes", "Free heap");
+MetricGauge heapMinFreeBytes("lightsys_heap_min_free_bytes", "Lowest free heap since boot");
+MetricGauge heapLargestBlockBytes("lightsys_heap_largest_free_block_bytes", "Largest allocatable block (fragmentation)");
+MetricGauge httpConnections("lightsys_http_connections", "Open HTTP connections");
+MetricGauge wifiRssiDbm("lightsys_wifi_rssi_dbm", "WiFi signal strength, 0 while disconnected");
+MetricGauge uptimeSeconds("lightsys_uptime_seconds", "Seconds since boot");
+MetricGauge samplesPerSecond("lightsys_sensor_samples_per_second", "Sensor readings per second at the current ping rate");
+MetricGauge occupants("lightsys_occupants", "Estimated people in all rooms");
+MetricGauge cpuDutyPermille("lightsys_cpu_awake_permille", "Share of time the CPU was awake, last power window");
+MetricGauge estimatedCurrent("lightsys_estimated_current_microamps", "Modelled average supply current");
+#endif
+
+// Times every request the IFTTT task makes, for the metrics and the
+// radio's share of the power estimate
+class TimedWebhookTransport : public WebhookTransport {
+public:
+    explicit TimedWebhookTransport(WebhookTransport& transport) : transport_(transport) {}
+    int get(const char* url) override {
+        METRIC_SCOPE(webhookRequestSeconds);
+        uint32_t start = micros();
+        int status = transport_.get(url);
+        powerMonitor.addRadioUs(micros() - start);
+        return status;
+    }
+
+private:
+    WebhookTransport& transport_;
+};
+
+// Occupancy changes are queued here by the sensor task and delivered by the
+// IFTTT task; the sensor task never waits on HTTP. The room index is the
+// coalescing key.
+HttpWebhookTransport webhookTransport;
+TimedWebhookTransport timedWebhookTransport(webhookTransport);
+WebhookDispatcher webhookDispatcher(timedWebhookTransport);
+TaskHandle_t iftttTaskHandle;
+
+// Latest state for the web and LCD tasks, written only by the sensor task
+SeqLock<StatusSnapshot> statusSnapshot;
+uint32_t sensorOverruns = 0;
+
+// Detection tuning from /api/config and /api/filter, published as one
+// value so the sensor task swaps all of it at the start of a frame when the
+// generation changes; the storage task also picks up the light power for
+// the history
+struct SensingTuning {
+    DoorwayConfig doorway;
+    SignalFilterConfig filter;
+    float lightPowerWatts;
+};
+SeqLock<SensingTuning> tuningSettings;
+std::atomic<uint32_t> tuningGeneration{0};
+
+// Learned baselines, published by the sensor task for /api/calibration and
+// the storage task. A reset request is handled by the sensor task, which
+// owns the estimators; the storage task saves whenever asked to.
+SeqLock<CalibrationSet> calibrationState;
+std::atomic<uint32_t> calibrationResetGeneration{0};
+std::atomic<bool> calibrationSaveRequested{false};
+const unsigned long CALIBRATION_PUBLISH_MS = 1000;
+
+// Web server (include/http_server.h), polled by the web task on the network
+// core. Everything below is only touched from that task.
+LwipTcpListener tcpListener;
+HttpServer server(tcpListener);
+StatusEventStream statusEvents(server);
+
+// Response bodies are encoded here and copied into the server's buffers
+uint8_t statusBody[STATUS_ENCODED_MAX];
+int32_t statusHeapDelta = 0;  // Free-heap change across the last /api/status request
+char roomsBody[ROOMS_ENCODED_MAX];
+char jsonBody[1536];  // Largest is /api/calibration with every sensor
 
 // Set the LCD address to 0x3F for a 16 chars and 2 line display
 LiquidCrystal_I2C lcd(0x3F, 16, 2);
+LcdDisplay display(lcd);
+DisplayRenderer lcdRenderer(display);  // setup(), then only the LCD task
+
+// Defined below setup(); .cpp files get no Arduino auto-prototypes
+void handleAPIStatus(const HttpRequest& request, HttpResponse& response);
+void handleAPIRooms(const HttpRequest& request, HttpResponse& response);
+void handleAPIEvents(const HttpRequest& request, HttpResponse& response);
+void handleAPIWebhooks(const HttpRequest& request, HttpResponse& response);
+void handleAPITrace(const HttpRequest& request, HttpResponse& response);
+void handleAPITraceFlush(const HttpRequest& request, HttpResponse& response);
+void handleAPIHistory(const HttpRequest& request, HttpResponse& response);
+void handleAPIExport(const HttpRequest& request, HttpResponse& response);
+void handleAPISessions(const HttpRequest& request, HttpResponse& response);
+void handleAPIEnergy(const HttpRequest& request, HttpResponse& response);
+void handleAPIFilter(const HttpRequest& request, HttpResponse& response);
+void handleAPIConfig(const HttpRequest& request, HttpResponse& response);
+void handleAPICalibration(const HttpRequest& request, HttpResponse& response);
+void handleAPICalibrationReset(const HttpRequest& request, HttpResponse& response);
+void handleAPIMetrics(const HttpRequest& request, HttpResponse& response);
+void handleAPIPower(const HttpRequest& request, HttpResponse& response);
+void restoreTotals();
+DeviceConfig defaultConfig();
+void readAirTemperature();
+void showLcdMessage(const char* top, const char* bottom);
+bool connectWifi(const char* title, const char* ssid, const char* password);
+void startTasks();
 
 void setup() {
     Serial.begin(115200);
-    
-    // Initialize dual sensor pins
-    pinMode(TRIG_PIN_1, OUTPUT);
-    pinMode(ECHO_PIN_1, INPUT);
-    pinMode(TRIG_PIN_2, OUTPUT);
-    pinMode(ECHO_PIN_2, INPUT);
+    if (esp_reset_reason() == ESP_RST_POWERON || failedBootsMagic != FAILED_BOOTS_MAGIC) {
+        failedBootsMagic = FAILED_BOOTS_MAGIC;
+        failedBoots = 0;
+    }
+
+    // History, trace and config storage; formats the partition on first boot
+    bootConfig = defaultConfig();
+    bool mounted = SPIFFS.begin(true);
+    static DeviceConfig saved;
+    saved = bootConfig;
+    if (!mounted) {
+        Serial.println("SPIFFS mount failed, history and traces stay in RAM");
+    } else if (loadDeviceConfig(flashStorage, CONFIG_FILE, saved)) {
+        if (failedBoots >= CONFIG_MAX_FAILED_BOOTS) {
+            Serial.printf("Config generation %lu reset the board %u times, using the defaults\n",
+                          static_cast<unsigned long>(saved.generation), failedBoots);
+            bootConfig.generation = saved.generation;  // So patches against it still apply
+        } else {
+            Serial.printf("Config generation %lu loaded\n", static_cast<unsigned long>(saved.generation));
+            bootConfig = saved;
+            savedConfigInUse = true;
+            failedBoots++;  // Taken back by the storage task after CONFIG_BOOT_OK_MS
+        }
+    }
+    liveConfig = bootConfig;
+    configState.publish(liveConfig);
+
+    // Initialize the sensor pins and their echo interrupts
+    for (uint8_t channel = 0; channel < SENSOR_COUNT; channel++) {
+        const uint8_t* pins = bootConfig.sensorPins[channel];
+        if (pins[0] != CONFIG_NO_PIN && pins[1] != CONFIG_NO_PIN) {
+            echoCaptureAttach(channel, pins[0], pins[1]);
+        }
+    }
+
+    sensing.setDoorwayConfig(configDoorway(bootConfig));
+    sensing.setFilter(configFilter(bootConfig));
+    sensing.setLightPowerWatts(configLightWatts(bootConfig));
+    minuteAccumulator.setLightPowerWatts(configLightWatts(bootConfig));
+    energyLedger.setDefaultRoomMilliwatts(bootConfig.lightMilliwatts);
+    tuningSettings.publish(SensingTuning{configDoorway(bootConfig), configFilter(bootConfig),
+                                         configLightWatts(bootConfig)});
+
+    if (mounted) {
+        if (history.begin()) {
+            restoreTotals();
+        }
+        CalibrationSet calibration;
+        if (loadCalibration(flashStorage, CALIBRATION_FILE, calibration)) {
+            sensing.restoreCalibration(calibration);
+        }
+        LightProfile lights[ENERGY_MAX_LIGHTS];
+        size_t lightCount = loadLightProfiles(flashStorage, LIGHTS_FILE, lights, ENERGY_MAX_LIGHTS);
+        if (lightCount > 0) {
+            energyLedger.setLights(lights, lightCount);
+        }
+        LedgerTotals ledger;
+        if (loadLedger(flashStorage, LEDGER_FILE, ledger)) {
+            energyLedger.restore(ledger);
+        }
+    }
+    ledgerState.publish(energyLedger.totals());
 
     // Initialize the LCD
     lcd.init();
     lcd.backlight();
+    readAirTemperature();
 
     // Print a welcome message
-    lcd.setCursor(0, 0);
-    lcd.print("Smart Light Sys");
-    lcd.setCursor(0, 1);
-    lcd.print("Initializing...");
+    char line[DISPLAY_COLS + 1];
+    showLcdMessage("Smart Light Sys", "Initializing...");
     
-    // Connect to Wi-Fi
-    WiFi.begin(ssid, password);
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-        delay(1000);
-        attempts++;
-        Serial.println("Connecting to WiFi...");
-        lcd.setCursor(0, 1);
-        lcd.print("WiFi: " + String(attempts) + "/20    ");
+    // Connect to Wi-Fi; modem sleep wakes the radio for every DTIM beacon,
+    // max modem sleep only for every WIFI_LISTEN_BEACONS-th
+    WiFi.mode(WIFI_STA);
+    WiFi.setSleep(LOW_POWER ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+    // Saved credentials that do not connect fall back to the built-in ones,
+    // so /api/config stays reachable to correct them
+    bool connected = connectWifi("Smart Light Sys", bootConfig.wifiSsid, bootConfig.wifiPassword);
+    if (!connected && (strcmp(bootConfig.wifiSsid, ssid) != 0 || strcmp(bootConfig.wifiPassword, password) != 0)) {
+        Serial.println("Saved WiFi settings failed, trying the defaults");
+        WiFi.disconnect();
+        connected = connectWifi("Default WiFi", ssid, password);
     }
-    
-    if (WiFi.status() == WL_CONNECTED) {
+
+    if (connected) {
         Serial.println("Connected to WiFi");
         Serial.print("IP address: ");
         Serial.println(WiFi.localIP());
+
+        // Wall clock for the history and the day/week/month rollover; offsets
+        // are applied by the store and the sensing engine
+        configTime(0, 0, "pool.ntp.org", "time.nist.gov");
         
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("WiFi Connected");
-        lcd.setCursor(0, 1);
-        lcd.print(WiFi.localIP());
+        IPAddress ip = WiFi.localIP();
+        snprintf(line, sizeof(line), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        showLcdMessage("WiFi Connected", line);
         
         // Setup web server routes
-        server.on("/", handleRoot);
-        server.on("/api/status", handleAPIStatus);
-        server.on("/manifest.json", handleManifest);
-        server.begin();
+        server.setAssets(webAssets, webAssetCount);
+        server.on("/api/status", HTTP_METHOD_ANY, handleAPIStatus);
+        server.on("/api/rooms", HTTP_METHOD_GET, handleAPIRooms);
+        server.on("/api/events", HTTP_METHOD_GET, handleAPIEvents);
+        server.on("/api/webhooks", HTTP_METHOD_ANY, handleAPIWebhooks);
+        server.on("/api/trace", HTTP_METHOD_GET, handleAPITrace);
+        server.on("/api/trace/flush", HTTP_METHOD_POST, handleAPITraceFlush);
+        server.on("/api/history", HTTP_METHOD_GET, handleAPIHistory);
+        server.on("/api/export", HTTP_METHOD_GET, handleAPIExport);
+        server.on("/api/sessions", HTTP_METHOD_GET, handleAPISessions);
+        server.on("/api/energy", HTTP_METHOD_GET, handleAPIEnergy);
+        server.on("/api/filter", HTTP_METHOD_ANY, handleAPIFilter);
+        server.on("/api/config", HTTP_METHOD_ANY, handleAPIConfig);
+        server.on("/api/calibration", HTTP_METHOD_GET, handleAPICalibration);
+        server.on("/api/calibration/reset", HTTP_METHOD_POST, handleAPICalibrationReset);
+        server.on("/api/power", HTTP_METHOD_GET, handleAPIPower);
+#if PERF_METRICS
+        server.on("/api/metrics", HTTP_METHOD_GET, handleAPIMetrics);
+#endif
+        server.begin(80);
         Serial.println("Web server started");
         
         delay(3000);
     } else {
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("WiFi Failed");
-        lcd.setCursor(0, 1);
-        lcd.print("Check Config");
+        showLcdMessage("WiFi Failed", "Check Config");
     }
     
-    lcd.clear();
-    lastDayReset = millis();
+    sensing.setTrace(&sensorTrace);
+    sensing.setTemperature(airTemperature.load());
+    sensing.begin();
+
+    if (LOW_POWER) {
+        powerMode = boardPower.begin(true, POWER_MIN_CPU_MHZ);
+        powerMonitor.setLightSleep(powerMode == POWER_MODE_LIGHT_SLEEP);
+        Serial.printf("Low power: %s, CPU at %lu MHz\n", esp32PowerModeName(powerMode),
+                      static_cast<unsigned long>(getCpuFrequencyMhz()));
+    }
+    powerState.publish(powerMonitor.stats());
+
+    startTasks();
 }
 
-// Function to read distance from ultrasonic sensor
-int readDistance(int trigPin, int echoPin) {
-    digitalWrite(trigPin, LOW);
-    delayMicroseconds(2);
-    digitalWrite(trigPin, HIGH);
-    delayMicroseconds(10);
-    digitalWrite(trigPin, LOW);
-    
-    long duration = pulseIn(echoPin, HIGH);
-    return duration * 0.034 / 2;
+bool connectWifi(const char* title, const char* ssid, const char* password) {
+    char line[DISPLAY_COLS + 1];
+    WiFi.begin(ssid, password);
+    for (int attempts = 1; WiFi.status() != WL_CONNECTED && attempts <= WIFI_CONNECT_ATTEMPTS; attempts++) {
+        delay(1000);
+        Serial.println("Connecting to WiFi...");
+        snprintf(line, sizeof(line), "WiFi: %d/%d", attempts, WIFI_CONNECT_ATTEMPTS);
+        showLcdMessage(title, line);
+    }
+    return WiFi.status() == WL_CONNECTED;
 }
 
-// Function to detect direction of movement
-void detectMovement() {
-    distance1 = readDistance(TRIG_PIN_1, ECHO_PIN_1);
-    distance2 = readDistance(TRIG_PIN_2, ECHO_PIN_2);
-    
-    unsigned long currentTime = millis();
-    
-    // Check sensor 1 (entrance)
-    if (distance1 < SENSOR_THRESHOLD && !sensor1_triggered) {
-        sensor1_triggered = true;
-        sensor1_time = currentTime;
-    } else if (distance1 >= SENSOR_THRESHOLD && sensor1_triggered) {
-        sensor1_triggered = false;
+// Small JSON answers are formatted with snprintf into one static buffer.
+// length is what the snprintf calls returned in total; an answer that did
+// not fit goes out as a 500 rather than as truncated JSON.
+void sendJson(HttpResponse& response, size_t length) {
+    if (length >= sizeof(jsonBody)) {
+        response.send(500, "text/plain", "Response too large");
+        return;
     }
-    
-    // Check sensor 2 (exit)
-    if (distance2 < SENSOR_THRESHOLD && !sensor2_triggered) {
-        sensor2_triggered = true;
-        sensor2_time = currentTime;
-    } else if (distance2 >= SENSOR_THRESHOLD && sensor2_triggered) {
-        sensor2_triggered = false;
+    response.send(200, "application/json", jsonBody, length);
+}
+
+// /api/status[?fields=a,b,c][&format=cbor]
+void handleAPIStatus(const HttpRequest& request, HttpResponse& response) {
+    METRIC_ADD(statusRequestsTotal, 1);
+    uint32_t heapBefore = ESP.getFreeHeap();
+
+    StatusReport report;
+    report.status = statusSnapshot.read();
+    report.uptimeMs = millis();
+    report.heapFree = heapBefore;
+    report.heapMinFree = ESP.getMinFreeHeap();
+    report.heapDelta = statusHeapDelta;
+
+    uint32_t fields = request.hasArg("fields") ? parseStatusFields(request.arg("fields")) : STATUS_ALL_FIELDS;
+    const char* format = request.arg("format");
+    const char* accept = request.header("Accept");
+    bool cbor = (format && strcmp(format, "cbor") == 0) || (accept && strstr(accept, "application/cbor"));
+
+    size_t length;
+    if (cbor) {
+        length = encodeStatusCbor(report, fields, statusBody, sizeof(statusBody));
+    } else {
+        length = encodeStatusJson(report, fields, reinterpret_cast<char*>(statusBody), sizeof(statusBody));
     }
-    
-    // Detect entry sequence: sensor1 then sensor2
-    if (sensor1_triggered && sensor2_time > sensor1_time && 
-        (currentTime - sensor1_time) < SEQUENCE_TIMEOUT) {
-        occupantCount++;
-        roomOccupied = true;
-        if (!previousState) {
-            roomOccupiedSince = currentTime;
-        }
-        Serial.println("Person entered room. Count: " + String(occupantCount));
-        sensor1_triggered = false;
-        sensor2_triggered = false;
+    response.send(200, cbor ? "application/cbor" : "application/json", statusBody, length);
+
+    // Free heap should come back to where it started; anything else means
+    // the request path is allocating (or leaking) again.
+    statusHeapDelta = static_cast<int32_t>(ESP.getFreeHeap() - heapBefore);
+}
+
+// /api/rooms lists every room with its doorways, /api/rooms?room=N just one.
+// /api/status stays the aggregate over all rooms.
+void handleAPIRooms(const HttpRequest& request, HttpResponse& response) {
+    int room = request.hasArg("room") ? atoi(request.arg("room")) : -1;
+    size_t length = encodeRoomsJson(statusSnapshot.read(), room, roomsBody, sizeof(roomsBody));
+    if (length == 0) {
+        response.send(404, "text/plain", "No such room");
+        return;
     }
-    
-    // Detect exit sequence: sensor2 then sensor1
-    if (sensor2_triggered && sensor1_time > sensor2_time && 
-        (currentTime - sensor2_time) < SEQUENCE_TIMEOUT) {
-        occupantCount = max(0, occupantCount - 1);
-        if (occupantCount == 0) {
-            roomOccupied = false;
-            if (previousState && roomOccupiedSince > 0) {
-                unsigned long sessionTime = currentTime - roomOccupiedSince;
-                totalOccupiedTime += sessionTime;
-                dailyOccupiedTime += sessionTime;
-                updateEnergySavings(sessionTime);
-            }
+    response.send(200, "application/json", roomsBody, length);
+}
+
+// Hand the connection over to the push channel; the web task sends every
+// later frame from statusEvents.update()
+void handleAPIEvents(const HttpRequest&, HttpResponse& response) {
+    if (!statusEvents.subscribe(response, statusSnapshot.read(), millis())) {
+        response.send(503, "text/plain", "Too many event subscribers");
+    }
+}
+
+void handleAPIWebhooks(const HttpRequest&, HttpResponse& response) {
+    WebhookStats stats = webhookDispatcher.stats();
+
+    int length = snprintf(jsonBody, sizeof(jsonBody),
+                          "{\"queued\":%lu,\"sent\":%lu,\"retried\":%lu,\"coalesced\":%lu,\"dropped\":%lu,"
+                          "\"pending\":%lu,\"lastStatus\":%d}",
+                          static_cast<unsigned long>(stats.queued), static_cast<unsigned long>(stats.sent),
+                          static_cast<unsigned long>(stats.retried), static_cast<unsigned long>(stats.coalesced),
+                          static_cast<unsigned long>(stats.dropped), static_cast<unsigned long>(stats.pending),
+                          stats.lastStatus);
+    sendJson(response, length);
+}
+
+const char* TRACE_DISPOSITION = "Content-Disposition: attachment; filename=\"trace.bin\"\r\n";
+
+struct StoredTraceStream {
+    const char* path;
+    uint32_t offset;
+    uint32_t size;
+};
+
+// A stored trace, a socket's worth of the file at a time
+size_t fillStoredTrace(HttpStream& stream, uint8_t* out, size_t size) {
+    StoredTraceStream& trace = stream.state<StoredTraceStream>();
+    if (trace.offset >= trace.size) {
+        return HTTP_STREAM_END;
+    }
+    size_t length = trace.size - trace.offset;
+    length = length < size ? length : size;
+    if (!flashStorage.read(trace.path, trace.offset, out, length)) {
+        return HTTP_STREAM_END;  // Rotated away underneath us; the download ends short
+    }
+    trace.offset += length;
+    return length;
+}
+
+struct RamTraceStream {
+    uint32_t sequence;
+    uint32_t end;
+    bool magicSent;
+};
+
+// The RAM ring as it stands when the request came in, as many blocks per
+// piece as fit. Blocks overwritten in the meantime are skipped.
+size_t fillRamTrace(HttpStream& stream, uint8_t* out, size_t size) {
+    RamTraceStream& trace = stream.state<RamTraceStream>();
+    size_t length = 0;
+    if (!trace.magicSent) {
+        memcpy(out, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+        length = TRACE_MAGIC_SIZE;
+        trace.magicSent = true;
+    }
+    while (trace.sequence < trace.end && size - length >= TRACE_BLOCK_MAX) {
+        length += sensorTrace.copyBlock(trace.sequence++, out + length);
+    }
+    if (length == 0 && trace.sequence >= trace.end) {
+        return HTTP_STREAM_END;
+    }
+    return length;
+}
+
+// /api/trace downloads the RAM ring, /api/trace?stored=1 (or =old) the
+// trace saved in flash. The RAM trace is copied block by block as the
+// socket drains, so its length is not known up front.
+void handleAPITrace(const HttpRequest& request, HttpResponse& response) {
+    const char* stored = request.arg("stored");
+    if (stored) {
+        StoredTraceStream trace = {strcmp(stored, "old") == 0 ? TRACE_FILE_OLD : TRACE_FILE, 0, 0};
+        trace.size = flashStorage.size(trace.path);
+        if (trace.size == 0) {
+            response.send(404, "text/plain", "No stored trace");
+            return;
         }
-        Serial.println("Person exited room. Count: " + String(occupantCount));
-        sensor1_triggered = false;
-        sensor2_triggered = false;
+        response.stream(200, "application/octet-stream", fillStoredTrace, trace, TRACE_DISPOSITION);
+        return;
     }
-    
-    // Reset sensors if timeout exceeded
-    if ((currentTime - sensor1_time) > SEQUENCE_TIMEOUT) {
-        sensor1_triggered = false;
-    }
-    if ((currentTime - sensor2_time) > SEQUENCE_TIMEOUT) {
-        sensor2_triggered = false;
-    }
-}
-
-void handleRoot() {
-    String html = R"html(
-<!DOCTYPE html>
-<html lang="en">
-<head>
-    <title>Smart Light System Dashboard</title>
-    <meta charset="UTF-8">
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <meta name="theme-color" content="#2196f3">
-    <meta name="description" content="Smart lighting system with occupancy detection and energy analytics">
-    <link rel="manifest" href="/manifest.json">
-    <style>
-        body { font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Roboto, Oxygen, Ubuntu, Cantarell, sans-serif; margin: 0; padding: 20px; background-color: #f5f5f5; line-height: 1.6; }
-        .container { max-width: 1200px; margin: 0 auto; }
-        .header { text-align: center; color: #333; margin-bottom: 30px; }
-        .header h1 { margin: 0; font-size: 2.5em; font-weight: 300; }
-        .card { background: white; padding: 20px; margin: 10px; border-radius: 12px; box-shadow: 0 4px 6px rgba(0,0,0,0.1); transition: transform 0.2s; }
-        .card:hover { transform: translateY(-2px); }
-        .status-grid { display: grid; grid-template-columns: repeat(auto-fit, minmax(280px, 1fr)); gap: 20px; margin-bottom: 20px; }
-        .status-occupied { background: linear-gradient(135deg, #e8f5e8, #f1f9f1); border-left: 4px solid #4caf50; }
-        .status-empty { background: linear-gradient(135deg, #fff3e0, #fef7f0); border-left: 4px solid #ff9800; }
-        .metrics { display: grid; grid-template-columns: repeat(auto-fit, minmax(200px, 1fr)); gap: 15px; }
-        .metric { text-align: center; padding: 10px; }
-        .metric-value { font-size: 2.2em; font-weight: 600; color: #2196f3; margin-bottom: 5px; }
-        .metric-label { color: #666; font-size: 0.9em; text-transform: uppercase; letter-spacing: 0.5px; }
-        .server-status { display: inline-block; width: 12px; height: 12px; border-radius: 50%; margin-right: 8px; animation: pulse 2s infinite; }
-        .online { background-color: #4caf50; }
-        @keyframes pulse { 0% { opacity: 1; } 50% { opacity: 0.5; } 100% { opacity: 1; } }
-        .refresh-btn { background: linear-gradient(135deg, #2196f3, #1976d2); color: white; border: none; padding: 12px 24px; border-radius: 8px; cursor: pointer; font-size: 16px; transition: all 0.3s; box-shadow: 0 2px 4px rgba(33,150,243,0.3); }
-        .refresh-btn:hover { transform: translateY(-1px); box-shadow: 0 4px 8px rgba(33,150,243,0.4); }
-        .refresh-btn:active { transform: translateY(0); }
-        .card h2 { margin-top: 0; color: #333; font-weight: 500; }
-        .install-banner { background: linear-gradient(135deg, #667eea 0%, #764ba2 100%); color: white; padding: 15px; border-radius: 8px; margin-bottom: 20px; text-align: center; display: none; }
-        .install-btn { background: rgba(255,255,255,0.2); border: 1px solid rgba(255,255,255,0.3); color: white; padding: 8px 16px; border-radius: 6px; cursor: pointer; margin-left: 10px; }
-        
-        @media (max-width: 768px) {
-            body { padding: 10px; }
-            .header h1 { font-size: 2em; }
-            .metrics { grid-template-columns: repeat(auto-fit, minmax(150px, 1fr)); }
-            .metric-value { font-size: 1.8em; }
-            .card { padding: 15px; margin: 5px; }
-        }
-    </style>
-    <script>
-        let deferredPrompt;
-        
-        window.addEventListener('beforeinstallprompt', (e) => {
-            e.preventDefault();
-            deferredPrompt = e;
-            document.getElementById('install-banner').style.display = 'block';
-        });
-        
-        function installApp() {
-            if (deferredPrompt) {
-                deferredPrompt.prompt();
-                deferredPrompt.userChoice.then((choiceResult) => {
-                    if (choiceResult.outcome === 'accepted') {
-                        document.getElementById('install-banner').style.display = 'none';
-                    }
-                    deferredPrompt = null;
-                });
+
+    RamTraceStream trace = {sensorTrace.oldestSequence(), sensorTrace.nextSequence(), false};
+    response.stream(200, "application/octet-stream", fillRamTrace, trace, TRACE_DISPOSITION);
+}
+
+// Save finished blocks now instead of waiting for the next periodic flush
+void handleAPITraceFlush(const HttpRequest&, HttpResponse& response) {
+    xTaskNotifyGive(storageTaskHandle);
+    response.send(202, "application/json", "{\"flushing\":true}");
+}
+
+struct HistoryStream {
+    HistoryCursor cursor;
+    uint8_t part;           // 0 header, 1 points, 2 footer, 3 done
+    bool first;
+};
+
+// One piece per call: the header, then as many points as fit, then the footer
+size_t fillHistory(HttpStream& stream, uint8_t* out, size_t size) {
+    HistoryStream& history = stream.state<HistoryStream>();
+    char* text = reinterpret_cast<char*>(out);
+    size_t length = 0;
+    if (history.part == 0) {
+        length = formatHistoryHeader(history.cursor, text, size);
+        history.part = 1;
+    }
+    if (history.part == 1) {
+        HistoryPoint point;
+        while (size - length >= HISTORY_POINT_MAX) {
+            if (historyBuckets.read(history.cursor, &point, 1) == 0) {
+                history.part = 2;
+                break;
             }
+            length += formatHistoryPoint(point, history.first, text + length, size - length);
+            history.first = false;
         }
-        
-        function refreshData() {
-            fetch('/api/status')
-                .then(response => response.json())
-                .then(data => {
-                    document.getElementById('room-status').textContent = data.occupied ? 'Occupied' : 'Empty';
-                    document.getElementById('room-card').className = 'card ' + (data.occupied ? 'status-occupied' : 'status-empty');
-                    document.getElementById('occupant-count').textContent = data.occupantCount;
-                    document.getElementById('energy-today').textContent = data.energySavedToday.toFixed(3);
-                    document.getElementById('energy-week').textContent = data.energySavedWeek.toFixed(3);
-                    document.getElementById('energy-month').textContent = data.energySavedMonth.toFixed(3);
-                    document.getElementById('energy-year').textContent = data.energySavedYear.toFixed(3);
-                    document.getElementById('occupied-today').textContent = (data.dailyOccupiedTime / 3600000).toFixed(1);
-                    document.getElementById('total-occupied').textContent = (data.totalOccupiedTime / 3600000).toFixed(1);
-                    document.getElementById('uptime').textContent = (data.uptime / 1000).toFixed(0);
-                    document.getElementById('distance1').textContent = data.distance1;
-                    document.getElementById('distance2').textContent = data.distance2;
-                })
-                .catch(error => {
-                    console.error('Error fetching data:', error);
-                    document.getElementById('room-status').textContent = 'Connection Error';
-                });
+    }
+    if (history.part == 2 && size - length >= HISTORY_POINT_MAX) {
+        length += formatHistoryFooter(history.cursor, text + length, size - length);
+        history.part = 3;
+    }
+    return length == 0 ? HTTP_STREAM_END : length;
+}
+
+// /api/history?from=&to=&step= with Unix-second bounds and a named
+// (minute, hour, day, week, month, year) or numeric step. Points are
+// formatted as the socket drains, so the length is not known up front.
+void handleAPIHistory(const HttpRequest& request, HttpResponse& response) {
+    uint32_t now = boardClock.epochSeconds();
+    if (now == 0) {
+        response.send(503, "text/plain", "Clock not set");
+        return;
+    }
+    HistoryQuery query;
+    if (!parseHistoryQuery(request.arg("from"), request.arg("to"), request.arg("step"), now, query)) {
+        response.send(400, "text/plain", "Bad from, to or step");
+        return;
+    }
+    HistoryStream history;
+    if (!historyBuckets.open(query, history.cursor)) {
+        response.send(404, "text/plain", "No history yet");
+        return;
+    }
+    history.part = 0;
+    history.first = true;
+    response.stream(200, "application/json", fillHistory, history);
+}
+
+static_assert(EXPORT_PIECE_MAX <= HTTP_RESPONSE_MAX - 16, "An export piece must fit one stream fill");
+
+size_t fillExport(HttpStream& stream, uint8_t* out, size_t) {
+    size_t length = historyExport.read(stream.state<ExportCursor>(), out, millis());
+    return length == 0 ? HTTP_STREAM_END : length;
+}
+
+// /api/export?since=<cursor> streams every stored minute from the cursor on
+// in the columnar format of include/history_export.h, gzipped when the
+// client accepts it. X-Export-Cursor is the since for the next collection.
+void handleAPIExport(const HttpRequest& request, HttpResponse& response) {
+    static char headers[64];
+    const char* since = request.arg("since");
+    const char* encodings = request.header("Accept-Encoding");
+    bool gzip = encodings && strstr(encodings, "gzip");
+    ExportCursor cursor;
+    if (!historyExport.open(since ? strtoul(since, NULL, 10) : 0, gzip, millis(), cursor)) {
+        response.send(503, "text/plain", "Another compressed export is running");
+        return;
+    }
+    snprintf(headers, sizeof(headers), "X-Export-Cursor: %lu\r\n%s", static_cast<unsigned long>(cursor.end),
+             gzip ? "Content-Encoding: gzip\r\n" : "");
+    response.stream(200, "application/octet-stream", fillExport, cursor, headers);
+}
+
+static_assert(SESSION_SUMMARY_MAX <= HTTP_RESPONSE_MAX - 16, "The session summary must fit one stream fill");
+
+struct SessionStream {
+    uint16_t index;         // Next record, 0 = newest
+    uint16_t count;
+    uint8_t part;           // 0 summary, 1 records, 2 footer, 3 done
+};
+
+// Sessions that finish while the response is streaming shift the ring, so
+// a long list may repeat a record; it never skips one of the summary's
+size_t fillSessions(HttpStream& stream, uint8_t* out, size_t size) {
+    SessionStream& sessions = stream.state<SessionStream>();
+    char* text = reinterpret_cast<char*>(out);
+    size_t length = 0;
+    if (sessions.part == 0) {
+        length = formatSessionSummary(sessionLog, text, size);
+        sessions.part = 1;
+    }
+    while (sessions.part == 1 && size - length >= SESSION_RECORD_MAX) {
+        if (sessions.index >= sessions.count) {
+            sessions.part = 2;
+            break;
         }
-        
-        setInterval(refreshData, 5000);
-        window.onload = refreshData;
-        
-        // Service worker registration
-        if ('serviceWorker' in navigator) {
-            navigator.serviceWorker.register('/sw.js').catch(console.error);
-        }
-    </script>
-</head>
-<body>
-    <div class="container">
-        <div id="install-banner" class="install-banner">
-            📱 Install this app for the best experience!
-            <button class="install-btn" onclick="installApp()">Install</button>
-        </div>
-        
-        <div class="header">
-            <h1>🏠 Smart Light System</h1>
-            <p>Intelligent occupancy detection and energy monitoring</p>
-        </div>
-        
-        <div class="status-grid">
-            <div id="room-card" class="card status-empty">
-                <h2>🚪 Room Status</h2>
-                <h3 id="room-status">Empty</h3>
-                <p>Current occupants: <span id="occupant-count">0</span></p>
-                <p style="font-size: 0.9em; color: #666;">
-                    Sensor 1: <span id="distance1">--</span>cm | 
-                    Sensor 2: <span id="distance2">--</span>cm
-                </p>
-            </div>
-            
-            <div class="card">
-                <h2><span class="server-status online"></span>🖥️ System Status</h2>
-                <p><strong>Status:</strong> Online & Monitoring</p>
-                <p><strong>Uptime:</strong> <span id="uptime">0</span> seconds</p>
-                <p><strong>WiFi:</strong> Connected</p>
-                <p><strong>Sensors:</strong> Dual HC-SR04 Active</p>
-            </div>
-        </div>
-        
-        <div class="card">
-            <h2>⚡ Energy Savings Analytics</h2>
-            <div class="metrics">
-                <div class="metric">
-                    <div class="metric-value" id="energy-today">0.000</div>
-                    <div class="metric-label">kWh Saved Today</div>
-                </div>
-                <div class="metric">
-                    <div class="metric-value" id="energy-week">0.000</div>
-                    <div class="metric-label">kWh Saved This Week</div>
-                </div>
-                <div class="metric">
-                    <div class="metric-value" id="energy-month">0.000</div>
-                    <div class="metric-label">kWh Saved This Month</div>
-                </div>
-                <div class="metric">
-                    <div class="metric-value" id="energy-year">0.000</div>
-                    <div class="metric-label">kWh Saved This Year</div>
-                </div>
-            </div>
-        </div>
-        
-        <div class="card">
-            <h2>⏰ Occupancy Analytics</h2>
-            <div class="metrics">
-                <div class="metric">
-                    <div class="metric-value" id="occupied-today">0.0</div>
-                    <div class="metric-label">Hours Occupied Today</div>
-                </div>
-                <div class="metric">
-                    <div class="metric-value" id="total-occupied">0.0</div>
-                    <div class="metric-label">Total Hours Occupied</div>
-                </div>
-            </div>
-        </div>
-        
-        <div style="text-align: center; margin-top: 30px;">
-            <button class="refresh-btn" onclick="refreshData()">🔄 Refresh Data</button>
-        </div>
-        
-        <div style="text-align: center; margin-top: 20px; color: #666; font-size: 0.9em;">
-            Smart Light System v2.0 | <a href="https://github.com/yousef20920/Light-System" style="color: #2196f3;">GitHub</a>
-        </div>
-    </div>
-</body>
-</html>
-)html";
-    server.send(200, "text/html", html);
-}
-
-void handleManifest() {
-    String manifest = R"json({
-  "name": "Smart Light System Dashboard",
-  "short_name": "SmartLights",
-  "description": "Monitor and control your smart lighting system with occupancy detection and energy analytics",
-  "start_url": "/",
-  "display": "standalone",
-  "background_color": "#f5f5f5",
-  "theme_color": "#2196f3",
-  "orientation": "portrait-primary",
-  "icons": [
-    {
-      "src": "data:image/svg+xml;base64,PHN2ZyB3aWR0aD0iMTkyIiBoZWlnaHQ9IjE5MiIgdmlld0JveD0iMCAwIDI0IDI0IiBmaWxsPSIjMjE5NmYzIiB4bWxucz0iaHR0cDovL3d3dy53My5vcmcvMjAwMC9zdmciPjxwYXRoIGQ9Ik05IDIxYzAgLjU1LjQ1IDEgMSAxaDRjLjU1IDAgMS0uNDUgMS0xdi0xSDl2MXptMy0xOUMyIDIgMiA2IDIgNmMwIDIuNjEgMS42NyA0Ljg2IDQgNS43NFYxN2MwIC41NS40NSAxIDEgMWg2Yy41NSAwIDEtLjQ1IDEtMXYtNS4yNmMyLjMzLS44OCA0LTMuMTMgNC01Ljc0IDAtNC00LTQtNC00czQgMCA0IDRjMCAyLjYxLTEuNjcgNC44Ni00IDUuNzRWMTdIMTFWNy43NEM4LjY3IDYuODYgNyA0LjYxIDcgMiA3LjAxIDIgOSAyIDkgMnoiLz48L3N2Zz4=",
-      "sizes": "192x192",
-      "type": "image/svg+xml"
-    },
-    {
-      "src": "data:image/svg+xml;base64,PHN2ZyB3aWR0aD0iNTEyIiBoZWlnaHQ9IjUxMiIgdmlld0JveD0iMCAwIDI0IDI0IiBmaWxsPSIjMjE5NmYzIiB4bWxucz0iaHR0cDovL3d3dy53My5vcmcvMjAwMC9zdmciPjxwYXRoIGQ9Ik05IDIxYzAgLjU1LjQ1IDEgMSAxaDRjLjU1IDAgMS0uNDUgMS0xdi0xSDl2MXptMy0xOUMyIDIgMiA2IDIgNmMwIDIuNjEgMS42NyA0Ljg2IDQgNS43NFYxN2MwIC41NS40NSAxIDEgMWg2Yy41NSAwIDEtLjQ1IDEtMXYtNS4yNmMyLjMzLS44OCA0LTMuMTMgNC01Ljc0IDAtNC00LTQtNC00czQgMCA0IDRjMCAyLjYxLTEuNjcgNC44Ni00IDUuNzRWMTdIMTFWNy43NEM4LjY3IDYuODYgNyA0LjYxIDcgMiA3LjAxIDIgOSAyIDkgMnoiLz48L3N2Zz4=",
-      "sizes": "512x512",
-      "type": "image/svg+xml"
-    }
-  ]
-})json";
-    server.send(200, "application/json", manifest);
-}
-
-void handleAPIStatus() {
-    StaticJsonDocument<512> doc;
-    doc["occupied"] = roomOccupied;
-    doc["occupantCount"] = occupantCount;
-    doc["energySavedToday"] = energySavedToday;
-    doc["energySavedWeek"] = energySavedWeek;
-    doc["energySavedMonth"] = energySavedMonth;
-    doc["energySavedYear"] = energySavedYear;
-    doc["dailyOccupiedTime"] = dailyOccupiedTime;
-    doc["totalOccupiedTime"] = totalOccupiedTime;
-    doc["uptime"] = millis();
-    doc["distance1"] = distance1;
-    doc["distance2"] = distance2;
-    
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+        length += formatSessionRecord(sessionLog.recent(sessions.index), sessions.index == 0, text + length,
+                                      size - length);
+        sessions.index++;
+    }
+    if (sessions.part == 2 && size - length >= SESSION_RECORD_MAX) {
+        length += formatSessionFooter(text + length, size - length);
+        sessions.part = 3;
+    }
+    return length == 0 ? HTTP_STREAM_END : length;
 }
 
-void sendIFTTTRequest(const char* url) {
-    if (WiFi.status() == WL_CONNECTED) {
-        HTTPClient http;
-        http.begin(url);
-        int httpResponseCode = http.GET();
+// /api/sessions?recent=N: session count, p50/p90 length, dwell histogram,
+// occupied seconds per local hour, the busiest hours and the N newest
+// sessions (default SESSIONS_DEFAULT_RECENT, at most the ring's worth)
+void handleAPISessions(const HttpRequest& request, HttpResponse& response) {
+    const char* recent = request.arg("recent");
+    unsigned long count = recent ? strtoul(recent, NULL, 10) : SESSIONS_DEFAULT_RECENT;
+    SessionStream sessions;
+    sessions.index = 0;
+    sessions.count = count < sessionLog.held() ? count : sessionLog.held();
+    sessions.part = 0;
+    response.stream(200, "application/json", fillSessions, sessions);
+}
 
-        if (httpResponseCode > 0) {
-            Serial.print("HTTP Response code: ");
-            Serial.println(httpResponseCode);
-        } else {
-            Serial.print("Error code: ");
-            Serial.println(httpResponseCode);
+static_assert(sizeof(jsonBody) >= ENERGY_JSON_MAX, "jsonBody must hold the energy report");
+
+// /api/energy?room=N: kWh, cost and CO2 today, this week, month, year and
+// since the ledger was started, split by tariff band; all rooms by default
+void handleAPIEnergy(const HttpRequest& request, HttpResponse& response) {
+    uint8_t room = ENERGY_ALL_ROOMS;
+    if (request.hasArg("room")) {
+        int index = atoi(request.arg("room"));
+        if (index < 0 || index >= ROOM_COUNT) {
+            response.send(404, "text/plain", "No such room");
+            return;
         }
-        http.end();
-    } else {
-        Serial.println("WiFi Disconnected");
+        room = static_cast<uint8_t>(index);
+    }
+    uint32_t now = boardClock.epochSeconds();
+    if (now > 0) {
+        energyLedger.rollTo(localDayFromMinute(now / 60, UTC_OFFSET_MINUTES));
+    }
+    size_t length = formatEnergyJson(energyLedger, room, ROOM_COUNT, jsonBody, sizeof(jsonBody));
+    // 0 when the report did not fit; a 500 rather than an empty 200
+    if (length == 0) {
+        response.send(500, "text/plain", "Response too large");
+        return;
     }
+    response.send(200, "application/json", jsonBody, length);
 }
 
-void loop() {
-    // Handle web server clients
-    server.handleClient();
-    
-    // Detect movement with dual sensors
-    detectMovement();
-    
-    // Reset daily statistics at midnight (24 hours)
-    if (millis() - lastDayReset > 86400000) { // 24 hours in milliseconds
-        dailyOccupiedTime = 0;
-        energySavedToday = 0;
-        lastDayReset = millis();
-    }
-
-    // Display current status on LCD
-    lcd.setCursor(0, 0);
-    lcd.print("D1:");
-    lcd.print(distance1);
-    lcd.print(" D2:");
-    lcd.print(distance2);
-    lcd.print("    ");
-
-    lcd.setCursor(0, 1);
-    if (roomOccupied) {
-        lcd.print("Occupied (" + String(occupantCount) + ")   ");
-    } else {
-        lcd.print("Empty           ");
+// liveConfig's tuning for the sensor and storage tasks, all in one step
+void publishTuning() {
+    tuningSettings.publish(SensingTuning{configDoorway(liveConfig), configFilter(liveConfig),
+                                         configLightWatts(liveConfig)});
+    tuningGeneration.fetch_add(1, std::memory_order_release);
+}
+
+// GET shows the signal filter settings; POST with any of enabled=0|1,
+// median=K, hysteresis=CM and debounce=N changes them until the next reboot.
+void handleAPIFilter(const HttpRequest& request, HttpResponse& response) {
+    SignalFilterConfig filter = configFilter(liveConfig);
+    if (request.method() == HTTP_METHOD_POST) {
+        if (request.hasArg("enabled")) {
+            filter.enabled = strcmp(request.arg("enabled"), "0") != 0;
+        }
+        if (request.hasArg("median")) {
+            filter.medianTaps = constrain(atoi(request.arg("median")), 1, SIGNAL_FILTER_MAX_TAPS);
+        }
+        if (request.hasArg("hysteresis")) {
+            filter.hysteresisCm = constrain(atoi(request.arg("hysteresis")), 0, 255);
+        }
+        if (request.hasArg("debounce")) {
+            filter.debounceSamples = constrain(atoi(request.arg("debounce")), 1, 255);
+        }
+        filter = sanitizeSignalFilter(filter);
+        // Shown by /api/config too, but only saved by it
+        liveConfig.filterEnabled = filter.enabled;
+        liveConfig.filterMedianTaps = filter.medianTaps;
+        liveConfig.filterHysteresisCm = filter.hysteresisCm;
+        liveConfig.filterDebounceSamples = filter.debounceSamples;
+        publishTuning();
     }
 
-    // Check for state change and update accordingly
-    if (roomOccupied != previousState) {
-        if (roomOccupied) {
-            Serial.println("Room Occupied. Sending turn on request.");
-            sendIFTTTRequest(ifttt_webhook_occupied);
+    int length = snprintf(jsonBody, sizeof(jsonBody),
+                          "{\"enabled\":%s,\"median\":%u,\"hysteresis\":%u,\"debounce\":%u}",
+                          filter.enabled ? "true" : "false", filter.medianTaps, filter.hysteresisCm,
+                          filter.debounceSamples);
+    sendJson(response, length);
+}
+
+struct ConfigStream {
+    uint8_t field;
+    uint8_t part;
+};
+
+// The fields in CONFIG_FIELDS order, as many per chunk as fit
+size_t fillConfig(HttpStream& stream, uint8_t* out, size_t size) {
+    ConfigStream& config = stream.state<ConfigStream>();
+    char* text = reinterpret_cast<char*>(out);
+    size_t length = 0;
+    if (config.part == 0) {
+        length = snprintf(text, size, "{\"generation\":%lu,\"rebootRequired\":%s,\"fields\":{",
+                          static_cast<unsigned long>(liveConfig.generation),
+                          configNeedsReboot(bootConfig, liveConfig) ? "true" : "false");
+        config.part = 1;
+    }
+    while (config.part == 1 && size - length >= CONFIG_FIELD_JSON_MAX) {
+        if (config.field >= CONFIG_FIELD_COUNT) {
+            config.part = 2;
+            break;
+        }
+        length += formatConfigField(liveConfig, CONFIG_FIELDS[config.field], config.field == 0, text + length,
+                                    size - length);
+        config.field++;
+    }
+    if (config.part == 2 && size - length >= 4) {
+        length += snprintf(text + length, size - length, "}}");
+        config.part = 3;
+    }
+    return length == 0 ? HTTP_STREAM_END : length;
+}
+
+// Hand an accepted change to the tasks that use it: tuning to the sensor
+// and storage tasks at their next pass, the whole config to flash within
+// a storage pass
+void applyLiveConfig() {
+    publishTuning();
+    energyLedger.setDefaultRoomMilliwatts(liveConfig.lightMilliwatts);
+    configState.publish(liveConfig);
+    configSaveRequested.store(true);
+}
+
+// /api/config with "Authorization: Bearer <CONFIG_API_TOKEN>". GET shows
+// every field (secrets masked). POST changes them either as form arguments
+// named like the fields, or as a binary patch
+// (application/octet-stream, include/device_config.h) whose generation is
+// 0 or the one GET showed. Either is all or nothing.
+void handleAPIConfig(const HttpRequest& request, HttpResponse& response) {
+    if (!configAuthorized(liveConfig, request.header("Authorization"))) {
+        if (liveConfig.apiToken[0] == '\0') {
+            response.send(403, "text/plain", "No API token configured");
         } else {
-            Serial.println("Room Empty. Sending turn off request.");
-            sendIFTTTRequest(ifttt_webhook_empty);
+            response.send(401, "text/plain", "Bad token", 9, "no-store", "WWW-Authenticate: Bearer\r\n");
         }
-        previousState = roomOccupied;
+        return;
     }
-    
-    delay(100); // Reduced delay for more responsive sensor reading
+    if (request.method() == HTTP_METHOD_GET) {
+        ConfigStream config;
+        config.field = 0;
+        config.part = 0;
+        response.stream(200, "application/json", fillConfig, config);
+        return;
+    }
+    if (request.method() != HTTP_METHOD_POST) {
+        response.send(405, "text/plain", "GET or POST");
+        return;
+    }
+
+    ConfigResult result = request.bodyLength() > 0
+        ? applyConfigPatch(liveConfig, request.body(), request.bodyLength())
+        : applyConfigForm(liveConfig, request);
+    if (result == CONFIG_STALE) {
+        response.send(409, "text/plain", "Config changed since; GET it again");
+        return;
+    }
+    if (result != CONFIG_OK) {
+        response.send(400, "text/plain", result == CONFIG_BAD_VERSION ? "Unsupported schema version"
+                                                                      : "Invalid config");
+        return;
+    }
+    applyLiveConfig();
+
+    size_t length = snprintf(jsonBody, sizeof(jsonBody), "{\"generation\":%lu,\"rebootRequired\":%s}",
+                             static_cast<unsigned long>(liveConfig.generation),
+                             configNeedsReboot(bootConfig, liveConfig) ? "true" : "false");
+    response.send(200, "application/json", jsonBody, length);
+}
+
+// Per sensor: what the empty doorway reads, its spread, the threshold in use
+// and whether it is still learning
+void handleAPICalibration(const HttpRequest&, HttpResponse& response) {
+    CalibrationSet set = calibrationState.read();
+    const BaselineConfig& config = SENSOR_CALIBRATION;
+
+    size_t length = snprintf(jsonBody, sizeof(jsonBody), "{\"enabled\":%s,\"sensors\":[",
+                             config.enabled ? "true" : "false");
+    for (uint8_t i = 0; i < set.count && length < sizeof(jsonBody); i++) {
+        BaselineEstimator baseline;
+        baseline.restore(set.sensors[i]);
+        length += snprintf(jsonBody + length, sizeof(jsonBody) - length,
+                           "%s{\"doorway\":%u,\"side\":\"%s\",\"calibrated\":%s,\"emptyCm\":%d,\"sigmaCm\":%d,"
+                           "\"thresholdCm\":%d,\"samples\":%lu}",
+                           i > 0 ? "," : "", i >> 1, (i & 1) ? "inside" : "entrance",
+                           baseline.calibrated(config) ? "true" : "false", baseline.meanCm(), baseline.sigmaCm(),
+                           baseline.threshold(config, liveConfig.thresholdCm),
+                           static_cast<unsigned long>(set.sensors[i].samples));
+    }
+    if (length < sizeof(jsonBody)) {
+        length += snprintf(jsonBody + length, sizeof(jsonBody) - length, "]}");
+    }
+    sendJson(response, length);
+}
+
+// Forget what every sensor learned; they relearn the empty doorways, which
+// should be clear for a second or two after this
+void handleAPICalibrationReset(const HttpRequest&, HttpResponse& response) {
+    calibrationResetGeneration.fetch_add(1, std::memory_order_release);
+    response.send(202, "application/json", "{\"resetting\":true}");
+}
+
+#if PERF_METRICS
+// Prometheus text format (version 0.0.4), one metric family per piece so
+// the response never has to fit in memory at once
+size_t fillMetrics(HttpStream& stream, uint8_t* out, size_t size) {
+    const Metric*& metric = stream.state<const Metric*>();
+    if (!metric) {
+        return HTTP_STREAM_END;
+    }
+    size_t length = metric->format(reinterpret_cast<char*>(out), size);
+    metric = metric->next();
+    return length;
+}
+
+void handleAPIMetrics(const HttpRequest&, HttpResponse& response) {
+    StatusSnapshot status = statusSnapshot.read();
+    WebhookStats webhooks = webhookDispatcher.stats();
+    const HttpServerStats& http = server.stats();
+    sensorOverrunsTotal.set(status.sensorOverruns);
+    echoTimeoutsTotal.set(status.echoTimeouts);
+    skippedPingsTotal.set(status.skippedPings);
+    lateSlotsTotal.set(status.lateSlots);
+    entriesTotal.set(status.totalEntries);
+    exitsTotal.set(status.totalExits);
+    webhookSentTotal.set(webhooks.sent);
+    webhookRetriedTotal.set(webhooks.retried);
+    webhookDroppedTotal.set(webhooks.dropped);
+    httpRequestsTotal.set(http.requests);
+    httpRejectedTotal.set(http.rejected);
+    httpTimedOutTotal.set(http.timedOut);
+    httpConnections.set(http.connections);
+    heapFreeBytes.set(ESP.getFreeHeap());
+    heapMinFreeBytes.set(ESP.getMinFreeHeap());
+    heapLargestBlockBytes.set(ESP.getMaxAllocHeap());
+    wifiRssiDbm.set(WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0);
+    uptimeSeconds.set(millis() / 1000);
+    samplesPerSecond.set(status.samplesPerSecond);
+    occupants.set(status.occupantCount);
+    PowerStats power = powerState.read();
+    cpuDutyPermille.set(power.cpuDutyPermille);
+    estimatedCurrent.set(power.estimatedDeciMa * 100);
+
+    response.stream(200, "text/plain; version=0.0.4", fillMetrics, Metric::first());
+}
+#endif
+
+// Duty cycle and modelled current over the last POWER_WINDOW_US, and what
+// low-power mode costs in latency
+void handleAPIPower(const HttpRequest&, HttpResponse& response) {
+    PowerStats power = powerState.read();
+
+    // Fractions printed from the integer tenths and microseconds
+    int length = snprintf(jsonBody, sizeof(jsonBody),
+                          "{\"lowPower\":%s,\"powerMode\":\"%s\",\"lightSleep\":%s,\"frameMs\":%lu.%03lu,"
+                          "\"cpuDutyPercent\":%u.%u,\"radioDutyPercent\":%u.%u,\"wakeupsPerSecond\":%u,"
+                          "\"estimatedMa\":%u.%u,\"webLatencyBoundMs\":%lu,\"wakeLatencyBoundMs\":%lu}",
+                          LOW_POWER ? "true" : "false", esp32PowerModeName(powerMode),
+                          power.lightSleep ? "true" : "false",
+                          static_cast<unsigned long>(power.frameUs / 1000),
+                          static_cast<unsigned long>(power.frameUs % 1000),
+                          power.cpuDutyPermille / 10, power.cpuDutyPermille % 10,
+                          power.radioDutyPermille / 10, power.radioDutyPermille % 10, power.wakeupsPerSecond,
+                          power.estimatedDeciMa / 10, power.estimatedDeciMa % 10, WEB_LATENCY_BOUND_MS,
+                          LOW_POWER ? POWER_MAX_SLEEP_MS : SENSOR_FRAME_MS);
+    sendJson(response, length);
+}
+
+void publishStatus() {
+    StatusSnapshot snapshot;
+    sensing.fillSnapshot(snapshot);
+    snapshot.sensorOverruns = sensorOverruns;
+    statusSnapshot.publish(snapshot);
+}
+
+// High-priority sensing task: pings, runs the entry/exit state machine and
+// publishes the snapshot on a fixed frame. It never touches the network or
+// the LCD, so a slow client cannot stretch the sampling cadence.
+void sensorTask(void* param) {
+    TickType_t lastWake = xTaskGetTickCount();
+    bool previousState[MAX_ROOMS] = {};
+    uint32_t appliedTuning = 0;
+    uint32_t appliedReset = 0;
+    uint32_t savedChanges = sensing.calibrationChanges();
+    unsigned long lastCalibrationPublish = 0;
+#if PERF_METRICS
+    uint32_t lastFrameCycles = perfCycles();
+#endif
+    for (;;) {
+#if PERF_METRICS
+        uint32_t frameCycles = perfCycles();
+        sensorPeriodSeconds.observeCycles(frameCycles - lastFrameCycles);
+        lastFrameCycles = frameCycles;
+#endif
+        uint32_t frameStartUs = micros();
+        if (boardPower.takeWake()) {
+            sensing.wake();
+        }
+        uint32_t generation = tuningGeneration.load(std::memory_order_acquire);
+        if (generation != appliedTuning) {
+            SensingTuning tuning = tuningSettings.read();
+            sensing.setDoorwayConfig(tuning.doorway);
+            sensing.setFilter(tuning.filter);
+            sensing.setLightPowerWatts(tuning.lightPowerWatts);
+            appliedTuning = generation;
+        }
+        generation = calibrationResetGeneration.load(std::memory_order_acquire);
+        if (generation != appliedReset) {
+            sensing.resetCalibration();
+            appliedReset = generation;
+        }
+        int16_t temperature = airTemperature.load(std::memory_order_relaxed);
+        if (temperature != sensing.temperature()) {
+            sensing.setTemperature(temperature);
+        }
+        sensing.step();
+
+        if (millis() - lastCalibrationPublish >= CALIBRATION_PUBLISH_MS ||
+            sensing.calibrationChanges() != savedChanges) {
+            CalibrationSet calibration;
+            sensing.exportCalibration(calibration);
+            calibrationState.publish(calibration);
+            if (sensing.calibrationChanges() != savedChanges) {
+                calibrationSaveRequested.store(true);
+                savedChanges = sensing.calibrationChanges();
+            }
+            lastCalibrationPublish = millis();
+        }
+
+        for (uint8_t room = 0; room < sensing.roomCount(); room++) {
+            bool roomOccupied = sensing.room(room).occupied;
+            if (roomOccupied == previousState[room]) {
+                continue;
+            }
+            if (roomOccupied) {
+                Serial.printf("Room %u Occupied. Queueing turn on request.\n", room);
+                webhookDispatcher.enqueue(room, bootConfig.webhooks[room][0], millis());
+            } else {
+                Serial.printf("Room %u Empty. Queueing turn off request.\n", room);
+                webhookDispatcher.enqueue(room, bootConfig.webhooks[room][1], millis());
+            }
+            xTaskNotifyGive(iftttTaskHandle);
+            previousState[room] = roomOccupied;
+        }
+
+        publishStatus();
+#if PERF_METRICS
+        sensorFrameSeconds.observeCycles(perfCycles() - frameCycles);
+#endif
+
+        // While nothing is happening, sleep until the next idle ping (or the
+        // wake pin) and let the chip light-sleep; otherwise stay awake for
+        // the echoes and keep the short frame
+        uint32_t idleUs = sensing.idleUs();
+        uint32_t frameUs = powerMonitor.nextFrameUs(idleUs);
+        boardPower.stayAwake(idleUs == 0);
+        powerMonitor.addWake(micros() - frameStartUs);
+        if (powerMonitor.update(micros())) {
+            powerState.publish(powerMonitor.stats());
+        }
+        if (frameUs > POWER_CONFIG.activeFrameUs) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(frameUs / 1000));
+            lastWake = xTaskGetTickCount();
+        } else if (xTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SENSOR_FRAME_MS)) == pdFALSE) {
+            // vTaskDelayUntil returns pdFALSE when the frame deadline was missed
+            sensorOverruns++;
+        }
+    }
+}
+
+// Serving a client keeps the radio busy, so the web task's time counts
+// towards the radio's share of the power estimate as well as the CPU's
+void webTask(void* param) {
+    for (;;) {
+        server.wait(LOW_POWER ? WEB_POLL_LOW_POWER_MS : WEB_POLL_MS);
+        uint32_t start = micros();
+        {
+            METRIC_SCOPE(httpPollSeconds);
+            server.poll(millis());
+        }
+        statusEvents.update(statusSnapshot.read(), millis());
+        SessionRecord session;
+        bool sessionsAdded = false;
+        while (sensing.nextSession(session)) {
+            sessionLog.add(session);
+            energyLedger.add(session);
+            sessionsAdded = true;
+        }
+        if (sessionsAdded) {
+            ledgerState.publish(energyLedger.totals());
+            ledgerChanged.store(true);
+        }
+        uint32_t busyUs = micros() - start;
+        powerMonitor.addWake(busyUs);
+        powerMonitor.addRadioUs(busyUs);
+    }
+}
+
+// Webhook worker: delivers queued events and sleeps until the next retry
+// is due or the sensor task queues something new.
+void iftttTask(void* param) {
+    for (;;) {
+        uint32_t start = micros();
+        uint32_t waitMs = webhookDispatcher.poll(millis());
+        powerMonitor.addWake(micros() - start);
+        if (waitMs == 0) {
+            continue;
+        }
+        TickType_t waitTicks = waitMs == WEBHOOK_IDLE_WAIT_MS ? portMAX_DELAY : pdMS_TO_TICKS(waitMs);
+        ulTaskNotifyTake(pdTRUE, waitTicks);
+    }
+}
+
+// Append the trace blocks finished since the last flush. Blocks the ring
+// overwrote before we got to them show up as a sequence gap in the file.
+uint32_t traceFlushedSequence = 0;
+uint8_t traceFlushBlock[TRACE_BLOCK_MAX];
+
+void flushTrace() {
+    uint32_t next = sensorTrace.nextSequence();
+    if (next == 0) {
+        return;
+    }
+    uint32_t finished = next - 1;  // The newest block is still being written
+    uint32_t oldest = sensorTrace.oldestSequence();
+    if (traceFlushedSequence < oldest) {
+        traceFlushedSequence = oldest;
+    }
+    if (traceFlushedSequence >= finished) {
+        return;
+    }
+
+    File file = SPIFFS.open(TRACE_FILE, FILE_APPEND);
+    if (file && file.size() >= TRACE_FILE_MAX) {
+        file.close();
+        SPIFFS.remove(TRACE_FILE_OLD);
+        SPIFFS.rename(TRACE_FILE, TRACE_FILE_OLD);
+        file = SPIFFS.open(TRACE_FILE, FILE_APPEND);
+    }
+    if (!file) {
+        return;
+    }
+    if (file.size() == 0) {
+        file.write(reinterpret_cast<const uint8_t*>(TRACE_MAGIC), TRACE_MAGIC_SIZE);
+    }
+    for (; traceFlushedSequence < finished; traceFlushedSequence++) {
+        size_t length = sensorTrace.copyBlock(traceFlushedSequence, traceFlushBlock);
+        if (length > 0) {
+            file.write(traceFlushBlock, length);
+        }
+    }
+    file.close();
+}
+
+// The compile-time settings above, for a board without a saved config
+DeviceConfig defaultConfig() {
+    DeviceConfig config = {};
+    strlcpy(config.wifiSsid, ssid, sizeof(config.wifiSsid));
+    strlcpy(config.wifiPassword, password, sizeof(config.wifiPassword));
+    strlcpy(config.apiToken, CONFIG_API_TOKEN, sizeof(config.apiToken));
+    for (uint8_t room = 0; room < ROOM_COUNT && room < MAX_ROOMS; room++) {
+        strlcpy(config.webhooks[room][0], ROOM_WEBHOOKS[room][0], CONFIG_URL_MAX);
+        strlcpy(config.webhooks[room][1], ROOM_WEBHOOKS[room][1], CONFIG_URL_MAX);
+    }
+    memset(config.sensorPins, CONFIG_NO_PIN, sizeof(config.sensorPins));
+    for (uint8_t channel = 0; channel < SENSOR_COUNT && channel < CONFIG_MAX_CHANNELS; channel++) {
+        config.sensorPins[channel][0] = SENSOR_PINS[channel][0];
+        config.sensorPins[channel][1] = SENSOR_PINS[channel][1];
+    }
+    config.thresholdCm = SENSOR_THRESHOLD;
+    config.sequenceTimeoutMs = SEQUENCE_TIMEOUT;
+    config.lightMilliwatts = static_cast<uint32_t>(LIGHT_POWER_WATTS * 1000);
+    config.filterEnabled = true;
+    config.filterMedianTaps = FILTER_MEDIAN_TAPS;
+    config.filterHysteresisCm = FILTER_HYSTERESIS_CM;
+    config.filterDebounceSamples = FILTER_DEBOUNCE_SAMPLES;
+    return config;
+}
+
+// Seed the sensing engine's energy and occupied-time totals from the
+// history written before the last reset
+void restoreTotals() {
+    StoreTotals totals = history.totals();
+    EnergyAnalytics energy;
+    energy.energySavedToday = totals.today.energyMwh / 1e6f;
+    energy.energySavedWeek = totals.week.energyMwh / 1e6f;
+    energy.energySavedMonth = totals.month.energyMwh / 1e6f;
+    energy.energySavedYear = totals.year.energyMwh / 1e6f;
+    StoreStats stats = history.stats();
+    int32_t day = stats.records > 0 ? history.localDay(stats.lastMinute) : SENSING_NO_DAY;
+    sensing.restoreTotals(energy, totals.lifetime.occupiedSeconds * 1000UL,
+                          totals.today.occupiedSeconds * 1000UL, day);
+}
+
+// Flash writes can stall for tens of milliseconds, so the history and the
+// trace are written from their own low-priority task rather than the web or
+// sensor task. A notification (POST /api/trace/flush) flushes the trace early.
+void storageTask(void* param) {
+    historyBuckets.prime(history);
+    unsigned long lastTraceFlush = millis();
+    unsigned long lastCalibrationSave = millis();
+    unsigned long lastLedgerSave = millis();
+    uint32_t appliedTuning = 0;
+    for (;;) {
+        bool flushRequested = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HISTORY_SAMPLE_MS)) > 0;
+        METRIC_SCOPE(storagePassSeconds);
+        uint32_t start = micros();
+
+        if (calibrationSaveRequested.exchange(false) || millis() - lastCalibrationSave >= CALIBRATION_SAVE_MS) {
+            saveCalibration(flashStorage, CALIBRATION_FILE, calibrationState.read());
+            lastCalibrationSave = millis();
+        }
+
+        if (configSaveRequested.exchange(false) && saveDeviceConfig(flashStorage, CONFIG_FILE, configState.read())) {
+            failedBoots = 0;  // A new config gets its own tries
+        }
+        if (savedConfigInUse && millis() >= CONFIG_BOOT_OK_MS) {
+            failedBoots = 0;
+            savedConfigInUse = false;
+        }
+
+        if (millis() - lastLedgerSave >= LEDGER_SAVE_MS) {
+            if (ledgerChanged.exchange(false)) {
+                saveLedger(flashStorage, LEDGER_FILE, ledgerState.read());
+            }
+            lastLedgerSave = millis();
+        }
+
+        uint32_t generation = tuningGeneration.load(std::memory_order_acquire);
+        if (generation != appliedTuning) {
+            minuteAccumulator.setLightPowerWatts(tuningSettings.read().lightPowerWatts);
+            appliedTuning = generation;
+        }
+
+        MinuteRecord minute;
+        if (minuteAccumulator.sample(statusSnapshot.read(), boardClock.epochSeconds(), minute)) {
+            history.append(minute);
+            historyBuckets.add(minute);
+        }
+
+        if (flushRequested || millis() - lastTraceFlush >= TRACE_FLUSH_MS) {
+            flushTrace();
+            lastTraceFlush = millis();
+        }
+        powerMonitor.addWake(micros() - start);
+    }
+}
+
+// Falls back to AIR_TEMPERATURE_DECI_C while the sensor does not answer.
+// Only called from setup() and the LCD task, which share the I2C bus.
+void readAirTemperature() {
+    static bool answered = true;
+    int16_t deciCelsius;
+    bool ok = temperatureSource.read(deciCelsius);
+    if (!ok) {
+        METRIC_ADD(temperatureErrorsTotal, 1);
+    }
+    if (ok != answered) {
+        Serial.println(ok ? "Temperature sensor answering again" : "Temperature sensor not answering");
+        answered = ok;
+    }
+    airTemperature.store(ok ? deciCelsius : AIR_TEMPERATURE_DECI_C, std::memory_order_relaxed);
+}
+
+void showLcdMessage(const char* top, const char* bottom) {
+    char rows[DISPLAY_ROWS][DISPLAY_COLS + 1];
+    formatTextRows(top, bottom, rows);
+    lcdRenderer.present(rows);
 }
+
+// Only characters that changed since the last refresh go over I2C
+void lcdTask(void* param) {
+    char rows[DISPLAY_ROWS][DISPLAY_COLS + 1];
+    unsigned long lastTemperatureRead = millis();
+    for (;;) {
+        uint32_t start = micros();
+        {
+            METRIC_SCOPE(lcdRefreshSeconds);
+            formatStatusRows(statusSnapshot.read(), rows);
+            METRIC_ADD(lcdBytesTotal, lcdRenderer.present(rows));
+        }
+
+        if (millis() - lastTemperatureRead >= TEMPERATURE_READ_MS) {
+            readAirTemperature();
+            lastTemperatureRead = millis();
+        }
+        powerMonitor.addWake(micros() - start);
+
+        vTaskDelay(pdMS_TO_TICKS(LCD_REFRESH_MS));
+    }
+}
+
+void startTasks() {
+    publishStatus();
+
+    // Sensing owns the application core; everything that can block on I/O
+    // shares the protocol core with the WiFi stack. The IFTTT task must exist
+    // before the sensor task can notify it.
+    xTaskCreatePinnedToCore(iftttTask, "ifttt", 8192, NULL, 1, &iftttTaskHandle, NETWORK_CORE);
+    xTaskCreatePinnedToCore(sensorTask, "sensor", 4096, NULL, 5, &sensorTaskHandle, SENSOR_CORE);
+    xTaskCreatePinnedToCore(webTask, "web", 8192, NULL, 2, NULL, NETWORK_CORE);
+    xTaskCreatePinnedToCore(lcdTask, "lcd", 4096, NULL, 1, NULL, NETWORK_CORE);
+    xTaskCreatePinnedToCore(storageTask, "storage", 6144, NULL, 1, &storageTaskHandle, NETWORK_CORE);
+    boardPower.wakeOnPin(PRESENCE_WAKE_PIN, sensorTaskHandle);
+}
+
+void loop() {
+    // All work runs in the pinned tasks created by startTasks()
+    vTaskDelete(NULL);
+}
\ No newline at end of file
@@ -0,0 +1,691 @@
+// Host build of the firmware logic (pio run -e native).
+//
+// Runs the same SensingEngine, webhook dispatcher, LCD formatting and status
+// encoder as the ESP32 build against a simulated clock and a scripted sensor
+// input, as fast as the host allows:
+//
+//   .pio/build/native/program [script.txt] [--record trace.bin] [--store dir]
+//                             [--temperature celsius] [--metrics] [--low-power]
+//                             [--serve port] [--token token]
+//
+// Without a script it plays a built-in walk-in / walk-out sequence. See
+// sim/enter_exit.txt for the script format and sim/two_rooms.txt for several
+// doorways. --record writes the sensor trace of the run; --replay runs a
+// recorded trace instead (see replay.h). --store keeps the per-minute history
+// and the learned sensor baselines in an existing directory, so repeated runs
+// carry them over like reboots of the board. --temperature sets the simulated
+// air temperature (default 20 C), which both shapes the echoes and is what
+// the engine is told. --metrics prints the run's telemetry as /api/metrics
+// would, timed in host CPU time. --low-power paces the sensor frames as the
+// firmware's low-power mode does and prints the modelled duty cycle and
+// current. --serve runs the simulation in real time instead, without an end,
+// and serves the dashboard, /api/status, /api/rooms, /api/events,
+// /api/metrics, /api/sessions, /api/energy and /api/config on the port
+// through the firmware's HttpServer until interrupted;
+// scripts/http_load_test.py measures it. /api/config takes the Bearer token
+// given by --token and applies a change from the next frame. With --store the
+// change is also saved in <dir>/config.bin (two slots, as on the board) and
+// the history is served at /api/export. Every run ends with the session
+// statistics as /api/sessions?recent=5 would give them and the cost report of
+// /api/energy, which with --store uses the lights in <dir>/lights.txt and
+// carries its totals over in <dir>/energy.bin.
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "calendar.h"
+#include "device_config.h"
+#include "display_renderer.h"
+#include "energy_ledger.h"
+#include "history_buckets.h"
+#include "history_export.h"
+#include "http_server.h"
+#include "perf_metrics.h"
+#include "power_monitor.h"
+#include "replay.h"
+#include "sensing_engine.h"
+#include "session_log.h"
+#include "sim_hal.h"
+#include "status_display.h"
+#include "status_encoder.h"
+#include "status_event_stream.h"
+#include "timeseries_store.h"
+#include "web_assets.h"
+#include "webhook_dispatcher.h"
+
+// Same values as the firmware (src/main.cpp)
+const int SENSOR_THRESHOLD = 75;
+const uint32_t SEQUENCE_TIMEOUT = 3000;
+const int NO_ECHO_DISTANCE = 400;
+const int MAX_SENSOR_DISTANCE = 400;
+const uint32_t PING_GUARD_US = 2500;
+const uint32_t PING_IDLE_SLOT_US = 60000;
+const int PING_WAKE_DISTANCE = 100;
+const uint32_t PING_ACTIVE_HOLD_MS = 5000;
+const uint8_t FILTER_MEDIAN_TAPS = 3;
+const uint8_t FILTER_HYSTERESIS_CM = 10;
+const uint8_t FILTER_DEBOUNCE_SAMPLES = 1;
+const uint8_t CALIBRATION_ALPHA_SHIFT = 6;
+const uint8_t CALIBRATION_SIGMA_MULTIPLE = 4;
+const uint8_t CALIBRATION_THRESHOLD_PERCENT = 70;
+const uint16_t CALIBRATION_SAMPLES = 16;
+const int CALIBRATION_MIN_THRESHOLD = 20;
+const int CALIBRATION_MAX_THRESHOLD = 150;
+const char* CALIBRATION_FILE = "/baseline.bin";
+const TariffConfig TARIFF = {2, {80000, 150000}, 1, {{17 * 60, 21 * 60, 0x7F, 1}}, 500, 0};
+const char* LIGHTS_FILE = "/lights.txt";
+const char* LEDGER_FILE = "/energy.bin";
+const char* CONFIG_FILE = "/config.bin";
+const uint32_t TRACKER_QUIET_MS = 2 * 3600000UL;
+const uint8_t TRACKER_QUIET_PERCENT = 25;
+const float LIGHT_POWER_WATTS = 60.0;
+const uint32_t SENSOR_FRAME_US = 5000;
+const uint32_t LCD_REFRESH_MS = 250;
+const uint32_t RUN_OUT_MS = 5000;  // Keep simulating after the last step
+const uint16_t SESSIONS_DEFAULT_RECENT = 20;
+const uint16_t SESSIONS_PRINTED = 5;
+const uint32_t HISTORY_SAMPLE_MS = 1000;
+const uint32_t SIM_EPOCH = 1704096000;  // 2024-01-01 08:00 UTC, the "NTP" time at start
+const int32_t UTC_OFFSET_MINUTES = 0;
+const uint32_t POWER_MAX_SLEEP_US = 100000;
+const uint32_t SIM_FRAME_WORK_US = 200;  // Sensor task work per frame, as measured on the board
+const PowerConfig POWER_CONFIG = {false, SENSOR_FRAME_US, POWER_MAX_SLEEP_US, 500, 30, 20, 1, 100, 3000, 3 * 102400};
+
+// A subset of the firmware's /api/metrics (src/main.cpp)
+LatencyHistogram sensorFrameSeconds("lightsys_sensor_frame_seconds", "Sensor task work per frame");
+MetricCounter echoTimeoutsTotal("lightsys_echo_timeouts_total", "Pings that got no echo");
+MetricCounter entriesTotal("lightsys_entries_total", "People counted in");
+MetricCounter exitsTotal("lightsys_exits_total", "People counted out");
+MetricCounter lcdBytesTotal("lightsys_lcd_bytes_total", "Characters and cursor moves sent to the LCD");
+MetricGauge occupants("lightsys_occupants", "Estimated people in all rooms");
+MetricCounter httpRequestsTotal("lightsys_http_requests_total", "HTTP requests answered");
+MetricGauge httpConnections("lightsys_http_connections", "Open HTTP connections");
+
+const char* WEBHOOK_OCCUPIED = "http://stand-in.local/room_occupied";
+const char* WEBHOOK_EMPTY = "http://stand-in.local/room_empty";
+
+// --serve: what the handlers see, updated every frame
+PosixTcpListener tcpListener;
+HttpServer server(tcpListener);
+StatusEventStream statusEvents(server);
+StatusSnapshot servedStatus = {};
+uint32_t servedUptimeMs = 0;
+uint8_t statusBody[STATUS_ENCODED_MAX];
+char roomsBody[ROOMS_ENCODED_MAX];
+HistoryExport* servedExport = NULL;
+char exportHeaders[64];
+SessionLog sessionLog(UTC_OFFSET_MINUTES);
+EnergyLedger energyLedger(TARIFF, static_cast<uint32_t>(LIGHT_POWER_WATTS * 1000));
+uint8_t servedRooms = 1;
+char energyBody[ENERGY_JSON_MAX];
+DeviceConfig bootConfig;
+DeviceConfig liveConfig;
+volatile sig_atomic_t stopServing = 0;
+
+void onInterrupt(int) {
+    stopServing = 1;
+}
+
+// Same query handling as the firmware's, without the heap fields
+void handleAPIStatus(const HttpRequest& request, HttpResponse& response) {
+    StatusReport report = {};
+    report.status = servedStatus;
+    report.uptimeMs = servedUptimeMs;
+    uint32_t fields = request.hasArg("fields") ? parseStatusFields(request.arg("fields")) : STATUS_ALL_FIELDS;
+    const char* format = request.arg("format");
+    const char* accept = request.header("Accept");
+    bool cbor = (format && strcmp(format, "cbor") == 0) || (accept && strstr(accept, "application/cbor"));
+
+    size_t length = cbor ? encodeStatusCbor(report, fields, statusBody, sizeof(statusBody))
+                         : encodeStatusJson(report, fields, reinterpret_cast<char*>(statusBody), sizeof(statusBody));
+    response.send(200, cbor ? "application/cbor" : "application/json", statusBody, length);
+}
+
+void handleAPIRooms(const HttpRequest& request, HttpResponse& response) {
+    int room = request.hasArg("room") ? atoi(request.arg("room")) : -1;
+    size_t length = encodeRoomsJson(servedStatus, room, roomsBody, sizeof(roomsBody));
+    if (length == 0) {
+        response.send(404, "text/plain", "No such room");
+        return;
+    }
+    response.send(200, "application/json", roomsBody, length);
+}
+
+void handleAPIEvents(const HttpRequest&, HttpResponse& response) {
+    if (!statusEvents.subscribe(response, servedStatus, servedUptimeMs)) {
+        response.send(503, "text/plain", "Too many event subscribers");
+    }
+}
+
+// One metric family per piece
+size_t fillMetrics(HttpStream& stream, uint8_t* out, size_t size) {
+    const Metric*& metric = stream.state<const Metric*>();
+    if (!metric) {
+        return HTTP_STREAM_END;
+    }
+    size_t length = metric->format(reinterpret_cast<char*>(out), size);
+    metric = metric->next();
+    return length;
+}
+
+// The gauges and counters the status snapshot carries, as the firmware sets them
+void setStatusMetrics(const StatusSnapshot& status) {
+    echoTimeoutsTotal.set(status.echoTimeouts);
+    entriesTotal.set(status.totalEntries);
+    exitsTotal.set(status.totalExits);
+    occupants.set(status.occupantCount);
+}
+
+void handleAPIMetrics(const HttpRequest&, HttpResponse& response) {
+    const HttpServerStats& http = server.stats();
+    setStatusMetrics(servedStatus);
+    httpRequestsTotal.set(http.requests);
+    httpConnections.set(http.connections);
+    response.stream(200, "text/plain; version=0.0.4", fillMetrics, Metric::first());
+}
+
+size_t fillExport(HttpStream& stream, uint8_t* out, size_t) {
+    size_t length = servedExport->read(stream.state<ExportCursor>(), out, servedUptimeMs);
+    return length == 0 ? HTTP_STREAM_END : length;
+}
+
+// Same as the firmware's
+void handleAPIExport(const HttpRequest& request, HttpResponse& response) {
+    const char* since = request.arg("since");
+    const char* encodings = request.header("Accept-Encoding");
+    bool gzip = encodings && strstr(encodings, "gzip");
+    ExportCursor cursor;
+    if (!servedExport->open(since ? strtoul(since, NULL, 10) : 0, gzip, servedUptimeMs, cursor)) {
+        response.send(503, "text/plain", "Another compressed export is running");
+        return;
+    }
+    snprintf(exportHeaders, sizeof(exportHeaders), "X-Export-Cursor: %u\r\n%s", cursor.end,
+             gzip ? "Content-Encoding: gzip\r\n" : "");
+    response.stream(200, "application/octet-stream", fillExport, cursor, exportHeaders);
+}
+
+struct SessionStream {
+    uint16_t index;
+    uint16_t count;
+    uint8_t part;
+};
+
+// Same as the firmware's
+size_t fillSessions(HttpStream& stream, uint8_t* out, size_t size) {
+    SessionStream& sessions = stream.state<SessionStream>();
+    char* text = reinterpret_cast<char*>(out);
+    size_t length = 0;
+    if (sessions.part == 0) {
+        length = formatSessionSummary(sessionLog, text, size);
+        sessions.part = 1;
+    }
+    while (sessions.part == 1 && size - length >= SESSION_RECORD_MAX) {
+        if (sessions.index >= sessions.count) {
+            sessions.part = 2;
+            break;
+        }
+        length += formatSessionRecord(sessionLog.recent(sessions.index), sessions.index == 0, text + length,
+                                      size - length);
+        sessions.index++;
+    }
+    if (sessions.part == 2 && size - length >= SESSION_RECORD_MAX) {
+        length += formatSessionFooter(text + length, size - length);
+        sessions.part = 3;
+    }
+    return length == 0 ? HTTP_STREAM_END : length;
+}
+
+void handleAPISessions(const HttpRequest& request, HttpResponse& response) {
+    const char* recent = request.arg("recent");
+    unsigned long count = recent ? strtoul(recent, NULL, 10) : SESSIONS_DEFAULT_RECENT;
+    SessionStream sessions;
+    sessions.index = 0;
+    sessions.count = count < sessionLog.held() ? count : sessionLog.held();
+    sessions.part = 0;
+    response.stream(200, "application/json", fillSessions, sessions);
+}
+
+// Same as the firmware's
+void handleAPIEnergy(const HttpRequest& request, HttpResponse& response) {
+    uint8_t room = ENERGY_ALL_ROOMS;
+    if (request.hasArg("room")) {
+        int index = atoi(request.arg("room"));
+        if (index < 0 || index >= servedRooms) {
+            response.send(404, "text/plain", "No such room");
+            return;
+        }
+        room = static_cast<uint8_t>(index);
+    }
+    size_t length = formatEnergyJson(energyLedger, room, servedRooms, energyBody, sizeof(energyBody));
+    // 0 when the report did not fit; a 500 rather than an empty 200
+    if (length == 0) {
+        response.send(500, "text/plain", "Response too large");
+        return;
+    }
+    response.send(200, "application/json", energyBody, length);
+}
+
+struct ConfigStream {
+    uint8_t field;
+    uint8_t part;
+};
+
+// Same as the firmware's
+size_t fillConfig(HttpStream& stream, uint8_t* out, size_t size) {
+    ConfigStream& config = stream.state<ConfigStream>();
+    char* text = reinterpret_cast<char*>(out);
+    size_t length = 0;
+    if (config.part == 0) {
+        length = snprintf(text, size, "{\"generation\":%u,\"rebootRequired\":%s,\"fields\":{",
+                          liveConfig.generation, configNeedsReboot(bootConfig, liveConfig) ? "true" : "false");
+        config.part = 1;
+    }
+    while (config.part == 1 && size - length >= CONFIG_FIELD_JSON_MAX) {
+        if (config.field >= CONFIG_FIELD_COUNT) {
+            config.part = 2;
+            break;
+        }
+        length += formatConfigField(liveConfig, CONFIG_FIELDS[config.field], config.field == 0, text + length,
+                                    size - length);
+        config.field++;
+    }
+    if (config.part == 2 && size - length >= 4) {
+        length += snprintf(text + length, size - length, "}}");
+        config.part = 3;
+    }
+    return length == 0 ? HTTP_STREAM_END : length;
+}
+
+// Same as the firmware's; the simulation loop applies and saves a change
+// when it sees the generation move
+void handleAPIConfig(const HttpRequest& request, HttpResponse& response) {
+    if (!configAuthorized(liveConfig, request.header("Authorization"))) {
+        if (liveConfig.apiToken[0] == '\0') {
+            response.send(403, "text/plain", "No API token configured");
+        } else {
+            response.send(401, "text/plain", "Bad token", 9, "no-store", "WWW-Authenticate: Bearer\r\n");
+        }
+        return;
+    }
+    if (request.method() == HTTP_METHOD_GET) {
+        ConfigStream config;
+        config.field = 0;
+        config.part = 0;
+        response.stream(200, "application/json", fillConfig, config);
+        return;
+    }
+    if (request.method() != HTTP_METHOD_POST) {
+        response.send(405, "text/plain", "GET or POST");
+        return;
+    }
+
+    ConfigResult result = request.bodyLength() > 0
+        ? applyConfigPatch(liveConfig, request.body(), request.bodyLength())
+        : applyConfigForm(liveConfig, request);
+    if (result == CONFIG_STALE) {
+        response.send(409, "text/plain", "Config changed since; GET it again");
+        return;
+    }
+    if (result != CONFIG_OK) {
+        response.send(400, "text/plain", result == CONFIG_BAD_VERSION ? "Unsupported schema version"
+                                                                      : "Invalid config");
+        return;
+    }
+    size_t length = snprintf(energyBody, sizeof(energyBody), "{\"generation\":%u,\"rebootRequired\":%s}",
+                             liveConfig.generation, configNeedsReboot(bootConfig, liveConfig) ? "true" : "false");
+    response.send(200, "application/json", energyBody, length);
+}
+
+int main(int argc, char** argv) {
+    const char* scriptPath = NULL;
+    const char* recordPath = NULL;
+    const char* storeDir = NULL;
+    int16_t airDeciCelsius = RANGE_DEFAULT_DECI_CELSIUS;
+    bool printMetrics = false;
+    int servePort = 0;
+    const char* apiToken = "";
+    PowerConfig powerConfig = POWER_CONFIG;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--replay") == 0) {
+            return runReplay(argc, argv);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            storeDir = argv[++i];
+        } else if (strcmp(argv[i], "--temperature") == 0 && i + 1 < argc) {
+            airDeciCelsius = static_cast<int16_t>(lround(atof(argv[++i]) * 10));
+        } else if (strcmp(argv[i], "--metrics") == 0) {
+            printMetrics = true;
+        } else if (strcmp(argv[i], "--low-power") == 0) {
+            powerConfig.lowPower = true;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--token") == 0 && i + 1 < argc) {
+            apiToken = argv[++i];
+        } else {
+            scriptPath = argv[i];
+        }
+    }
+
+    std::vector<ScriptStep> script;
+    std::vector<uint8_t> rooms;
+    if (scriptPath) {
+        if (!loadScript(scriptPath, script, &rooms) || script.empty()) {
+            fprintf(stderr, "Cannot read script %s\n", scriptPath);
+            return 1;
+        }
+    } else {
+        script = defaultScript();
+    }
+
+    // One doorway per scripted sensor pair, on channels 2n/2n+1, with
+    // neighbours in alternating phases
+    uint8_t channels = 0;
+    for (const ScriptStep& step : script) {
+        channels = step.channels > channels ? step.channels : channels;
+    }
+    DoorwaySetup doorways[MAX_DOORWAYS];
+    uint8_t doorwayCount = channels / 2 < MAX_DOORWAYS ? channels / 2 : MAX_DOORWAYS;
+    uint8_t roomCount = 1;
+    for (uint8_t i = 0; i < doorwayCount; i++) {
+        uint8_t room = i < rooms.size() && rooms[i] < MAX_ROOMS ? rooms[i] : 0;
+        doorways[i] = DoorwaySetup{static_cast<uint8_t>(i * 2), static_cast<uint8_t>(i * 2 + 1), room,
+                                   static_cast<uint8_t>(i & 1)};
+        roomCount = room + 1 > roomCount ? room + 1 : roomCount;
+    }
+
+    SimClock clock;
+    ScriptedEchoSource echoes(clock, script, NO_ECHO_DISTANCE);
+    echoes.setAirTemperature(airDeciCelsius);
+    FixedTemperature thermometer(airDeciCelsius);
+    ConsoleDisplay display;
+    DisplayRenderer lcd(display);
+    LoggingTransport transport;
+    WebhookDispatcher webhooks(transport);
+
+    SensingEngine sensing(clock, echoes, SensingConfig{
+        doorways, doorwayCount, roomCount,
+        PingScheduleConfig{MAX_SENSOR_DISTANCE, PING_GUARD_US, PING_IDLE_SLOT_US, PING_WAKE_DISTANCE,
+                           PING_ACTIVE_HOLD_MS},
+        NO_ECHO_DISTANCE, DoorwayConfig{SENSOR_THRESHOLD, SEQUENCE_TIMEOUT},
+        SignalFilterConfig{true, FILTER_MEDIAN_TAPS, FILTER_HYSTERESIS_CM, FILTER_DEBOUNCE_SAMPLES},
+        BaselineConfig{true, CALIBRATION_ALPHA_SHIFT, CALIBRATION_SIGMA_MULTIPLE, CALIBRATION_THRESHOLD_PERCENT,
+                       CALIBRATION_SAMPLES, CALIBRATION_MIN_THRESHOLD, CALIBRATION_MAX_THRESHOLD},
+        TrackerConfig{TRACKER_QUIET_MS, TRACKER_QUIET_PERCENT}, LIGHT_POWER_WATTS, UTC_OFFSET_MINUTES});
+    static TraceRecorder trace;
+    if (recordPath) {
+        sensing.setTrace(&trace);
+    }
+
+    // The firmware's defaults with the stand-in webhooks and no pins; a
+    // stored config replaces them, as on the board
+    DirectoryStorage storage(storeDir ? storeDir : ".");
+    bootConfig = DeviceConfig{};
+    strncpy(bootConfig.apiToken, apiToken, sizeof(bootConfig.apiToken) - 1);
+    for (uint8_t room = 0; room < MAX_ROOMS; room++) {
+        strncpy(bootConfig.webhooks[room][0], WEBHOOK_OCCUPIED, CONFIG_URL_MAX - 1);
+        strncpy(bootConfig.webhooks[room][1], WEBHOOK_EMPTY, CONFIG_URL_MAX - 1);
+    }
+    memset(bootConfig.sensorPins, CONFIG_NO_PIN, sizeof(bootConfig.sensorPins));
+    bootConfig.thresholdCm = SENSOR_THRESHOLD;
+    bootConfig.sequenceTimeoutMs = SEQUENCE_TIMEOUT;
+    bootConfig.lightMilliwatts = static_cast<uint32_t>(LIGHT_POWER_WATTS * 1000);
+    bootConfig.filterEnabled = true;
+    bootConfig.filterMedianTaps = FILTER_MEDIAN_TAPS;
+    bootConfig.filterHysteresisCm = FILTER_HYSTERESIS_CM;
+    bootConfig.filterDebounceSamples = FILTER_DEBOUNCE_SAMPLES;
+    if (storeDir && loadDeviceConfig(storage, CONFIG_FILE, bootConfig)) {
+        printf("config: generation %u loaded\n", bootConfig.generation);
+    }
+    liveConfig = bootConfig;
+    uint32_t appliedConfig = liveConfig.generation;
+    sensing.setDoorwayConfig(configDoorway(liveConfig));
+    sensing.setFilter(configFilter(liveConfig));
+    sensing.setLightPowerWatts(configLightWatts(liveConfig));
+    energyLedger.setDefaultRoomMilliwatts(liveConfig.lightMilliwatts);
+
+    // A stored history continues where the previous run stopped
+    TimeSeriesStore history(storage, UTC_OFFSET_MINUTES);
+    HistoryBuckets buckets(UTC_OFFSET_MINUTES);
+    MinuteAccumulator minutes(configLightWatts(liveConfig));
+    if (storeDir) {
+        if (!history.begin()) {
+            fprintf(stderr, "Cannot open history in %s\n", storeDir);
+            return 1;
+        }
+        StoreStats stats = history.stats();
+        clock.setEpoch(stats.lastMinute ? (stats.lastMinute + 1) * 60 : SIM_EPOCH);
+
+        StoreTotals totals = history.totals();
+        EnergyAnalytics energy = {totals.today.energyMwh / 1e6f, totals.week.energyMwh / 1e6f,
+                                  totals.month.energyMwh / 1e6f, totals.year.energyMwh / 1e6f};
+        sensing.restoreTotals(energy, totals.lifetime.occupiedSeconds * 1000UL,
+                              totals.today.occupiedSeconds * 1000UL,
+                              stats.records > 0 ? history.localDay(stats.lastMinute) : SENSING_NO_DAY);
+        buckets.prime(history);
+
+        CalibrationSet calibration;
+        if (loadCalibration(storage, CALIBRATION_FILE, calibration)) {
+            sensing.restoreCalibration(calibration);
+        }
+        LightProfile lights[ENERGY_MAX_LIGHTS];
+        size_t lightCount = loadLightProfiles(storage, LIGHTS_FILE, lights, ENERGY_MAX_LIGHTS);
+        if (lightCount > 0) {
+            energyLedger.setLights(lights, lightCount);
+        }
+        LedgerTotals ledger;
+        if (loadLedger(storage, LEDGER_FILE, ledger)) {
+            energyLedger.restore(ledger);
+        }
+    }
+    servedRooms = roomCount;
+    int16_t deciCelsius;
+    if (thermometer.read(deciCelsius)) {
+        sensing.setTemperature(deciCelsius);
+    }
+    sensing.begin();
+
+    uint32_t endMs = script.back().atMs + RUN_OUT_MS;
+    uint32_t lastLcdMs = 0;
+    uint32_t lastHistoryMs = 0;
+    bool previousState[MAX_ROOMS] = {};
+    char rows[DISPLAY_ROWS][DISPLAY_COLS + 1];
+    StatusSnapshot snapshot = {};
+    PowerMonitor power(powerConfig);
+    power.setLightSleep(powerConfig.lowPower);
+    uint32_t frames = 0;
+    uint32_t sleptUs = 0;
+
+    if (servePort) {
+        server.setAssets(webAssets, webAssetCount);
+        server.on("/api/status", HTTP_METHOD_GET, handleAPIStatus);
+        server.on("/api/rooms", HTTP_METHOD_GET, handleAPIRooms);
+        server.on("/api/events", HTTP_METHOD_GET, handleAPIEvents);
+        server.on("/api/metrics", HTTP_METHOD_GET, handleAPIMetrics);
+        server.on("/api/sessions", HTTP_METHOD_GET, handleAPISessions);
+        server.on("/api/energy", HTTP_METHOD_GET, handleAPIEnergy);
+        server.on("/api/config", HTTP_METHOD_ANY, handleAPIConfig);
+        if (storeDir) {
+            static HistoryExport exporter(history);
+            servedExport = &exporter;
+            server.on("/api/export", HTTP_METHOD_GET, handleAPIExport);
+        }
+        if (!server.begin(static_cast<uint16_t>(servePort))) {
+            fprintf(stderr, "Cannot listen on port %d\n", servePort);
+            return 1;
+        }
+        signal(SIGINT, onInterrupt);
+        signal(SIGTERM, onInterrupt);
+        printf("serving on http://localhost:%d/ until interrupted\n", servePort);
+        fflush(stdout);
+    }
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+
+    while (servePort ? !stopServing : clock.millis() < endMs) {
+        if (liveConfig.generation != appliedConfig) {
+            sensing.setDoorwayConfig(configDoorway(liveConfig));
+            sensing.setFilter(configFilter(liveConfig));
+            sensing.setLightPowerWatts(configLightWatts(liveConfig));
+            minutes.setLightPowerWatts(configLightWatts(liveConfig));
+            energyLedger.setDefaultRoomMilliwatts(liveConfig.lightMilliwatts);
+            if (storeDir) {
+                saveDeviceConfig(storage, CONFIG_FILE, liveConfig);
+            }
+            printf("config: generation %u applied\n", liveConfig.generation);
+            fflush(stdout);
+            appliedConfig = liveConfig.generation;
+        }
+        {
+            METRIC_SCOPE(sensorFrameSeconds);
+            sensing.step();
+        }
+        SessionRecord session;
+        while (sensing.nextSession(session)) {
+            sessionLog.add(session);
+            energyLedger.add(session);
+        }
+
+        for (uint8_t room = 0; room < sensing.roomCount(); room++) {
+            bool occupied = sensing.room(room).occupied;
+            if (occupied != previousState[room]) {
+                webhooks.enqueue(room, bootConfig.webhooks[room][occupied ? 0 : 1], clock.millis());
+                previousState[room] = occupied;
+            }
+        }
+        webhooks.poll(clock.millis());
+
+        sensing.fillSnapshot(snapshot);
+        if (clock.millis() - lastLcdMs >= LCD_REFRESH_MS) {
+            formatStatusRows(snapshot, rows);
+            METRIC_ADD(lcdBytesTotal, lcd.present(rows));
+            lastLcdMs = clock.millis();
+        }
+
+        if (storeDir && clock.millis() - lastHistoryMs >= HISTORY_SAMPLE_MS) {
+            MinuteRecord minute;
+            if (minutes.sample(snapshot, clock.epochSeconds(), minute)) {
+                history.append(minute);
+                buckets.add(minute);
+            }
+            lastHistoryMs = clock.millis();
+        }
+
+        uint32_t frameUs = power.nextFrameUs(sensing.idleUs());
+        power.addWake(SIM_FRAME_WORK_US);
+        power.update(clock.micros());
+        frames++;
+        sleptUs += frameUs > SENSOR_FRAME_US ? frameUs : 0;
+        clock.advanceUs(frameUs);
+
+        // Serve until the wall clock catches up with the simulation
+        while (servePort) {
+            servedStatus = snapshot;
+            servedUptimeMs = clock.millis();
+            server.poll(clock.millis());
+            statusEvents.update(snapshot, clock.millis());
+            int64_t aheadUs = static_cast<int64_t>(clock.nowUs()) -
+                              std::chrono::duration_cast<std::chrono::microseconds>(
+                                  std::chrono::steady_clock::now() - wallStart).count();
+            if (aheadUs <= 0 || stopServing) {
+                break;
+            }
+            server.wait(static_cast<uint32_t>((aheadUs + 999) / 1000));
+        }
+    }
+
+    StatusReport report = {};
+    report.status = snapshot;
+    report.uptimeMs = clock.millis();
+    char json[STATUS_ENCODED_MAX];
+    size_t length = encodeStatusJson(report, STATUS_ALL_FIELDS, json, sizeof(json));
+    printf("%.*s\n", static_cast<int>(length), json);
+    if (sensing.roomCount() > 1) {
+        char roomsJson[ROOMS_ENCODED_MAX];
+        length = encodeRoomsJson(snapshot, -1, roomsJson, sizeof(roomsJson));
+        printf("%.*s\n", static_cast<int>(length), roomsJson);
+    }
+
+    // A full rewrite sends both rows plus a cursor move for each
+    const DisplayStats& lcdStats = lcd.stats();
+    printf("lcd: %u frames, %u bytes sent, %u with full rewrites\n", lcdStats.frames, lcdStats.bytes,
+           lcdStats.frames * DISPLAY_ROWS * (DISPLAY_COLS + 1));
+
+    if (powerConfig.lowPower) {
+        const PowerStats& powerStats = power.stats();
+        printf("power: %u frames (%u at the fixed frame), %u%% of the time in long frames, "
+               "last window cpu %u.%u%%, %u.%u mA estimated\n",
+               frames, clock.millis() / (SENSOR_FRAME_US / 1000),
+               static_cast<unsigned>(static_cast<uint64_t>(sleptUs) * 100 / (clock.millis() * 1000ULL)),
+               powerStats.cpuDutyPermille / 10, powerStats.cpuDutyPermille % 10,
+               powerStats.estimatedDeciMa / 10, powerStats.estimatedDeciMa % 10);
+    }
+
+    if (printMetrics) {
+        setStatusMetrics(snapshot);
+        char text[METRIC_TEXT_MAX];
+        for (const Metric* metric = Metric::first(); metric; metric = metric->next()) {
+            printf("%.*s", static_cast<int>(metric->format(text, sizeof(text))), text);
+        }
+    }
+
+    // Same output as GET /api/sessions?recent=5
+    char sessionsText[SESSION_SUMMARY_MAX];
+    formatSessionSummary(sessionLog, sessionsText, sizeof(sessionsText));
+    printf("sessions: %s", sessionsText);
+    for (size_t i = 0; i < SESSIONS_PRINTED && i < sessionLog.held(); i++) {
+        formatSessionRecord(sessionLog.recent(i), i == 0, sessionsText, sizeof(sessionsText));
+        printf("%s", sessionsText);
+    }
+    formatSessionFooter(sessionsText, sizeof(sessionsText));
+    printf("%s\n", sessionsText);
+
+    // Same output as GET /api/energy
+    if (clock.epochSeconds() > 0) {
+        energyLedger.rollTo(localDayFromMinute(clock.epochSeconds() / 60, UTC_OFFSET_MINUTES));
+    }
+    length = formatEnergyJson(energyLedger, ENERGY_ALL_ROOMS, roomCount, energyBody, sizeof(energyBody));
+    printf("energy: %.*s\n", static_cast<int>(length), energyBody);
+
+    for (uint8_t i = 0; i < sensing.doorwayCount(); i++) {
+        printf("calibration: doorway %u thresholds %d/%d cm\n", i, sensing.threshold(i, 0), sensing.threshold(i, 1));
+    }
+
+    if (storeDir) {
+        CalibrationSet calibration;
+        sensing.exportCalibration(calibration);
+        saveCalibration(storage, CALIBRATION_FILE, calibration);
+        saveLedger(storage, LEDGER_FILE, energyLedger.totals());
+
+        StoreTotals totals = history.totals();
+        StoreStats stats = history.stats();
+        printf("history: %u minutes stored, today %us occupied / %.3f kWh, lifetime %us / %.3f kWh\n",
+               stats.records, totals.today.occupiedSeconds, totals.today.energyMwh / 1e6,
+               totals.lifetime.occupiedSeconds, totals.lifetime.energyMwh / 1e6);
+
+        // Same output as GET /api/history?step=hour
+        HistoryQuery query;
+        HistoryCursor cursor;
+        if (parseHistoryQuery(NULL, NULL, "hour", clock.epochSeconds(), query) && buckets.open(query, cursor)) {
+            char text[HISTORY_HEADER_MAX];
+            HistoryPoint point;
+            formatHistoryHeader(cursor, text, sizeof(text));
+            printf("history: %s", text);
+            for (bool first = true; buckets.read(cursor, &point, 1) > 0; first = false) {
+                formatHistoryPoint(point, first, text, sizeof(text));
+                printf("%s", text);
+            }
+            formatHistoryFooter(cursor, text, sizeof(text));
+            printf("%s\n", text);
+        }
+    }
+
+    if (recordPath && !saveTrace(recordPath, trace)) {
+        fprintf(stderr, "Cannot write trace %s\n", recordPath);
+        return 1;
+    }
+    return 0;
+}
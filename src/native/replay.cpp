@@ -0,0 +1,334 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// A detection this close to a label of the same kind counts as a match
+const uint32_t MATCH_TOLERANCE_MS = 1500;
+
+// --sweep grid
+const int SWEEP_THRESHOLD_MIN = 30;
+const int SWEEP_THRESHOLD_MAX = 200;
+const int SWEEP_THRESHOLD_STEP = 5;
+const uint32_t SWEEP_TIMEOUT_MIN = 500;
+const uint32_t SWEEP_TIMEOUT_MAX = 6000;
+const uint32_t SWEEP_TIMEOUT_STEP = 250;
+const size_t SWEEP_SHOWN = 10;
+
+struct Score {
+    uint32_t matched;
+    uint32_t passed;    // Unmatched entry/exit label pairs close together: people passing each other
+    uint32_t missed;    // Labelled crossings the replay did not find
+    uint32_t spurious;  // Crossings found that no label accounts for
+    double countRight;  // Share of the trace time the occupant count was right
+    double occupiedRight;  // ...and the room was correctly empty or not
+};
+
+struct Trial {
+    DoorwayConfig config;
+    ReplayResult result;
+    Score score;
+};
+
+struct Detections {
+    std::vector<TraceLabel> crossings;
+    std::vector<std::pair<uint32_t, int>> counts;  // Occupants from this time on
+};
+
+void collectCrossing(CrossingEvent event, uint32_t atMs, int occupants, void* context) {
+    Detections* detections = static_cast<Detections*>(context);
+    detections->crossings.push_back(TraceLabel{atMs, event});
+    detections->counts.push_back(std::make_pair(atMs, occupants));
+}
+
+// Greedy in time order: each label takes the earliest unused detection of
+// the same kind within the tolerance.
+Score scoreCrossings(const std::vector<TraceLabel>& detected, const std::vector<TraceLabel>& labels) {
+    Score score = {0, 0, 0, 0, 0.0, 0.0};
+    std::vector<bool> used(detected.size(), false);
+    std::vector<bool> matchedLabel(labels.size(), false);
+    for (size_t index = 0; index < labels.size(); index++) {
+        const TraceLabel& label = labels[index];
+        bool found = false;
+        for (size_t i = 0; i < detected.size(); i++) {
+            uint32_t gap = detected[i].atMs > label.atMs ? detected[i].atMs - label.atMs
+                                                         : label.atMs - detected[i].atMs;
+            if (!used[i] && detected[i].event == label.event && gap <= MATCH_TOLERANCE_MS) {
+                used[i] = true;
+                found = true;
+                break;
+            }
+        }
+        if (found) {
+            score.matched++;
+            matchedLabel[index] = true;
+        } else {
+            score.missed++;
+        }
+    }
+    score.spurious = detected.size() - score.matched;
+
+    // An entry and an exit that cancel out in the doorway are not counted,
+    // and need not be: the occupancy stays right
+    std::vector<bool> paired(labels.size(), false);
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (matchedLabel[i] || paired[i]) {
+            continue;
+        }
+        for (size_t j = i + 1; j < labels.size() && labels[j].atMs - labels[i].atMs <= MATCH_TOLERANCE_MS; j++) {
+            if (!matchedLabel[j] && !paired[j] && labels[j].event != labels[i].event) {
+                paired[i] = true;
+                paired[j] = true;
+                score.passed += 2;
+                score.missed -= 2;
+                break;
+            }
+        }
+    }
+    return score;
+}
+
+// Compare the replayed occupant count with the one the labels imply over
+// [startMs, endMs]
+void scoreOccupancy(const Detections& detections, const std::vector<TraceLabel>& labels, uint32_t startMs,
+                    uint32_t endMs, Score& score) {
+    uint32_t countRightMs = 0;
+    uint32_t occupiedRightMs = 0;
+    int truth = 0;
+    int estimate = 0;
+    size_t label = 0;
+    size_t detection = 0;
+    uint32_t at = startMs;
+    while (at < endMs) {
+        while (label < labels.size() && labels[label].atMs <= at) {
+            truth += labels[label].event == CROSSING_ENTRY ? 1 : (truth > 0 ? -1 : 0);
+            label++;
+        }
+        while (detection < detections.counts.size() && detections.counts[detection].first <= at) {
+            estimate = detections.counts[detection].second;
+            detection++;
+        }
+        uint32_t next = endMs;
+        if (label < labels.size() && labels[label].atMs < next) {
+            next = labels[label].atMs;
+        }
+        if (detection < detections.counts.size() && detections.counts[detection].first < next) {
+            next = detections.counts[detection].first;
+        }
+        if (estimate == truth) {
+            countRightMs += next - at;
+        }
+        if ((estimate > 0) == (truth > 0)) {
+            occupiedRightMs += next - at;
+        }
+        at = next;
+    }
+    uint32_t spanMs = endMs > startMs ? endMs - startMs : 1;
+    score.countRight = static_cast<double>(countRightMs) / spanMs;
+    score.occupiedRight = static_cast<double>(occupiedRightMs) / spanMs;
+}
+
+// First and last record times
+void traceSpan(const std::vector<uint8_t>& trace, uint32_t& startMs, uint32_t& endMs) {
+    TraceReader reader(trace.data(), trace.size());
+    TraceRecord record;
+    bool first = true;
+    startMs = 0;
+    endMs = 0;
+    while (reader.next(record)) {
+        if (first) {
+            startMs = record.atMs;
+            first = false;
+        }
+        endMs = record.atMs;
+    }
+}
+
+Trial runTrial(const std::vector<uint8_t>& trace, const DoorwayConfig& config,
+               const SignalFilterConfig& filter, const std::vector<TraceLabel>& labels) {
+    Detections detected;
+    Trial trial;
+    trial.config = config;
+    trial.result = replayTrace(trace.data(), trace.size(), config, filter, collectCrossing, &detected);
+    trial.score = scoreCrossings(detected.crossings, labels);
+    uint32_t startMs, endMs;
+    traceSpan(trace, startMs, endMs);
+    scoreOccupancy(detected, labels, startMs, endMs, trial.score);
+    return trial;
+}
+
+void printTrial(const Trial& trial, bool labelled) {
+    printf("threshold=%dcm timeout=%ums: entries=%u exits=%u final=%d (%u%%)", trial.config.thresholdCm,
+           static_cast<unsigned>(trial.config.sequenceTimeoutMs), trial.result.entries,
+           trial.result.exits, trial.result.finalCount, trial.result.finalConfidence);
+    if (labelled) {
+        printf(" matched=%u passed=%u missed=%u spurious=%u count right %.1f%% occupied right %.1f%%",
+               trial.score.matched, trial.score.passed, trial.score.missed, trial.score.spurious,
+               trial.score.countRight * 100, trial.score.occupiedRight * 100);
+    }
+    printf("\n");
+}
+
+}  // namespace
+
+bool loadTrace(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(file);
+    return true;
+}
+
+bool loadLabels(const char* path, std::vector<TraceLabel>& labels) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        unsigned atMs;
+        char kind[16];
+        if (line[0] == '#' || sscanf(line, "%u %15s", &atMs, kind) != 2) {
+            continue;
+        }
+        if (strcmp(kind, "entry") == 0) {
+            labels.push_back(TraceLabel{atMs, CROSSING_ENTRY});
+        } else if (strcmp(kind, "exit") == 0) {
+            labels.push_back(TraceLabel{atMs, CROSSING_EXIT});
+        }
+    }
+    fclose(file);
+    std::sort(labels.begin(), labels.end(),
+              [](const TraceLabel& a, const TraceLabel& b) { return a.atMs < b.atMs; });
+    return true;
+}
+
+bool saveTrace(const char* path, TraceRecorder& recorder) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, file);
+    uint8_t block[TRACE_BLOCK_MAX];
+    uint32_t end = recorder.nextSequence();
+    for (uint32_t sequence = recorder.oldestSequence(); sequence < end; sequence++) {
+        size_t length = recorder.copyBlock(sequence, block);
+        fwrite(block, 1, length, file);
+    }
+    return fclose(file) == 0;
+}
+
+int runReplay(int argc, char** argv) {
+    const char* tracePath = NULL;
+    const char* labelsPath = NULL;
+    DoorwayConfig config = {75, 3000};  // Firmware defaults
+    SignalFilterConfig filter = {true, 3, 10, 1};
+    bool sweep = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            config.thresholdCm = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            config.sequenceTimeoutMs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--median") == 0 && i + 1 < argc) {
+            filter.medianTaps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hysteresis") == 0 && i + 1 < argc) {
+            filter.hysteresisCm = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc) {
+            filter.debounceSamples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-filter") == 0) {
+            filter.enabled = false;
+        } else if (strcmp(argv[i], "--sweep") == 0) {
+            sweep = true;
+        } else if (argv[i][0] != '-' && !labelsPath) {
+            labelsPath = argv[i];
+        }
+    }
+
+    std::vector<uint8_t> trace;
+    if (!tracePath || !loadTrace(tracePath, trace)) {
+        fprintf(stderr, "Cannot read trace %s\n", tracePath ? tracePath : "(none)");
+        return 1;
+    }
+    std::vector<TraceLabel> labels;
+    if (labelsPath && !loadLabels(labelsPath, labels)) {
+        fprintf(stderr, "Cannot read labels %s\n", labelsPath);
+        return 1;
+    }
+    if (sweep && labels.empty()) {
+        fprintf(stderr, "--sweep needs a labels file\n");
+        return 1;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    Trial current = runTrial(trace, config, filter, labels);
+    std::vector<Trial> trials;
+    if (sweep) {
+        for (int threshold = SWEEP_THRESHOLD_MIN; threshold <= SWEEP_THRESHOLD_MAX;
+             threshold += SWEEP_THRESHOLD_STEP) {
+            for (uint32_t timeout = SWEEP_TIMEOUT_MIN; timeout <= SWEEP_TIMEOUT_MAX;
+                 timeout += SWEEP_TIMEOUT_STEP) {
+                trials.push_back(runTrial(trace, DoorwayConfig{threshold, timeout}, filter, labels));
+            }
+        }
+    }
+    double elapsedMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - started).count();
+
+    if (!current.result.valid) {
+        fprintf(stderr, "Trace is malformed; replayed the readable part only\n");
+    }
+    uint32_t startMs, endMs;
+    traceSpan(trace, startMs, endMs);
+    uint32_t durationMs = endMs - startMs;
+    size_t runs = 1 + trials.size();
+    printf("trace: %u readings over %.1fs, %u lost block gaps, device counted %u entries / %u exits\n",
+           current.result.readings, durationMs / 1000.0, current.result.gaps,
+           current.result.deviceEntries, current.result.deviceExits);
+    printf("replayed %zu run%s in %.1fms (%.0fx real time)\n", runs, runs == 1 ? "" : "s", elapsedMs,
+           elapsedMs > 0 ? durationMs * runs / elapsedMs : 0.0);
+    printTrial(current, !labels.empty());
+    printf("passages: %u turned back, %u tandem, %u slow, %u guessed\n", current.result.turnedBack,
+           current.result.tandem, current.result.slow, current.result.guessed);
+
+    if (sweep) {
+        // Fewest miscounts first; among equals, closest to the current settings
+        std::sort(trials.begin(), trials.end(), [&](const Trial& a, const Trial& b) {
+            uint32_t errorsA = a.score.missed + a.score.spurious;
+            uint32_t errorsB = b.score.missed + b.score.spurious;
+            if (errorsA != errorsB) {
+                return errorsA < errorsB;
+            }
+            int thresholdA = abs(a.config.thresholdCm - config.thresholdCm);
+            int thresholdB = abs(b.config.thresholdCm - config.thresholdCm);
+            if (thresholdA != thresholdB) {
+                return thresholdA < thresholdB;
+            }
+            return labs(static_cast<long>(a.config.sequenceTimeoutMs) - static_cast<long>(config.sequenceTimeoutMs)) <
+                   labs(static_cast<long>(b.config.sequenceTimeoutMs) - static_cast<long>(config.sequenceTimeoutMs));
+        });
+        printf("best settings:\n");
+        for (size_t i = 0; i < trials.size() && i < SWEEP_SHOWN; i++) {
+            printf("  ");
+            printTrial(trials[i], true);
+        }
+    }
+
+    if (labels.empty()) {
+        return 0;
+    }
+    return current.score.missed + current.score.spurious == 0 ? 0 : 2;
+}
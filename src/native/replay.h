@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "occupancy.h"
+#include "sensor_trace.h"
+
+// Offline replay of recorded sensor traces (see sensor_trace.h):
+//
+//   program --replay trace.bin [labels.txt] [--threshold CM] [--timeout MS]
+//           [--median K] [--hysteresis CM] [--debounce N] [--no-filter]
+//   program --replay trace.bin labels.txt --sweep
+//
+// Labels are the ground truth, one "<ms> entry|exit" line per crossing; '#'
+// starts a comment. With labels the replay reports matched, missed and
+// spurious crossings (an entry and an exit that passed each other in the
+// doorway count as "passed", since the room's count is unaffected) and the
+// share of the trace's time the replayed occupant count and the occupied
+// state were right. The filter options default to the firmware's. --sweep
+// tries a grid of thresholds and timeouts with the given filter and lists the
+// settings with the fewest miscounts.
+
+struct TraceLabel {
+    uint32_t atMs;
+    CrossingEvent event;
+};
+
+bool loadTrace(const char* path, std::vector<uint8_t>& data);
+bool loadLabels(const char* path, std::vector<TraceLabel>& labels);
+
+// Write everything the recorder still holds as a trace file
+bool saveTrace(const char* path, TraceRecorder& recorder);
+
+int runReplay(int argc, char** argv);
@@ -0,0 +1,299 @@
+#include "sim_hal.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+#include "echo_capture.h"
+#include "perf_metrics.h"
+
+void logMessage(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// Nanoseconds of the host's monotonic clock stand in for cycles
+uint32_t perfCycles() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint32_t perfCyclesPerUs() {
+    return 1000;
+}
+
+bool loadScript(const char* path, std::vector<ScriptStep>& steps, std::vector<uint8_t>* rooms) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        char* cursor = line;
+        char* end;
+        if (strncmp(line, "rooms", 5) == 0) {
+            cursor += 5;
+            for (long room = strtol(cursor, &end, 10); end != cursor; room = strtol(cursor, &end, 10)) {
+                if (rooms) {
+                    rooms->push_back(static_cast<uint8_t>(room));
+                }
+                cursor = end;
+            }
+            continue;
+        }
+
+        ScriptStep step = {};
+        step.atMs = strtoul(cursor, &end, 10);
+        if (end == cursor) {
+            continue;
+        }
+        cursor = end;
+        while (step.channels < SIM_MAX_CHANNELS) {
+            long distance = strtol(cursor, &end, 10);
+            if (end == cursor) {
+                break;
+            }
+            step.distance[step.channels++] = static_cast<int>(distance);
+            cursor = end;
+        }
+        if (step.channels >= 2) {
+            steps.push_back(step);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+std::vector<ScriptStep> defaultScript() {
+    return {
+        {0, 2, {400, 400}},
+        {1000, 2, {50, 400}},    // Walk in: entrance sensor first
+        {1300, 2, {50, 50}},
+        {1600, 2, {400, 50}},
+        {1900, 2, {400, 400}},
+        {10000, 2, {400, 50}},   // Walk out: inside sensor first
+        {10300, 2, {50, 50}},
+        {10600, 2, {50, 400}},
+        {10900, 2, {400, 400}},
+        {12000, 2, {400, 400}},
+    };
+}
+
+ScriptedEchoSource::ScriptedEchoSource(SimClock& clock, const std::vector<ScriptStep>& steps, int noEchoCm)
+    : clock_(clock), steps_(steps), noEchoCm_(noEchoCm), maxWidthUs_(ECHO_TIMEOUT_US),
+      rangeFactorQ18_(rangeFactorQ18(RANGE_DEFAULT_DECI_CELSIUS)) {
+    memset(pings_, 0, sizeof(pings_));
+}
+
+bool ScriptedEchoSource::trigger(uint8_t channel) {
+    if (channel >= SIM_MAX_CHANNELS || pings_[channel].pending) {
+        return false;
+    }
+    Ping& ping = pings_[channel];
+    int distance = distanceAt(channel, clock_.millis());
+    uint32_t widthUs = echoWidthForCm(distance, rangeFactorQ18_);
+    ping.pending = true;
+    if (distance >= noEchoCm_ || widthUs > maxWidthUs_) {
+        ping.timedOut = true;
+        ping.widthUs = 0;
+        ping.doneAtUs = clock_.nowUs() + ECHO_START_US + maxWidthUs_;
+    } else {
+        ping.timedOut = false;
+        ping.widthUs = widthUs;
+        ping.doneAtUs = clock_.nowUs() + widthUs;
+    }
+    return true;
+}
+
+bool ScriptedEchoSource::busy(uint8_t channel) {
+    return channel < SIM_MAX_CHANNELS && pings_[channel].pending;
+}
+
+bool ScriptedEchoSource::next(EchoSample& out) {
+    for (uint8_t channel = 0; channel < SIM_MAX_CHANNELS; channel++) {
+        Ping& ping = pings_[channel];
+        if (!ping.pending || ping.doneAtUs > clock_.nowUs()) {
+            continue;
+        }
+        ping.pending = false;
+        out.channel = channel;
+        out.timedOut = ping.timedOut;
+        out.widthUs = ping.widthUs;
+        out.timestampUs = static_cast<uint32_t>(ping.doneAtUs);
+        return true;
+    }
+    return false;
+}
+
+int ScriptedEchoSource::distanceAt(uint8_t channel, uint32_t ms) const {
+    // Last step at or before ms; steps are in time order
+    auto after = std::upper_bound(steps_.begin(), steps_.end(), ms,
+        [](uint32_t t, const ScriptStep& step) { return t < step.atMs; });
+    if (after == steps_.begin()) {
+        return noEchoCm_;
+    }
+    const ScriptStep& step = *(after - 1);
+    return channel < step.channels ? step.distance[channel] : noEchoCm_;
+}
+
+size_t DirectoryStorage::size(const char* path) {
+    FILE* file = fopen(resolve(path).c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size < 0 ? 0 : size;
+}
+
+bool DirectoryStorage::read(const char* path, uint32_t offset, void* out, size_t length) {
+    FILE* file = fopen(resolve(path).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fseek(file, offset, SEEK_SET) == 0 && fread(out, 1, length, file) == length;
+    fclose(file);
+    return ok;
+}
+
+bool DirectoryStorage::append(const char* path, const void* data, size_t length) {
+    FILE* file = fopen(resolve(path).c_str(), "ab");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(data, 1, length, file) == length;
+    return fclose(file) == 0 && ok;
+}
+
+bool DirectoryStorage::write(const char* path, uint32_t offset, const void* data, size_t length) {
+    FILE* file = fopen(resolve(path).c_str(), "r+b");
+    if (!file) {
+        return false;
+    }
+    bool ok = fseek(file, offset, SEEK_SET) == 0 && fwrite(data, 1, length, file) == length;
+    return fclose(file) == 0 && ok;
+}
+
+bool DirectoryStorage::remove(const char* path) {
+    ::remove(resolve(path).c_str());
+    return true;
+}
+
+ConsoleDisplay::ConsoleDisplay() {
+    memset(rows_, ' ', sizeof(rows_));
+    for (uint8_t row = 0; row < DISPLAY_ROWS; row++) {
+        rows_[row][DISPLAY_COLS] = '\0';
+    }
+}
+
+void ConsoleDisplay::write(uint8_t row, uint8_t col, const char* text, uint8_t length) {
+    if (row >= DISPLAY_ROWS || col >= DISPLAY_COLS) {
+        return;
+    }
+    if (length > DISPLAY_COLS - col) {
+        length = DISPLAY_COLS - col;
+    }
+    memcpy(rows_[row] + col, text, length);
+    printf("[lcd %u] |%s|\n", row, rows_[row]);
+}
+
+int LoggingTransport::get(const char* url) {
+    printf("[webhook] GET %s -> %d\n", url, status_);
+    return status_;
+}
+
+// Load tests open many connections at once
+const int HTTP_LISTEN_BACKLOG = 64;
+
+bool PosixTcpListener::begin(uint16_t port) {
+    socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (socket_ < 0) {
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(socket_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(socket_, HTTP_LISTEN_BACKLOG) < 0) {
+        ::close(socket_);
+        socket_ = -1;
+        return false;
+    }
+    fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+int PosixTcpListener::accept() {
+    int connection = ::accept(socket_, NULL, NULL);
+    if (connection < 0) {
+        return -1;
+    }
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL, 0) | O_NONBLOCK);
+    int noDelay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return connection;
+}
+
+int PosixTcpListener::read(int connection, uint8_t* out, size_t size) {
+    ssize_t length = recv(connection, out, size, 0);
+    if (length > 0) {
+        return static_cast<int>(length);
+    }
+    return (length < 0 && (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)) ? 0 : -1;
+}
+
+// MSG_NOSIGNAL: a client that went away is an error return, not SIGPIPE
+int PosixTcpListener::write(int connection, const uint8_t* data, size_t length) {
+    ssize_t written = send(connection, data, length, MSG_NOSIGNAL);
+    if (written >= 0) {
+        return static_cast<int>(written);
+    }
+    return (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) ? 0 : -1;
+}
+
+void PosixTcpListener::close(int connection) {
+    ::close(connection);
+}
+
+void PosixTcpListener::wait(const int* readable, size_t readableCount, const int* writable, size_t writableCount,
+                            bool accepting, uint32_t timeoutMs) {
+    fd_set readSet;
+    fd_set writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    int maxSocket = -1;
+    if (accepting && socket_ >= 0) {
+        FD_SET(socket_, &readSet);
+        maxSocket = socket_;
+    }
+    for (size_t i = 0; i < readableCount; i++) {
+        FD_SET(readable[i], &readSet);
+        maxSocket = std::max(maxSocket, readable[i]);
+    }
+    for (size_t i = 0; i < writableCount; i++) {
+        FD_SET(writable[i], &writeSet);
+        maxSocket = std::max(maxSocket, writable[i]);
+    }
+    struct timeval timeout = {static_cast<time_t>(timeoutMs / 1000), static_cast<suseconds_t>(timeoutMs % 1000 * 1000)};
+    select(maxSocket + 1, &readSet, &writeSet, NULL, &timeout);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "hal.h"
+#include "range_conversion.h"
+#include "status_display.h"
+#include "webhook_dispatcher.h"
+
+// Host implementations of the HAL: time only moves when the simulation
+// advances it, and sensor distances come from a script.
+
+class SimClock : public Clock {
+public:
+    SimClock() : nowUs_(0), epochStart_(0) {}
+    uint32_t millis() override { return static_cast<uint32_t>(nowUs_ / 1000); }
+    uint32_t micros() override { return static_cast<uint32_t>(nowUs_); }
+    uint32_t epochSeconds() override {
+        return epochStart_ ? epochStart_ + static_cast<uint32_t>(nowUs_ / 1000000) : 0;
+    }
+    void advanceUs(uint64_t us) { nowUs_ += us; }
+    uint64_t nowUs() const { return nowUs_; }
+    // Wall-clock time at simulation start; 0 leaves it unset (no NTP)
+    void setEpoch(uint32_t epochSeconds) { epochStart_ = epochSeconds; }
+
+private:
+    uint64_t nowUs_;
+    uint32_t epochStart_;
+};
+
+// Storage in a host directory, one file per path
+class DirectoryStorage : public Storage {
+public:
+    explicit DirectoryStorage(const char* directory) : directory_(directory) {}
+
+    size_t size(const char* path) override;
+    bool read(const char* path, uint32_t offset, void* out, size_t length) override;
+    bool append(const char* path, const void* data, size_t length) override;
+    bool write(const char* path, uint32_t offset, const void* data, size_t length) override;
+    bool remove(const char* path) override;
+
+private:
+    std::string resolve(const char* path) const { return directory_ + path; }
+
+    std::string directory_;
+};
+
+#define SIM_MAX_CHANNELS 8
+
+// One scripted step: from atMs on, the sensors see these distances.
+// Channels 2n and 2n+1 are doorway n's entrance and inside sensors.
+struct ScriptStep {
+    uint32_t atMs;
+    uint8_t channels;            // Channels the step sets; the rest never echo
+    int distance[SIM_MAX_CHANNELS];
+};
+
+// Load "<ms> <distance1_cm> <distance2_cm> [<doorway 1 distances> ...]"
+// lines; '#' starts a comment. An optional "rooms <r0> <r1> ..." line gives
+// the room each doorway opens into (default: all room 0).
+bool loadScript(const char* path, std::vector<ScriptStep>& steps, std::vector<uint8_t>* rooms = NULL);
+
+// A short walk-in / walk-out sequence used when no script is given
+std::vector<ScriptStep> defaultScript();
+
+// Answers pings on the scripted channels with echoes whose width matches the scripted
+// distance at trigger time. Distances at or beyond noEchoCm, or further than
+// the maximum echo width allows, never echo and expire like a real lost ping.
+class ScriptedEchoSource : public EchoSource {
+public:
+    ScriptedEchoSource(SimClock& clock, const std::vector<ScriptStep>& steps, int noEchoCm);
+
+    bool trigger(uint8_t channel) override;
+    bool busy(uint8_t channel) override;
+    bool next(EchoSample& out) override;
+    void setMaxEchoWidth(uint32_t widthUs) override { maxWidthUs_ = widthUs; }
+    // Echo widths follow the speed of sound at this temperature
+    void setAirTemperature(int16_t deciCelsius) { rangeFactorQ18_ = rangeFactorQ18(deciCelsius); }
+
+private:
+    struct Ping {
+        bool pending;
+        bool timedOut;
+        uint32_t widthUs;
+        uint64_t doneAtUs;
+    };
+
+    int distanceAt(uint8_t channel, uint32_t ms) const;
+
+    SimClock& clock_;
+    std::vector<ScriptStep> steps_;
+    int noEchoCm_;
+    uint32_t maxWidthUs_;
+    uint32_t rangeFactorQ18_;
+    Ping pings_[SIM_MAX_CHANNELS];
+};
+
+// Prints the whole row after each write
+class ConsoleDisplay : public Display {
+public:
+    ConsoleDisplay();
+    void write(uint8_t row, uint8_t col, const char* text, uint8_t length) override;
+
+private:
+    char rows_[DISPLAY_ROWS][DISPLAY_COLS + 1];
+};
+
+// Non-blocking POSIX sockets for HttpServer; wait() is a select() on them
+class PosixTcpListener : public TcpListener {
+public:
+    PosixTcpListener() : socket_(-1) {}
+    bool begin(uint16_t port) override;
+    int accept() override;
+    int read(int connection, uint8_t* out, size_t size) override;
+    int write(int connection, const uint8_t* data, size_t length) override;
+    void close(int connection) override;
+    void wait(const int* readable, size_t readableCount, const int* writable, size_t writableCount,
+              bool accepting, uint32_t timeoutMs) override;
+
+private:
+    int socket_;
+};
+
+// Logs requests instead of sending them and answers with a fixed status
+class LoggingTransport : public WebhookTransport {
+public:
+    explicit LoggingTransport(int status = 200) : status_(status) {}
+    int get(const char* url) override;
+
+private:
+    int status_;
+};
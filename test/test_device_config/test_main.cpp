@@ -0,0 +1,189 @@
+// Host checks of the /api/config blob decoder and patch rules:
+//   pio test -e test -f test_device_config
+
+#include <string.h>
+#include <unity.h>
+
+#include "byte_order.h"
+#include "device_config.h"
+
+namespace {
+
+DeviceConfig config;
+uint8_t blob[CONFIG_BLOB_MAX];
+
+DeviceConfig baseline() {
+    DeviceConfig base;
+    memset(&base, 0, sizeof(base));
+    base.generation = 7;
+    strcpy(base.wifiSsid, "home");
+    memset(base.sensorPins, CONFIG_NO_PIN, sizeof(base.sensorPins));
+    base.thresholdCm = 150;
+    base.sequenceTimeoutMs = 3000;
+    base.lightMilliwatts = 60000;
+    base.filterMedianTaps = 3;
+    base.filterDebounceSamples = 2;
+    return base;
+}
+
+// Header for generation; records go from CONFIG_HEADER_SIZE
+size_t header(uint32_t generation) {
+    memcpy(blob, CONFIG_MAGIC, 4);
+    blob[4] = CONFIG_SCHEMA_MAJOR;
+    blob[5] = CONFIG_SCHEMA_MINOR;
+    putU32(blob + 6, generation);
+    return CONFIG_HEADER_SIZE;
+}
+
+size_t record(size_t length, uint8_t tag, const void* value, uint8_t valueLength) {
+    blob[length] = tag;
+    blob[length + 1] = valueLength;
+    memcpy(blob + length + 2, value, valueLength);
+    return length + 2 + valueLength;
+}
+
+size_t thresholdRecord(size_t length, int16_t cm) {
+    uint8_t value[2];
+    putU16(value, static_cast<uint16_t>(cm));
+    return record(length, 4, value, sizeof(value));
+}
+
+size_t seal(size_t length) {
+    putU16(blob + length, crc16(blob, length));
+    return length + 2;
+}
+
+}  // namespace
+
+void setUp() {
+    config = baseline();
+}
+
+void tearDown() {}
+
+void test_patch_applies_and_bumps_generation() {
+    size_t length = seal(thresholdRecord(header(0), 80));
+    TEST_ASSERT_EQUAL(CONFIG_OK, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(80, config.thresholdCm);
+    TEST_ASSERT_EQUAL_UINT32(8, config.generation);
+    TEST_ASSERT_EQUAL_STRING("home", config.wifiSsid);
+}
+
+void test_full_config_round_trips() {
+    config.filterEnabled = true;
+    strcpy(config.webhooks[2][1], "http://hub.local/empty");
+    config.sensorPins[0][0] = 5;
+    config.sensorPins[0][1] = 34;
+    size_t length = encodeDeviceConfig(config, blob, sizeof(blob));
+    TEST_ASSERT_TRUE(length > 0);
+
+    DeviceConfig decoded;
+    memset(&decoded, 0, sizeof(decoded));
+    uint32_t generation = 0;
+    TEST_ASSERT_EQUAL(CONFIG_OK, decodeDeviceConfig(blob, length, decoded, generation));
+    TEST_ASSERT_EQUAL_UINT32(7, generation);
+    TEST_ASSERT_TRUE(decoded.filterEnabled);
+    TEST_ASSERT_EQUAL_STRING("http://hub.local/empty", decoded.webhooks[2][1]);
+    TEST_ASSERT_EQUAL_MEMORY(config.sensorPins, decoded.sensorPins, sizeof(config.sensorPins));
+    TEST_ASSERT_EQUAL_INT(150, decoded.thresholdCm);
+    TEST_ASSERT_EQUAL_UINT32(60000, decoded.lightMilliwatts);
+}
+
+void test_truncated_blob_is_refused() {
+    size_t length = seal(thresholdRecord(header(0), 80));
+    for (size_t cut = 0; cut < length; cut++) {
+        TEST_ASSERT_EQUAL(CONFIG_BAD_FORMAT, applyConfigPatch(config, blob, cut));
+    }
+    // A record cut short, even with a CRC that matches what is left
+    length = seal(thresholdRecord(header(0), 80) - 1);
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FORMAT, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(150, config.thresholdCm);
+    TEST_ASSERT_EQUAL_UINT32(7, config.generation);
+}
+
+void test_bad_crc_is_refused() {
+    size_t length = seal(thresholdRecord(header(0), 80));
+    blob[CONFIG_HEADER_SIZE + 2] ^= 1;
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FORMAT, applyConfigPatch(config, blob, length));
+    blob[CONFIG_HEADER_SIZE + 2] ^= 1;
+    blob[length - 1] ^= 0x80;
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FORMAT, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(150, config.thresholdCm);
+    TEST_ASSERT_EQUAL_UINT32(7, config.generation);
+}
+
+void test_bad_magic_and_major_version_are_refused() {
+    size_t length = seal(thresholdRecord(header(0), 80));
+    blob[0] = 'X';
+    seal(length - 2);
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FORMAT, applyConfigPatch(config, blob, length));
+
+    length = thresholdRecord(header(0), 80);
+    blob[4] = CONFIG_SCHEMA_MAJOR + 1;
+    length = seal(length);
+    TEST_ASSERT_EQUAL(CONFIG_BAD_VERSION, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(150, config.thresholdCm);
+}
+
+void test_unknown_tag_is_skipped() {
+    const uint8_t future[] = {1, 2, 3, 4, 5};
+    size_t length = record(header(0), 250, future, sizeof(future));
+    length = record(length, 11, future, 0);
+    length = seal(thresholdRecord(length, 80));
+    TEST_ASSERT_EQUAL(CONFIG_OK, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(80, config.thresholdCm);
+}
+
+void test_out_of_range_record_rejects_whole_patch() {
+    uint8_t pin = 6;    // Flash
+    size_t length = thresholdRecord(header(0), 80);
+    length = seal(record(length, 32, &pin, 1));
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FIELD, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(150, config.thresholdCm);
+    TEST_ASSERT_EQUAL(CONFIG_NO_PIN, config.sensorPins[0][0]);
+
+    pin = 34;           // Input only, so no trigger
+    length = seal(record(header(0), 32, &pin, 1));
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FIELD, applyConfigPatch(config, blob, length));
+    length = seal(record(header(0), 33, &pin, 1));
+    TEST_ASSERT_EQUAL(CONFIG_OK, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL(34, config.sensorPins[0][1]);
+
+    length = seal(thresholdRecord(header(0), 401));
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FIELD, applyConfigPatch(config, blob, length));
+    // A number of the wrong width
+    length = seal(record(header(0), 4, "\x50", 1));
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FIELD, applyConfigPatch(config, blob, length));
+    // Text as long as the field, leaving no room for the NUL
+    char ssid[sizeof(config.wifiSsid)];
+    memset(ssid, 'a', sizeof(ssid));
+    length = seal(record(header(0), 1, ssid, sizeof(ssid)));
+    TEST_ASSERT_EQUAL(CONFIG_BAD_FIELD, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_STRING("home", config.wifiSsid);
+}
+
+void test_stale_generation_is_refused() {
+    size_t length = seal(thresholdRecord(header(6), 80));
+    TEST_ASSERT_EQUAL(CONFIG_STALE, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_INT(150, config.thresholdCm);
+    TEST_ASSERT_EQUAL_UINT32(7, config.generation);
+
+    length = seal(thresholdRecord(header(7), 80));
+    TEST_ASSERT_EQUAL(CONFIG_OK, applyConfigPatch(config, blob, length));
+    TEST_ASSERT_EQUAL_UINT32(8, config.generation);
+    // The same patch again was made against the generation it replaced
+    TEST_ASSERT_EQUAL(CONFIG_STALE, applyConfigPatch(config, blob, length));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_patch_applies_and_bumps_generation);
+    RUN_TEST(test_full_config_round_trips);
+    RUN_TEST(test_truncated_blob_is_refused);
+    RUN_TEST(test_bad_crc_is_refused);
+    RUN_TEST(test_bad_magic_and_major_version_are_refused);
+    RUN_TEST(test_unknown_tag_is_skipped);
+    RUN_TEST(test_out_of_range_record_rejects_whole_patch);
+    RUN_TEST(test_stale_generation_is_refused);
+    return UNITY_END();
+}
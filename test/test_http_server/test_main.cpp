@@ -0,0 +1,225 @@
+// Host checks of the HTTP request parser, driven through HttpServer over an
+// in-memory TcpListener:
+//   pio test -e test -f test_http_server
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unity.h>
+
+#include "http_server.h"
+
+namespace {
+
+// One client at a time; what it sent and what the server wrote back
+class FakeListener : public TcpListener {
+public:
+    bool begin(uint16_t) override { return true; }
+    int accept() override {
+        if (!connecting) {
+            return -1;
+        }
+        connecting = false;
+        return 1;
+    }
+    int read(int, uint8_t* out, size_t size) override {
+        size_t length = input.size() - inputRead;
+        if (length == 0) {
+            return 0;
+        }
+        length = length < size ? length : size;
+        memcpy(out, input.data() + inputRead, length);
+        inputRead += length;
+        return static_cast<int>(length);
+    }
+    int write(int, const uint8_t* data, size_t length) override {
+        output.append(reinterpret_cast<const char*>(data), length);
+        return static_cast<int>(length);
+    }
+    void close(int) override { closed = true; }
+    void wait(const int*, size_t, const int*, size_t, bool, uint32_t) override {}
+
+    bool connecting = false;
+    bool closed = false;
+    std::string input;
+    size_t inputRead = 0;
+    std::string output;
+};
+
+const uint8_t PAGE_BYTES[] = {0x1f, 0x8b, 8, 0, 0, 0};
+const WebAsset PAGE = {"/", "text/html", "no-cache", "\"0123abcd\"", PAGE_BYTES, sizeof(PAGE_BYTES)};
+
+FakeListener* listener;
+HttpServer* server;
+uint32_t nowMs;
+
+// Echoes what the parser made of the request
+void handleEcho(const HttpRequest& request, HttpResponse& response) {
+    char body[128];
+    const char* a = request.arg("a");
+    const char* b = request.arg("b");
+    snprintf(body, sizeof(body), "[%s a=%s b=%s body=%.*s]", request.method() == HTTP_METHOD_POST ? "POST" : "GET",
+             a ? a : "-", b ? b : "-", static_cast<int>(request.bodyLength()),
+             request.body() ? reinterpret_cast<const char*>(request.body()) : "");
+    response.send(200, "text/plain", body);
+}
+
+// Bytes from the client, answered as far as the server can; returns what
+// it sent back
+std::string exchange(const std::string& bytes) {
+    listener->input += bytes;
+    listener->output.clear();
+    for (int i = 0; i < 8; i++) {
+        server->poll(nowMs++);
+    }
+    return listener->output;
+}
+
+int count(const std::string& text, const char* part) {
+    int found = 0;
+    for (size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1)) {
+        found++;
+    }
+    return found;
+}
+
+}  // namespace
+
+void setUp() {
+    listener = new FakeListener();
+    server = new HttpServer(*listener);
+    server->begin(80);
+    server->setAssets(&PAGE, 1);
+    server->on("/echo", HTTP_METHOD_ANY, handleEcho);
+    listener->connecting = true;
+    nowMs = 1000;
+}
+
+void tearDown() {
+    delete server;
+    delete listener;
+}
+
+void test_pipelined_requests_answered_in_order() {
+    std::string out = exchange("GET /echo?a=1 HTTP/1.1\r\nHost: board\r\n\r\n"
+                               "GET /echo?a=2&b=x HTTP/1.1\r\nHost: board\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(2, count(out, "HTTP/1.1 200"));
+    size_t first = out.find("[GET a=1 b=- body=]");
+    size_t second = out.find("[GET a=2 b=x body=]");
+    TEST_ASSERT_TRUE(first != std::string::npos && second != std::string::npos && first < second);
+    TEST_ASSERT_FALSE(listener->closed);
+    TEST_ASSERT_EQUAL_UINT32(1, server->stats().reused);
+}
+
+void test_request_split_across_reads() {
+    TEST_ASSERT_EQUAL_INT(0, static_cast<int>(exchange("POST /echo HTTP/1.1\r\nContent-Le").size()));
+    TEST_ASSERT_EQUAL_INT(0, static_cast<int>(exchange("ngth: 5\r\n\r\nhel").size()));
+    TEST_ASSERT_EQUAL_INT(1, count(exchange("lo"), "[POST a=- b=- body=hello]"));
+}
+
+// The form is moved one byte back over the head's last '\n'; the request
+// behind it must come through intact
+void test_form_body_relocated_before_pipelined_request() {
+    std::string out = exchange("POST /echo?b=q HTTP/1.1\r\n"
+                               "Content-Type: application/x-www-form-urlencoded\r\n"
+                               "Content-Length: 11\r\n\r\n"
+                               "a=3%20&c=ok"
+                               "GET /echo?a=4 HTTP/1.1\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[POST a=3  b=q body=]"));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[GET a=4 b=- body=]"));
+    TEST_ASSERT_FALSE(listener->closed);
+}
+
+void test_binary_body_kept_as_is() {
+    std::string out = exchange("POST /echo HTTP/1.1\r\nContent-Type: application/octet-stream\r\n"
+                               "Content-Length: 3\r\n\r\nLSC");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[POST a=- b=- body=LSC]"));
+}
+
+void test_oversized_content_length_gets_413() {
+    std::string out = exchange("POST /echo HTTP/1.1\r\nContent-Length: 100000000000\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 413"));
+    TEST_ASSERT_TRUE(listener->closed);
+}
+
+void test_body_just_over_buffer_gets_413() {
+    const char head[] = "POST /echo HTTP/1.1\r\nContent-Length: 1000\r\n\r\n";
+    static_assert(sizeof(head) - 1 + 1000 > HTTP_REQUEST_MAX, "Must not fit");
+    std::string out = exchange(head);
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 413"));
+    TEST_ASSERT_TRUE(listener->closed);
+}
+
+void test_head_without_end_gets_413() {
+    std::string out = exchange("GET /echo?a=" + std::string(HTTP_REQUEST_MAX, 'x'));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 413"));
+}
+
+void test_chunked_body_gets_400() {
+    std::string out = exchange("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                               "5\r\nhello\r\n0\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 400"));
+    TEST_ASSERT_EQUAL_INT(0, count(out, "[POST"));
+    TEST_ASSERT_TRUE(listener->closed);
+}
+
+void test_malformed_request_line_gets_400() {
+    std::string out = exchange("GET echo HTTP/1.1\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 400"));
+}
+
+void test_http10_keep_alive_only_when_asked() {
+    std::string out = exchange("GET /echo?a=5 HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[GET a=5 b=- body=]"));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "Content-Length:"));
+    TEST_ASSERT_FALSE(listener->closed);
+
+    out = exchange("GET /echo?a=6 HTTP/1.0\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[GET a=6 b=- body=]"));
+    TEST_ASSERT_TRUE(listener->closed);
+}
+
+void test_http11_connection_close() {
+    std::string out = exchange("GET /echo?a=7 HTTP/1.1\r\nConnection: close\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[GET a=7 b=- body=]"));
+    TEST_ASSERT_TRUE(listener->closed);
+}
+
+// A 304 carries the length the 200 would have (RFC 9110 8.6) but no body
+void test_not_modified_asset_keeps_content_length() {
+    std::string out = exchange("GET / HTTP/1.1\r\nAccept-Encoding: gzip\r\nIf-None-Match: \"0123abcd\"\r\n\r\n"
+                               "GET /echo?a=8 HTTP/1.1\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 304 Not Modified\r\n"));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "Content-Length: 6\r\n"));
+    TEST_ASSERT_EQUAL_INT(0, count(out, "\x1f\x8b"));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "[GET a=8 b=- body=]"));
+}
+
+void test_gzip_asset_only_for_clients_that_accept_it() {
+    std::string out = exchange("GET / HTTP/1.1\r\nAccept-Encoding: gzip, deflate, br\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 200 OK\r\n"));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "Content-Encoding: gzip\r\n"));
+    TEST_ASSERT_EQUAL_INT(1, count(out, "Vary: Accept-Encoding\r\n"));
+
+    out = exchange("GET / HTTP/1.1\r\n\r\n");
+    TEST_ASSERT_EQUAL_INT(1, count(out, "HTTP/1.1 406 Not Acceptable\r\n"));
+    TEST_ASSERT_EQUAL_INT(0, count(out, "\x1f\x8b"));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pipelined_requests_answered_in_order);
+    RUN_TEST(test_request_split_across_reads);
+    RUN_TEST(test_form_body_relocated_before_pipelined_request);
+    RUN_TEST(test_binary_body_kept_as_is);
+    RUN_TEST(test_oversized_content_length_gets_413);
+    RUN_TEST(test_body_just_over_buffer_gets_413);
+    RUN_TEST(test_head_without_end_gets_413);
+    RUN_TEST(test_chunked_body_gets_400);
+    RUN_TEST(test_malformed_request_line_gets_400);
+    RUN_TEST(test_http10_keep_alive_only_when_asked);
+    RUN_TEST(test_http11_connection_close);
+    RUN_TEST(test_not_modified_asset_keeps_content_length);
+    RUN_TEST(test_gzip_asset_only_for_clients_that_accept_it);
+    return UNITY_END();
+}
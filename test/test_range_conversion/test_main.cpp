@@ -0,0 +1,69 @@
+// Host checks of the integer echo-width conversion against the speed of
+// sound in double precision, over the HC-SR04's 2..400 cm and the table's
+// -20..60 C:
+//   pio test -e test -f test_range_conversion
+
+#include <math.h>
+#include <unity.h>
+
+#include "range_conversion.h"
+
+namespace {
+
+const int MIN_CM = 2;
+const int MAX_CM = 400;
+
+// Round-trip mm per us of echo at deciCelsius
+double exactMmPerUs(int deciCelsius) {
+    return 331.3 * sqrt(1.0 + deciCelsius / 2731.5) / 2000.0;
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+// Every whole-microsecond echo from 2 cm to 4 m, every tenth of a degree.
+// The table and its interpolation stay within 0.1 mm; rounding to whole
+// millimetres adds up to another 0.5.
+void test_error_within_a_tenth_of_a_millimetre() {
+    double worstMm = 0;
+    double worstRoundedMm = 0;
+    for (int deciCelsius = RANGE_MIN_CELSIUS * 10; deciCelsius <= RANGE_MAX_CELSIUS * 10; deciCelsius++) {
+        uint32_t factor = rangeFactorQ18(static_cast<int16_t>(deciCelsius));
+        double mmPerUs = exactMmPerUs(deciCelsius);
+        uint32_t first = static_cast<uint32_t>(floor(MIN_CM * 10 / mmPerUs));
+        uint32_t last = static_cast<uint32_t>(ceil(MAX_CM * 10 / mmPerUs));
+        for (uint32_t widthUs = first; widthUs <= last; widthUs++) {
+            double exact = widthUs * mmPerUs;
+            worstMm = fmax(worstMm, fabs(widthUs * (factor / 262144.0) - exact));
+            worstRoundedMm = fmax(worstRoundedMm, fabs(echoWidthToMm(widthUs, factor) - exact));
+        }
+    }
+    TEST_ASSERT_DOUBLE_WITHIN(0.1, 0.0, worstMm);
+    TEST_ASSERT_DOUBLE_WITHIN(0.6, 0.0, worstRoundedMm);
+}
+
+void test_width_for_cm_round_trips() {
+    for (int deciCelsius = RANGE_MIN_CELSIUS * 10; deciCelsius <= RANGE_MAX_CELSIUS * 10; deciCelsius += 5) {
+        uint32_t factor = rangeFactorQ18(static_cast<int16_t>(deciCelsius));
+        for (int cm = MIN_CM; cm <= MAX_CM; cm++) {
+            TEST_ASSERT_EQUAL_INT(cm, echoWidthToCm(echoWidthForCm(cm, factor), factor));
+        }
+    }
+}
+
+void test_temperatures_outside_table_clamp() {
+    TEST_ASSERT_EQUAL_UINT32(rangeFactorQ18(RANGE_MIN_CELSIUS * 10), rangeFactorQ18(-400));
+    TEST_ASSERT_EQUAL_UINT32(rangeFactorQ18(RANGE_MAX_CELSIUS * 10), rangeFactorQ18(900));
+    TEST_ASSERT_EQUAL_UINT32(0, echoWidthForCm(0, rangeFactorQ18(RANGE_DEFAULT_DECI_CELSIUS)));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_error_within_a_tenth_of_a_millimetre);
+    RUN_TEST(test_width_for_cm_round_trips);
+    RUN_TEST(test_temperatures_outside_table_clamp);
+    return UNITY_END();
+}
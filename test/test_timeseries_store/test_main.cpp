@@ -0,0 +1,265 @@
+// Host checks of the minute log's recovery: torn and partial records,
+// segment rotation and the lifetime repair, on files in a temporary
+// directory:
+//   pio test -e test -f test_timeseries_store
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <unity.h>
+
+#include "sim_hal.h"
+#include "timeseries_store.h"
+
+namespace {
+
+// Midnight UTC on Monday 2024-10-14, so each segment holds exactly one day
+const uint32_t START = 20010UL * 1440;
+const uint32_t ENERGY_MWH = 10;
+const char* ROLLUP_FILE = "/tsroll.bin";
+
+char directory[64];
+DirectoryStorage* storage;
+
+std::string file(const char* path) {
+    return std::string(directory) + path;
+}
+
+MinuteRecord minute(uint32_t at) {
+    MinuteRecord record;
+    memset(&record, 0, sizeof(record));
+    record.minute = at;
+    record.energyMwh = ENERGY_MWH;
+    record.occupiedSeconds = 60;
+    record.entries = 1;
+    record.exits = 1;
+    record.peakOccupants = 2;
+    return record;
+}
+
+// Appends count minutes from first through a store opened on the directory
+void appendMinutes(uint32_t first, uint32_t count) {
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    for (uint32_t i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(store.append(minute(first + i)));
+    }
+}
+
+long fileSize(const char* path) {
+    FILE* f = fopen(file(path).c_str(), "rb");
+    if (!f) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+void patch(const char* path, long offset, const void* data, size_t length) {
+    FILE* f = fopen(file(path).c_str(), "r+b");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, offset, SEEK_SET);
+    TEST_ASSERT_EQUAL(length, fwrite(data, 1, length, f));
+    fclose(f);
+}
+
+void peek(const char* path, long offset, void* out, size_t length) {
+    FILE* f = fopen(file(path).c_str(), "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, offset, SEEK_SET);
+    TEST_ASSERT_EQUAL(length, fread(out, 1, length, f));
+    fclose(f);
+}
+
+long recordOffset(uint32_t index) {
+    return TS_SEGMENT_HEADER_SIZE + static_cast<long>(index) * TS_RECORD_SIZE;
+}
+
+}  // namespace
+
+void setUp() {
+    strcpy(directory, "/tmp/lightsys-tsXXXXXX");
+    TEST_ASSERT_NOT_NULL(mkdtemp(directory));
+    storage = new DirectoryStorage(directory);
+}
+
+void tearDown() {
+    char path[16];
+    for (uint8_t i = 0; i < TS_SEGMENT_COUNT; i++) {
+        snprintf(path, sizeof(path), "/ts%u.bin", i);
+        unlink(file(path).c_str());
+    }
+    unlink(file(ROLLUP_FILE).c_str());
+    rmdir(directory);
+    delete storage;
+}
+
+void test_reopen_restores_minutes_and_today() {
+    appendMinutes(START, 10);
+
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    StoreStats stats = store.stats();
+    TEST_ASSERT_EQUAL_UINT32(10, stats.records);
+    TEST_ASSERT_EQUAL_UINT32(START + 9, stats.lastMinute);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.tornRecords);
+    TEST_ASSERT_EQUAL_UINT32(10 * ENERGY_MWH, store.totals().today.energyMwh);
+    TEST_ASSERT_FALSE(store.append(minute(START + 9)));
+    TEST_ASSERT_TRUE(store.append(minute(START + 10)));
+}
+
+void test_partial_record_is_realigned() {
+    appendMinutes(START, 5);
+    // Reset in the middle of the fifth record's payload
+    TEST_ASSERT_EQUAL_INT(0, truncate(file("/ts0.bin").c_str(), recordOffset(4) + 7));
+
+    {
+        TimeSeriesStore store(*storage, 0);
+        TEST_ASSERT_TRUE(store.begin());
+        TEST_ASSERT_EQUAL_INT(recordOffset(5), fileSize("/ts0.bin"));
+        TEST_ASSERT_EQUAL_UINT32(START + 3, store.stats().lastMinute);
+        TEST_ASSERT_EQUAL_UINT32(4 * ENERGY_MWH, store.totals().today.energyMwh);
+
+        MinuteRecord out[8];
+        TEST_ASSERT_EQUAL(4, store.readMinutes(0, UINT32_MAX, out, 8));
+        TEST_ASSERT_TRUE(store.stats().tornRecords > 0);
+
+        // The next minute lands on the record grid, after the padding
+        TEST_ASSERT_TRUE(store.append(minute(START + 4)));
+    }
+
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    MinuteRecord out[8];
+    TEST_ASSERT_EQUAL(5, store.readMinutes(0, UINT32_MAX, out, 8));
+    TEST_ASSERT_EQUAL_UINT32(START + 4, out[4].minute);
+    TEST_ASSERT_EQUAL_UINT32(5 * ENERGY_MWH, store.totals().today.energyMwh);
+}
+
+void test_torn_records_are_skipped() {
+    appendMinutes(START, 5);
+    // No commit marker on the second record, a bad CRC on the fourth
+    uint8_t cleared = 0;
+    patch("/ts0.bin", recordOffset(1) + TS_RECORD_SIZE - 1, &cleared, 1);
+    uint8_t energy;
+    peek("/ts0.bin", recordOffset(3) + 4, &energy, 1);
+    energy ^= 0x40;
+    patch("/ts0.bin", recordOffset(3) + 4, &energy, 1);
+
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    MinuteRecord out[8];
+    TEST_ASSERT_EQUAL(3, store.readMinutes(0, UINT32_MAX, out, 8));
+    TEST_ASSERT_EQUAL_UINT32(START, out[0].minute);
+    TEST_ASSERT_EQUAL_UINT32(START + 2, out[1].minute);
+    TEST_ASSERT_EQUAL_UINT32(START + 4, out[2].minute);
+    TEST_ASSERT_EQUAL_UINT32(3 * ENERGY_MWH, store.totals().today.energyMwh);
+    TEST_ASSERT_EQUAL_UINT32(START + 4, store.stats().lastMinute);
+    TEST_ASSERT_TRUE(store.stats().tornRecords >= 2);
+}
+
+void test_last_record_torn_falls_back_to_previous() {
+    appendMinutes(START, 3);
+    uint8_t cleared = 0;
+    patch("/ts0.bin", recordOffset(2) + TS_RECORD_SIZE - 1, &cleared, 1);
+
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    TEST_ASSERT_EQUAL_UINT32(START + 1, store.stats().lastMinute);
+    TEST_ASSERT_EQUAL_UINT32(2 * ENERGY_MWH, store.totals().today.energyMwh);
+    // The torn minute may be written again
+    TEST_ASSERT_TRUE(store.append(minute(START + 2)));
+}
+
+void test_rotation_reuses_oldest_segment() {
+    const uint32_t total = TS_SEGMENT_COUNT * TS_SEGMENT_RECORDS + 10;
+    appendMinutes(START, total);
+
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    StoreStats stats = store.stats();
+    TEST_ASSERT_EQUAL_UINT32(TS_SEGMENT_COUNT + 1, stats.generation);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.activeSegment);
+    TEST_ASSERT_EQUAL_UINT32((TS_SEGMENT_COUNT - 1) * TS_SEGMENT_RECORDS + 10, stats.records);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.minEraseCount);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.maxEraseCount);
+    TEST_ASSERT_EQUAL_UINT32(START + total - 1, stats.lastMinute);
+
+    // The first day's minutes went with the erased segment; its summary stays
+    MinuteRecord out[2];
+    TEST_ASSERT_EQUAL(1, store.readMinutes(0, UINT32_MAX, out, 1));
+    TEST_ASSERT_EQUAL_UINT32(START + TS_SEGMENT_RECORDS, out[0].minute);
+    PeriodSummary day;
+    TEST_ASSERT_TRUE(store.readDay(store.localDay(START), day));
+    TEST_ASSERT_EQUAL_UINT32(TS_SEGMENT_RECORDS * ENERGY_MWH, day.energyMwh);
+
+    StoreTotals totals = store.totals();
+    TEST_ASSERT_EQUAL_UINT32(10 * ENERGY_MWH, totals.today.energyMwh);
+    TEST_ASSERT_EQUAL_UINT32(total * ENERGY_MWH, totals.lifetime.energyMwh);
+
+    // The recovered generation keeps rotating in order
+    for (uint32_t i = 0; i < TS_SEGMENT_RECORDS - 10 + 1; i++) {
+        TEST_ASSERT_TRUE(store.append(minute(START + total + i)));
+    }
+    stats = store.stats();
+    TEST_ASSERT_EQUAL_UINT32(TS_SEGMENT_COUNT + 2, stats.generation);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.activeSegment);
+    TEST_ASSERT_EQUAL(1, store.readMinutes(0, UINT32_MAX, out, 1));
+    TEST_ASSERT_EQUAL_UINT32(START + 2 * TS_SEGMENT_RECORDS, out[0].minute);
+}
+
+void test_lifetime_repaired_after_reset_between_rollup_writes() {
+    const uint32_t day = 1440;
+    appendMinutes(START, 3);
+    appendMinutes(START + day, 3);
+    // Lifetime slot as it stood after the first day closed
+    uint8_t lifetime[TS_SUMMARY_SIZE];
+    peek(ROLLUP_FILE, 0, lifetime, sizeof(lifetime));
+    appendMinutes(START + 2 * day, 3);
+    // Reset after the second day's summary but before the lifetime update
+    patch(ROLLUP_FILE, 0, lifetime, sizeof(lifetime));
+
+    {
+        TimeSeriesStore store(*storage, 0);
+        TEST_ASSERT_TRUE(store.begin());
+        StoreTotals totals = store.totals();
+        TEST_ASSERT_EQUAL_UINT32(9 * ENERGY_MWH, totals.lifetime.energyMwh);
+        TEST_ASSERT_EQUAL_UINT32(9, totals.lifetime.entries);
+        TEST_ASSERT_EQUAL_UINT32(3 * ENERGY_MWH, totals.today.energyMwh);
+        TEST_ASSERT_EQUAL_UINT32(9 * ENERGY_MWH, totals.week.energyMwh);
+    }
+
+    // The repair was written back and is not counted twice
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    TEST_ASSERT_EQUAL_UINT32(9 * ENERGY_MWH, store.totals().lifetime.energyMwh);
+}
+
+void test_torn_lifetime_rebuilt_from_days() {
+    const uint32_t day = 1440;
+    appendMinutes(START, 2);
+    appendMinutes(START + day, 2);
+    appendMinutes(START + 2 * day, 2);
+    uint8_t cleared = 0;
+    patch(ROLLUP_FILE, TS_SUMMARY_SIZE - 1, &cleared, 1);
+
+    TimeSeriesStore store(*storage, 0);
+    TEST_ASSERT_TRUE(store.begin());
+    TEST_ASSERT_EQUAL_UINT32(6 * ENERGY_MWH, store.totals().lifetime.energyMwh);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_reopen_restores_minutes_and_today);
+    RUN_TEST(test_partial_record_is_realigned);
+    RUN_TEST(test_torn_records_are_skipped);
+    RUN_TEST(test_last_record_torn_falls_back_to_previous);
+    RUN_TEST(test_rotation_reuses_oldest_segment);
+    RUN_TEST(test_lifetime_repaired_after_reset_between_rollup_writes);
+    RUN_TEST(test_torn_lifetime_rebuilt_from_days);
+    return UNITY_END();
+}